@@ -0,0 +1,74 @@
+//============================================================================
+// Name        : CRC32Benchmark.cpp
+// Description : Compares the bitwise CRC32 that was used before with the
+//               table driven Protocol::CRC32 for typical packet sizes.
+//
+// Build       : Eclipse CDT project in this directory (like SignalIDSamplerates),
+//               Protocol.cpp is linked into src. Without Eclipse, compile
+//               src/CRC32Benchmark.cpp and Protocol.cpp with -O2 -std=c++14
+//               and -I../../VNA_embedded/Application/Communication
+//============================================================================
+
+#include "Protocol.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+using namespace std;
+
+constexpr int repetitions = 200000;
+
+// Previous implementation, processes one bit at a time
+uint32_t CRC32Bitwise(uint32_t crc, const void *data, uint32_t len) {
+	uint8_t *u8buf = (uint8_t*) data;
+	int k;
+
+	crc = ~crc;
+	while (len--) {
+		crc ^= *u8buf++;
+		for (k = 0; k < 8; k++)
+			crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+	}
+	return ~crc;
+}
+
+template<typename F> double nsPerCall(F crcFunction, const vector<uint8_t> &data, uint32_t &result) {
+	auto start = chrono::steady_clock::now();
+	uint32_t crc = 0;
+	for (int i = 0; i < repetitions; i++) {
+		// feed back the result to prevent the compiler from optimizing the loop away
+		crc = crcFunction(crc, data.data(), data.size());
+	}
+	auto stop = chrono::steady_clock::now();
+	result = crc;
+	return chrono::duration<double, nano>(stop - start).count() / repetitions;
+}
+
+int main() {
+	// sizes of CRC protected data: datapoint, batch of datapoints, firmware packet, 1kB
+	const vector<uint32_t> sizes = {
+		sizeof(Protocol::Datapoint) + 4,
+		sizeof(Protocol::DatapointBatch) + 4,
+		sizeof(Protocol::FirmwarePacket) + 4,
+		1024
+	};
+	cout << setw(8) << "Bytes" << setw(14) << "Bitwise [ns]" << setw(14) << "Table [ns]" << setw(10) << "Speedup" << endl;
+	for (auto size : sizes) {
+		vector<uint8_t> data(size);
+		for (auto &d : data) {
+			d = rand();
+		}
+		uint32_t oldResult, newResult;
+		auto oldTime = nsPerCall(CRC32Bitwise, data, oldResult);
+		auto newTime = nsPerCall(Protocol::CRC32, data, newResult);
+		if (oldResult != newResult) {
+			cout << "CRC mismatch for " << size << " bytes" << endl;
+			return 1;
+		}
+		cout << setw(8) << size << setw(14) << fixed << setprecision(1) << oldTime << setw(14) << newTime
+				<< setw(9) << oldTime / newTime << "x" << endl;
+	}
+	return 0;
+}
@@ -0,0 +1,108 @@
+//============================================================================
+// Name        : ExpressionBenchmark.cpp
+// Description : Compares evaluating a custom math expression sample by sample
+//               with ParserX::Eval() against Math::CompiledExpression, which
+//               evaluates all samples of a trace at once.
+//
+// Build       : Eclipse CDT project in this directory (like SignalIDSamplerates),
+//               compiledexpression.cpp and the parser directory are linked
+//               into src. Without Eclipse, compile src/ExpressionBenchmark.cpp,
+//               compiledexpression.cpp and parser/*.cpp from
+//               ../../PC_Application/Traces/Math with -O2 -std=c++17 and
+//               -I../../PC_Application/Traces/Math
+//============================================================================
+
+#include "compiledexpression.h"
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <complex>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+using namespace std;
+using namespace mup;
+
+constexpr unsigned int points = 10001;
+constexpr int repetitions = 20;
+
+// typical expressions of the custom math trace (x: trace data, f: frequency)
+const vector<string> expressions = {
+	"x*2",
+	"abs(x)^2",
+	"20*log10(abs(x))",
+	"(1+x)/(1-x)*50",
+	"x*exp(-2*pi*i*f*1.5n)",
+	"sqrt(conj(x)*x)+arg(x)",
+};
+
+template<typename F> double msPerSweep(F evaluate) {
+	auto start = chrono::steady_clock::now();
+	for (int i = 0; i < repetitions; i++) {
+		evaluate();
+	}
+	auto stop = chrono::steady_clock::now();
+	return chrono::duration<double, milli>(stop - start).count() / repetitions;
+}
+
+bool equal(double a, double b) {
+	if (isnan(a) || isnan(b)) {
+		return isnan(a) && isnan(b);
+	}
+	return a == b || abs(a - b) <= 1e-12 * max(abs(a), abs(b));
+}
+
+int main() {
+	vector<double> freq(points), re(points), im(points);
+	for (unsigned int i = 0; i < points; i++) {
+		freq[i] = 1e6 + i * 6e9 / (points - 1);
+		re[i] = (double) rand() / RAND_MAX * 2 - 1;
+		im[i] = (double) rand() / RAND_MAX * 2 - 1;
+	}
+
+	Value f, x;
+	ParserX parser(pckCOMMON | pckUNIT | pckCOMPLEX);
+	parser.DefineVar("f", Variable(&f));
+	parser.DefineVar("x", Variable(&x));
+
+	cout << setw(26) << left << "Expression" << right << setw(14) << "Eval [ms]" << setw(16) << "Compiled [ms]"
+			<< setw(10) << "Speedup" << endl;
+	for (auto &e : expressions) {
+		parser.SetExpr(e);
+		Math::CompiledExpression compiled;
+		if (!compiled.compile(parser, {&f, &x})) {
+			cout << "Unable to compile " << e << endl;
+			return 1;
+		}
+
+		vector<complex<double>> evalResult(points);
+		auto evalTime = msPerSweep([&]() {
+			for (unsigned int i = 0; i < points; i++) {
+				f = freq[i];
+				x = complex<double>(re[i], im[i]);
+				evalResult[i] = parser.Eval().GetComplex();
+			}
+		});
+
+		vector<double> resRe(points), resIm(points);
+		const vector<Math::CompiledExpression::Input> inputs = {
+			{freq.data(), nullptr},
+			{re.data(), im.data()},
+		};
+		auto compiledTime = msPerSweep([&]() {
+			compiled.evaluate(inputs, points, resRe.data(), resIm.data());
+		});
+
+		for (unsigned int i = 0; i < points; i++) {
+			if (!equal(evalResult[i].real(), resRe[i]) || !equal(evalResult[i].imag(), resIm[i])) {
+				cout << "Result mismatch for " << e << " at point " << i << ": " << evalResult[i] << " vs. ("
+						<< resRe[i] << "," << resIm[i] << ")" << endl;
+				return 1;
+			}
+		}
+		cout << setw(26) << left << e << right << setw(14) << fixed << setprecision(3) << evalTime
+				<< setw(16) << compiledTime << setw(9) << setprecision(1) << evalTime / compiledTime << "x" << endl;
+	}
+	return 0;
+}
@@ -0,0 +1,325 @@
+//============================================================================
+// Name        : FFTBenchmark.cpp
+// Description : Compares the previous Fft::transform (radix-2 or Bluestein,
+//               all tables calculated on every call) with the cached
+//               Fft::Plan for the sizes used by typical point counts
+//               (sweeps, DFT of the lowpass TDR output). Also compares the
+//               lowpass TDR with an odd length spectrum (complex transform of
+//               the full length) to the even length spectrum with a Nyquist
+//               bin (complex transform of half the length), validates both
+//               against the complex transform of the mirrored spectrum and the
+//               chirp-Z transform (TDR/DFT zoom) against the direct
+//               evaluation of its sum.
+//
+// Build       : Eclipse CDT project in this directory (like SignalIDSamplerates),
+//               fftplan.cpp and fftcomplex.cpp are linked into src. Without
+//               Eclipse, compile src/FFTBenchmark.cpp, fftplan.cpp and
+//               fftcomplex.cpp from ../../PC_Application/Traces with -O2
+//               -std=c++17 and -I../../PC_Application/Traces
+//============================================================================
+
+#include "fftplan.h"
+#include "fftcomplex.h"
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <utility>
+#include <complex>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+using namespace std;
+
+// Point counts of typical sweeps. Most of them are not 2/3/5-smooth and neither are the sizes derived from them,
+// the plans use Bluestein's algorithm for those. Every point count is benchmarked with the sizes it causes:
+// the sweep itself (bandpass TDR, de-embedding) and the DFT of the lowpass TDR output (2*points-2 values,
+// 2*points with step response)
+const vector<size_t> pointCounts = {101, 201, 501, 1001, 1601, 2001, 4501, 10001};
+// radix-2 sizes for comparison, the previous implementation did not use Bluestein's algorithm for them
+const vector<size_t> powerOfTwoSizes = {1024, 8192};
+constexpr int repetitions = 50;
+
+// Bluestein's algorithm as used by Fft::transform before, with radix-2 FFTs for the convolution
+void previousBluestein(vector<complex<double>> &vec, bool inverse) {
+	size_t n = vec.size();
+	size_t m = 1;
+	while (m / 2 <= n) {
+		m *= 2;
+	}
+	vector<complex<double>> expTable(n);
+	for (size_t i = 0; i < n; i++) {
+		uintmax_t temp = static_cast<uintmax_t>(i) * i;
+		temp %= static_cast<uintmax_t>(n) * 2;
+		expTable[i] = polar(1.0, (inverse ? M_PI : -M_PI) * temp / n);
+	}
+	vector<complex<double>> avec(m), bvec(m);
+	for (size_t i = 0; i < n; i++) {
+		avec[i] = vec[i] * expTable[i];
+	}
+	bvec[0] = expTable[0];
+	for (size_t i = 1; i < n; i++) {
+		bvec[i] = bvec[m - i] = conj(expTable[i]);
+	}
+	Fft::transformRadix2(avec, false);
+	Fft::transformRadix2(bvec, false);
+	for (size_t i = 0; i < m; i++) {
+		avec[i] *= bvec[i];
+	}
+	Fft::transformRadix2(avec, true);
+	for (size_t i = 0; i < n; i++) {
+		vec[i] = avec[i] / static_cast<double>(m) * expTable[i];
+	}
+}
+
+void previousTransform(vector<complex<double>> &vec, bool inverse) {
+	size_t n = vec.size();
+	if ((n & (n - 1)) == 0) {
+		Fft::transformRadix2(vec, inverse);
+	} else {
+		previousBluestein(vec, inverse);
+	}
+}
+
+vector<complex<double>> naiveDFT(const vector<complex<double>> &in, bool inverse) {
+	size_t n = in.size();
+	vector<complex<double>> out(n);
+	for (size_t k = 0; k < n; k++) {
+		for (size_t i = 0; i < n; i++) {
+			out[k] += in[i] * polar(1.0, (inverse ? 2 : -2) * M_PI * (double) (i * k % n) / n);
+		}
+	}
+	return out;
+}
+
+vector<complex<double>> randomData(size_t n) {
+	vector<complex<double>> data(n);
+	for (auto &d : data) {
+		d = complex<double>((double) rand() / RAND_MAX * 2 - 1, (double) rand() / RAND_MAX * 2 - 1);
+	}
+	return data;
+}
+
+// largest deviation relative to the largest magnitude
+double maxError(const vector<complex<double>> &a, const vector<complex<double>> &b) {
+	double err = 0, mag = 0;
+	for (size_t i = 0; i < a.size(); i++) {
+		err = max(err, abs(a[i] - b[i]));
+		mag = max(mag, abs(b[i]));
+	}
+	return mag > 0 ? err / mag : err;
+}
+
+// the lowpass TDR as a complex transform: mirror the one-sided spectrum into n values and transform all of them. For
+// even n, the last one-sided bin is the real Nyquist bin
+vector<double> mirroredTransform(const vector<complex<double>> &oneSided, size_t n) {
+	vector<complex<double>> full(n);
+	full[0] = oneSided[0].real();
+	for (size_t k = 1; k < oneSided.size(); k++) {
+		if (2 * k == n) {
+			full[k] = oneSided[k].real();
+		} else {
+			full[k] = oneSided[k];
+			full[n - k] = conj(oneSided[k]);
+		}
+	}
+	Fft::transform(full, true);
+	vector<double> result(n);
+	for (size_t i = 0; i < n; i++) {
+		result[i] = full[i].real();
+	}
+	return result;
+}
+
+// chirp-Z transform by its definition
+vector<complex<double>> naiveChirpZ(const vector<complex<double>> &in, size_t m, double start, double step, bool inverse) {
+	vector<complex<double>> out(m);
+	for (size_t k = 0; k < m; k++) {
+		for (size_t j = 0; j < in.size(); j++) {
+			out[k] += in[j] * polar(1.0, (inverse ? 2 : -2) * M_PI * j * (start + k * step));
+		}
+	}
+	return out;
+}
+
+template<typename F> double usPerTransform(F transform) {
+	auto start = chrono::steady_clock::now();
+	for (int i = 0; i < repetitions; i++) {
+		transform();
+	}
+	auto stop = chrono::steady_clock::now();
+	return chrono::duration<double, micro>(stop - start).count() / repetitions;
+}
+
+int main() {
+	// all small sizes against the definition of the DFT (covers every kernel and Bluestein)
+	for (size_t n = 1; n <= 300; n++) {
+		for (bool inverse : {false, true}) {
+			auto data = randomData(n);
+			auto expected = naiveDFT(data, inverse);
+			Fft::Plan::get(n, inverse)->execute(data);
+			auto err = maxError(data, expected);
+			if (err > 1e-12) {
+				cout << "Size " << n << (inverse ? " (inverse)" : "") << " deviates from DFT by " << err << endl;
+				return 1;
+			}
+		}
+	}
+	for (size_t n = 1; n <= 300; n++) {
+		auto spectrum = randomData(n);
+		spectrum[0] = spectrum[0].real();
+		for (size_t k = 1; k < n; k++) {
+			if (2 * k == n) {
+				spectrum[k] = spectrum[k].real();
+			} else if (2 * k > n) {
+				spectrum[k] = conj(spectrum[n - k]);
+			}
+		}
+		auto expected = naiveDFT(spectrum, true);
+		vector<double> result;
+		Fft::InverseRealPlan::get(n)->execute(spectrum, result);
+		double err = 0, mag = 0;
+		for (size_t i = 0; i < n; i++) {
+			err = max(err, abs(expected[i] - result[i]));
+			mag = max(mag, abs(expected[i]));
+		}
+		if (err > 1e-12 * mag) {
+			cout << "Complex to real size " << n << " deviates from DFT by " << err / mag << endl;
+			return 1;
+		}
+	}
+	cout << "Sizes 1 to 300 match the DFT" << endl;
+
+	// arbitrary ranges and resolutions, including more outputs than inputs and negative frequencies
+	for (size_t n : {1, 2, 7, 64, 101, 1001}) {
+		for (size_t m : {1, 2, 50, 333, 2000}) {
+			for (bool inverse : {false, true}) {
+				double start = (double) rand() / RAND_MAX - 0.5;
+				double step = ((double) rand() / RAND_MAX) / m;
+				auto in = randomData(n);
+				auto expected = naiveChirpZ(in, m, start, step, inverse);
+				vector<complex<double>> result;
+				Fft::ChirpZ(n, m, start, step, inverse).execute(in, result);
+				auto err = maxError(result, expected);
+				if (err > 1e-10) {
+					cout << "Chirp-Z " << n << " to " << m << " deviates from its definition by " << err << endl;
+					return 1;
+				}
+			}
+		}
+	}
+	// on the bins, the chirp-Z transform is a DFT
+	for (size_t n : {100, 1001, 20001}) {
+		auto in = randomData(n);
+		auto dft = in;
+		Fft::transform(dft, true);
+		vector<complex<double>> result;
+		Fft::ChirpZ(n, n / 2, (double) (n / 4) / n, 1.0 / n, true).execute(in, result);
+		double err = 0, mag = 0;
+		for (size_t k = 0; k < result.size(); k++) {
+			err = max(err, abs(result[k] - dft[n / 4 + k]));
+			mag = max(mag, abs(dft[n / 4 + k]));
+		}
+		if (err > 1e-10 * mag) {
+			cout << "Chirp-Z on the bins of size " << n << " deviates from the DFT by " << err / mag << endl;
+			return 1;
+		}
+	}
+	cout << "Chirp-Z transform matches its definition" << endl << endl;
+
+	vector<pair<size_t, string>> sizes;
+	for (auto p : pointCounts) {
+		sizes.push_back({p, to_string(p) + " points"});
+		sizes.push_back({2 * p - 2, "DFT of TDR"});
+		sizes.push_back({2 * p, "DFT of step"});
+	}
+	for (auto n : powerOfTwoSizes) {
+		sizes.push_back({n, ""});
+	}
+	cout << setw(8) << "Size" << setw(14) << "Used for" << setw(14) << "Algorithm" << setw(16) << "Previous [us]"
+			<< setw(12) << "Plan [us]" << setw(10) << "Speedup" << setw(12) << "Deviation" << endl;
+	for (auto &entry : sizes) {
+		auto n = entry.first;
+		auto input = randomData(n);
+		auto previous = input, planned = input;
+		previousTransform(previous, false);
+		Fft::transform(planned, false);
+		auto err = maxError(planned, previous);
+		if (err > 1e-10) {
+			cout << "Size " << n << " deviates from the previous implementation by " << err << endl;
+			return 1;
+		}
+
+		auto buf = input;
+		auto previousTime = usPerTransform([&]() {
+			previousTransform(buf, false);
+		});
+		auto plan = Fft::Plan::get(n, false);
+		auto planTime = usPerTransform([&]() {
+			plan->execute(buf);
+		});
+
+		// find out which algorithm the plan uses
+		size_t largestFactor = 1, r = n;
+		for (size_t p = 2; p <= r; p++) {
+			while (r % p == 0) {
+				largestFactor = p;
+				r /= p;
+			}
+		}
+		string algorithm = largestFactor <= Fft::Plan::MaxRadix ? "mixed radix" : "Bluestein";
+
+		cout << setw(8) << n << setw(14) << entry.second << setw(14) << algorithm << setw(16) << fixed << setprecision(1) << previousTime
+				<< setw(12) << planTime << setw(9) << setprecision(1) << previousTime / planTime << "x"
+				<< setw(12) << scientific << setprecision(1) << err << endl;
+		cout << defaultfloat;
+	}
+
+	// The lowpass TDR transforms points+1 one-sided bins with step response (extrapolated DC bin), points without.
+	// Previously the spectrum had an odd length of 2*bins-1, the complex to real transform has to use a complex
+	// transform of the full length for it. Now the last bin is the Nyquist bin of 2*(bins-1) values, which only
+	// needs a complex transform of half the length
+	cout << endl << "Lowpass TDR (complex to real)" << endl;
+	cout << setw(8) << "Points" << setw(14) << "Used for" << setw(10) << "Odd" << setw(12) << "Odd [us]" << setw(10)
+			<< "Even" << setw(12) << "Even [us]" << setw(10) << "Speedup" << setw(12) << "Deviation" << endl;
+	for (auto p : pointCounts) {
+		for (bool step : {false, true}) {
+			auto bins = step ? p + 1 : p;
+			auto oneSided = randomData(bins);
+			auto odd = Fft::InverseRealPlan::get(2 * bins - 1);
+			auto even = Fft::InverseRealPlan::get(2 * (bins - 1));
+			vector<double> oddResult, evenResult;
+			odd->execute(oneSided, oddResult);
+			even->execute(oneSided, evenResult);
+			auto oddErr = 0.0, evenErr = 0.0;
+			for (auto &check : {make_pair(&oddResult, &oddErr), make_pair(&evenResult, &evenErr)}) {
+				auto &result = *check.first;
+				auto expected = mirroredTransform(oneSided, result.size());
+				double err = 0, mag = 0;
+				for (size_t i = 0; i < result.size(); i++) {
+					err = max(err, abs(expected[i] - result[i]));
+					mag = max(mag, abs(expected[i]));
+				}
+				*check.second = err / mag;
+			}
+			if (oddErr > 1e-10 || evenErr > 1e-10) {
+				cout << "TDR with " << bins << " bins deviates from the mirrored transform by " << max(oddErr, evenErr)
+						<< endl;
+				return 1;
+			}
+			auto oddTime = usPerTransform([&]() {
+				odd->execute(oneSided, oddResult);
+			});
+			auto evenTime = usPerTransform([&]() {
+				even->execute(oneSided, evenResult);
+			});
+			cout << setw(8) << p << setw(14) << (step ? "TDR step" : "TDR") << setw(10) << odd->size() << setw(12)
+					<< fixed << setprecision(1) << oddTime << setw(10) << even->size() << setw(12) << evenTime << setw(9)
+					<< oddTime / evenTime << "x" << setw(12) << scientific << setprecision(1) << evenErr
+					<< endl;
+			cout << defaultfloat;
+		}
+	}
+	return 0;
+}
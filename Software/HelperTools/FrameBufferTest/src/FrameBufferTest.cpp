@@ -0,0 +1,254 @@
+//============================================================================
+// Name        : FrameBufferTest.cpp
+// Description : Checks Protocol::FrameBuffer and Protocol::FrameViewBuffer
+//               with frames split across reads at every possible position,
+//               leading garbage, corrupted frames and buffers small enough
+//               that frames wrap around the end. Reports every failed
+//               check and returns a non-zero exit code if any failed.
+//
+// Build       : Eclipse CDT project in this directory (like SignalIDSamplerates),
+//               Protocol.cpp is linked into src. Without Eclipse, compile
+//               src/FrameBufferTest.cpp and Protocol.cpp with -std=c++14 and
+//               -I../../VNA_embedded/Application/Communication
+//============================================================================
+
+#include "Protocol.hpp"
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+using namespace std;
+
+using Bytes = vector<uint8_t>;
+
+// the biggest possible frame (PacketInfo plus header, sequence number and CRC)
+constexpr uint16_t maxFrameLength = sizeof(Protocol::PacketInfo) + 8;
+
+static int failures = 0;
+
+static void fail(const string &test, const string &message) {
+	cout << test << ": " << message << endl;
+	failures++;
+}
+
+static uint8_t randomByte() {
+	return rand() & 0xFF;
+}
+
+static Bytes encode(const Protocol::PacketInfo &p, bool datapointCRC = true, int16_t sequenceNumber = Protocol::NoSequenceNumber) {
+	Bytes frame(maxFrameLength);
+	auto length = Protocol::EncodePacket(p, frame.data(), frame.size(), datapointCRC, sequenceNumber);
+	frame.resize(length);
+	return frame;
+}
+
+// a few frames of different types and lengths, some with a sequence number
+static vector<Bytes> testFrames() {
+	vector<Bytes> frames;
+	Protocol::PacketInfo p;
+
+	memset(&p, 0, sizeof(p));
+	p.type = Protocol::PacketType::Ack;
+	frames.push_back(encode(p));
+	frames.push_back(encode(p, true, 3));
+
+	memset(&p, 0, sizeof(p));
+	p.type = Protocol::PacketType::Datapoint;
+	p.datapoint.frequency = 123456789;
+	p.datapoint.pointNum = 42;
+	p.datapoint.real_S21 = 0.5f;
+	frames.push_back(encode(p));
+
+	memset(&p, 0, sizeof(p));
+	p.type = Protocol::PacketType::DatapointBatch;
+	p.datapointBatch.numPoints = Protocol::MaxBatchedDatapoints;
+	for(unsigned int i=0;i<p.datapointBatch.numPoints;i++) {
+		p.datapointBatch.points[i].pointNum = i;
+		p.datapointBatch.points[i].imag_S11 = i * 0.25f;
+	}
+	frames.push_back(encode(p));
+
+	memset(&p, 0, sizeof(p));
+	p.type = Protocol::PacketType::FirmwarePacket;
+	p.firmware.address = 0x1000;
+	for(auto &b : p.firmware.data) {
+		// contains header bytes, the decoder must not resynchronize on them
+		b = randomByte() | 0x5A;
+	}
+	frames.push_back(encode(p, true, 1));
+
+	memset(&p, 0, sizeof(p));
+	p.type = Protocol::PacketType::SweepSettings;
+	p.settings.f_start = 1000000;
+	p.settings.f_stop = 6000000000ULL;
+	p.settings.points = 501;
+	frames.push_back(encode(p));
+	return frames;
+}
+
+static Bytes concat(const vector<Bytes> &frames) {
+	Bytes all;
+	for(auto &f : frames) {
+		all.insert(all.end(), f.begin(), f.end());
+	}
+	return all;
+}
+
+// Feeds data into the buffer in chunks of the given sizes (the last one is repeated) and collects all decoded
+// frames, encoded again for comparison. Decodes after every chunk, like the receivers do.
+template<typename Buffer, typename DecodeFunc> vector<Bytes> feed(Buffer &buffer, const Bytes &data, const vector<size_t> &chunks, DecodeFunc decode) {
+	vector<Bytes> decoded;
+	size_t pos = 0;
+	unsigned int chunk = 0;
+	while(pos < data.size()) {
+		auto len = min(chunks[chunk], data.size() - pos);
+		if(chunk < chunks.size() - 1) {
+			chunk++;
+		}
+		while(len > 0) {
+			auto added = buffer.Add(&data[pos], len);
+			pos += added;
+			len -= added;
+			Protocol::PacketInfo p;
+			int16_t sequenceNumber;
+			while(decode(buffer, &p, &sequenceNumber)) {
+				decoded.push_back(encode(p, true, sequenceNumber));
+			}
+			if(!added && len) {
+				// buffer full and nothing decoded
+				return decoded;
+			}
+		}
+	}
+	return decoded;
+}
+
+static bool decodeInfo(Protocol::FrameBuffer &buffer, Protocol::PacketInfo *p, int16_t *sequenceNumber) {
+	return buffer.Decode(p, sequenceNumber);
+}
+
+static bool decodeView(Protocol::FrameViewBuffer &buffer, Protocol::PacketInfo *p, int16_t *sequenceNumber) {
+	Protocol::PacketView view;
+	if(!buffer.Decode(&view, sequenceNumber)) {
+		return false;
+	}
+	view.CopyTo(p);
+	return true;
+}
+
+static void expectFrames(const string &test, const vector<Bytes> &decoded, const vector<Bytes> &expected) {
+	if(decoded.size() != expected.size()) {
+		fail(test, "decoded " + to_string(decoded.size()) + " frames, expected " + to_string(expected.size()));
+		return;
+	}
+	for(unsigned int i=0;i<decoded.size();i++) {
+		if(decoded[i] != expected[i]) {
+			fail(test, "frame " + to_string(i) + " differs");
+			return;
+		}
+	}
+}
+
+// runs a test with both buffer types, with a large buffer and one that only fits the biggest frame (frames wrap)
+template<typename F> void withBuffers(const string &test, F run) {
+	for(uint16_t size : {(uint16_t) 4096, maxFrameLength}) {
+		vector<uint8_t> memory(size);
+		Protocol::FrameBuffer frameBuffer(memory.data(), size);
+		run(test + " (FrameBuffer, " + to_string(size) + " bytes)", frameBuffer, decodeInfo);
+		Protocol::FrameViewBuffer viewBuffer(memory.data(), size);
+		run(test + " (FrameViewBuffer, " + to_string(size) + " bytes)", viewBuffer, decodeView);
+	}
+}
+
+int main() {
+	auto frames = testFrames();
+	auto stream = concat(frames);
+
+	// every possible position of a single split
+	withBuffers("Split", [&](const string &test, auto &buffer, auto decode) {
+		for(size_t split = 1; split < stream.size(); split++) {
+			buffer.Clear();
+			expectFrames(test + " at " + to_string(split), feed(buffer, stream, {split, stream.size()}, decode), frames);
+		}
+	});
+
+	// small chunks, every frame is split several times and wraps around the end of the small buffer
+	withBuffers("Chunks", [&](const string &test, auto &buffer, auto decode) {
+		for(size_t chunk = 1; chunk <= 70; chunk++) {
+			buffer.Clear();
+			// repeated, so the read position moves through the whole buffer
+			vector<Bytes> repeated;
+			for(int i=0;i<5;i++) {
+				repeated.insert(repeated.end(), frames.begin(), frames.end());
+			}
+			expectFrames(test + " of " + to_string(chunk), feed(buffer, concat(repeated), {chunk}, decode), repeated);
+		}
+	});
+
+	// garbage in front of the frames, including header bytes and impossible lengths
+	withBuffers("Leading garbage", [&](const string &test, auto &buffer, auto decode) {
+		for(int i=0;i<200;i++) {
+			Bytes garbage(rand() % 40);
+			for(auto &b : garbage) {
+				b = randomByte();
+			}
+			if(!garbage.empty() && i % 2) {
+				garbage[rand() % garbage.size()] = 0x5A;
+			}
+			Bytes data = garbage;
+			data.insert(data.end(), stream.begin(), stream.end());
+			buffer.Clear();
+			auto decoded = feed(buffer, data, {(size_t) rand() % 50 + 1}, decode);
+			// the garbage may look like the start of a frame and swallow some bytes, but never a valid frame
+			while(decoded.size() > frames.size()) {
+				decoded.erase(decoded.begin());
+			}
+			expectFrames(test + " " + to_string(i), decoded, frames);
+		}
+	});
+
+	// one corrupted byte in one frame at every possible split position: only that frame is lost
+	withBuffers("CRC failure", [&](const string &test, auto &buffer, auto decode) {
+		for(unsigned int corrupt = 0; corrupt < frames.size(); corrupt++) {
+			auto corrupted = frames;
+			auto &f = corrupted[corrupt];
+			// not the header or length, those are covered by the garbage test
+			auto pos = 3 + rand() % (f.size() - 3);
+			f[pos] ^= 1 << (rand() % 8);
+			auto data = concat(corrupted);
+			auto expected = frames;
+			expected.erase(expected.begin() + corrupt);
+			for(size_t split = 1; split < data.size(); split += 7) {
+				buffer.Clear();
+				expectFrames(test + " in frame " + to_string(corrupt) + ", split at " + to_string(split),
+						feed(buffer, data, {split, data.size()}, decode), expected);
+			}
+		}
+	});
+
+	// datapoints with a zero CRC are only accepted as long as the datapoint CRC is not required
+	withBuffers("Datapoint without CRC", [&](const string &test, auto &buffer, auto decode) {
+		Protocol::PacketInfo p;
+		memset(&p, 0, sizeof(p));
+		p.type = Protocol::PacketType::Datapoint;
+		p.datapoint.pointNum = 7;
+		auto withoutCRC = encode(p, false);
+		auto withCRC = encode(p, true);
+		buffer.Clear();
+		buffer.RequireDatapointCRC(false);
+		expectFrames(test + ", not required", feed(buffer, withoutCRC, {withoutCRC.size()}, decode), {withCRC});
+		buffer.RequireDatapointCRC(true);
+		expectFrames(test + ", required", feed(buffer, withoutCRC, {withoutCRC.size()}, decode), {});
+		expectFrames(test + ", required and present", feed(buffer, withCRC, {withCRC.size()}, decode), {withCRC});
+		buffer.RequireDatapointCRC(false);
+	});
+
+	if(failures) {
+		cout << failures << " checks failed" << endl;
+		return 1;
+	}
+	cout << "All checks passed" << endl;
+	return 0;
+}
@@ -1,12 +1,18 @@
 #include "device.h"
 
+#include "virtualdevice.h"
+#include "deviceregistry.h"
 #include "CustomWidgets/informationbox.h"
+#include "preferences.h"
 
 #include <signal.h>
 #include <QDebug>
 #include <QString>
 #include <QMessageBox>
 #include <mutex>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 
 using namespace std;
 
@@ -19,88 +25,154 @@ static constexpr USBID IDs[] = {
     {0x0483, 0x4121},
 };
 
-USBInBuffer::USBInBuffer(libusb_device_handle *handle, unsigned char endpoint, int buffer_size) :
-    buffer_size(buffer_size),
-    received_size(0),
-    inCallback(false)
+USBInBuffer::USBInBuffer(libusb_device_handle *handle, unsigned char endpoint, int buffer_size, int num_transfers) :
+    nextToProcess(0),
+    inFlight(0),
+    stopping(false),
+    ranDry(0)
 {
-    buffer = new unsigned char[buffer_size];
-    transfer = libusb_alloc_transfer(0);
-    libusb_fill_bulk_transfer(transfer, handle, endpoint, buffer, buffer_size, CallbackTrampoline, this, 100);
-    libusb_submit_transfer(transfer);
+    if(num_transfers < 1) {
+        num_transfers = 1;
+    }
+    for(int i=0;i<num_transfers;i++) {
+        Transfer t;
+        t.data = new unsigned char[buffer_size];
+        t.transfer = libusb_alloc_transfer(0);
+        t.completed = false;
+        t.submitted = false;
+        libusb_fill_bulk_transfer(t.transfer, handle, endpoint, t.data, buffer_size, CallbackTrampoline, this, 100);
+        ring.push_back(t);
+    }
+    lock_guard<mutex> guard(mtx);
+    for(unsigned int i=0;i<ring.size();i++) {
+        submit(i);
+    }
 }
 
 USBInBuffer::~USBInBuffer()
 {
-    if(transfer) {
-        libusb_cancel_transfer(transfer);
-        // wait for cancellation to complete
-        mutex mtx;
-        unique_lock<mutex> lck(mtx);
-        using namespace std::chrono_literals;
-        if(cv.wait_for(lck, 100ms) == cv_status::timeout) {
-            qWarning() << "Timed out waiting for mutex acquisition during disconnect";
+    unique_lock<mutex> lck(mtx);
+    // from now on, completed transfers are not resubmitted
+    stopping = true;
+    for(auto &t : ring) {
+        if(!t.transfer) {
+            continue;
+        }
+        if(t.submitted) {
+            libusb_cancel_transfer(t.transfer);
+        } else {
+            // not queued (waiting for a previous transfer to complete), no callback will occur for this transfer
+            libusb_free_transfer(t.transfer);
+            t.transfer = nullptr;
+        }
+    }
+    // wait for cancellation to complete, libusb may still write into the buffers of submitted transfers
+    using namespace std::chrono_literals;
+    bool cancelled = false;
+    for(int i=0;i<10 && !cancelled;i++) {
+        cancelled = cv.wait_for(lck, 100ms, [=](){
+            return inFlight == 0;
+        });
+        if(!cancelled) {
+            qWarning() << "Still waiting for" << inFlight << "USB transfers to be cancelled";
         }
     }
-    delete[] buffer;
+    lck.unlock();
+    if(!cancelled) {
+        // better to leak the buffers than to free them while a transfer may still use them
+        qCritical() << "USB transfers were not cancelled, not freeing their buffers";
+        return;
+    }
+    for(auto &t : ring) {
+        delete[] t.data;
+    }
 }
 
-void USBInBuffer::removeBytes(int handled_bytes)
+unsigned long USBInBuffer::getRanDryCount() const
 {
-    if(!inCallback) {
-        throw runtime_error("Removing of bytes is only allowed from within receive callback");
-    }
-    if(handled_bytes >= received_size) {
-        received_size = 0;
-    } else {
-        // not removing all bytes, have to move remaining data to the beginning of the buffer
-        memmove(buffer, &buffer[handled_bytes], received_size - handled_bytes);
-        received_size -= handled_bytes;
-    }
+    return ranDry;
 }
 
-int USBInBuffer::getReceived() const
+bool USBInBuffer::submit(int index)
 {
-    return received_size;
+    auto &t = ring[index];
+    t.transfer->buffer = t.data;
+    auto ret = libusb_submit_transfer(t.transfer);
+    if(ret < 0) {
+        qCritical() << "Failed to submit USB transfer:" << libusb_strerror((libusb_error) ret);
+        t.submitted = false;
+        emit TransferError();
+        return false;
+    }
+    t.submitted = true;
+    inFlight++;
+    return true;
 }
 
 void USBInBuffer::Callback(libusb_transfer *transfer)
 {
+    lock_guard<mutex> guard(mtx);
+    int index = 0;
+    while(ring[index].transfer != transfer) {
+        index++;
+    }
+    auto &t = ring[index];
+    t.submitted = false;
+    inFlight--;
+    if(stopping) {
+        // The destructor is waiting for the transfers to return. This transfer may have completed before it could be
+        // cancelled, it must not be submitted again
+        libusb_free_transfer(transfer);
+        t.transfer = nullptr;
+        cv.notify_all();
+        return;
+    }
     switch(transfer->status) {
     case LIBUSB_TRANSFER_COMPLETED:
-        received_size += transfer->actual_length;
-        inCallback = true;
-        emit DataReceived();
-        inCallback = false;
+    case LIBUSB_TRANSFER_TIMED_OUT:
+        // a timed out transfer may still contain some data
+        if(transfer->actual_length > 0 && inFlight == 0) {
+            // no other transfer was queued while this one was being handled
+            ranDry++;
+        }
+        t.completed = true;
         break;
     case LIBUSB_TRANSFER_NO_DEVICE:
         qCritical() << "LIBUSB_TRANSFER_NO_DEVICE";
         libusb_free_transfer(transfer);
+        t.transfer = nullptr;
+        cv.notify_all();
         return;
     case LIBUSB_TRANSFER_ERROR:
     case LIBUSB_TRANSFER_OVERFLOW:
     case LIBUSB_TRANSFER_STALL:
         qCritical() << "LIBUSB_ERROR" << transfer->status;
         libusb_free_transfer(transfer);
-        this->transfer = nullptr;
+        t.transfer = nullptr;
+        cv.notify_all();
         emit TransferError();
         return;
         break;
-    case LIBUSB_TRANSFER_TIMED_OUT:
-        // nothing to do
-        break;
     case LIBUSB_TRANSFER_CANCELLED:
         // destructor called, do not resubmit
         libusb_free_transfer(transfer);
-        this->transfer = nullptr;
+        t.transfer = nullptr;
         cv.notify_all();
         return;
         break;
     }
-    // Resubmit the transfer
-    transfer->buffer = &buffer[received_size];
-    transfer->length = buffer_size - received_size;
-    libusb_submit_transfer(transfer);
+    // Pass on data in the order the transfers were submitted and resubmit them
+    while(ring[nextToProcess].completed) {
+        auto &next = ring[nextToProcess];
+        next.completed = false;
+        int length = next.transfer->actual_length;
+        if(length > 0) {
+            // the transfer is not resubmitted before the data has been handled
+            emit DataReceived(next.data, length);
+        }
+        submit(nextToProcess);
+        nextToProcess = (nextToProcess + 1) % ring.size();
+    }
 }
 
 void USBInBuffer::CallbackTrampoline(libusb_transfer *transfer)
@@ -109,11 +181,6 @@ void USBInBuffer::CallbackTrampoline(libusb_transfer *transfer)
     usb->Callback(transfer);
 }
 
-uint8_t *USBInBuffer::getBuffer() const
-{
-    return buffer;
-}
-
 static constexpr Protocol::DeviceInfo defaultInfo = {
     .ProtocolVersion = Protocol::Version,
     .FW_major = 0,
@@ -132,6 +199,11 @@ static constexpr Protocol::DeviceInfo defaultInfo = {
     .limits_maxRBW = 1000000,
     .limits_maxAmplitudePoints = 255,
     .limits_maxFreqHarmonic = 18000000000,
+    .supportsDatapointBatch = 0,
+    .supportsDatapointCRC = 0,
+    .supportsCompactDatapoints = 0,
+    .supportsSequenceNumbers = 0,
+    .supportsFirmwareVerify = 0,
 };
 
 static constexpr Protocol::DeviceStatusV1 defaultStatusV1 = {
@@ -147,19 +219,71 @@ static constexpr Protocol::DeviceStatusV1 defaultStatusV1 = {
     .temp_MCU = 0,
 };
 
-Device::Device(QString serial)
+Device::Device(QString serial) :
+    virtualDevice(nullptr),
+    replay(nullptr),
+    capture(nullptr),
+    dataFramer(dataFramerBuffer, sizeof(dataFramerBuffer)),
+    datapointQueue(queueCapacity),
+    spectrumQueue(queueCapacity),
+    drainScheduled(false)
 {
     info = defaultInfo;
     status = {};
+    sweepSettings = {};
+    pointFrequency.Setup(sweepSettings);
 
     m_handle = nullptr;
     infoValid = false;
+    if(serial == VirtualDevice::serial) {
+        // no hardware involved, the virtual device takes the place of the USB endpoints
+        auto &pref = Preferences::getInstance();
+        m_serial = serial;
+        m_context = nullptr;
+        dataBuffer = nullptr;
+        logBuffer = nullptr;
+        m_receiveThread = nullptr;
+        virtualDevice = new VirtualDevice(pref.Acquisition.virtualDeviceRate, pref.Acquisition.virtualDeviceDUT);
+        connect(virtualDevice, &VirtualDevice::DataReceived, this, &Device::ReceivedData, Qt::DirectConnection);
+        connect(virtualDevice, &VirtualDevice::LogReceived, this, &Device::ReceivedLog, Qt::DirectConnection);
+        qInfo() << "Connected to virtual device" << flush;
+        m_connected = true;
+    } else if(serial.startsWith(USBReplay::serialPrefix)) {
+        // the data of the device comes from a capture, transmitted packets are discarded
+        m_serial = serial;
+        m_context = nullptr;
+        dataBuffer = nullptr;
+        logBuffer = nullptr;
+        m_receiveThread = nullptr;
+        replay = new USBReplay(serial.mid(USBReplay::serialPrefix.size()), Preferences::getInstance().Acquisition.replayRealtime);
+        connect(replay, &USBReplay::DataReceived, this, &Device::ReplayedData, Qt::DirectConnection);
+        connect(replay, &USBReplay::LogReceived, this, &Device::ReceivedLog, Qt::DirectConnection);
+        connect(replay, &USBReplay::DataTransmitted, this, &Device::ReplayedTransmission, Qt::DirectConnection);
+        m_connected = true;
+    } else {
+        connectUSB(serial);
+    }
+    connect(&transmissionTimer, &QTimer::timeout, this, &Device::transmissionTimeout);
+    connect(this, &Device::receivedAnswer, this, &Device::transmissionFinished, Qt::QueuedConnection);
+    transmissionTimer.setSingleShot(true);
+    transmissionsInFlight = 0;
+    nextSequenceNumber = 0;
+    // got a new connection, request info
+    SendCommandWithoutPayload(Protocol::PacketType::RequestDeviceInfo);
+    if(replay) {
+        // everything has to be connected before the first packet of the capture arrives
+        replay->Start();
+    }
+}
+
+void Device::connectUSB(QString serial)
+{
     libusb_init(&m_context);
 #if LIBUSB_API_VERSION >= 0x01000106
     libusb_set_option(m_context, LIBUSB_OPTION_LOG_LEVEL, LIBUSB_LOG_LEVEL_INFO);
 #endif
 
-    SearchDevices([=](libusb_device_handle *handle, QString found_serial) -> bool {
+    auto foundCallback = [=](libusb_device_handle *handle, QString found_serial) -> bool {
         if(serial.isEmpty() || serial == found_serial) {
             // accept connection to this device
             m_serial = found_serial;
@@ -170,7 +294,17 @@ Device::Device(QString serial)
             // not the requested device, continue search
             return true;
         }
-    }, m_context, false);
+    };
+    uint8_t bus, address;
+    if(!serial.isEmpty() && DeviceRegistry::getInstance().getLocation(serial, bus, address)) {
+        // the location of the requested device is known, no need to open any other device
+        SearchDevices(foundCallback, m_context, false, [=](libusb_device *device) -> bool {
+            return libusb_get_bus_number(device) == bus && libusb_get_device_address(device) == address;
+        });
+    }
+    if(!m_handle) {
+        SearchDevices(foundCallback, m_context, false);
+    }
 
     if(!m_handle) {
         QString message =  "No device found";
@@ -200,23 +334,28 @@ Device::Device(QString serial)
     qInfo() << "USB connection established" << flush;
     m_connected = true;
     m_receiveThread = new std::thread(&Device::USBHandleThread, this);
-    dataBuffer = new USBInBuffer(m_handle, EP_Data_In_Addr, 65536);
+    dataBuffer = new USBInBuffer(m_handle, EP_Data_In_Addr, 65536, Preferences::getInstance().Acquisition.USBTransfers);
     logBuffer = new USBInBuffer(m_handle, EP_Log_In_Addr, 65536);
     connect(dataBuffer, &USBInBuffer::DataReceived, this, &Device::ReceivedData, Qt::DirectConnection);
     connect(dataBuffer, &USBInBuffer::TransferError, this, &Device::ConnectionLost);
     connect(logBuffer, &USBInBuffer::DataReceived, this, &Device::ReceivedLog, Qt::DirectConnection);
-    connect(&transmissionTimer, &QTimer::timeout, this, &Device::transmissionTimeout);
-    connect(this, &Device::receivedAnswer, this, &Device::transmissionFinished, Qt::QueuedConnection);
-    transmissionTimer.setSingleShot(true);
-    transmissionActive = false;
-    // got a new connection, request info
-    SendCommandWithoutPayload(Protocol::PacketType::RequestDeviceInfo);
 }
 
 Device::~Device()
 {
-    if(m_connected) {
+    if(m_connected && (virtualDevice || replay)) {
         SetIdle();
+        {
+            // the replay might wait for a drain, which will not happen anymore
+            lock_guard<mutex> guard(drainMutex);
+            m_connected = false;
+        }
+        drained.notify_all();
+        delete virtualDevice;
+        delete replay;
+    } else if(m_connected) {
+        SetIdle();
+        qDebug() << "USB receive ring ran dry" << dataBuffer->getRanDryCount() << "times";
         delete dataBuffer;
         delete logBuffer;
         m_connected = false;
@@ -232,11 +371,13 @@ Device::~Device()
         libusb_exit(m_context);
         delete m_receiveThread;
     }
+    StopCapture();
 }
 
 void Device::RegisterTypes()
 {
     qRegisterMetaType<Protocol::Datapoint>("Datapoint");
+    qRegisterMetaType<std::vector<Protocol::Datapoint>>("DatapointVector");
     qRegisterMetaType<Protocol::ManualStatusV1>("ManualV1");
     qRegisterMetaType<Protocol::SpectrumAnalyzerResult>("SpectrumAnalyzerResult");
     qRegisterMetaType<Protocol::AmplitudeCorrectionPoint>("AmplitudeCorrection");
@@ -248,11 +389,10 @@ bool Device::SendPacket(const Protocol::PacketInfo& packet, std::function<void(T
     t.packet = packet;
     t.timeout = timeout;
     t.callback = cb;
+    t.sequenceNumber = Protocol::NoSequenceNumber;
     transmissionQueue.enqueue(t);
 //    qDebug() << "Enqueued packet, queue at " << transmissionQueue.size();
-    if(!transmissionActive) {
-        startNextTransmission();
-    }
+    startTransmissions();
     return true;
 }
 
@@ -261,6 +401,11 @@ bool Device::Configure(Protocol::SweepSettings settings, std::function<void(Tran
     Protocol::PacketInfo p;
     p.type = Protocol::PacketType::SweepSettings;
     p.settings = settings;
+    // older firmware sends each datapoint in its own packet
+    p.settings.batchDatapoints = info.supportsDatapointBatch;
+    p.settings.datapointCRC = info.supportsDatapointCRC && Preferences::getInstance().Acquisition.datapointCRC;
+    p.settings.compactDatapoints = info.supportsCompactDatapoints;
+    // the settings are used for decoding compact datapoints once the device acknowledged them
     return SendPacket(p, cb);
 }
 
@@ -285,12 +430,12 @@ bool Device::SetIdle(std::function<void(TransmissionResult)> cb)
     return SendCommandWithoutPayload(Protocol::PacketType::SetIdle, cb);
 }
 
-bool Device::SendFirmwareChunk(Protocol::FirmwarePacket &fw)
+bool Device::SendFirmwareChunk(Protocol::FirmwarePacket &fw, std::function<void(TransmissionResult)> cb)
 {
     Protocol::PacketInfo p;
     p.type = Protocol::PacketType::FirmwarePacket;
     p.firmware = fw;
-    return SendPacket(p);
+    return SendPacket(p, cb);
 }
 
 bool Device::SendCommandWithoutPayload(Protocol::PacketType type, std::function<void(TransmissionResult)> cb)
@@ -302,22 +447,7 @@ bool Device::SendCommandWithoutPayload(Protocol::PacketType type, std::function<
 
 std::set<QString> Device::GetDevices()
 {
-    std::set<QString> serials;
-
-    libusb_context *ctx;
-    libusb_init(&ctx);
-#if LIBUSB_API_VERSION >= 0x01000106
-    libusb_set_option(ctx, LIBUSB_OPTION_LOG_LEVEL, LIBUSB_LOG_LEVEL_INFO);
-#endif
-
-    SearchDevices([&serials](libusb_device_handle *, QString serial) -> bool {
-        serials.insert(serial);
-        return true;
-    }, ctx, true);
-
-    libusb_exit(ctx);
-
-    return serials;
+    return DeviceRegistry::getInstance().getDevices();
 }
 
 void Device::USBHandleThread()
@@ -329,77 +459,94 @@ void Device::USBHandleThread()
     qDebug() << "Disconnected, receive thread exiting";
 }
 
-void Device::SearchDevices(std::function<bool (libusb_device_handle *, QString)> foundCallback, libusb_context *context, bool ignoreOpenError)
+void Device::SearchDevices(std::function<bool (libusb_device_handle *, QString)> foundCallback, libusb_context *context, bool ignoreOpenError,
+                           std::function<bool (libusb_device *)> filter)
 {
     libusb_device **devList;
     auto ndevices = libusb_get_device_list(context, &devList);
 
     for (ssize_t idx = 0; idx < ndevices; idx++) {
-        int ret;
         libusb_device *device = devList[idx];
-        libusb_device_descriptor desc = {};
-
-        ret = libusb_get_device_descriptor(device, &desc);
-        if (ret) {
-            /* some error occured */
-            qCritical() << "Failed to get device descriptor: "
-                    << libusb_strerror((libusb_error) ret);
+        if(filter && !filter(device)) {
             continue;
         }
-
-        bool correctID = false;
-        int numIDs = sizeof(IDs)/sizeof(IDs[0]);
-        for(int i=0;i<numIDs;i++) {
-            if(desc.idVendor == IDs[i].VID && desc.idProduct == IDs[i].PID) {
-                correctID = true;
-                break;
-            }
-        }
-        if(!correctID) {
+        QString serial;
+        auto handle = OpenDevice(device, serial, ignoreOpenError);
+        if(!handle) {
             continue;
         }
+        if(!foundCallback(handle, serial)) {
+            // abort search
+            break;
+        }
+        libusb_close(handle);
+    }
+    libusb_free_device_list(devList, 1);
+}
 
-        /* Try to open the device */
-        libusb_device_handle *handle = nullptr;
-        ret = libusb_open(device, &handle);
-        if (ret) {
-            qDebug() << libusb_strerror((enum libusb_error) ret);
-            /* Failed to open */
-            if(!ignoreOpenError) {
-                QString message =  "Found potential device but failed to open usb connection: \"";
-                message.append(libusb_strerror((libusb_error) ret));
-                message.append("\" On Linux this is most likely caused by a missing udev rule. "
-                               "On Windows this most likely means that you are already connected to "
-                               "this device (is another instance of the application already runnning?)");
-                qWarning() << message;
-                InformationBox::ShowError("Error opening device", message);
-            }
-            continue;
+libusb_device_handle *Device::OpenDevice(libusb_device *device, QString &serial, bool ignoreOpenError)
+{
+    int ret;
+    libusb_device_descriptor desc = {};
+
+    ret = libusb_get_device_descriptor(device, &desc);
+    if (ret) {
+        /* some error occured */
+        qCritical() << "Failed to get device descriptor: "
+                << libusb_strerror((libusb_error) ret);
+        return nullptr;
+    }
+
+    bool correctID = false;
+    int numIDs = sizeof(IDs)/sizeof(IDs[0]);
+    for(int i=0;i<numIDs;i++) {
+        if(desc.idVendor == IDs[i].VID && desc.idProduct == IDs[i].PID) {
+            correctID = true;
+            break;
         }
+    }
+    if(!correctID) {
+        return nullptr;
+    }
 
-        char c_product[256];
-        char c_serial[256];
-        libusb_get_string_descriptor_ascii(handle, desc.iSerialNumber,
-                (unsigned char*) c_serial, sizeof(c_serial));
-        ret = libusb_get_string_descriptor_ascii(handle, desc.iProduct,
-                (unsigned char*) c_product, sizeof(c_product));
-        if (ret > 0) {
-            /* managed to read the product string */
-            QString product(c_product);
-            if (product == "VNA") {
-                // this is a match
-                if(!foundCallback(handle, QString(c_serial))) {
-                    // abort search
-                    break;
-                }
-            }
-        } else {
-            qWarning() << "Failed to get product descriptor: "
-                    << libusb_strerror((libusb_error) ret);
+    /* Try to open the device */
+    libusb_device_handle *handle = nullptr;
+    ret = libusb_open(device, &handle);
+    if (ret) {
+        qDebug() << libusb_strerror((enum libusb_error) ret);
+        /* Failed to open */
+        if(!ignoreOpenError) {
+            QString message =  "Found potential device but failed to open usb connection: \"";
+            message.append(libusb_strerror((libusb_error) ret));
+            message.append("\" On Linux this is most likely caused by a missing udev rule. "
+                           "On Windows this most likely means that you are already connected to "
+                           "this device (is another instance of the application already runnning?)");
+            qWarning() << message;
+            InformationBox::ShowError("Error opening device", message);
         }
-        libusb_close(handle);
+        return nullptr;
     }
-    libusb_free_device_list(devList, 1);
+
+    char c_product[256];
+    char c_serial[256];
+    libusb_get_string_descriptor_ascii(handle, desc.iSerialNumber,
+            (unsigned char*) c_serial, sizeof(c_serial));
+    ret = libusb_get_string_descriptor_ascii(handle, desc.iProduct,
+            (unsigned char*) c_product, sizeof(c_product));
+    if (ret > 0) {
+        /* managed to read the product string */
+        QString product(c_product);
+        if (product == "VNA") {
+            // this is a match
+            serial = QString(c_serial);
+            return handle;
+        }
+    } else {
+        qWarning() << "Failed to get product descriptor: "
+                << libusb_strerror((libusb_error) ret);
+    }
+    libusb_close(handle);
+    return nullptr;
 }
 
 const Protocol::DeviceInfo &Device::Info()
@@ -453,73 +600,353 @@ QString Device::getLastDeviceInfoString()
     return ret;
 }
 
-void Device::ReceivedData()
+unsigned long Device::getUSBRanDryCount() const
 {
+    if(!dataBuffer) {
+        // virtual device
+        return 0;
+    }
+    return dataBuffer->getRanDryCount();
+}
+
+void Device::ReceivedData(const unsigned char *data, int length)
+{
+    Protocol::PacketView view;
     Protocol::PacketInfo packet;
-    uint16_t handled_len;
+    int16_t sequenceNumber;
+    bool queuedData = false;
 //    qDebug() << "Received data";
-    do {
-        handled_len = Protocol::DecodeBuffer(dataBuffer->getBuffer(), dataBuffer->getReceived(), &packet);
-        dataBuffer->removeBytes(handled_len);
-        switch(packet.type) {
-        case Protocol::PacketType::Datapoint:
-            emit DatapointReceived(packet.datapoint);
-            break;
-        case Protocol::PacketType::ManualStatusV1:
-            emit ManualStatusReceived(packet.manualStatusV1);
-            break;
-        case Protocol::PacketType::SpectrumAnalyzerResult:
-            emit SpectrumResultReceived(packet.spectrumResult);
-            break;
-        case Protocol::PacketType::SourceCalPoint:
-        case Protocol::PacketType::ReceiverCalPoint:
-            emit AmplitudeCorrectionPointReceived(packet.amplitudePoint);
-            break;
-        case Protocol::PacketType::DeviceInfo:
-            if(packet.info.ProtocolVersion != Protocol::Version) {
-                if(!infoValid) {
-                emit NeedsFirmwareUpdate(packet.info.ProtocolVersion, Protocol::Version);
+    record(USBCapture::Source::DataIn, data, length);
+    while(length > 0) {
+        // the framer may not be able to take everything at once, decoding frees up space for the rest
+        auto added = dataFramer.Add(data, min(length, 0xFFFF));
+        data += added;
+        length -= added;
+        bool decoded = false;
+        while(dataFramer.Decode(&view, &sequenceNumber)) {
+            decoded = true;
+            if(queueMeasurement(view)) {
+                queuedData = true;
+                continue;
+            }
+            // not measurement data, these packets are rare enough to work on a copy
+            view.CopyTo(&packet);
+            switch(packet.type) {
+            case Protocol::PacketType::ManualStatusV1:
+                emit ManualStatusReceived(packet.manualStatusV1);
+                break;
+            case Protocol::PacketType::SourceCalPoint:
+            case Protocol::PacketType::ReceiverCalPoint:
+                emit AmplitudeCorrectionPointReceived(packet.amplitudePoint);
+                break;
+            case Protocol::PacketType::DeviceInfo:
+                if(packet.info.ProtocolVersion != Protocol::Version) {
+                    if(!infoValid) {
+                    emit NeedsFirmwareUpdate(packet.info.ProtocolVersion, Protocol::Version);
+                    }
+                } else {
+                    info = packet.info;
+                }
+                infoValid = true;
+                emit DeviceInfoUpdated();
+                break;
+            case Protocol::PacketType::DeviceStatusV1:
+                status.v1 = packet.statusV1;
+                emit DeviceStatusUpdated();
+                break;
+            case Protocol::PacketType::Ack:
+                if(replay) {
+                    // answer to a transmission of the captured session, the current transmissions are answered locally
+                    break;
+                }
+                // datapoints following this Ack belong to the new sweep
+                acceptSweepSettings(sequenceNumber);
+                if(queuedData) {
+                    // make sure data received before the answer is handled first
+                    scheduleDrain();
                 }
-            } else {
-                info = packet.info;
+                emit AckReceived();
+                emit receivedAnswer(TransmissionResult::Ack, sequenceNumber);
+                break;
+            case Protocol::PacketType::Nack:
+                if(replay) {
+                    break;
+                }
+                if(queuedData) {
+                    scheduleDrain();
+                }
+                emit NackReceived();
+                emit receivedAnswer(TransmissionResult::Nack, sequenceNumber);
+                break;
+            case Protocol::PacketType::FrequencyCorrection:
+                emit FrequencyCorrectionReceived(packet.frequencyCorrection.ppm);
+                break;
+            default:
+                break;
             }
-            infoValid = true;
-            emit DeviceInfoUpdated();
-            break;
-        case Protocol::PacketType::DeviceStatusV1:
-            status.v1 = packet.statusV1;
-            emit DeviceStatusUpdated();
-            break;
-        case Protocol::PacketType::Ack:
-            emit AckReceived();
-            emit receivedAnswer(TransmissionResult::Ack);
-            break;
-        case Protocol::PacketType::Nack:
-            emit NackReceived();
-            emit receivedAnswer(TransmissionResult::Nack);
-            break;
-        case Protocol::PacketType::FrequencyCorrection:
-            emit FrequencyCorrectionReceived(packet.frequencyCorrection.ppm);
-            break;
-       default:
-            break;
         }
-    } while (handled_len > 0);
+        if(!added && !decoded) {
+            // no progress possible, should never happen as the framer only waits for frames that fit
+            qWarning() << "USB frame buffer stuck, dropping" << dataFramer.Used() << "bytes";
+            dataFramer.Clear();
+        }
+    }
+    if(queuedData) {
+        scheduleDrain();
+    }
 }
 
-void Device::ReceivedLog()
+bool Device::queueMeasurement(const Protocol::PacketView &view)
 {
-    uint16_t handled_len;
-    do {
-        handled_len = 0;
-        auto firstLinebreak = (uint8_t*) memchr(logBuffer->getBuffer(), '\n', logBuffer->getReceived());
-        if(firstLinebreak) {
-            handled_len = firstLinebreak - logBuffer->getBuffer();
-            auto line = QString::fromLatin1((const char*) logBuffer->getBuffer(), handled_len - 1);
-            emit LogLineReceived(line);
-            logBuffer->removeBytes(handled_len + 1);
+    switch(view.type) {
+    case Protocol::PacketType::Datapoint:
+        if(auto d = view.As<Protocol::Datapoint>()) {
+            datapointQueue.push(*d);
+        } else {
+            // shorter packet from an older version, the copy fills in the missing fields
+            Protocol::PacketInfo packet;
+            view.CopyTo(&packet);
+            datapointQueue.push(packet.datapoint);
+        }
+        return true;
+    case Protocol::PacketType::DatapointBatch: {
+        auto batch = view.As<Protocol::DatapointBatch>(sizeof(Protocol::DatapointBatch::numPoints));
+        if(!batch || batch->numPoints > Protocol::MaxBatchedDatapoints
+                || view.length < sizeof(batch->numPoints) + batch->numPoints * sizeof(Protocol::Datapoint)) {
+            qWarning() << "Ignoring incomplete datapoint batch";
+            return true;
+        }
+        for(unsigned int i=0;i<batch->numPoints;i++) {
+            datapointQueue.push(batch->points[i]);
+        }
+        return true;
+    }
+    case Protocol::PacketType::CompactDatapoints: {
+        constexpr uint16_t headerLength = sizeof(Protocol::CompactDatapoints) - sizeof(Protocol::CompactDatapoints::values);
+        auto compact = view.As<Protocol::CompactDatapoints>(headerLength);
+        if(!compact || view.length < headerLength
+                + compact->numPoints * Protocol::CompactValuesPerPoint(compact->port1, compact->port2) * sizeof(float)) {
+            qWarning() << "Ignoring incomplete compact datapoints";
+            return true;
+        }
+        queueCompactDatapoints(*compact);
+        return true;
+    }
+    case Protocol::PacketType::SpectrumAnalyzerResult:
+        if(auto result = view.As<Protocol::SpectrumAnalyzerResult>()) {
+            spectrumQueue.push(*result);
+        } else {
+            Protocol::PacketInfo packet;
+            view.CopyTo(&packet);
+            spectrumQueue.push(packet.spectrumResult);
+        }
+        return true;
+    default:
+        return false;
+    }
+}
+
+void Device::queueCompactDatapoints(const Protocol::CompactDatapoints &compact)
+{
+    auto valuesPerPoint = Protocol::CompactValuesPerPoint(compact.port1, compact.port2);
+    if(!valuesPerPoint || compact.numPoints * valuesPerPoint > Protocol::MaxCompactValues) {
+        qWarning() << "Ignoring compact datapoints with invalid size";
+        return;
+    }
+    lock_guard<mutex> guard(sweepSettingsMutex);
+    auto &s = sweepSettings;
+    auto values = compact.values;
+    for(unsigned int i=0;i<compact.numPoints;i++) {
+        Protocol::Datapoint d = {};
+        d.pointNum = compact.firstPointNum + i;
+        // same calculation as in the firmware
+        d.frequency = pointFrequency.Get(d.pointNum);
+        if(s.points > 1) {
+            d.cdbm = s.cdbm_excitation_start + (s.cdbm_excitation_stop - s.cdbm_excitation_start) * d.pointNum / (s.points - 1);
+        } else {
+            d.cdbm = s.cdbm_excitation_start;
+        }
+        if(compact.port1) {
+            d.real_S11 = *values++;
+            d.imag_S11 = *values++;
+            d.real_S21 = *values++;
+            d.imag_S21 = *values++;
         }
-    } while(handled_len > 0);
+        if(compact.port2) {
+            d.real_S12 = *values++;
+            d.imag_S12 = *values++;
+            d.real_S22 = *values++;
+            d.imag_S22 = *values++;
+        }
+        datapointQueue.push(d);
+    }
+}
+
+void Device::acceptSweepSettings(int sequenceNumber)
+{
+    lock_guard<mutex> guard(sweepSettingsMutex);
+    auto it = find_if(pendingSweepSettings.begin(), pendingSweepSettings.end(), [=](const PendingSweepSettings &p) {
+        return p.sequenceNumber == sequenceNumber;
+    });
+    if(it == pendingSweepSettings.end()) {
+        // acknowledged some other packet
+        return;
+    }
+    sweepSettings = it->settings;
+    pointFrequency.Setup(sweepSettings);
+    // from now on, the device calculates the CRC of every datapoint (if enabled)
+    dataFramer.RequireDatapointCRC(sweepSettings.datapointCRC);
+    // older settings have been replaced by these ones
+    pendingSweepSettings.erase(pendingSweepSettings.begin(), it + 1);
+}
+
+void Device::scheduleDrain()
+{
+    if(!drainScheduled.exchange(true)) {
+        // no drain pending yet
+        QMetaObject::invokeMethod(this, "drainQueues", Qt::QueuedConnection);
+    }
+}
+
+void Device::drainQueues()
+{
+    // clear the flag before taking data out of the queues. Data that is queued while
+    // draining schedules another drain instead of getting stuck in the queue
+    drainScheduled = false;
+    if(datapointQueue.size() > 0) {
+        std::vector<Protocol::Datapoint> points;
+        points.reserve(datapointQueue.size());
+        Protocol::Datapoint d;
+        while(datapointQueue.pop(d)) {
+            points.push_back(d);
+        }
+        emit DatapointsReceived(points);
+    }
+    Protocol::SpectrumAnalyzerResult result;
+    while(spectrumQueue.pop(result)) {
+        emit SpectrumResultReceived(result);
+    }
+    if(replay) {
+        // notify while holding the lock, otherwise the replay could miss it between checking the queues and waiting
+        lock_guard<mutex> guard(drainMutex);
+        drained.notify_all();
+    }
+}
+
+Device::QueueStatistics Device::getDatapointQueueStatistics() const
+{
+    return {datapointQueue.highWaterMark(), datapointQueue.overflows()};
+}
+
+Device::QueueStatistics Device::getSpectrumQueueStatistics() const
+{
+    return {spectrumQueue.highWaterMark(), spectrumQueue.overflows()};
+}
+
+bool Device::StartCapture(QString filename)
+{
+    USBCapture *newCapture;
+    try {
+        newCapture = new USBCapture(filename);
+    } catch (const runtime_error &e) {
+        qWarning() << "Failed to start capture:" << e.what();
+        return false;
+    }
+    {
+        lock_guard<mutex> guard(captureMutex);
+        delete capture;
+        capture = newCapture;
+    }
+    // A replay needs the sweep settings for decoding compact datapoints, record the current ones as if they
+    // had been transmitted right now. The device info is requested again, so that it is part of the capture
+    Protocol::PacketInfo p;
+    p.type = Protocol::PacketType::SweepSettings;
+    {
+        lock_guard<mutex> guard(sweepSettingsMutex);
+        p.settings = sweepSettings;
+    }
+    if(p.settings.points > 0) {
+        unsigned char buffer[1024];
+        auto length = Protocol::EncodePacket(p, buffer, sizeof(buffer));
+        record(USBCapture::Source::DataOut, buffer, length);
+    }
+    SendCommandWithoutPayload(Protocol::PacketType::RequestDeviceInfo);
+    return true;
+}
+
+void Device::StopCapture()
+{
+    lock_guard<mutex> guard(captureMutex);
+    delete capture;
+    capture = nullptr;
+}
+
+bool Device::isCapturing()
+{
+    lock_guard<mutex> guard(captureMutex);
+    return capture != nullptr;
+}
+
+bool Device::isReplayFinished() const
+{
+    return replay && replay->isFinished();
+}
+
+void Device::record(USBCapture::Source source, const unsigned char *data, int length)
+{
+    lock_guard<mutex> guard(captureMutex);
+    if(capture) {
+        capture->Record(source, data, length);
+    }
+}
+
+void Device::ReplayedData(const unsigned char *data, int length)
+{
+    // Unlike a real device, the replay can produce data faster than the GUI thread takes it out of the queues. Wait
+    // until the queues have room for everything this buffer may contain instead of dropping measurements.
+    // The smallest measurement is a compact datapoint with one port (4 floats)
+    const size_t maxItems = length / (4 * sizeof(float)) + 1;
+    auto hasRoom = [=](size_t used, size_t capacity) {
+        return used + maxItems <= capacity;
+    };
+    unique_lock<mutex> lock(drainMutex);
+    while(m_connected && !(hasRoom(datapointQueue.size(), datapointQueue.capacity())
+                           && hasRoom(spectrumQueue.size(), spectrumQueue.capacity()))) {
+        scheduleDrain();
+        drained.wait(lock);
+    }
+    lock.unlock();
+    ReceivedData(data, length);
+}
+
+void Device::ReplayedTransmission(const unsigned char *data, int length)
+{
+    // only the sweep settings are relevant, they are required for decoding compact datapoints
+    uint8_t buffer[1024];
+    if(length > (int) sizeof(buffer)) {
+        return;
+    }
+    memcpy(buffer, data, length);
+    Protocol::PacketInfo packet;
+    Protocol::DecodeBuffer(buffer, length, &packet);
+    if(packet.type == Protocol::PacketType::SweepSettings) {
+        lock_guard<mutex> guard(sweepSettingsMutex);
+        sweepSettings = packet.settings;
+        pointFrequency.Setup(sweepSettings);
+    }
+}
+
+void Device::ReceivedLog(const unsigned char *data, int length)
+{
+    record(USBCapture::Source::LogIn, data, length);
+    logLine.append((const char*) data, length);
+    int lineEnd;
+    while((lineEnd = logLine.indexOf('\n')) >= 0) {
+        // lines are terminated by "\r\n", the carriage return is not part of the line
+        auto line = QString::fromLatin1(logLine.constData(), lineEnd > 0 ? lineEnd - 1 : 0);
+        emit LogLineReceived(line);
+        logLine.remove(0, lineEnd + 1);
+    }
 }
 
 QString Device::serial() const
@@ -529,37 +956,65 @@ QString Device::serial() const
 
 bool Device::startNextTransmission()
 {
-    if(transmissionQueue.isEmpty() || !m_connected) {
+    if(transmissionQueue.size() <= transmissionsInFlight || !m_connected) {
         // nothing more to transmit
-        transmissionActive = false;
         return false;
     }
-    transmissionActive = true;
-    auto t = transmissionQueue.head();
+    auto &t = transmissionQueue[transmissionsInFlight];
+    if(transmissionWindow() > 1) {
+        // the answer is matched by the sequence number
+        t.sequenceNumber = nextSequenceNumber++;
+    } else {
+        t.sequenceNumber = Protocol::NoSequenceNumber;
+    }
     unsigned char buffer[1024];
-    unsigned int length = Protocol::EncodePacket(t.packet, buffer, sizeof(buffer));
+    unsigned int length = Protocol::EncodePacket(t.packet, buffer, sizeof(buffer), false, t.sequenceNumber);
     if(!length) {
         qCritical() << "Failed to encode packet";
         return false;
     }
-    int actual_length;
-    auto ret = libusb_bulk_transfer(m_handle, EP_Data_Out_Addr, buffer, length, &actual_length, 0);
-    if(ret < 0) {
-        qCritical() << "Error sending data: "
-                                << libusb_strerror((libusb_error) ret);
-        return false;
+    record(USBCapture::Source::DataOut, buffer, length);
+    if(t.packet.type == Protocol::PacketType::SweepSettings && !replay) {
+        // Compact datapoints of the previous sweep may still arrive until the settings are acknowledged.
+        // During a replay, the settings are taken from the capture instead
+        lock_guard<mutex> guard(sweepSettingsMutex);
+        pendingSweepSettings.push_back({t.sequenceNumber, t.packet.settings});
     }
-    transmissionTimer.start(t.timeout);
+    if(virtualDevice) {
+        virtualDevice->Transmit(buffer, length);
+    } else if(replay) {
+        // nothing to send to, the packet is accepted right away
+        emit receivedAnswer(TransmissionResult::Ack, t.sequenceNumber);
+    } else {
+        int actual_length;
+        auto ret = libusb_bulk_transfer(m_handle, EP_Data_Out_Addr, buffer, length, &actual_length, 0);
+        if(ret < 0) {
+            qCritical() << "Error sending data: "
+                                    << libusb_strerror((libusb_error) ret);
+            return false;
+        }
+    }
+    if(transmissionsInFlight == 0) {
+        transmissionTimer.start(t.timeout);
+    }
+    transmissionsInFlight++;
 //    qDebug() << "Transmission started, queue at " << transmissionQueue.size();
     return true;
 }
 
-void Device::transmissionFinished(TransmissionResult result)
+void Device::transmissionFinished(TransmissionResult result, int sequenceNumber)
 {
-    // remove transmitted packet
+    // find the transmission this answer belongs to
+    int index = -1;
+    for(int i=0;i<transmissionsInFlight;i++) {
+        if(transmissionQueue[i].sequenceNumber == sequenceNumber) {
+            index = i;
+            break;
+        }
+    }
 //    qDebug() << "Transmission finsished (" << result << "), queue at " << transmissionQueue.size();
-    if(transmissionQueue.empty()) {
-        qWarning() << "transmissionFinished with empty transmission queue, stray Ack?";
+    if(index < 0) {
+        qWarning() << "transmissionFinished without matching transmission, stray Ack?";
         return;
     }
     if(result == TransmissionResult::Timeout) {
@@ -568,23 +1023,50 @@ void Device::transmissionFinished(TransmissionResult result)
     if(result == TransmissionResult::Nack) {
         qWarning() << "transmissionFinished with NACK";
     }
-    auto t = transmissionQueue.dequeue();
+    if(result != TransmissionResult::Ack) {
+        // settings that were not accepted by the device are never used for decoding
+        lock_guard<mutex> guard(sweepSettingsMutex);
+        pendingSweepSettings.erase(remove_if(pendingSweepSettings.begin(), pendingSweepSettings.end(), [=](const PendingSweepSettings &p) {
+            return p.sequenceNumber == sequenceNumber;
+        }), pendingSweepSettings.end());
+    }
+    // remove transmitted packet
+    auto t = transmissionQueue.takeAt(index);
+    transmissionsInFlight--;
+    transmissionTimer.stop();
+    if(transmissionsInFlight > 0) {
+        // restart the timeout for the oldest transmission that is still in flight
+        transmissionTimer.start(transmissionQueue.head().timeout);
+    }
     if(t.callback) {
         t.callback(result);
     }
-    transmissionTimer.stop();
-    bool success = false;
-    while(!transmissionQueue.isEmpty() && !success) {
-        success = startNextTransmission();
-        if(!success) {
+    startTransmissions();
+}
+
+unsigned int Device::transmissionWindow()
+{
+    if(!info.supportsSequenceNumbers) {
+        return 1;
+    }
+    if(transmissionQueue.size() > transmissionsInFlight
+            && transmissionQueue[transmissionsInFlight].packet.type == Protocol::PacketType::FirmwarePacket) {
+        // nothing else is transmitted during a firmware update, always pipeline the firmware packets
+        return Protocol::MaxOutstandingPackets;
+    }
+    auto window = Preferences::getInstance().Acquisition.outstandingCommands;
+    return qBound(1, window, (int) Protocol::MaxOutstandingPackets);
+}
+
+void Device::startTransmissions()
+{
+    while(transmissionsInFlight < (int) transmissionWindow() && transmissionQueue.size() > transmissionsInFlight) {
+        if(!startNextTransmission()) {
             // failed to send this packet
-            auto t = transmissionQueue.dequeue();
+            auto t = transmissionQueue.takeAt(transmissionsInFlight);
             if(t.callback) {
                 t.callback(TransmissionResult::InternalError);
             }
         }
     }
-    if(transmissionQueue.isEmpty()) {
-        transmissionActive = false;
-    }
 }
@@ -2,17 +2,25 @@
 #define DEVICE_H
 
 #include "../VNA_embedded/Application/Communication/Protocol.hpp"
+#include "Util/spscqueue.h"
+#include "usbcapture.h"
 
 #include <functional>
 #include <libusb-1.0/libusb.h>
 #include <thread>
 #include <QObject>
 #include <condition_variable>
+#include <mutex>
+#include <atomic>
+#include <vector>
 #include <set>
 #include <QQueue>
 #include <QTimer>
 
+class VirtualDevice;
+
 Q_DECLARE_METATYPE(Protocol::Datapoint);
+Q_DECLARE_METATYPE(std::vector<Protocol::Datapoint>);
 Q_DECLARE_METATYPE(Protocol::ManualStatusV1);
 Q_DECLARE_METATYPE(Protocol::SpectrumAnalyzerResult);
 Q_DECLARE_METATYPE(Protocol::AmplitudeCorrectionPoint);
@@ -20,25 +28,38 @@ Q_DECLARE_METATYPE(Protocol::AmplitudeCorrectionPoint);
 class USBInBuffer : public QObject {
     Q_OBJECT;
 public:
-    USBInBuffer(libusb_device_handle *handle, unsigned char endpoint, int buffer_size);
+    // Keeps num_transfers bulk transfers of buffer_size bytes queued on the endpoint at all times.
+    // The data of completed transfers is passed on in the order they were submitted.
+    USBInBuffer(libusb_device_handle *handle, unsigned char endpoint, int buffer_size, int num_transfers = 1);
     ~USBInBuffer();
 
-    void removeBytes(int handled_bytes);
-    int getReceived() const;
-    uint8_t *getBuffer() const;
+    // Number of times data arrived while no other transfer was queued (the endpoint ran dry)
+    unsigned long getRanDryCount() const;
 
 signals:
-    void DataReceived();
+    // data is only valid during the signal emission, connected slots have to copy what they need to keep
+    void DataReceived(const unsigned char *data, int length);
     void TransferError();
 
 private:
     void Callback(libusb_transfer *transfer);
     static void LIBUSB_CALL CallbackTrampoline(libusb_transfer *transfer);
-    libusb_transfer *transfer;
-    unsigned char *buffer;
-    int buffer_size;
-    int received_size;
-    bool inCallback;
+    bool submit(int index);
+
+    using Transfer = struct {
+        libusb_transfer *transfer;
+        unsigned char *data;
+        bool completed;
+        bool submitted;
+    };
+    std::vector<Transfer> ring;
+    int nextToProcess;
+    int inFlight;
+    // set by the destructor, transfers are not resubmitted anymore
+    bool stopping;
+    std::atomic<unsigned long> ranDry;
+
+    std::mutex mtx;
     std::condition_variable cv;
 };
 
@@ -55,7 +76,9 @@ public:
     };
     Q_ENUM(TransmissionResult)
 
-    // connect to a VNA device. If serial is specified only connecting to this device, otherwise to the first one found
+    // connect to a VNA device. If serial is specified only connecting to this device, otherwise to the first one found.
+    // The serial "VIRTUAL" connects to a simulated device that does not require any hardware,
+    // "REPLAY:<file>" plays back a capture created with StartCapture
     Device(QString serial = QString());
     ~Device();
 
@@ -65,7 +88,7 @@ public:
     bool Configure(Protocol::SpectrumAnalyzerSettings settings, std::function<void(TransmissionResult)> cb = nullptr);
     bool SetManual(Protocol::ManualControlV1 manual);
     bool SetIdle(std::function<void(TransmissionResult)> cb = nullptr);
-    bool SendFirmwareChunk(Protocol::FirmwarePacket &fw);
+    bool SendFirmwareChunk(Protocol::FirmwarePacket &fw, std::function<void(TransmissionResult)> cb = nullptr);
     bool SendCommandWithoutPayload(Protocol::PacketType type, std::function<void(TransmissionResult)> cb = nullptr);
     QString serial() const;
     const Protocol::DeviceInfo& Info();
@@ -73,11 +96,30 @@ public:
     Protocol::DeviceStatusV1& StatusV1();
     static const Protocol::DeviceStatusV1& StatusV1(Device *dev);
     QString getLastDeviceInfoString();
-
-    // Returns serial numbers of all connected devices
+    // Number of times the USB receive transfer ring ran dry since connecting
+    unsigned long getUSBRanDryCount() const;
+    using QueueStatistics = struct {
+        size_t highWaterMark;
+        unsigned long overflows;
+    };
+    // Statistics of the queues between the USB thread and the consumers of measurement data
+    QueueStatistics getDatapointQueueStatistics() const;
+    QueueStatistics getSpectrumQueueStatistics() const;
+
+    // Records all USB traffic of this device into filename (see USBCapture). Returns false if the file can not be created
+    bool StartCapture(QString filename);
+    void StopCapture();
+    bool isCapturing();
+    // Only meaningful when connected to a replay: true once the complete capture has been played back
+    bool isReplayFinished() const;
+
+    // Returns serial numbers of all connected devices (cached by the DeviceRegistry if hotplug events are supported)
     static std::set<QString> GetDevices();
+    // Opens the USB device if it is a LibreVNA and reads its serial number. Returns nullptr for any other device
+    static libusb_device_handle *OpenDevice(libusb_device *device, QString &serial, bool ignoreOpenError);
 signals:
-    void DatapointReceived(Protocol::Datapoint);
+    // all datapoints that were received since the last emission, in the order they were received
+    void DatapointsReceived(const std::vector<Protocol::Datapoint>&);
     void ManualStatusReceived(Protocol::ManualStatusV1);
     void SpectrumResultReceived(Protocol::SpectrumAnalyzerResult);
     void AmplitudeCorrectionPointReceived(Protocol::AmplitudeCorrectionPoint);
@@ -90,14 +132,21 @@ signals:
     void LogLineReceived(QString line);
     void NeedsFirmwareUpdate(int usedProtocol, int requiredProtocol);
 private slots:
-    void ReceivedData();
-    void ReceivedLog();
+    void ReceivedData(const unsigned char *data, int length);
+    void ReceivedLog(const unsigned char *data, int length);
+    void drainQueues();
+    // received data of a replay, blocks the replay until the measurement queues have enough room
+    void ReplayedData(const unsigned char *data, int length);
+    // host packets of a replayed capture
+    void ReplayedTransmission(const unsigned char *data, int length);
     void transmissionTimeout() {
-        transmissionFinished(TransmissionResult::Timeout);
+        // the oldest transmission in flight timed out
+        transmissionFinished(TransmissionResult::Timeout, transmissionQueue.isEmpty() ? Protocol::NoSequenceNumber : transmissionQueue.head().sequenceNumber);
     }
-    void transmissionFinished(TransmissionResult result);
+    // sequenceNumber identifies the transmission the answer belongs to (Protocol::NoSequenceNumber if sent without)
+    void transmissionFinished(TransmissionResult result, int sequenceNumber);
 signals:
-    void receivedAnswer(TransmissionResult result);
+    void receivedAnswer(TransmissionResult result, int sequenceNumber);
 
 private:
     static constexpr int EP_Data_Out_Addr = 0x01;
@@ -105,25 +154,76 @@ private:
     static constexpr int EP_Log_In_Addr = 0x82;
 
     void USBHandleThread();
+    // opens and claims the USB device, throws on failure
+    void connectUSB(QString serial);
     // foundCallback is called for every device that is found. If it returns true the search continues, otherwise it is aborted.
-    // When the search is aborted the last found device is still opened
-    static void SearchDevices(std::function<bool(libusb_device_handle *handle, QString serial)> foundCallback, libusb_context *context, bool ignoreOpenError);
+    // When the search is aborted the last found device is still opened. Only devices accepted by filter (if set) are opened
+    static void SearchDevices(std::function<bool(libusb_device_handle *handle, QString serial)> foundCallback, libusb_context *context, bool ignoreOpenError,
+                              std::function<bool(libusb_device *device)> filter = nullptr);
 
     libusb_device_handle *m_handle;
     libusb_context *m_context;
     USBInBuffer *dataBuffer;
     USBInBuffer *logBuffer;
+    // only set when connected to the virtual device, the USB members are not used in that case
+    VirtualDevice *virtualDevice;
+    // only set when playing back a capture, received data comes from the capture file
+    USBReplay *replay;
+
+    // all traffic is passed to the capture while it is set. Data is received and transmitted from different threads
+    void record(USBCapture::Source source, const unsigned char *data, int length);
+    USBCapture *capture;
+    std::mutex captureMutex;
+    // Frames are assembled in a circular buffer, incomplete frames stay in place until the rest arrives
+    uint8_t dataFramerBuffer[16384];
+    Protocol::FrameViewBuffer dataFramer;
+    // incomplete log line
+    QByteArray logLine;
+
+    // Measurement data is handed from the USB thread to the GUI thread through these queues. Instead of
+    // one queued signal per datapoint, only one drain is scheduled for everything that is queued meanwhile
+    void scheduleDrain();
+    static constexpr size_t queueCapacity = 16384;
+    SPSCQueue<Protocol::Datapoint> datapointQueue;
+    SPSCQueue<Protocol::SpectrumAnalyzerResult> spectrumQueue;
+    std::atomic<bool> drainScheduled;
+    // signalled after every drain, a replay waits on it until the queues have room again
+    std::mutex drainMutex;
+    std::condition_variable drained;
+
+    // Queues datapoints and spectrum analyzer results directly from the receive buffer. Returns false for any other packet
+    bool queueMeasurement(const Protocol::PacketView &view);
+    // Compact datapoints do not contain frequency and power, they are calculated from the last sweep settings
+    void queueCompactDatapoints(const Protocol::CompactDatapoints &compact);
+    Protocol::SweepSettings sweepSettings;
+    Protocol::PointFrequency pointFrequency;
+    // Settings that have been transmitted but not acknowledged yet, identified by the sequence number of their transmission
+    using PendingSweepSettings = struct {
+        int sequenceNumber;
+        Protocol::SweepSettings settings;
+    };
+    std::vector<PendingSweepSettings> pendingSweepSettings;
+    // switches to the pending settings with this sequence number (if any), called when the Ack is received
+    void acceptSweepSettings(int sequenceNumber);
+    std::mutex sweepSettingsMutex;
 
     using Transmission = struct {
         Protocol::PacketInfo packet;
         unsigned int timeout;
         std::function<void(TransmissionResult)> callback;
+        int sequenceNumber;
     };
 
+    // The first transmissionsInFlight entries of the queue have been sent and are waiting for their answer.
+    // More than one transmission can only be in flight if the device supports sequence numbers
     QQueue<Transmission> transmissionQueue;
+    int transmissionsInFlight;
+    uint8_t nextSequenceNumber;
+    unsigned int transmissionWindow();
+    // sends queued transmissions until the window is full
+    void startTransmissions();
     bool startNextTransmission();
     QTimer transmissionTimer;
-    bool transmissionActive;
 
     QString m_serial;
     bool m_connected;
@@ -0,0 +1,465 @@
+#include "devicemanager.h"
+
+#include "preferences.h"
+#include "VNA/vnadata.h"
+
+#include <QDebug>
+#include <QTimer>
+#include <algorithm>
+
+using namespace std;
+
+DeviceManager::DeviceManager(SCPINode &scpiRoot, QObject *parent) :
+    QObject(parent),
+    scpiRoot(scpiRoot),
+    startingSweeps(false),
+    startSweepsCount(0),
+    primary(nullptr),
+    primaryWaitingForIdle(false)
+{
+}
+
+DeviceManager::~DeviceManager()
+{
+    removeAllDevices();
+}
+
+unsigned int DeviceManager::addDevice(QString serial)
+{
+    if(serial.isEmpty()) {
+        // connecting to the first device found would most likely pick the device used by the modes
+        qWarning() << "Additional devices can only be added by their serial number";
+        return 0;
+    }
+    for(auto &i : instruments) {
+        if(i.second.device->serial() == serial) {
+            qWarning() << "Device" << serial << "is already managed as device" << i.first;
+            return 0;
+        }
+    }
+    Device *device;
+    try {
+        device = new Device(serial);
+    } catch (const runtime_error &e) {
+        qWarning() << "Failed to connect to" << serial << ":" << e.what();
+        return 0;
+    }
+    // use the lowest free number, the numbers of the other devices stay the same
+    unsigned int number = 1;
+    while(instruments.count(number)) {
+        number++;
+    }
+
+    Instrument i = {};
+    i.device = device;
+    i.traces = new TraceModel(this);
+    for(auto p : {Trace::LiveParameter::S11, Trace::LiveParameter::S12, Trace::LiveParameter::S21, Trace::LiveParameter::S22}) {
+        i.traces->addTrace(new Trace(Trace::ParameterToString(p), Qt::darkYellow, p));
+    }
+    i.settings.f_start = 1000000;
+    i.settings.f_stop = 6000000000;
+    i.settings.points = 501;
+    i.settings.if_bandwidth = 1000;
+    i.settings.cdbm_excitation_start = -1000;
+    i.settings.cdbm_excitation_stop = -1000;
+    i.settings.excitePort1 = 1;
+    i.settings.excitePort2 = 1;
+    // the sweeps of several devices are usually only aligned if they share the same reference
+    i.reference.AutomaticSwitch = 1;
+    instruments[number] = i;
+
+    connect(device, &Device::DatapointsReceived, this, [=](const std::vector<Protocol::Datapoint> &points) {
+        newDatapoints(number, points);
+    });
+    connect(device, &Device::LogLineReceived, this, [=](QString line) {
+        emit LogLineReceived("[DEV" + QString::number(number) + "] " + line);
+    });
+    connect(device, &Device::ConnectionLost, this, [=]() {
+        qWarning() << "Lost connection to device" << number;
+        // the device must not be deleted from within its own signal
+        QTimer::singleShot(0, this, [=]() {
+            removeDevice(number);
+        });
+    });
+
+    // same acquisition settings as the device used by the modes
+    Protocol::PacketInfo p;
+    p.type = Protocol::PacketType::AcquisitionFrequencySettings;
+    auto& pref = Preferences::getInstance();
+    p.acquisitionFrequencySettings.IF1 = pref.Acquisition.IF1;
+    p.acquisitionFrequencySettings.ADCprescaler = pref.Acquisition.ADCprescaler;
+    p.acquisitionFrequencySettings.DFTphaseInc = pref.Acquisition.DFTPhaseInc;
+    device->SendPacket(p);
+    sendReference(instruments[number]);
+    device->SetIdle();
+
+    setupSCPI(number);
+    qInfo() << "Added device" << serial << "as device" << number;
+    emit deviceAdded(number);
+    return number;
+}
+
+bool DeviceManager::removeDevice(unsigned int number)
+{
+    if(!instruments.count(number)) {
+        return false;
+    }
+    auto &i = instruments[number];
+    qInfo() << "Removing device" << number;
+    // also removes the node from the SCPI tree
+    delete i.scpi;
+    delete i.device;
+    delete i.traces;
+    instruments.erase(number);
+    emit deviceRemoved(number);
+    // the removed device might have been the last one the other devices were waiting for
+    continueStartSweeps();
+    return true;
+}
+
+void DeviceManager::removeAllDevices()
+{
+    startingSweeps = false;
+    while(!instruments.empty()) {
+        removeDevice(instruments.begin()->first);
+    }
+}
+
+std::vector<unsigned int> DeviceManager::getDeviceNumbers() const
+{
+    std::vector<unsigned int> ret;
+    for(auto &i : instruments) {
+        ret.push_back(i.first);
+    }
+    return ret;
+}
+
+Device *DeviceManager::getDevice(unsigned int number)
+{
+    if(!instruments.count(number)) {
+        return nullptr;
+    }
+    return instruments[number].device;
+}
+
+TraceModel *DeviceManager::getTraceModel(unsigned int number)
+{
+    if(!instruments.count(number)) {
+        return nullptr;
+    }
+    return instruments[number].traces;
+}
+
+void DeviceManager::startSweeps(bool singleSweep, Device *primary, std::function<void()> startPrimary)
+{
+    if(instruments.empty() && !primary) {
+        return;
+    }
+    startingSweeps = true;
+    auto count = ++startSweepsCount;
+    for(auto &i : instruments) {
+        auto number = i.first;
+        i.second.changingSettings = true;
+        i.second.sweeping = true;
+        i.second.singleSweep = singleSweep;
+        i.second.completedSweeps = 0;
+        i.second.traces->clearLiveData();
+        // Configuring a device takes a different amount of time depending on what it was doing before.
+        // Wait until all devices are idle, then send the settings to all of them back to back
+        i.second.waitingForIdle = i.second.device->SetIdle([=](Device::TransmissionResult res) {
+            if(res != Device::TransmissionResult::Ack) {
+                qWarning() << "Device" << number << "failed to stop its sweep:" << res;
+            }
+            if(count != startSweepsCount || !instruments.count(number)) {
+                return;
+            }
+            instruments[number].waitingForIdle = false;
+            continueStartSweeps();
+        });
+    }
+    disconnect(primaryDestroyed);
+    this->primary = primary;
+    this->startPrimary = startPrimary;
+    primaryWaitingForIdle = false;
+    if(primary) {
+        // the device used by the modes may be disconnected before it acknowledged the idle state
+        primaryDestroyed = connect(primary, &QObject::destroyed, this, [=]() {
+            this->primary = nullptr;
+            primaryWaitingForIdle = false;
+            continueStartSweeps();
+        });
+        primaryWaitingForIdle = primary->SetIdle([=](Device::TransmissionResult res) {
+            if(res != Device::TransmissionResult::Ack) {
+                qWarning() << "Primary device failed to stop its sweep:" << res;
+            }
+            if(count != startSweepsCount) {
+                return;
+            }
+            primaryWaitingForIdle = false;
+            continueStartSweeps();
+        });
+    }
+    continueStartSweeps();
+}
+
+void DeviceManager::continueStartSweeps()
+{
+    if(!startingSweeps || primaryWaitingForIdle) {
+        return;
+    }
+    for(auto &i : instruments) {
+        if(i.second.waitingForIdle) {
+            return;
+        }
+    }
+    startingSweeps = false;
+    for(auto &i : instruments) {
+        if(i.second.sweeping) {
+            configure(i.second);
+        }
+    }
+    disconnect(primaryDestroyed);
+    if(primary && startPrimary) {
+        startPrimary();
+    }
+    primary = nullptr;
+    startPrimary = nullptr;
+}
+
+void DeviceManager::stopSweeps()
+{
+    // a start that is still waiting for the devices to become idle must not configure them anymore
+    startingSweeps = false;
+    disconnect(primaryDestroyed);
+    primary = nullptr;
+    startPrimary = nullptr;
+    for(auto &i : instruments) {
+        auto number = i.first;
+        i.second.changingSettings = true;
+        i.second.sweeping = false;
+        i.second.device->SetIdle([=](Device::TransmissionResult) {
+            if(instruments.count(number)) {
+                instruments[number].changingSettings = false;
+            }
+        });
+    }
+}
+
+bool DeviceManager::sweepsFinished() const
+{
+    for(auto &i : instruments) {
+        if(i.second.sweeping) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void DeviceManager::newDatapoints(unsigned int number, const std::vector<Protocol::Datapoint> &points)
+{
+    if(!instruments.count(number)) {
+        return;
+    }
+    auto &i = instruments[number];
+    std::vector<VNAData> batch;
+    for(auto &d : points) {
+        if(i.changingSettings || !i.sweeping) {
+            // points of the previous settings
+            break;
+        }
+        if(d.pointNum >= i.settings.points) {
+            qWarning() << "Device" << number << "ignoring point with too large point number (" << d.pointNum << ")";
+            continue;
+        }
+        batch.push_back(VNAData(d));
+        if(d.pointNum == i.settings.points - 1) {
+            i.traces->addVNAData(batch, TraceMath::DataType::Frequency);
+            batch.clear();
+            i.completedSweeps++;
+            if(i.singleSweep) {
+                i.changingSettings = true;
+                i.device->SetIdle([=](Device::TransmissionResult) {
+                    if(instruments.count(number)) {
+                        instruments[number].changingSettings = false;
+                        instruments[number].sweeping = false;
+                    }
+                });
+            }
+        }
+    }
+    i.traces->addVNAData(batch, TraceMath::DataType::Frequency);
+}
+
+void DeviceManager::configure(Instrument &i)
+{
+    auto info = i.device->Info();
+    i.settings.f_start = clamp<uint64_t>(i.settings.f_start, info.limits_minFreq, info.limits_maxFreq);
+    i.settings.f_stop = clamp<uint64_t>(i.settings.f_stop, i.settings.f_start, info.limits_maxFreq);
+    i.settings.points = clamp<uint16_t>(i.settings.points, 1, info.limits_maxPoints);
+    i.settings.if_bandwidth = clamp<uint32_t>(i.settings.if_bandwidth, info.limits_minIFBW, info.limits_maxIFBW);
+    i.settings.cdbm_excitation_start = clamp<int16_t>(i.settings.cdbm_excitation_start, info.limits_cdbm_min, info.limits_cdbm_max);
+    i.settings.cdbm_excitation_stop = i.settings.cdbm_excitation_start;
+    i.settings.suppressPeaks = Preferences::getInstance().Acquisition.suppressPeaks ? 1 : 0;
+    i.settings.fixedPowerSetting = Preferences::getInstance().Acquisition.adjustPowerLevel ? 0 : 1;
+    auto device = i.device;
+    i.device->Configure(i.settings, [=](Device::TransmissionResult) {
+        for(auto &inst : instruments) {
+            if(inst.second.device == device) {
+                inst.second.changingSettings = false;
+            }
+        }
+    });
+}
+
+void DeviceManager::sendReference(Instrument &i)
+{
+    Protocol::PacketInfo p;
+    p.type = Protocol::PacketType::Reference;
+    p.reference = i.reference;
+    i.device->SendPacket(p);
+}
+
+void DeviceManager::setupSCPI(unsigned int number)
+{
+    auto &i = instruments[number];
+    i.scpi = new SCPINode("DEV" + QString::number(number));
+    scpiRoot.add(i.scpi);
+    // the commands are deleted together with the node when the device is removed, the instrument always exists while they are called
+    auto instrument = [=]() -> Instrument& {
+        return instruments[number];
+    };
+
+    i.scpi->add(new SCPICommand("SERial", nullptr, [=](QStringList) -> QString {
+        return instrument().device->serial();
+    }));
+
+    auto scpi_freq = new SCPINode("FREQuency");
+    i.scpi->add(scpi_freq);
+    scpi_freq->add(new SCPICommand("START", [=](QStringList params) -> QString {
+        unsigned long long newval;
+        if(!SCPI::paramToULongLong(params, 0, newval)) {
+            return SCPI::getResultName(SCPI::Result::Error);
+        }
+        instrument().settings.f_start = newval;
+        return SCPI::getResultName(SCPI::Result::Empty);
+    }, [=](QStringList) -> QString {
+        return QString::number(instrument().settings.f_start);
+    }));
+    scpi_freq->add(new SCPICommand("STOP", [=](QStringList params) -> QString {
+        unsigned long long newval;
+        if(!SCPI::paramToULongLong(params, 0, newval)) {
+            return SCPI::getResultName(SCPI::Result::Error);
+        }
+        instrument().settings.f_stop = newval;
+        return SCPI::getResultName(SCPI::Result::Empty);
+    }, [=](QStringList) -> QString {
+        return QString::number(instrument().settings.f_stop);
+    }));
+
+    auto scpi_acq = new SCPINode("ACQuisition");
+    i.scpi->add(scpi_acq);
+    scpi_acq->add(new SCPICommand("IFBW", [=](QStringList params) -> QString {
+        unsigned long long newval;
+        if(!SCPI::paramToULongLong(params, 0, newval)) {
+            return SCPI::getResultName(SCPI::Result::Error);
+        }
+        instrument().settings.if_bandwidth = newval;
+        return SCPI::getResultName(SCPI::Result::Empty);
+    }, [=](QStringList) -> QString {
+        return QString::number(instrument().settings.if_bandwidth);
+    }));
+    scpi_acq->add(new SCPICommand("POINTS", [=](QStringList params) -> QString {
+        unsigned long long newval;
+        if(!SCPI::paramToULongLong(params, 0, newval) || newval == 0 || newval > UINT16_MAX) {
+            return SCPI::getResultName(SCPI::Result::Error);
+        }
+        instrument().settings.points = newval;
+        return SCPI::getResultName(SCPI::Result::Empty);
+    }, [=](QStringList) -> QString {
+        return QString::number(instrument().settings.points);
+    }));
+    scpi_acq->add(new SCPICommand("FINished", nullptr, [=](QStringList) -> QString {
+        return instrument().sweeping ? "FALSE" : "TRUE";
+    }));
+    scpi_acq->add(new SCPICommand("COUNT", nullptr, [=](QStringList) -> QString {
+        return QString::number(instrument().completedSweeps);
+    }));
+
+    auto scpi_stim = new SCPINode("STIMulus");
+    i.scpi->add(scpi_stim);
+    scpi_stim->add(new SCPICommand("LVL", [=](QStringList params) -> QString {
+        double newval;
+        if(!SCPI::paramToDouble(params, 0, newval)) {
+            return SCPI::getResultName(SCPI::Result::Error);
+        }
+        instrument().settings.cdbm_excitation_start = newval * 100;
+        instrument().settings.cdbm_excitation_stop = newval * 100;
+        return SCPI::getResultName(SCPI::Result::Empty);
+    }, [=](QStringList) -> QString {
+        return QString::number(instrument().settings.cdbm_excitation_start / 100.0);
+    }));
+
+    auto scpi_ref = new SCPINode("REFerence");
+    i.scpi->add(scpi_ref);
+    scpi_ref->add(new SCPICommand("IN", [=](QStringList params) -> QString {
+        if(params.size() != 1) {
+            return SCPI::getResultName(SCPI::Result::Error);
+        }
+        auto &ref = instrument().reference;
+        if(params[0] == "INT") {
+            ref.AutomaticSwitch = 0;
+            ref.UseExternalRef = 0;
+        } else if(params[0] == "EXT") {
+            ref.AutomaticSwitch = 0;
+            ref.UseExternalRef = 1;
+        } else if(params[0] == "AUTO") {
+            ref.AutomaticSwitch = 1;
+            ref.UseExternalRef = 0;
+        } else {
+            return SCPI::getResultName(SCPI::Result::Error);
+        }
+        sendReference(instrument());
+        return SCPI::getResultName(SCPI::Result::Empty);
+    }, [=](QStringList) -> QString {
+        return instrument().device->StatusV1().extRefInUse ? "EXT" : "INT";
+    }));
+
+    auto scpi_trace = new SCPINode("TRACe");
+    i.scpi->add(scpi_trace);
+    scpi_trace->add(new SCPICommand("LIST", nullptr, [=](QStringList) -> QString {
+        QString ret;
+        for(auto t : instrument().traces->getTraces()) {
+            ret += t->name() + ",";
+        }
+        ret.chop(1);
+        return ret;
+    }));
+    scpi_trace->add(new SCPICommand("DATA", nullptr, [=](QStringList params) -> QString {
+        if(params.size() < 1) {
+            return SCPI::getResultName(SCPI::Result::Error);
+        }
+        Trace *trace = nullptr;
+        auto traces = instrument().traces->getTraces();
+        bool ok;
+        auto n = params[0].toUInt(&ok);
+        if(ok && n < traces.size()) {
+            trace = traces[n];
+        } else {
+            for(auto t : traces) {
+                if(t->name().compare(params[0], Qt::CaseInsensitive) == 0) {
+                    trace = t;
+                }
+            }
+        }
+        if(!trace) {
+            return SCPI::getResultName(SCPI::Result::Error);
+        }
+        QString ret;
+        for(unsigned int i=0;i<trace->size();i++) {
+            auto d = trace->sample(i);
+            ret += "[" + QString::number(d.x, 'f', 0) + "," + QString::number(d.y.real()) + "," + QString::number(d.y.imag()) + "],";
+        }
+        ret.chop(1);
+        return ret;
+    }));
+}
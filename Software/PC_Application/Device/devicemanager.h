@@ -0,0 +1,83 @@
+#ifndef DEVICEMANAGER_H
+#define DEVICEMANAGER_H
+
+#include "device.h"
+#include "Traces/tracemodel.h"
+#include "scpi.h"
+
+#include <QObject>
+#include <map>
+#include <functional>
+
+// Manages additional devices that are operated next to the device used by the modes. Every device
+// has its own USB thread, sweep settings and TraceModel (with the four uncalibrated S-parameters as
+// live traces). The devices are addressed by their number through SCPI (:DEV<n>:...) and their sweeps
+// can be started together.
+class DeviceManager : public QObject
+{
+    Q_OBJECT
+public:
+    // The SCPI nodes of the devices are added to scpiRoot
+    DeviceManager(SCPINode &scpiRoot, QObject *parent = nullptr);
+    ~DeviceManager();
+
+    // Connects to an additional device, returns its number (starting at 1) or 0 if the connection failed
+    unsigned int addDevice(QString serial);
+    bool removeDevice(unsigned int number);
+    void removeAllDevices();
+    std::vector<unsigned int> getDeviceNumbers() const;
+    // Returns nullptr if no device with this number exists
+    Device *getDevice(unsigned int number);
+    TraceModel *getTraceModel(unsigned int number);
+
+    // Sends the sweep settings to all devices. All devices are set to idle first, the new settings are
+    // only transmitted once every device is idle so the sweeps start as close together as possible.
+    // The device used by the modes can take part as well: it is set to idle together with the other
+    // devices and startPrimary is called (instead of sending settings) once all of them are idle
+    void startSweeps(bool singleSweep, Device *primary = nullptr, std::function<void()> startPrimary = nullptr);
+    void stopSweeps();
+    // True if no device is sweeping anymore (only possible for single sweeps)
+    bool sweepsFinished() const;
+
+signals:
+    void deviceAdded(unsigned int number);
+    void deviceRemoved(unsigned int number);
+    // log output of all managed devices, prefixed with their number
+    void LogLineReceived(QString line);
+
+private:
+    using Instrument = struct {
+        Device *device;
+        TraceModel *traces;
+        SCPINode *scpi;
+        Protocol::SweepSettings settings;
+        Protocol::ReferenceSettings reference;
+        // incoming data is ignored while new settings are sent
+        bool changingSettings;
+        bool sweeping;
+        bool singleSweep;
+        unsigned long completedSweeps;
+        // set to idle by startSweeps, not acknowledged yet
+        bool waitingForIdle;
+    };
+
+    void newDatapoints(unsigned int number, const std::vector<Protocol::Datapoint> &points);
+    // configures all sweeping devices once none of them is waiting for the idle state anymore
+    void continueStartSweeps();
+    void configure(Instrument &i);
+    void sendReference(Instrument &i);
+    void setupSCPI(unsigned int number);
+
+    SCPINode &scpiRoot;
+    std::map<unsigned int, Instrument> instruments;
+
+    // state of startSweeps, callbacks of a previous start are ignored once a new one begins
+    bool startingSweeps;
+    unsigned int startSweepsCount;
+    Device *primary;
+    bool primaryWaitingForIdle;
+    std::function<void()> startPrimary;
+    QMetaObject::Connection primaryDestroyed;
+};
+
+#endif // DEVICEMANAGER_H
@@ -0,0 +1,214 @@
+#include "deviceregistry.h"
+
+#include "device.h"
+
+#include <QDebug>
+
+using namespace std;
+
+DeviceRegistry::DeviceRegistry() :
+    context(nullptr),
+    hotplug(false),
+    callbackHandle(0),
+    thread(nullptr),
+    running(false)
+{
+    libusb_init(&context);
+#if LIBUSB_API_VERSION >= 0x01000106
+    libusb_set_option(context, LIBUSB_OPTION_LOG_LEVEL, LIBUSB_LOG_LEVEL_INFO);
+#endif
+    if(libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
+        // Devices that are already attached are reported during the registration
+        auto ret = libusb_hotplug_register_callback(context,
+                (libusb_hotplug_event) (LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT),
+                LIBUSB_HOTPLUG_ENUMERATE, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY,
+                LIBUSB_HOTPLUG_MATCH_ANY, HotplugCallback, this, &callbackHandle);
+        if(ret == LIBUSB_SUCCESS) {
+            hotplug = true;
+            processEvents();
+            running = true;
+            thread = new std::thread(&DeviceRegistry::Thread, this);
+        } else {
+            qWarning() << "Failed to register hotplug callback:" << libusb_strerror((libusb_error) ret);
+        }
+    }
+    if(!hotplug) {
+        qInfo() << "USB hotplug events not available, enumerating devices on every request";
+    }
+}
+
+DeviceRegistry::~DeviceRegistry()
+{
+    if(hotplug) {
+        running = false;
+        thread->join();
+        delete thread;
+        libusb_hotplug_deregister_callback(context, callbackHandle);
+        for(auto d : attached) {
+            libusb_unref_device(d);
+        }
+        for(auto d : detached) {
+            libusb_unref_device(d);
+        }
+        for(auto d : devices) {
+            libusb_unref_device(d.first);
+        }
+    }
+    libusb_exit(context);
+}
+
+std::set<QString> DeviceRegistry::getDevices()
+{
+    std::set<QString> serials;
+    if(hotplug) {
+        lock_guard<mutex> guard(mtx);
+        for(auto d : devices) {
+            serials.insert(d.second);
+        }
+        return serials;
+    }
+    // no hotplug support, all devices have to be opened to find the LibreVNAs and their serial numbers
+    libusb_device **devList;
+    auto ndevices = libusb_get_device_list(context, &devList);
+    for (ssize_t idx = 0; idx < ndevices; idx++) {
+        QString serial;
+        auto handle = Device::OpenDevice(devList[idx], serial, true);
+        if(handle) {
+            serials.insert(serial);
+            libusb_close(handle);
+        }
+    }
+    libusb_free_device_list(devList, 1);
+    return serials;
+}
+
+bool DeviceRegistry::getLocation(QString serial, uint8_t &bus, uint8_t &address)
+{
+    lock_guard<mutex> guard(mtx);
+    for(auto d : devices) {
+        if(d.second == serial) {
+            bus = libusb_get_bus_number(d.first);
+            address = libusb_get_device_address(d.first);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool DeviceRegistry::hotplugSupported() const
+{
+    return hotplug;
+}
+
+void DeviceRegistry::rescan()
+{
+    if(!hotplug) {
+        // devices are enumerated on every request anyway
+        return;
+    }
+    bool changed = false;
+    libusb_device **devList;
+    auto ndevices = libusb_get_device_list(context, &devList);
+    for (ssize_t idx = 0; idx < ndevices; idx++) {
+        bool known;
+        {
+            lock_guard<mutex> guard(mtx);
+            known = devices.count(devList[idx]) > 0;
+        }
+        if(!known && identify(devList[idx])) {
+            changed = true;
+        }
+    }
+    libusb_free_device_list(devList, 1);
+    if(changed) {
+        emit DevicesChanged();
+    }
+}
+
+int DeviceRegistry::HotplugCallback(libusb_context *ctx, libusb_device *device, libusb_hotplug_event event, void *user_data)
+{
+    Q_UNUSED(ctx)
+    auto registry = (DeviceRegistry*) user_data;
+    lock_guard<mutex> guard(registry->mtx);
+    libusb_ref_device(device);
+    if(event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED) {
+        registry->attached.push_back(device);
+    } else {
+        registry->detached.push_back(device);
+    }
+    // keep the callback registered
+    return 0;
+}
+
+void DeviceRegistry::Thread()
+{
+    qDebug() << "Device registry thread started";
+    while(running) {
+        // the timeout limits how long it takes to stop the thread
+        timeval tv = {0, 100000};
+        libusb_handle_events_timeout_completed(context, &tv, nullptr);
+        processEvents();
+    }
+    qDebug() << "Device registry thread stopped";
+}
+
+void DeviceRegistry::processEvents()
+{
+    vector<libusb_device*> newDevices, removedDevices;
+    {
+        lock_guard<mutex> guard(mtx);
+        swap(newDevices, attached);
+        swap(removedDevices, detached);
+    }
+    bool changed = false;
+    for(auto d : removedDevices) {
+        QString serial;
+        {
+            lock_guard<mutex> guard(mtx);
+            auto it = devices.find(d);
+            if(it != devices.end()) {
+                serial = it->second;
+                libusb_unref_device(it->first);
+                devices.erase(it);
+            }
+        }
+        if(!serial.isEmpty()) {
+            qDebug() << "Device" << serial << "detached";
+            emit DeviceDetached(serial);
+            changed = true;
+        }
+        libusb_unref_device(d);
+    }
+    for(auto d : newDevices) {
+        if(identify(d)) {
+            changed = true;
+        }
+        libusb_unref_device(d);
+    }
+    if(changed) {
+        emit DevicesChanged();
+    }
+}
+
+bool DeviceRegistry::identify(libusb_device *device)
+{
+    QString serial;
+    auto handle = Device::OpenDevice(device, serial, true);
+    if(!handle) {
+        // not a LibreVNA (or no permission to open it)
+        return false;
+    }
+    libusb_close(handle);
+    {
+        lock_guard<mutex> guard(mtx);
+        if(devices.count(device)) {
+            // already identified
+            return false;
+        }
+        libusb_ref_device(device);
+        devices[device] = serial;
+    }
+    qDebug() << "Device" << serial << "attached";
+    emit DeviceAttached(serial);
+    return true;
+}
@@ -0,0 +1,69 @@
+#ifndef DEVICEREGISTRY_H
+#define DEVICEREGISTRY_H
+
+#include <QObject>
+#include <QString>
+#include <libusb-1.0/libusb.h>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <map>
+#include <set>
+#include <vector>
+
+// Keeps track of the attached devices. If libusb supports hotplug events, the serial number of a device
+// is read once when it is attached and then cached until it is detached. Without hotplug support
+// (e.g. on Windows) every query enumerates all USB devices, just like it was done before.
+class DeviceRegistry : public QObject
+{
+    Q_OBJECT
+public:
+    static DeviceRegistry& getInstance() {
+        static DeviceRegistry instance;
+        return instance;
+    }
+    DeviceRegistry(const DeviceRegistry&) = delete;
+
+    // Serial numbers of all attached devices
+    std::set<QString> getDevices();
+    // Returns the bus and address of an attached device. Returns false if the serial is unknown
+    bool getLocation(QString serial, uint8_t &bus, uint8_t &address);
+    // True if the device list is updated by hotplug events (the signals below are only emitted in that case)
+    bool hotplugSupported() const;
+    // Identifies attached devices that are not known yet (e.g. because they could not be opened when they were
+    // attached due to a missing udev rule). Does nothing without hotplug support
+    void rescan();
+
+signals:
+    // Emitted from the thread of the registry (or the thread calling rescan)
+    void DeviceAttached(QString serial);
+    void DeviceDetached(QString serial);
+    void DevicesChanged();
+
+private:
+    DeviceRegistry();
+    ~DeviceRegistry();
+
+    static int LIBUSB_CALL HotplugCallback(libusb_context *ctx, libusb_device *device, libusb_hotplug_event event, void *user_data);
+    void Thread();
+    // Handles the events that were collected by the hotplug callback
+    void processEvents();
+    // Reads the serial number of a newly attached device and adds it to the known devices. Returns true if it is a LibreVNA
+    bool identify(libusb_device *device);
+
+    libusb_context *context;
+    bool hotplug;
+    libusb_hotplug_callback_handle callbackHandle;
+    std::thread *thread;
+    std::atomic<bool> running;
+
+    std::mutex mtx;
+    // The hotplug callback must not perform any USB transfers, attached devices are only collected there and
+    // identified afterwards. Every libusb_device in these containers holds a reference
+    std::vector<libusb_device*> attached;
+    std::vector<libusb_device*> detached;
+    // identified devices and their serial numbers
+    std::map<libusb_device*, QString> devices;
+};
+
+#endif // DEVICEREGISTRY_H
@@ -1,6 +1,7 @@
 #include "firmwareupdatedialog.h"
 
 #include "ui_firmwareupdatedialog.h"
+#include "deviceregistry.h"
 
 #include <QFileDialog>
 #include <QStyle>
@@ -78,6 +79,7 @@ void FirmwareUpdateDialog::abortWithError(QString error)
     timer.stop();
     disconnect(dev, &Device::AckReceived, this, &FirmwareUpdateDialog::receivedAck);
     disconnect(dev, &Device::NackReceived, this, &FirmwareUpdateDialog::receivedNack);
+    disconnect(&DeviceRegistry::getInstance(), &DeviceRegistry::DeviceAttached, this, &FirmwareUpdateDialog::deviceAttached);
 
     QTextCharFormat tf;
     tf = ui->status->currentCharFormat();
@@ -94,13 +96,11 @@ void FirmwareUpdateDialog::timerCallback()
 {
     switch(state) {
     case State::WaitingForReboot: {
-        // Currently waiting for the reboot, check device list
+        // Currently waiting for the reboot and no hotplug events available, check device list
         auto devices = Device::GetDevices();
         if(devices.find(serialnumber) != devices.end()) {
             // the device rebooted and is available again
-            addStatus("...device enumerated, update complete");
-            state = State::WaitBeforeInitializing;
-            timer.start(3000);
+            deviceAttached(serialnumber);
         }
     }
         break;
@@ -126,31 +126,31 @@ void FirmwareUpdateDialog::receivedAck()
         // FLASH erased, begin transferring firmware
         state = State::TransferringData;
         transferredBytes = 0;
+        sentBytes = 0;
+        chunksInFlight = 0;
+        imageCRC = 0;
         addStatus("Transferring firmware...");
-        sendNextFirmwareChunk();
-        timer.start(1000);
+        // every chunk reports its result (including timeouts) through its callback
+        timer.stop();
+        sendFirmwareChunks();
         break;
     case State::TransferringData:
-        transferredBytes += Protocol::FirmwareChunkSize;
-        ui->progress->setValue(100 * transferredBytes / file->size());
-        if(transferredBytes >= file->size()) {
-            // complete file transferred
-            addStatus("Triggering device update...");
-            state = State::TriggeringUpdate;
-            dev->SendCommandWithoutPayload(Protocol::PacketType::PerformFirmwareUpdate);
-            timer.start(5000);
-        } else {
-            sendNextFirmwareChunk();
-            timer.start(1000);
-        }
+    case State::VerifyingImage:
+        // handled by the callbacks of the transmissions
         break;
     case State::TriggeringUpdate:
         addStatus("Rebooting device...");
         serialnumber = dev->serial();
         emit DeviceRebooting();
         state = State::WaitingForReboot;
-        timer.setSingleShot(false);
-        timer.start(2000);
+        if(DeviceRegistry::getInstance().hotplugSupported()) {
+            // the registry reports when the device is attached again
+            timer.stop();
+            connect(&DeviceRegistry::getInstance(), &DeviceRegistry::DeviceAttached, this, &FirmwareUpdateDialog::deviceAttached, Qt::UniqueConnection);
+        } else {
+            timer.setSingleShot(false);
+            timer.start(2000);
+        }
         break;
     default:
         break;
@@ -163,6 +163,10 @@ void FirmwareUpdateDialog::receivedNack()
     case State::ErasingFLASH:
         abortWithError("Nack received, device does not support firmware update");
         break;
+    case State::TransferringData:
+    case State::VerifyingImage:
+        // handled by the callbacks of the transmissions
+        break;
     default:
         abortWithError("Nack received, something went wrong");
         break;
@@ -170,10 +174,87 @@ void FirmwareUpdateDialog::receivedNack()
 
 }
 
-void FirmwareUpdateDialog::sendNextFirmwareChunk()
+void FirmwareUpdateDialog::deviceAttached(QString serial)
+{
+    if(state != State::WaitingForReboot || serial != serialnumber) {
+        return;
+    }
+    disconnect(&DeviceRegistry::getInstance(), &DeviceRegistry::DeviceAttached, this, &FirmwareUpdateDialog::deviceAttached);
+    addStatus("...device enumerated, update complete");
+    state = State::WaitBeforeInitializing;
+    timer.setSingleShot(true);
+    timer.start(3000);
+}
+
+void FirmwareUpdateDialog::sendFirmwareChunks()
+{
+    // Keep several chunks in flight if the device is able to buffer them, the round trip
+    // time for every chunk would dominate the duration of the update otherwise
+    int window = dev->Info().supportsSequenceNumbers ? Protocol::MaxOutstandingPackets : 1;
+    while(chunksInFlight < window && sentBytes < file->size()) {
+        Protocol::FirmwarePacket fw;
+        fw.address = sentBytes;
+        file->read((char*) &fw.data, Protocol::FirmwareChunkSize);
+        imageCRC = Protocol::CRC32(imageCRC, fw.data, Protocol::FirmwareChunkSize);
+        sentBytes += Protocol::FirmwareChunkSize;
+        chunksInFlight++;
+        dev->SendFirmwareChunk(fw, [=](Device::TransmissionResult result) {
+            chunkFinished(result);
+        });
+    }
+}
+
+void FirmwareUpdateDialog::chunkFinished(Device::TransmissionResult result)
+{
+    if(state != State::TransferringData) {
+        // update has already been aborted
+        return;
+    }
+    chunksInFlight--;
+    if(result != Device::TransmissionResult::Ack) {
+        abortWithError(result == Device::TransmissionResult::Nack ? "Nack received, failed to write firmware" : "Response timed out");
+        return;
+    }
+    transferredBytes += Protocol::FirmwareChunkSize;
+    ui->progress->setValue(100 * transferredBytes / file->size());
+    if(transferredBytes < file->size()) {
+        sendFirmwareChunks();
+        return;
+    }
+    // complete file transferred
+    if(!dev->Info().supportsFirmwareVerify) {
+        triggerUpdate();
+        return;
+    }
+    addStatus("Verifying firmware image...");
+    state = State::VerifyingImage;
+    Protocol::PacketInfo p;
+    p.type = Protocol::PacketType::VerifyFirmware;
+    p.firmwareVerify.size = file->size();
+    p.firmwareVerify.crc = imageCRC;
+    // the device reads back the whole image, this takes a while
+    dev->SendPacket(p, [=](Device::TransmissionResult result) {
+        if(state != State::VerifyingImage) {
+            return;
+        }
+        switch(result) {
+        case Device::TransmissionResult::Ack:
+            triggerUpdate();
+            break;
+        case Device::TransmissionResult::Nack:
+            abortWithError("Firmware image verification failed");
+            break;
+        default:
+            abortWithError("Response timed out");
+            break;
+        }
+    }, 5000);
+}
+
+void FirmwareUpdateDialog::triggerUpdate()
 {
-    Protocol::FirmwarePacket fw;
-    fw.address = transferredBytes;
-    file->read((char*) &fw.data, Protocol::FirmwareChunkSize);
-    dev->SendFirmwareChunk(fw);
+    addStatus("Triggering device update...");
+    state = State::TriggeringUpdate;
+    dev->SendCommandWithoutPayload(Protocol::PacketType::PerformFirmwareUpdate);
+    timer.start(5000);
 }
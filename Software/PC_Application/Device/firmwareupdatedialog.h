@@ -36,11 +36,15 @@ private slots:
     void timerCallback();
     void receivedAck();
     void receivedNack();
+    void deviceAttached(QString serial);
 
 private:
     void addStatus(QString line);
     void abortWithError(QString error);
-    void sendNextFirmwareChunk();
+    // sends chunks until the maximum number of chunks is in flight
+    void sendFirmwareChunks();
+    void chunkFinished(Device::TransmissionResult result);
+    void triggerUpdate();
     Ui::FirmwareUpdateDialog *ui;
     Device *dev;
     QFile *file;
@@ -50,12 +54,19 @@ private:
         Idle,
         ErasingFLASH,
         TransferringData,
+        VerifyingImage,
         TriggeringUpdate,
         WaitingForReboot,
         WaitBeforeInitializing,
     };
     State state;
+    // acknowledged by the device
     unsigned int transferredBytes;
+    // read from the file and handed to the device for transmission
+    unsigned int sentBytes;
+    int chunksInFlight;
+    // CRC32 over everything that has been sent
+    uint32_t imageCRC;
     QString serialnumber;
 };
 
@@ -0,0 +1,172 @@
+#include "usbcapture.h"
+
+#include "../VNA_embedded/Application/Communication/Protocol.hpp"
+
+#include <QDebug>
+#include <stdexcept>
+#include <vector>
+#include <cstring>
+
+using namespace std;
+
+const QString USBReplay::serialPrefix = "REPLAY:";
+
+// File layout: FileHeader, followed by any number of records. Each record consists of a RecordHeader
+// and the recorded data. All values are little endian.
+static constexpr char captureMagic[8] = {'L', 'V', 'N', 'A', 'C', 'A', 'P', 0};
+static constexpr uint16_t captureVersion = 1;
+
+#pragma pack(push, 1)
+using FileHeader = struct {
+    char magic[8];
+    uint16_t captureVersion;
+    // protocol version of the application that created the capture
+    uint16_t protocolVersion;
+};
+
+using RecordHeader = struct {
+    // time since the start of the capture in us
+    uint64_t timestamp;
+    uint8_t source;
+    uint32_t length;
+};
+#pragma pack(pop)
+
+// longest sleep during a realtime replay before checking whether the replay should be aborted
+static constexpr chrono::milliseconds maxSleep(100);
+
+USBCapture::USBCapture(QString filename) :
+    filename(filename),
+    recordedBytes(0)
+{
+    file.open(filename.toStdString(), ios::binary | ios::trunc);
+    if(!file.is_open()) {
+        throw runtime_error("Unable to create capture file " + filename.toStdString());
+    }
+    FileHeader header;
+    memcpy(header.magic, captureMagic, sizeof(header.magic));
+    header.captureVersion = captureVersion;
+    header.protocolVersion = Protocol::Version;
+    file.write((const char*) &header, sizeof(header));
+    start = chrono::steady_clock::now();
+    qInfo() << "Started USB capture to" << filename;
+}
+
+USBCapture::~USBCapture()
+{
+    file.close();
+    qInfo() << "Stopped USB capture," << recordedBytes << "bytes recorded";
+}
+
+void USBCapture::Record(Source source, const unsigned char *data, int length)
+{
+    if(length <= 0) {
+        return;
+    }
+    RecordHeader header;
+    header.timestamp = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+    header.source = (uint8_t) source;
+    header.length = length;
+    file.write((const char*) &header, sizeof(header));
+    file.write((const char*) data, length);
+    recordedBytes += length;
+}
+
+QString USBCapture::getFilename() const
+{
+    return filename;
+}
+
+unsigned long USBCapture::getRecordedBytes() const
+{
+    return recordedBytes;
+}
+
+USBReplay::USBReplay(QString filename, bool realtime) :
+    filename(filename),
+    realtime(realtime),
+    thread(nullptr),
+    running(false),
+    finished(false)
+{
+    file.open(filename.toStdString(), ios::binary);
+    if(!file.is_open()) {
+        throw runtime_error("Unable to open capture file " + filename.toStdString());
+    }
+    FileHeader header;
+    file.read((char*) &header, sizeof(header));
+    if(!file || memcmp(header.magic, captureMagic, sizeof(header.magic))) {
+        throw runtime_error(filename.toStdString() + " is not a USB capture");
+    }
+    if(header.captureVersion != captureVersion) {
+        throw runtime_error("Unsupported capture version " + to_string(header.captureVersion));
+    }
+    if(header.protocolVersion != Protocol::Version) {
+        qWarning() << "Capture was created with protocol version" << header.protocolVersion << ", replay may fail";
+    }
+}
+
+USBReplay::~USBReplay()
+{
+    running = false;
+    if(thread) {
+        thread->join();
+        delete thread;
+    }
+}
+
+void USBReplay::Start()
+{
+    if(thread) {
+        // already started
+        return;
+    }
+    running = true;
+    thread = new std::thread(&USBReplay::Thread, this);
+}
+
+bool USBReplay::isFinished() const
+{
+    return finished;
+}
+
+void USBReplay::Thread()
+{
+    qInfo() << "Replaying" << filename << (realtime ? "in real time" : "at maximum speed");
+    vector<unsigned char> data;
+    unsigned long replayedBytes = 0;
+    auto start = chrono::steady_clock::now();
+    RecordHeader header;
+    while(running && file.read((char*) &header, sizeof(header))) {
+        data.resize(header.length);
+        if(!file.read((char*) data.data(), header.length)) {
+            qWarning() << "Capture ends with an incomplete record";
+            break;
+        }
+        if(realtime) {
+            auto due = start + chrono::microseconds(header.timestamp);
+            while(running && chrono::steady_clock::now() < due) {
+                this_thread::sleep_for(min(chrono::duration_cast<chrono::milliseconds>(due - chrono::steady_clock::now()) + chrono::milliseconds(1), maxSleep));
+            }
+        }
+        switch((USBCapture::Source) header.source) {
+        case USBCapture::Source::DataIn:
+            emit DataReceived(data.data(), data.size());
+            replayedBytes += data.size();
+            break;
+        case USBCapture::Source::LogIn:
+            emit LogReceived(data.data(), data.size());
+            break;
+        case USBCapture::Source::DataOut:
+            emit DataTransmitted(data.data(), data.size());
+            break;
+        default:
+            qWarning() << "Skipping capture record with unknown source" << header.source;
+            break;
+        }
+    }
+    auto elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    qInfo() << "Replay finished," << replayedBytes << "bytes of data in" << elapsed << "seconds";
+    finished = true;
+    emit Finished();
+}
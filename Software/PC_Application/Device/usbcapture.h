@@ -0,0 +1,79 @@
+#ifndef USBCAPTURE_H
+#define USBCAPTURE_H
+
+#include <QObject>
+#include <QString>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Records the raw USB traffic of a device into a binary file. Every received and transmitted buffer is
+// stored unmodified together with the time (relative to the start of the capture) it was handled.
+class USBCapture
+{
+public:
+    enum class Source : uint8_t {
+        DataIn = 0,
+        LogIn = 1,
+        DataOut = 2,
+    };
+
+    // Throws std::runtime_error if the file can not be created
+    USBCapture(QString filename);
+    ~USBCapture();
+
+    // Not thread safe, the caller has to serialize calls from different threads
+    void Record(Source source, const unsigned char *data, int length);
+
+    QString getFilename() const;
+    unsigned long getRecordedBytes() const;
+
+private:
+    QString filename;
+    std::ofstream file;
+    std::chrono::steady_clock::time_point start;
+    unsigned long recordedBytes;
+};
+
+// Plays back a file created by USBCapture. Received buffers are emitted in the same chunks as they were
+// originally received, either with the recorded timing or as fast as the receiver is able to handle them.
+// The signals are meant for direct connections: the next buffer is only emitted after the slot returned, so a
+// receiver that can not keep up blocks in its slot instead of dropping data.
+class USBReplay : public QObject
+{
+    Q_OBJECT
+public:
+    // Serial numbers starting with this prefix select a replay, followed by the path of the capture file
+    static const QString serialPrefix;
+
+    // Throws std::runtime_error if the file can not be opened or is not a capture
+    USBReplay(QString filename, bool realtime);
+    ~USBReplay();
+
+    // Starts the playback, call after connecting the signals
+    void Start();
+    bool isFinished() const;
+
+signals:
+    // Equivalents of the data and log IN endpoints. Emitted from the thread of the replay,
+    // data is only valid during the signal emission
+    void DataReceived(const unsigned char *data, int length);
+    void LogReceived(const unsigned char *data, int length);
+    // Data the host sent during the capture (always one complete frame)
+    void DataTransmitted(const unsigned char *data, int length);
+    void Finished();
+
+private:
+    void Thread();
+
+    QString filename;
+    bool realtime;
+    std::ifstream file;
+    std::thread *thread;
+    std::atomic<bool> running;
+    std::atomic<bool> finished;
+};
+
+#endif // USBCAPTURE_H
@@ -0,0 +1,485 @@
+#include "virtualdevice.h"
+
+#include <QDebug>
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+const QString VirtualDevice::serial = "VIRTUAL";
+
+// encoded data is passed on in chunks of (at most) the size of a USB receive transfer
+static constexpr size_t transferSize = 65536;
+// limits the amount of data generated in one go if the host can not keep up
+static constexpr unsigned long maxPointsPerIteration = 2000;
+// standard deviation of the noise added to S-parameters (about -80dB)
+static constexpr double measurementNoise = 1e-4;
+// spectrum analyzer noise floor, about -120dBm
+static constexpr double noiseFloor = 1e-6;
+
+static constexpr Protocol::DeviceInfo virtualInfo = {
+    .ProtocolVersion = Protocol::Version,
+    .FW_major = FW_MAJOR,
+    .FW_minor = FW_MINOR,
+    .FW_patch = FW_PATCH,
+    .hardware_version = 1,
+    .HW_Revision = 'V',
+    .limits_minFreq = 0,
+    .limits_maxFreq = 6000000000,
+    .limits_minIFBW = 6,
+    .limits_maxIFBW = 50000,
+    .limits_maxPoints = 4501,
+    .limits_cdbm_min = -4000,
+    .limits_cdbm_max = 0,
+    .limits_minRBW = 13,
+    .limits_maxRBW = 111500,
+    .limits_maxAmplitudePoints = 64,
+    .limits_maxFreqHarmonic = 18000000000,
+    .supportsDatapointBatch = 1,
+    .supportsDatapointCRC = 1,
+    .supportsCompactDatapoints = 1,
+    .supportsSequenceNumbers = 1,
+    .supportsFirmwareVerify = 0,
+};
+
+VirtualDevice::VirtualDevice(int pointsPerSecond, QString touchstoneFile) :
+    pointsPerSecond(max(pointsPerSecond, 0)),
+    touchstone(nullptr),
+    running(true),
+    framer(framerBuffer, sizeof(framerBuffer)),
+    mode(Mode::Idle),
+    vnaSettings(),
+    saSettings(),
+    zerospan(false),
+    compactDatapoints(false),
+    pointCnt(0),
+    pointsProduced(0),
+    datapointCRC(false),
+    answerSequenceNumber(Protocol::NoSequenceNumber),
+    rng(0),
+    gauss(0.0, 1.0)
+{
+    batch.type = Protocol::PacketType::None;
+    if(!touchstoneFile.isEmpty()) {
+        try {
+            touchstone = new Touchstone(Touchstone::fromFile(touchstoneFile.toStdString()));
+            if(touchstone->points() == 0) {
+                throw runtime_error("File contains no datapoints");
+            }
+            if(touchstone->ports() > 2) {
+                touchstone->reduceTo2Port(0, 1);
+            }
+        } catch (const exception &e) {
+            qWarning() << "Failed to load DUT of virtual device, using built-in model:" << e.what();
+            delete touchstone;
+            touchstone = nullptr;
+        }
+    }
+    thread = new std::thread(&VirtualDevice::Thread, this);
+}
+
+VirtualDevice::~VirtualDevice()
+{
+    {
+        lock_guard<mutex> guard(inputMutex);
+        running = false;
+    }
+    inputCV.notify_all();
+    thread->join();
+    delete thread;
+    delete touchstone;
+}
+
+void VirtualDevice::Transmit(const unsigned char *data, int length)
+{
+    {
+        lock_guard<mutex> guard(inputMutex);
+        input.insert(input.end(), data, data + length);
+    }
+    inputCV.notify_all();
+}
+
+void VirtualDevice::Thread()
+{
+    qDebug() << "Virtual device started";
+    vector<unsigned char> received;
+    while(running) {
+        {
+            unique_lock<mutex> lck(inputMutex);
+            chrono::milliseconds timeout(100);
+            if(mode != Mode::Idle) {
+                timeout = chrono::milliseconds(pointsPerSecond > 0 ? 1 : 0);
+            }
+            inputCV.wait_for(lck, timeout, [=](){
+                return !input.empty() || !running;
+            });
+            swap(received, input);
+        }
+        // decode the received data like the firmware does
+        const unsigned char *data = received.data();
+        size_t length = received.size();
+        while(length > 0) {
+            auto added = framer.Add(data, min(length, (size_t) 0xFFFF));
+            data += added;
+            length -= added;
+            Protocol::PacketInfo packet;
+            int16_t sequenceNumber;
+            bool decoded = false;
+            while(framer.Decode(&packet, &sequenceNumber)) {
+                decoded = true;
+                answerSequenceNumber = sequenceNumber;
+                handlePacket(packet);
+            }
+            if(!added && !decoded) {
+                framer.Clear();
+            }
+        }
+        received.clear();
+
+        if(mode != Mode::Idle) {
+            // produce all points that are due at the configured rate
+            unsigned long due = maxPointsPerIteration;
+            if(pointsPerSecond > 0) {
+                auto elapsed = chrono::duration<double>(chrono::steady_clock::now() - measurementStart).count();
+                auto expected = (unsigned long) (elapsed * pointsPerSecond);
+                due = expected > pointsProduced ? min(expected - pointsProduced, maxPointsPerIteration) : 0;
+            }
+            for(unsigned long i=0;i<due;i++) {
+                if(mode == Mode::VNA) {
+                    generateVNAPoint();
+                } else {
+                    generateSAPoint();
+                }
+            }
+        }
+        flush();
+    }
+    qDebug() << "Virtual device stopped";
+}
+
+void VirtualDevice::handlePacket(const Protocol::PacketInfo &packet)
+{
+    switch(packet.type) {
+    case Protocol::PacketType::SweepSettings:
+        log("New settings received");
+        vnaSettings = packet.settings;
+        pointFrequency.Setup(vnaSettings);
+        datapointCRC = vnaSettings.datapointCRC;
+        if(vnaSettings.excitePort1 || vnaSettings.excitePort2) {
+            startMeasurement(Mode::VNA);
+        } else {
+            // both ports disabled, nothing to do
+            mode = Mode::Idle;
+        }
+        sendWithoutPayload(Protocol::PacketType::Ack);
+        break;
+    case Protocol::PacketType::SpectrumAnalyzerSettings:
+        log("Updating spectrum analyzer settings");
+        saSettings = packet.spectrumSettings;
+        startMeasurement(Mode::SA);
+        sendWithoutPayload(Protocol::PacketType::Ack);
+        break;
+    case Protocol::PacketType::SetIdle:
+    case Protocol::PacketType::ManualControlV1:
+    case Protocol::PacketType::Generator:
+        // no measurement data in these modes
+        mode = Mode::Idle;
+        sendWithoutPayload(Protocol::PacketType::Ack);
+        break;
+    case Protocol::PacketType::Reference:
+    case Protocol::PacketType::FrequencyCorrection:
+    case Protocol::PacketType::AcquisitionFrequencySettings:
+    case Protocol::PacketType::SourceCalPoint:
+    case Protocol::PacketType::ReceiverCalPoint:
+    case Protocol::PacketType::RequestSourceCal:
+    case Protocol::PacketType::RequestReceiverCal:
+        // nothing to configure, the virtual device has no amplitude calibration points
+        sendWithoutPayload(Protocol::PacketType::Ack);
+        break;
+    case Protocol::PacketType::RequestDeviceInfo: {
+        sendWithoutPayload(Protocol::PacketType::Ack);
+        Protocol::PacketInfo p;
+        p.type = Protocol::PacketType::DeviceInfo;
+        p.info = virtualInfo;
+        send(p);
+    }
+        break;
+    case Protocol::PacketType::RequestDeviceStatus:
+        sendWithoutPayload(Protocol::PacketType::Ack);
+        sendStatus();
+        break;
+    case Protocol::PacketType::RequestFrequencyCorrection: {
+        sendWithoutPayload(Protocol::PacketType::Ack);
+        Protocol::PacketInfo p;
+        p.type = Protocol::PacketType::FrequencyCorrection;
+        p.frequencyCorrection.ppm = 0.0f;
+        send(p);
+    }
+        break;
+    case Protocol::PacketType::RequestAcquisitionFrequencySettings: {
+        sendWithoutPayload(Protocol::PacketType::Ack);
+        Protocol::PacketInfo p;
+        p.type = Protocol::PacketType::AcquisitionFrequencySettings;
+        p.acquisitionFrequencySettings.IF1 = 62000000;
+        p.acquisitionFrequencySettings.ADCprescaler = 128;
+        p.acquisitionFrequencySettings.DFTphaseInc = 1280;
+        send(p);
+    }
+        break;
+    default:
+        // firmware update and everything else that requires real hardware
+        log("Unsupported packet type " + QString::number((int) packet.type));
+        sendWithoutPayload(Protocol::PacketType::Nack);
+        break;
+    }
+}
+
+void VirtualDevice::send(const Protocol::PacketInfo &packet)
+{
+    int16_t sequenceNumber = Protocol::NoSequenceNumber;
+    if(packet.type == Protocol::PacketType::Ack || packet.type == Protocol::PacketType::Nack) {
+        // only the first answer to a packet carries its sequence number
+        sequenceNumber = answerSequenceNumber;
+        answerSequenceNumber = Protocol::NoSequenceNumber;
+    }
+    unsigned char buffer[1024];
+    auto length = Protocol::EncodePacket(packet, buffer, sizeof(buffer), datapointCRC, sequenceNumber);
+    if(!length) {
+        qCritical() << "Virtual device failed to encode packet";
+        return;
+    }
+    output.insert(output.end(), buffer, buffer + length);
+    if(output.size() + sizeof(buffer) > transferSize) {
+        flush();
+    }
+}
+
+void VirtualDevice::sendWithoutPayload(Protocol::PacketType type)
+{
+    Protocol::PacketInfo p;
+    p.type = type;
+    send(p);
+}
+
+void VirtualDevice::log(QString line)
+{
+    auto data = QString(line + "\r\n").toLatin1();
+    emit LogReceived((const unsigned char*) data.constData(), data.size());
+}
+
+void VirtualDevice::flush()
+{
+    if(output.size() > 0) {
+        emit DataReceived(output.data(), output.size());
+        output.clear();
+    }
+}
+
+void VirtualDevice::startMeasurement(VirtualDevice::Mode m)
+{
+    mode = m;
+    pointCnt = 0;
+    pointsProduced = 0;
+    measurementStart = chrono::steady_clock::now();
+    batch.type = Protocol::PacketType::None;
+    if(mode == Mode::VNA) {
+        zerospan = (vnaSettings.f_start == vnaSettings.f_stop) && (vnaSettings.cdbm_excitation_start == vnaSettings.cdbm_excitation_stop);
+        // same as the firmware: the time of zero span points is not implied by the settings
+        compactDatapoints = vnaSettings.compactDatapoints && !zerospan;
+    } else {
+        zerospan = saSettings.f_start == saSettings.f_stop;
+        compactDatapoints = false;
+    }
+}
+
+void VirtualDevice::generateVNAPoint()
+{
+    auto &s = vnaSettings;
+    Protocol::Datapoint d = {};
+    d.pointNum = pointCnt;
+    double frequency;
+    if(zerospan) {
+        d.us = measurementTime();
+        frequency = s.f_start;
+    } else {
+        // same calculation as in the firmware
+        d.frequency = pointFrequency.Get(pointCnt);
+        if(s.points > 1) {
+            d.cdbm = s.cdbm_excitation_start + (s.cdbm_excitation_stop - s.cdbm_excitation_start) * pointCnt / (s.points - 1);
+        } else {
+            d.cdbm = s.cdbm_excitation_start;
+        }
+        frequency = d.frequency;
+    }
+    auto S = DUT(frequency);
+    for(auto &param : S) {
+        param += complex<double>(noise(), noise()) * measurementNoise;
+    }
+    if(s.excitePort1) {
+        d.real_S11 = S[0].real();
+        d.imag_S11 = S[0].imag();
+        d.real_S21 = S[2].real();
+        d.imag_S21 = S[2].imag();
+    }
+    if(s.excitePort2) {
+        d.real_S12 = S[1].real();
+        d.imag_S12 = S[1].imag();
+        d.real_S22 = S[3].real();
+        d.imag_S22 = S[3].imag();
+    }
+    addToBatch(d);
+    pointsProduced++;
+    pointCnt++;
+    if(pointCnt >= s.points) {
+        // end of sweep
+        flushBatch();
+        sendStatus();
+        pointCnt = 0;
+    }
+}
+
+void VirtualDevice::generateSAPoint()
+{
+    auto &s = saSettings;
+    Protocol::SpectrumAnalyzerResult r = {};
+    r.pointNum = pointCnt;
+    double frequency;
+    if(zerospan) {
+        r.us = measurementTime();
+        frequency = s.f_start;
+    } else {
+        if(s.pointNum > 1) {
+            r.frequency = s.f_start + (s.f_stop - s.f_start) * pointCnt / (s.pointNum - 1);
+        } else {
+            r.frequency = s.f_start;
+        }
+        frequency = r.frequency;
+    }
+    double port1 = noiseFloor * abs(1.0 + 0.3 * noise());
+    double port2 = noiseFloor * abs(1.0 + 0.3 * noise());
+    if(s.trackingGenerator && s.trackingGeneratorOffset == 0) {
+        // the tracking generator signal passes through the DUT
+        auto S = DUT(frequency);
+        auto level = pow(10.0, s.trackingPower / 2000.0);
+        if(s.trackingGeneratorPort == 0) {
+            port1 += abs(S[0]) * level;
+            port2 += abs(S[2]) * level;
+        } else {
+            port1 += abs(S[1]) * level;
+            port2 += abs(S[3]) * level;
+        }
+    }
+    r.port1 = port1;
+    r.port2 = port2;
+    Protocol::PacketInfo p;
+    p.type = Protocol::PacketType::SpectrumAnalyzerResult;
+    p.spectrumResult = r;
+    send(p);
+    pointsProduced++;
+    pointCnt++;
+    if(pointCnt >= s.pointNum) {
+        sendStatus();
+        pointCnt = 0;
+    }
+}
+
+void VirtualDevice::addToBatch(const Protocol::Datapoint &d)
+{
+    if(compactDatapoints) {
+        auto &compact = batch.compactDatapoints;
+        if(batch.type != Protocol::PacketType::CompactDatapoints) {
+            batch.type = Protocol::PacketType::CompactDatapoints;
+            compact.numPoints = 0;
+            compact.firstPointNum = d.pointNum;
+            compact.port1 = vnaSettings.excitePort1;
+            compact.port2 = vnaSettings.excitePort2;
+        }
+        auto valuesPerPoint = Protocol::CompactValuesPerPoint(compact.port1, compact.port2);
+        float *values = &compact.values[compact.numPoints * valuesPerPoint];
+        if(compact.port1) {
+            *values++ = d.real_S11;
+            *values++ = d.imag_S11;
+            *values++ = d.real_S21;
+            *values++ = d.imag_S21;
+        }
+        if(compact.port2) {
+            *values++ = d.real_S12;
+            *values++ = d.imag_S12;
+            *values++ = d.real_S22;
+            *values++ = d.imag_S22;
+        }
+        compact.numPoints++;
+        if((compact.numPoints + 1) * valuesPerPoint > Protocol::MaxCompactValues) {
+            flushBatch();
+        }
+    } else if(vnaSettings.batchDatapoints) {
+        if(batch.type != Protocol::PacketType::DatapointBatch) {
+            batch.type = Protocol::PacketType::DatapointBatch;
+            batch.datapointBatch.numPoints = 0;
+        }
+        batch.datapointBatch.points[batch.datapointBatch.numPoints++] = d;
+        if(batch.datapointBatch.numPoints >= Protocol::MaxBatchedDatapoints) {
+            flushBatch();
+        }
+    } else {
+        Protocol::PacketInfo p;
+        p.type = Protocol::PacketType::Datapoint;
+        p.datapoint = d;
+        send(p);
+    }
+}
+
+void VirtualDevice::flushBatch()
+{
+    if(batch.type != Protocol::PacketType::None) {
+        send(batch);
+        batch.type = Protocol::PacketType::None;
+    }
+}
+
+void VirtualDevice::sendStatus()
+{
+    Protocol::PacketInfo p;
+    p.type = Protocol::PacketType::DeviceStatusV1;
+    p.statusV1 = {};
+    p.statusV1.FPGA_configured = 1;
+    p.statusV1.source_locked = 1;
+    p.statusV1.LO1_locked = 1;
+    p.statusV1.temp_source = 40;
+    p.statusV1.temp_LO1 = 40;
+    p.statusV1.temp_MCU = 35;
+    send(p);
+}
+
+uint64_t VirtualDevice::measurementTime()
+{
+    if(pointsPerSecond > 0) {
+        // points are produced in bursts, use the nominal time of the point
+        return (uint64_t) pointsProduced * 1000000 / pointsPerSecond;
+    } else {
+        return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - measurementStart).count();
+    }
+}
+
+std::array<std::complex<double>, 4> VirtualDevice::DUT(double frequency)
+{
+    if(touchstone) {
+        auto p = touchstone->interpolate(frequency);
+        if(touchstone->ports() == 1) {
+            // same reflection at both ports, no transmission
+            return {p.S[0], 0.0, 0.0, p.S[0]};
+        } else {
+            return {p.S[0], p.S[1], p.S[2], p.S[3]};
+        }
+    }
+    // about 30cm of cable: 1.5ns delay, skin effect loss and a small mismatch at both ends
+    constexpr double delay = 1.5e-9;
+    auto transmission = pow(10.0, -0.5 * sqrt(frequency / 1e9) / 20.0) * polar(1.0, -2 * M_PI * frequency * delay);
+    auto reflection = 0.05 * (polar(1.0, -2 * M_PI * frequency * 50e-12) - transmission * transmission);
+    return {reflection, transmission, transmission, reflection};
+}
+
+double VirtualDevice::noise()
+{
+    return gauss(rng);
+}
@@ -0,0 +1,100 @@
+#ifndef VIRTUALDEVICE_H
+#define VIRTUALDEVICE_H
+
+#include "../VNA_embedded/Application/Communication/Protocol.hpp"
+#include "touchstone.h"
+
+#include <QObject>
+#include <QString>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <array>
+#include <complex>
+#include <chrono>
+#include <random>
+
+// Emulates the firmware of a LibreVNA without any hardware. Packets sent by the host are decoded and
+// answered like the firmware does. Measurements of a simulated DUT are encoded into the same frames
+// the firmware would send and passed on at a configurable rate.
+class VirtualDevice : public QObject
+{
+    Q_OBJECT
+public:
+    // serial number that selects the virtual device instead of a USB device
+    static const QString serial;
+
+    // pointsPerSecond = 0 produces data as fast as possible. If no touchstone file is given (or it
+    // can not be loaded) a built-in model of a short, slightly mismatched cable is measured
+    VirtualDevice(int pointsPerSecond, QString touchstoneFile = QString());
+    ~VirtualDevice();
+
+    // Takes encoded data from the host (the equivalent of the data OUT endpoint)
+    void Transmit(const unsigned char *data, int length);
+
+signals:
+    // Equivalents of the data and log IN endpoints. Emitted from the thread of the virtual device,
+    // data is only valid during the signal emission
+    void DataReceived(const unsigned char *data, int length);
+    void LogReceived(const unsigned char *data, int length);
+
+private:
+    enum class Mode {
+        Idle,
+        VNA,
+        SA,
+    };
+
+    void Thread();
+    void handlePacket(const Protocol::PacketInfo &packet);
+    void send(const Protocol::PacketInfo &packet);
+    void sendWithoutPayload(Protocol::PacketType type);
+    void log(QString line);
+    // passes on everything that has been encoded since the last call
+    void flush();
+
+    void startMeasurement(Mode m);
+    void generateVNAPoint();
+    void generateSAPoint();
+    void addToBatch(const Protocol::Datapoint &d);
+    void flushBatch();
+    void sendStatus();
+    // time since the first point in us
+    uint64_t measurementTime();
+    // S11, S12, S21, S22
+    std::array<std::complex<double>, 4> DUT(double frequency);
+    double noise();
+
+    int pointsPerSecond;
+    Touchstone *touchstone;
+
+    std::thread *thread;
+    std::atomic<bool> running;
+    std::mutex inputMutex;
+    std::condition_variable inputCV;
+    std::vector<unsigned char> input;
+
+    // only accessed from the thread of the virtual device
+    uint8_t framerBuffer[4096];
+    Protocol::FrameBuffer framer;
+    std::vector<unsigned char> output;
+    Mode mode;
+    Protocol::SweepSettings vnaSettings;
+    Protocol::PointFrequency pointFrequency;
+    Protocol::SpectrumAnalyzerSettings saSettings;
+    bool zerospan;
+    bool compactDatapoints;
+    Protocol::PacketInfo batch;
+    uint16_t pointCnt;
+    unsigned long pointsProduced;
+    std::chrono::steady_clock::time_point measurementStart;
+    bool datapointCRC;
+    // sequence number of the packet that is currently handled, the next Ack/Nack carries it
+    int16_t answerSequenceNumber;
+    std::mt19937 rng;
+    std::normal_distribution<double> gauss;
+};
+
+#endif // VIRTUALDEVICE_H
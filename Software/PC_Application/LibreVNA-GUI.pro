@@ -20,8 +20,12 @@ HEADERS += \
     CustomWidgets/touchstoneimport.h \
     Device/device.h \
     Device/devicelog.h \
+    Device/devicemanager.h \
+    Device/deviceregistry.h \
     Device/firmwareupdatedialog.h \
     Device/manualcontroldialog.h \
+    Device/usbcapture.h \
+    Device/virtualdevice.h \
     Generator/generator.h \
     Generator/signalgenwidget.h \
     SpectrumAnalyzer/spectrumanalyzer.h \
@@ -33,6 +37,7 @@ HEADERS += \
     Traces/Marker/markergroup.h \
     Traces/Marker/markermodel.h \
     Traces/Marker/markerwidget.h \
+    Traces/Math/compiledexpression.h \
     Traces/Math/dft.h \
     Traces/Math/expression.h \
     Traces/Math/medianfilter.h \
@@ -89,12 +94,14 @@ HEADERS += \
     Traces/Math/tracemath.h \
     Traces/Math/windowfunction.h \
     Traces/fftcomplex.h \
+    Traces/fftplan.h \
     Traces/sparamtraceselector.h \
     Traces/trace.h \
     Traces/traceaxis.h \
     Traces/tracecsvexport.h \
     Traces/traceeditdialog.h \
     Traces/traceimportdialog.h \
+    Traces/tracemathscheduler.h \
     Traces/tracemodel.h \
     Traces/traceplot.h \
     Traces/tracesmithchart.h \
@@ -107,6 +114,9 @@ HEADERS += \
     Traces/xyplotaxisdialog.h \
     Traces/tracepolarchart.h \
     Util/qpointervariant.h \
+    Util/slidingmedian.h \
+    Util/spscqueue.h \
+    Util/sweephistory.h \
     Util/util.h \
     Util/app_common.h \
     VNA/Deembedding/deembedding.h \
@@ -157,8 +167,12 @@ SOURCES += \
     CustomWidgets/touchstoneimport.cpp \
     Device/device.cpp \
     Device/devicelog.cpp \
+    Device/devicemanager.cpp \
+    Device/deviceregistry.cpp \
     Device/firmwareupdatedialog.cpp \
     Device/manualcontroldialog.cpp \
+    Device/usbcapture.cpp \
+    Device/virtualdevice.cpp \
     Generator/generator.cpp \
     Generator/signalgenwidget.cpp \
     SpectrumAnalyzer/spectrumanalyzer.cpp \
@@ -170,6 +184,7 @@ SOURCES += \
     Traces/Marker/markergroup.cpp \
     Traces/Marker/markermodel.cpp \
     Traces/Marker/markerwidget.cpp \
+    Traces/Math/compiledexpression.cpp \
     Traces/Math/dft.cpp \
     Traces/Math/expression.cpp \
     Traces/Math/medianfilter.cpp \
@@ -215,12 +230,14 @@ SOURCES += \
     Traces/Math/tracemath.cpp \
     Traces/Math/windowfunction.cpp \
     Traces/fftcomplex.cpp \
+    Traces/fftplan.cpp \
     Traces/sparamtraceselector.cpp \
     Traces/trace.cpp \
     Traces/traceaxis.cpp \
     Traces/tracecsvexport.cpp \
     Traces/traceeditdialog.cpp \
     Traces/traceimportdialog.cpp \
+    Traces/tracemathscheduler.cpp \
     Traces/tracemodel.cpp \
     Traces/traceplot.cpp \
     Traces/tracesmithchart.cpp \
@@ -232,6 +249,7 @@ SOURCES += \
     Traces/tracepolar.cpp \
     Traces/waterfallaxisdialog.cpp \
     Traces/xyplotaxisdialog.cpp \
+    Util/sweephistory.cpp \
     Util/util.cpp \
     VNA/Deembedding/deembedding.cpp \
     VNA/Deembedding/deembeddingdialog.cpp \
@@ -0,0 +1,393 @@
+#include "compiledexpression.h"
+
+#include "parser/mpOprtCmplx.h"
+#include "parser/mpFuncCmplx.h"
+#include "parser/mpPackageUnit.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+using namespace mup;
+using namespace std;
+
+Math::CompiledExpression::CompiledExpression()
+    : compiled(false),
+      numInputs(0)
+{
+    result = {Operand::Type::Register, 0};
+}
+
+bool Math::CompiledExpression::compile(const ParserX &parser, const std::vector<const IValue *> &inputs)
+{
+    clear();
+    numInputs = inputs.size();
+    inputUsed.assign(numInputs, false);
+    // Simulate the stack of the parser. Variables and constants are not copied, they stay on the stack
+    // as references until they are used. Intermediate results are stored in the register with the same
+    // index as their stack position, registers are only overwritten once their value has been consumed.
+    vector<Operand> stack;
+    unsigned int registers = 0;
+    auto &rpn = parser.GetRPN().GetData();
+    for(auto &t : rpn) {
+        auto tok = t.Get();
+        switch(tok->GetCode()) {
+        case cmVAL: {
+            auto val = tok->AsIValue();
+            if(val->IsVariable()) {
+                auto ptr = static_cast<Variable*>(val)->GetPtr();
+                auto it = find(inputs.begin(), inputs.end(), ptr);
+                if(it == inputs.end()) {
+                    return false;
+                }
+                unsigned int index = it - inputs.begin();
+                inputUsed[index] = true;
+                stack.push_back({Operand::Type::Input, index});
+            } else {
+                if(!val->IsScalar()) {
+                    return false;
+                }
+                constants.push_back(complex<double>(val->GetFloat(), val->GetImag()));
+                stack.push_back({Operand::Type::Constant, (unsigned int) constants.size() - 1});
+            }
+        }
+            break;
+        case cmFUNC:
+        case cmOPRT_BIN:
+        case cmOPRT_INFIX:
+        case cmOPRT_POSTFIX: {
+            auto cb = tok->AsICallback();
+            Instruction ins = {};
+            unsigned int args = 1;
+            if(dynamic_cast<OprtAddCmplx*>(cb)) {
+                ins.op = Op::Add;
+                args = 2;
+            } else if(dynamic_cast<OprtSubCmplx*>(cb)) {
+                ins.op = Op::Sub;
+                args = 2;
+            } else if(dynamic_cast<OprtMulCmplx*>(cb)) {
+                ins.op = Op::Mul;
+                args = 2;
+            } else if(dynamic_cast<OprtDivCmplx*>(cb)) {
+                ins.op = Op::Div;
+                args = 2;
+            } else if(dynamic_cast<OprtPowCmplx*>(cb)) {
+                ins.op = Op::Pow;
+                args = 2;
+            } else if(dynamic_cast<FunCmplxPow*>(cb)) {
+                ins.op = Op::PowFunction;
+                args = 2;
+            } else if(dynamic_cast<OprtSignCmplx*>(cb)) {
+                ins.op = Op::Negate;
+            } else if(dynamic_cast<OprtNano*>(cb)) {
+                ins.op = Op::Scale;
+                ins.factor = 1e-9;
+            } else if(dynamic_cast<OprtMicro*>(cb)) {
+                ins.op = Op::Scale;
+                ins.factor = 1e-6;
+            } else if(dynamic_cast<OprtMilli*>(cb)) {
+                ins.op = Op::Scale;
+                ins.factor = 1e-3;
+            } else if(dynamic_cast<OprtKilo*>(cb)) {
+                ins.op = Op::Scale;
+                ins.factor = 1e3;
+            } else if(dynamic_cast<OprtMega*>(cb)) {
+                ins.op = Op::Scale;
+                ins.factor = 1e6;
+            } else if(dynamic_cast<OprtGiga*>(cb)) {
+                ins.op = Op::Scale;
+                ins.factor = 1e9;
+            } else if(dynamic_cast<FunCmplxReal*>(cb)) {
+                ins.op = Op::Real;
+            } else if(dynamic_cast<FunCmplxImag*>(cb)) {
+                ins.op = Op::Imag;
+            } else if(dynamic_cast<FunCmplxConj*>(cb)) {
+                ins.op = Op::Conj;
+            } else if(dynamic_cast<FunCmplxArg*>(cb)) {
+                ins.op = Op::Arg;
+            } else if(dynamic_cast<FunCmplxNorm*>(cb)) {
+                ins.op = Op::Norm;
+            } else if(dynamic_cast<FunCmplxAbs*>(cb)) {
+                ins.op = Op::Abs;
+            } else if(dynamic_cast<FunCmplxSin*>(cb)) {
+                ins.op = Op::Sin;
+            } else if(dynamic_cast<FunCmplxCos*>(cb)) {
+                ins.op = Op::Cos;
+            } else if(dynamic_cast<FunCmplxTan*>(cb)) {
+                ins.op = Op::Tan;
+            } else if(dynamic_cast<FunCmplxSinH*>(cb)) {
+                ins.op = Op::SinH;
+            } else if(dynamic_cast<FunCmplxCosH*>(cb)) {
+                ins.op = Op::CosH;
+            } else if(dynamic_cast<FunCmplxTanH*>(cb)) {
+                ins.op = Op::TanH;
+            } else if(dynamic_cast<FunCmplxSqrt*>(cb)) {
+                ins.op = Op::Sqrt;
+            } else if(dynamic_cast<FunCmplxExp*>(cb)) {
+                ins.op = Op::Exp;
+            } else if(dynamic_cast<FunCmplxLn*>(cb) || dynamic_cast<FunCmplxLog*>(cb)) {
+                ins.op = Op::Log;
+            } else if(dynamic_cast<FunCmplxLog10*>(cb)) {
+                ins.op = Op::Log10;
+            } else if(dynamic_cast<FunCmplxLog2*>(cb)) {
+                ins.op = Op::Log2;
+            } else {
+                // not supported
+                return false;
+            }
+            if(cb->GetArgsPresent() != (int) args || stack.size() < args) {
+                return false;
+            }
+            ins.args = args;
+            ins.dest = stack.size() - args;
+            ins.a = stack[ins.dest];
+            if(args == 2) {
+                ins.b = stack[ins.dest + 1];
+            }
+            stack.resize(ins.dest);
+            stack.push_back({Operand::Type::Register, ins.dest});
+            registers = max(registers, ins.dest + 1);
+            program.push_back(ins);
+        }
+            break;
+        default:
+            // if-then-else, index operators, multiple expressions, ...
+            return false;
+        }
+    }
+    if(stack.size() != 1) {
+        return false;
+    }
+    result = stack[0];
+
+    constantRe.resize(constants.size() * BlockSize);
+    constantIm.resize(constants.size() * BlockSize);
+    for(unsigned int i=0;i<constants.size();i++) {
+        fill_n(constantRe.begin() + i * BlockSize, BlockSize, constants[i].real());
+        fill_n(constantIm.begin() + i * BlockSize, BlockSize, constants[i].imag());
+    }
+    registerRe.resize(registers * BlockSize);
+    registerIm.resize(registers * BlockSize);
+    zeros.assign(BlockSize, 0.0);
+    compiled = true;
+    return true;
+}
+
+void Math::CompiledExpression::clear()
+{
+    compiled = false;
+    program.clear();
+    constants.clear();
+    inputUsed.clear();
+    numInputs = 0;
+}
+
+bool Math::CompiledExpression::usesInput(unsigned int index) const
+{
+    return index < inputUsed.size() && inputUsed[index];
+}
+
+void Math::CompiledExpression::resolve(const Operand &o, const std::vector<Input> &inputs, unsigned int offset, const double *&re, const double *&im)
+{
+    switch(o.type) {
+    case Operand::Type::Register:
+        re = &registerRe[o.index * BlockSize];
+        im = &registerIm[o.index * BlockSize];
+        break;
+    case Operand::Type::Input:
+        re = inputs[o.index].re + offset;
+        im = inputs[o.index].im ? inputs[o.index].im + offset : zeros.data();
+        break;
+    case Operand::Type::Constant:
+        re = &constantRe[o.index * BlockSize];
+        im = &constantIm[o.index * BlockSize];
+        break;
+    }
+}
+
+// The operations below reproduce the calculations of the muparserx complex package. Values with an
+// imaginary part of zero are treated as real numbers by muparserx, some operations use the real
+// functions in that case.
+namespace {
+
+template<typename F> void apply(unsigned int n, const double *ar, const double *ai, double *dr, double *di, F f) {
+    for(unsigned int j=0;j<n;j++) {
+        auto r = f(complex<double>(ar[j], ai[j]));
+        dr[j] = r.real();
+        di[j] = r.imag();
+    }
+}
+
+bool isInteger(double re, double im) {
+    return im == 0 && re == (int64_t) re;
+}
+
+}
+
+void Math::CompiledExpression::evaluate(const std::vector<Input> &inputs, unsigned int n, double *re, double *im)
+{
+    if(!compiled || inputs.size() < numInputs) {
+        return;
+    }
+    for(unsigned int offset=0;offset<n;offset+=BlockSize) {
+        const unsigned int len = min(BlockSize, n - offset);
+        for(auto &ins : program) {
+            const double *ar, *ai, *br = nullptr, *bi = nullptr;
+            resolve(ins.a, inputs, offset, ar, ai);
+            if(ins.args == 2) {
+                resolve(ins.b, inputs, offset, br, bi);
+            }
+            double *dr = &registerRe[ins.dest * BlockSize];
+            double *di = &registerIm[ins.dest * BlockSize];
+            switch(ins.op) {
+            case Op::Add:
+                for(unsigned int j=0;j<len;j++) {
+                    dr[j] = ar[j] + br[j];
+                    di[j] = ai[j] + bi[j];
+                }
+                break;
+            case Op::Sub:
+                for(unsigned int j=0;j<len;j++) {
+                    dr[j] = ar[j] - br[j];
+                    di[j] = ai[j] - bi[j];
+                }
+                break;
+            case Op::Mul:
+                for(unsigned int j=0;j<len;j++) {
+                    double r = ar[j] * br[j] - ai[j] * bi[j];
+                    double i = ar[j] * bi[j] + ai[j] * br[j];
+                    dr[j] = r;
+                    di[j] = i;
+                }
+                break;
+            case Op::Div:
+                for(unsigned int j=0;j<len;j++) {
+                    double a = ar[j], b = ai[j], c = br[j], d = bi[j];
+                    double denom = c * c + d * d;
+                    double r = (a * c + b * d) / denom;
+                    double i = (b * c - a * d) / denom;
+                    // real division if both values are real
+                    bool real = b == 0 && d == 0;
+                    dr[j] = real ? a / c : r;
+                    di[j] = real ? 0.0 : i;
+                }
+                break;
+            case Op::Pow:
+                for(unsigned int j=0;j<len;j++) {
+                    complex<double> r;
+                    if(ai[j] != 0 || bi[j] != 0 || (ar[j] < 0 && !isInteger(br[j], bi[j]))) {
+                        r = pow(complex<double>(ar[j], ai[j]), complex<double>(br[j], bi[j]));
+                    } else {
+                        r = pow(ar[j], br[j]);
+                    }
+                    dr[j] = r.real();
+                    di[j] = r.imag();
+                }
+                break;
+            case Op::PowFunction:
+                for(unsigned int j=0;j<len;j++) {
+                    auto r = pow(complex<double>(ar[j], ai[j]), complex<double>(br[j], bi[j]));
+                    dr[j] = r.real();
+                    di[j] = r.imag();
+                }
+                break;
+            case Op::Negate:
+                for(unsigned int j=0;j<len;j++) {
+                    // no negative zero, see OprtSignCmplx
+                    double r = ar[j] == 0 ? 0.0 : -ar[j];
+                    double i = ai[j] == 0 ? 0.0 : -ai[j];
+                    dr[j] = r;
+                    di[j] = i;
+                }
+                break;
+            case Op::Scale: {
+                const double f = ins.factor;
+                for(unsigned int j=0;j<len;j++) {
+                    dr[j] = ar[j] * f;
+                    di[j] = ai[j] * f;
+                }
+            }
+                break;
+            case Op::Real:
+                for(unsigned int j=0;j<len;j++) {
+                    dr[j] = ar[j];
+                    di[j] = 0.0;
+                }
+                break;
+            case Op::Imag:
+                for(unsigned int j=0;j<len;j++) {
+                    dr[j] = ai[j];
+                    di[j] = 0.0;
+                }
+                break;
+            case Op::Conj:
+                for(unsigned int j=0;j<len;j++) {
+                    dr[j] = ar[j];
+                    di[j] = -ai[j];
+                }
+                break;
+            case Op::Norm:
+                for(unsigned int j=0;j<len;j++) {
+                    dr[j] = ar[j] * ar[j] + ai[j] * ai[j];
+                    di[j] = 0.0;
+                }
+                break;
+            case Op::Abs:
+                for(unsigned int j=0;j<len;j++) {
+                    dr[j] = sqrt(ar[j] * ar[j] + ai[j] * ai[j]);
+                    di[j] = 0.0;
+                }
+                break;
+            case Op::Arg:
+                for(unsigned int j=0;j<len;j++) {
+                    dr[j] = atan2(ai[j], ar[j]);
+                    di[j] = 0.0;
+                }
+                break;
+            case Op::Sin:
+                apply(len, ar, ai, dr, di, [](complex<double> v) -> complex<double> {
+                    return v.imag() == 0 ? complex<double>(sin(v.real())) : sin(v);
+                });
+                break;
+            case Op::Cos:
+                apply(len, ar, ai, dr, di, [](complex<double> v) -> complex<double> {
+                    return v.imag() == 0 ? complex<double>(cos(v.real())) : cos(v);
+                });
+                break;
+            case Op::Tan:
+                apply(len, ar, ai, dr, di, [](complex<double> v) -> complex<double> {
+                    return v.imag() == 0 ? complex<double>(tan(v.real())) : tan(v);
+                });
+                break;
+            case Op::SinH:
+                apply(len, ar, ai, dr, di, [](complex<double> v) { return sinh(v); });
+                break;
+            case Op::CosH:
+                apply(len, ar, ai, dr, di, [](complex<double> v) { return cosh(v); });
+                break;
+            case Op::TanH:
+                apply(len, ar, ai, dr, di, [](complex<double> v) { return tanh(v); });
+                break;
+            case Op::Sqrt:
+                apply(len, ar, ai, dr, di, [](complex<double> v) { return sqrt(v); });
+                break;
+            case Op::Exp:
+                apply(len, ar, ai, dr, di, [](complex<double> v) { return exp(v); });
+                break;
+            case Op::Log:
+                apply(len, ar, ai, dr, di, [](complex<double> v) { return log(v); });
+                break;
+            case Op::Log10:
+                apply(len, ar, ai, dr, di, [](complex<double> v) { return log10(v); });
+                break;
+            case Op::Log2:
+                apply(len, ar, ai, dr, di, [](complex<double> v) { return log(v) * 1.0 / log(2.0); });
+                break;
+            }
+        }
+        const double *rr, *ri;
+        resolve(result, inputs, offset, rr, ri);
+        copy_n(rr, len, re + offset);
+        copy_n(ri, len, im + offset);
+    }
+}
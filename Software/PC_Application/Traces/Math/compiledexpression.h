@@ -0,0 +1,110 @@
+#ifndef COMPILEDEXPRESSION_H
+#define COMPILEDEXPRESSION_H
+
+#include "parser/mpParser.h"
+
+#include <complex>
+#include <vector>
+
+namespace Math {
+
+// Evaluates the expression of a muparserx parser for many samples at once. The RPN of the parser is
+// translated once into a list of operations on complex values. These operations are executed on blocks of
+// samples stored as separate real and imaginary arrays, so the elementwise arithmetic can be vectorized by
+// the compiler. The results are identical to evaluating the parser for each sample.
+//
+// Supported are scalar values, the arithmetic operators, unit postfixes and the functions of the complex
+// package. Expressions using anything else (comparisons, if-then-else, matrices, strings, ...) can not be
+// compiled and have to be evaluated sample by sample with ParserX::Eval().
+class CompiledExpression
+{
+public:
+    CompiledExpression();
+
+    // Translates the current expression of the parser. Every variable of the expression must be one of the
+    // values in inputs, their order determines the input index in evaluate(). Returns false if the expression
+    // can not be compiled. Throws mup::ParserError if the expression itself is invalid.
+    bool compile(const mup::ParserX &parser, const std::vector<const mup::IValue*> &inputs);
+    void clear();
+    bool isCompiled() const { return compiled; }
+    // returns true if the input is used by the compiled expression
+    bool usesInput(unsigned int index) const;
+
+    class Input {
+    public:
+        const double *re;
+        // may be nullptr for real inputs
+        const double *im;
+    };
+    // Evaluates the expression for n samples, every input must point to at least n values
+    void evaluate(const std::vector<Input> &inputs, unsigned int n, double *re, double *im);
+
+private:
+    enum class Op {
+        Add,
+        Sub,
+        Mul,
+        Div,
+        Pow,
+        Negate,
+        Scale,
+        Real,
+        Imag,
+        Conj,
+        Arg,
+        Norm,
+        Abs,
+        Sin,
+        Cos,
+        Tan,
+        SinH,
+        CosH,
+        TanH,
+        Sqrt,
+        Exp,
+        Log,
+        Log10,
+        Log2,
+        PowFunction,
+    };
+
+    class Operand {
+    public:
+        enum class Type {
+            Register,
+            Input,
+            Constant,
+        };
+        Type type;
+        unsigned int index;
+    };
+
+    class Instruction {
+    public:
+        Op op;
+        unsigned int args; // 1 or 2 (uses operand b)
+        unsigned int dest; // register
+        Operand a, b;
+        double factor; // only used for Op::Scale
+    };
+
+    static constexpr unsigned int BlockSize = 256;
+
+    void resolve(const Operand &o, const std::vector<Input> &inputs, unsigned int offset, const double *&re, const double *&im);
+
+    bool compiled;
+    std::vector<Instruction> program;
+    Operand result;
+    unsigned int numInputs;
+    std::vector<bool> inputUsed;
+    std::vector<std::complex<double>> constants;
+    // every constant is expanded to a whole block, this way all operands are arrays
+    std::vector<double> constantRe, constantIm;
+    // registers for intermediate results, one block per register
+    std::vector<double> registerRe, registerIm;
+    std::vector<double> zeros;
+};
+
+}
+
+#endif // COMPILEDEXPRESSION_H
@@ -15,6 +15,12 @@ Math::DFT::DFT()
 {
     automaticDC = true;
     DCfreq = 1000000000.0;
+    zoom = false;
+    automaticRange = true;
+    rangeStart = 0.0;
+    rangeStop = 6000000000.0;
+    rangePoints = 1001;
+    displayedMin = displayedMax = 0.0;
 
     destructing = false;
     thread = new DFTThread(*this);
@@ -50,6 +56,13 @@ QString Math::DFT::description()
         ret += "DC:" + Unit::ToString(DCfreq, "Hz", " kMG", 6) + ")";
     }
     ret += ", window: " + window.getDescription();
+    if(zoom) {
+        if(automaticRange) {
+            ret += ", zoom: graph range";
+        } else {
+            ret += ", zoom: " + Unit::ToString(rangeStart, "Hz", " kMG", 6) + " to " + Unit::ToString(rangeStop, "Hz", " kMG", 6);
+        }
+    }
     return ret;
 }
 
@@ -86,6 +99,62 @@ void Math::DFT::edit()
         updateDFT();
     });
 
+    ui->rangeBox->setChecked(zoom);
+    if(automaticRange) {
+        ui->rangeAutomatic->setChecked(true);
+    } else {
+        ui->rangeManual->setChecked(true);
+    }
+    ui->rangeStart->setUnit("Hz");
+    ui->rangeStart->setPrefixes(" kMG");
+    ui->rangeStart->setPrecision(6);
+    ui->rangeStart->setValue(rangeStart);
+    ui->rangeStart->setEnabled(!automaticRange);
+    ui->rangeStop->setUnit("Hz");
+    ui->rangeStop->setPrefixes(" kMG");
+    ui->rangeStop->setPrecision(6);
+    ui->rangeStop->setValue(rangeStop);
+    ui->rangeStop->setEnabled(!automaticRange);
+    ui->rangePoints->setValue(rangePoints);
+
+    connect(ui->rangeBox, &QGroupBox::toggled, [=](bool enabled) {
+        {
+            std::lock_guard<std::mutex> lock(rangeMutex);
+            zoom = enabled;
+        }
+        updateDFT();
+    });
+    connect(ui->rangeManual, &QRadioButton::toggled, [=](bool manual) {
+        {
+            std::lock_guard<std::mutex> lock(rangeMutex);
+            automaticRange = !manual;
+        }
+        ui->rangeStart->setEnabled(manual);
+        ui->rangeStop->setEnabled(manual);
+        updateDFT();
+    });
+    connect(ui->rangeStart, &SIUnitEdit::valueChanged, [=](double newval){
+        {
+            std::lock_guard<std::mutex> lock(rangeMutex);
+            rangeStart = newval;
+        }
+        updateDFT();
+    });
+    connect(ui->rangeStop, &SIUnitEdit::valueChanged, [=](double newval){
+        {
+            std::lock_guard<std::mutex> lock(rangeMutex);
+            rangeStop = newval;
+        }
+        updateDFT();
+    });
+    connect(ui->rangePoints, qOverload<int>(&QSpinBox::valueChanged), [=](int newval){
+        {
+            std::lock_guard<std::mutex> lock(rangeMutex);
+            rangePoints = newval;
+        }
+        updateDFT();
+    });
+
     connect(ui->buttonBox, &QDialogButtonBox::accepted, d, &QDialog::accept);
     if(AppWindow::showGUI()) {
         d->show();
@@ -111,6 +180,13 @@ nlohmann::json Math::DFT::toJSON()
     if(!automaticDC) {
         j["DC"] = DCfreq;
     }
+    j["zoom"] = zoom;
+    if(zoom) {
+        j["zoom_automatic"] = automaticRange;
+        j["zoom_start"] = rangeStart;
+        j["zoom_stop"] = rangeStop;
+        j["zoom_points"] = rangePoints;
+    }
     return j;
 }
 
@@ -121,6 +197,14 @@ void Math::DFT::fromJSON(nlohmann::json j)
     if(j.contains("window")) {
         window.fromJSON(j["window"]);
     }
+    {
+        std::lock_guard<std::mutex> lock(rangeMutex);
+        zoom = j.value("zoom", false);
+        automaticRange = j.value("zoom_automatic", true);
+        rangeStart = j.value("zoom_start", 0.0);
+        rangeStop = j.value("zoom_stop", 6000000000.0);
+        rangePoints = j.value("zoom_points", 1001);
+    }
 }
 
 void Math::DFT::inputSamplesChanged(unsigned int begin, unsigned int end)
@@ -150,6 +234,39 @@ void Math::DFT::updateDFT()
     }
 }
 
+void Math::DFT::setDisplayedRange(double min, double max)
+{
+    if(min == displayedMin && max == displayedMax) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(rangeMutex);
+        displayedMin = min;
+        displayedMax = max;
+    }
+    if(zoom && automaticRange) {
+        updateDFT();
+    }
+}
+
+bool Math::DFT::getZoomRange(double &start, double &stop, unsigned int &points) const
+{
+    std::lock_guard<std::mutex> lock(rangeMutex);
+    if(!zoom) {
+        return false;
+    }
+    if(automaticRange) {
+        // without a graph with a fixed range, the full frequency range is calculated
+        start = displayedMin;
+        stop = displayedMax;
+    } else {
+        start = rangeStart;
+        stop = rangeStop;
+    }
+    points = rangePoints;
+    return start < stop && points >= 2;
+}
+
 Math::DFTThread::DFTThread(Math::DFT &dft)
     : dft(dft)
 {
@@ -203,31 +320,67 @@ void Math::DFTThread::run()
 
         Fft::shift(timeDomain, false);
         dft.window.apply(timeDomain);
-        Fft::shift(timeDomain, true);
-        Fft::transform(timeDomain, false);
-        // shift DC bin into the middle
-        Fft::shift(timeDomain, false);
 
         double binSpacing = 1.0 / (timeSpacing * timeDomain.size());
-        dft.data.clear();
-        int DCbin = timeDomain.size() / 2, startBin = 0;
-        if(DC > 0) {
-            dft.data.resize(timeDomain.size());
+        int DCbin = timeDomain.size() / 2;
+        double start, stop;
+        unsigned int points;
+        if(dft.getZoomRange(start, stop, points)) {
+            // The samples are in chronological order now, the first one is -samples/2 steps before the input starts:
+            // X(f) = exp(2*pi*i*(f-DC)*timeSpacing*samples/2) * sum over n of x[n] * exp(-2*pi*i*n*(f-DC)*timeSpacing)
+            auto spacing = (stop - start) / (points - 1);
+            vector<complex<double>> z;
+            zoomPlan(samples, points, (start - DC) * timeSpacing, spacing * timeSpacing).execute(timeDomain, z);
+
+            dft.data.clear();
+            dft.data.resize(points);
+            for(unsigned int i = 0;i<points;i++) {
+                auto freq = start + spacing * i;
+                auto cycles = (freq - DC) * timeSpacing * (samples / 2);
+                auto value = z[i] * polar(1.0, 2.0 * M_PI * (cycles - floor(cycles)));
+                // reverse effect of frequency domain window function from TDR (if available), the frequency is usually
+                // between the bins of the TDR
+                auto bin = DCbin + (freq - DC) / binSpacing;
+                if(tdr && bin >= 0 && bin <= samples - 1) {
+                    value /= tdr->getWindow().getFactor(bin, samples);
+                }
+                dft.data.setX(i, freq);
+                dft.data.setY(i, value);
+            }
         } else {
-            startBin = (timeDomain.size()+1) / 2;
-            dft.data.resize(timeDomain.size()/2);
-        }
+            Fft::shift(timeDomain, true);
+            Fft::transform(timeDomain, false);
+            // shift DC bin into the middle
+            Fft::shift(timeDomain, false);
 
-        // reverse effect of frequency domain window function from TDR (if available)
-        if(tdr) {
-            tdr->getWindow().reverse(timeDomain);
-        }
+            dft.data.clear();
+            int startBin = 0;
+            if(DC > 0) {
+                dft.data.resize(timeDomain.size());
+            } else {
+                startBin = (timeDomain.size()+1) / 2;
+                dft.data.resize(timeDomain.size()/2);
+            }
 
-        for(int i = startBin;(unsigned int) i<timeDomain.size();i++) {
-            auto freq = (i - DCbin) * binSpacing + DC;
-            dft.data[i - startBin].x = round(freq);
-            dft.data[i - startBin].y = timeDomain.at(i);
+            // reverse effect of frequency domain window function from TDR (if available)
+            if(tdr) {
+                tdr->getWindow().reverse(timeDomain);
+            }
+
+            for(int i = startBin;(unsigned int) i<timeDomain.size();i++) {
+                auto freq = (i - DCbin) * binSpacing + DC;
+                dft.data.setX(i - startBin, round(freq));
+                dft.data.setY(i - startBin, timeDomain.at(i));
+            }
         }
         emit dft.outputSamplesChanged(0, dft.data.size());
     }
 }
+
+const Fft::ChirpZ &Math::DFTThread::zoomPlan(size_t n, size_t m, double start, double step)
+{
+    if(!chirpZ || !chirpZ->matches(n, m, start, step, false)) {
+        chirpZ.reset(new Fft::ChirpZ(n, m, start, step, false));
+    }
+    return *chirpZ;
+}
@@ -85,19 +85,23 @@ void Math::Expression::fromJSON(nlohmann::json j)
 
 void Math::Expression::inputSamplesChanged(unsigned int begin, unsigned int end)
 {
-    auto in = input->rData();
+    auto &in = input->rData();
     data.resize(in.size());
     try {
-        for(unsigned int i=begin;i<end;i++) {
-            t = in[i].x;
-            f = in[i].x;
-            P = in[i].x;
-            w = in[i].x * 2 * M_PI;
-            d = root()->timeToDistance(t);
-            x = in[i].y;
-            Value res = parser->Eval();
-            data[i].x = in[i].x;
-            data[i].y = res.GetComplex();
+        if(compiled.isCompiled()) {
+            evaluateCompiled(begin, end);
+        } else {
+            for(unsigned int i=begin;i<end;i++) {
+                t = in[i].x;
+                f = in[i].x;
+                P = in[i].x;
+                w = in[i].x * 2 * M_PI;
+                d = root()->timeToDistance(t);
+                x = in[i].y;
+                Value res = parser->Eval();
+                data.setX(i, in.x(i));
+                data.setY(i, res.GetComplex());
+            }
         }
         success();
         emit outputSamplesChanged(begin, end);
@@ -106,8 +110,44 @@ void Math::Expression::inputSamplesChanged(unsigned int begin, unsigned int end)
     }
 }
 
+void Math::Expression::evaluateCompiled(unsigned int begin, unsigned int end)
+{
+    auto &in = input->rData();
+    const unsigned int n = end - begin;
+    auto xs = in.xData() + begin;
+    // the order of the inputs is the same as in expressionChanged()
+    vector<double> dist, omega;
+    if(compiled.usesInput(1)) {
+        dist.resize(n);
+        for(unsigned int i=0;i<n;i++) {
+            dist[i] = root()->timeToDistance(xs[i]);
+        }
+    }
+    if(compiled.usesInput(3)) {
+        omega.resize(n);
+        for(unsigned int i=0;i<n;i++) {
+            omega[i] = xs[i] * 2 * M_PI;
+        }
+    }
+    vector<CompiledExpression::Input> inputs = {
+        {xs, nullptr}, // t
+        {dist.data(), nullptr}, // d
+        {xs, nullptr}, // f
+        {omega.data(), nullptr}, // w
+        {in.realData() + begin, in.imagData() + begin}, // x
+        {xs, nullptr}, // P
+    };
+    vector<double> re(n), im(n);
+    compiled.evaluate(inputs, n, re.data(), im.data());
+    for(unsigned int i=0;i<n;i++) {
+        data.setX(begin + i, xs[i]);
+        data.setY(begin + i, complex<double>(re[i], im[i]));
+    }
+}
+
 void Math::Expression::expressionChanged()
 {
+    compiled.clear();
     if(exp.isEmpty()) {
         error("Empty expression");
         return;
@@ -136,6 +176,11 @@ void Math::Expression::expressionChanged()
     default:
         break;
     }
+    try {
+        compiled.compile(*parser, {&t, &d, &f, &w, &x, &P});
+    } catch (const ParserError &) {
+        // invalid expression, the error is reported when evaluating it
+    }
     if(input) {
         inputSamplesChanged(0, input->rData().size());
     }
@@ -2,6 +2,7 @@
 #define EXPRESSION_H
 
 #include "tracemath.h"
+#include "compiledexpression.h"
 #include "parser/mpParser.h"
 
 namespace Math {
@@ -28,9 +29,12 @@ public slots:
 private slots:
     void expressionChanged();
 private:
+    void evaluateCompiled(unsigned int begin, unsigned int end);
     QString exp;
     mup::ParserX *parser;
     mup::Value t, d, f, w, x, P;
+    // used instead of evaluating the parser for every sample if the expression supports it
+    CompiledExpression compiled;
 };
 
 }
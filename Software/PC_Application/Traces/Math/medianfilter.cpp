@@ -3,6 +3,7 @@
 #include "ui_medianfilterdialog.h"
 #include "ui_medianexplanationwidget.h"
 #include "CustomWidgets/informationbox.h"
+#include "Util/slidingmedian.h"
 #include "appwindow.h"
 
 using namespace Math;
@@ -93,55 +94,39 @@ void MedianFilter::inputSamplesChanged(unsigned int begin, unsigned int end) {
             stop = input->rData().size();
         }
 
-        auto comp = [=](const complex<double>&a, const complex<double>&b){
-           switch(order) {
-           case Order::AbsoluteValue: return abs(a) < abs(b);
-           case Order::Phase: return arg(a) < arg(b);
-           case Order::Real: return real(a) < real(b);
-           case Order::Imag: return imag(a) < imag(b);
-           default: return false;
-           }
+        // sort key of a sample, calculated once when the sample enters the kernel
+        auto key = [=](const complex<double> &c) -> double {
+            switch(order) {
+            case Order::AbsoluteValue: return abs(c);
+            case Order::Phase: return arg(c);
+            case Order::Real: return real(c);
+            case Order::Imag: return imag(c);
+            default: return 0.0;
+            }
+        };
+        // input samples outside of the data are replaced by the first/last sample
+        auto inputSample = [=](int index) {
+            if(index < 0) {
+                index = 0;
+            } else if(index >= (int) input->rData().size()) {
+                index = input->rData().size() - 1;
+            }
+            return input->rData().y(index);
         };
 
-        vector<complex<double>> kernel(kernelSize);
+        // Fill the kernel for the first output sample, except for its last input sample. For every output sample, only
+        // the input sample that is no longer needed is removed and one additional input sample is added
+        SlidingMedian kernel(kernelSize);
+        vector<complex<double>> samples(kernelSize);
+        for(int in = start - (int) kernelOffset;in < start + (int) kernelOffset;in++) {
+            auto sample = inputSample(in);
+            samples[kernel.add(key(sample))] = sample;
+        }
         for(unsigned int out=start;out<stop;out++) {
-            if(out == (unsigned int) start) {
-                // this is the first sample to update, fill initial kernel
-                for(unsigned int in=0;in<kernelSize;in++) {
-                    unsigned int inputSample;
-                    if(kernelOffset > in + out) {
-                        inputSample = 0;
-                    } else if(in + out >= input->rData().size() + kernelOffset) {
-                        inputSample = input->rData().size() - 1;
-                    } else {
-                        inputSample = in + out - kernelOffset;
-                    }
-                    auto sample = input->rData().at(inputSample).y;
-                    kernel[in] = sample;
-                }
-                // sort initial kernel
-                sort(kernel.begin(), kernel.end(), comp);
-            } else {
-                // kernel already filled and sorted from last output sample. Only remove the one input sample that
-                // is no longer needed for this output and add the one additional input sample
-                int toRemove = out - kernelOffset - 1;
-                unsigned int toAdd = out + kernelOffset;
-                if(toRemove < 0) {
-                    toRemove = 0;
-                }
-                if(toAdd >= input->rData().size()) {
-                    toAdd = input->rData().size() - 1;
-                }
-                auto sampleToRemove = input->rData().at(toRemove).y;
-                auto remove_iterator = lower_bound(kernel.begin(), kernel.end(), sampleToRemove, comp);
-                kernel.erase(remove_iterator);
-
-                auto sampleToAdd = input->rData().at(toAdd).y;
-                // insert sample at correct position in vector
-                kernel.insert(upper_bound(kernel.begin(), kernel.end(), sampleToAdd, comp), sampleToAdd);
-            }
-            data.at(out).y = kernel[kernelOffset];
-            data.at(out).x = input->rData().at(out).x;
+            auto sample = inputSample(out + kernelOffset);
+            samples[kernel.add(key(sample))] = sample;
+            data.setY(out, samples[kernel.lowerMedian()]);
+            data.setX(out, input->rData().x(out));
         }
         emit outputSamplesChanged(start, stop);
         success();
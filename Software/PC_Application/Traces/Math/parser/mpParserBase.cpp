@@ -710,6 +710,20 @@ void ParserXBase::DumpRPN() const
 	m_rpn.AsciiDump();
 }
 
+//---------------------------------------------------------------------------
+/** \brief Return the reverse polish notation of the current expression.
+
+	  The RPN is created if the expression has not been evaluated yet.
+	  \throw ParserError in case of syntax errors in the expression
+	  */
+const RPN& ParserXBase::GetRPN() const
+{
+	if (m_pParserEngine == &ParserXBase::ParseFromString)
+		PrepareRPN();
+
+	return m_rpn;
+}
+
 //---------------------------------------------------------------------------
 void ParserXBase::CreateRPN() const
 {
@@ -969,6 +983,15 @@ void ParserXBase::CreateRPN() const
 	  #m_pParseFormula will be changed to the second parse routine the uses bytecode instead of string parsing.
 	  */
 const IValue& ParserXBase::ParseFromString() const
+{
+	PrepareRPN();
+
+	return (this->*m_pParserEngine)();
+}
+
+//---------------------------------------------------------------------------
+/** \brief Create the RPN and switch to the RPN based parse function. */
+void ParserXBase::PrepareRPN() const
 {
 	CreateRPN();
 
@@ -982,8 +1005,6 @@ const IValue& ParserXBase::ParseFromString() const
 	}
 
 	m_pParserEngine = &ParserXBase::ParseFromRPN;
-
-	return (this->*m_pParserEngine)();
 }
 
 //---------------------------------------------------------------------------
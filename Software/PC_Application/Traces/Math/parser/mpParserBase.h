@@ -120,6 +120,7 @@ MUP_NAMESPACE_START
     void ClearPostfixOprt();
     void ClearOprt();
     void DumpRPN() const;
+    const RPN& GetRPN() const;
 
     const var_maptype& GetExprVar() const;
     const var_maptype& GetVar() const;
@@ -173,6 +174,7 @@ MUP_NAMESPACE_START
     void ApplyFunc(Stack<ptr_tok_type> &a_stOpt, int a_iArgCount) const;
     void ApplyIfElse(Stack<ptr_tok_type> &a_stOpt) const;
     void ApplyRemainingOprt(Stack<ptr_tok_type> &a_stOpt) const;
+    void PrepareRPN() const;
     const IValue& ParseFromString() const; 
     const IValue& ParseFromRPN() const; 
 
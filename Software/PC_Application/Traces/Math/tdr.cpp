@@ -1,9 +1,11 @@
 #include "tdr.h"
 
 #include "Traces/fftcomplex.h"
+#include "Traces/fftplan.h"
 #include "ui_tdrdialog.h"
 #include "ui_tdrexplanationwidget.h"
 #include "Util/util.h"
+#include "unit.h"
 #include "appwindow.h"
 
 #include <QVBoxLayout>
@@ -19,6 +21,12 @@ TDR::TDR()
     manualDC = 1.0;
     stepResponse = true;
     mode = Mode::Lowpass;
+    zoom = false;
+    automaticRange = true;
+    rangeStart = 0.0;
+    rangeStop = 100e-9;
+    rangePoints = 1001;
+    displayedMin = displayedMax = 0.0;
 
     destructing = false;
     thread = new TDRThread(*this);
@@ -57,6 +65,13 @@ QString TDR::description()
         ret += "bandpass)";
     }
     ret += ", window: " + window.getDescription();
+    if(zoom) {
+        if(automaticRange) {
+            ret += ", zoom: graph range";
+        } else {
+            ret += ", zoom: " + Unit::ToString(rangeStart, "s", "pnum ", 3) + " to " + Unit::ToString(rangeStop, "s", "pnum ", 3);
+        }
+    }
 
     return ret;
 }
@@ -81,6 +96,8 @@ void TDR::edit()
         enable &= !automaticDC;
         ui->manualPhase->setEnabled(enable);
         ui->manualMag->setEnabled(enable);
+        ui->rangeStart->setEnabled(!automaticRange);
+        ui->rangeStop->setEnabled(!automaticRange);
     };
 
     connect(ui->mode, qOverload<int>(&QComboBox::currentIndexChanged), [=](int index){
@@ -127,6 +144,60 @@ void TDR::edit()
         updateTDR();
     });
 
+    ui->rangeBox->setChecked(zoom);
+    if(automaticRange) {
+        ui->rangeAutomatic->setChecked(true);
+    } else {
+        ui->rangeManual->setChecked(true);
+    }
+    ui->rangeStart->setUnit("s");
+    ui->rangeStart->setPrefixes("pnum ");
+    ui->rangeStart->setPrecision(6);
+    ui->rangeStart->setValue(rangeStart);
+    ui->rangeStop->setUnit("s");
+    ui->rangeStop->setPrefixes("pnum ");
+    ui->rangeStop->setPrecision(6);
+    ui->rangeStop->setValue(rangeStop);
+    ui->rangePoints->setValue(rangePoints);
+    updateEnabledWidgets();
+
+    connect(ui->rangeBox, &QGroupBox::toggled, [=](bool enabled) {
+        {
+            std::lock_guard<std::mutex> lock(rangeMutex);
+            zoom = enabled;
+        }
+        updateTDR();
+    });
+    connect(ui->rangeManual, &QRadioButton::toggled, [=](bool manual) {
+        {
+            std::lock_guard<std::mutex> lock(rangeMutex);
+            automaticRange = !manual;
+        }
+        updateEnabledWidgets();
+        updateTDR();
+    });
+    connect(ui->rangeStart, &SIUnitEdit::valueChanged, [=](double newval){
+        {
+            std::lock_guard<std::mutex> lock(rangeMutex);
+            rangeStart = newval;
+        }
+        updateTDR();
+    });
+    connect(ui->rangeStop, &SIUnitEdit::valueChanged, [=](double newval){
+        {
+            std::lock_guard<std::mutex> lock(rangeMutex);
+            rangeStop = newval;
+        }
+        updateTDR();
+    });
+    connect(ui->rangePoints, qOverload<int>(&QSpinBox::valueChanged), [=](int newval){
+        {
+            std::lock_guard<std::mutex> lock(rangeMutex);
+            rangePoints = newval;
+        }
+        updateTDR();
+    });
+
     connect(ui->buttonBox, &QDialogButtonBox::accepted, d, &QDialog::accept);
     if(AppWindow::showGUI()) {
         d->show();
@@ -159,6 +230,13 @@ nlohmann::json TDR::toJSON()
             }
         }
     }
+    j["zoom"] = zoom;
+    if(zoom) {
+        j["zoom_automatic"] = automaticRange;
+        j["zoom_start"] = rangeStart;
+        j["zoom_stop"] = rangeStop;
+        j["zoom_points"] = rangePoints;
+    }
     return j;
 }
 
@@ -183,6 +261,14 @@ void TDR::fromJSON(nlohmann::json j)
             stepResponse = false;
         }
     }
+    {
+        std::lock_guard<std::mutex> lock(rangeMutex);
+        zoom = j.value("zoom", false);
+        automaticRange = j.value("zoom_automatic", true);
+        rangeStart = j.value("zoom_start", 0.0);
+        rangeStop = j.value("zoom_stop", 100e-9);
+        rangePoints = j.value("zoom_points", 1001);
+    }
 }
 
 void TDR::setMode(Mode m)
@@ -235,6 +321,39 @@ TDR::Mode TDR::getMode() const
     return mode;
 }
 
+void TDR::setDisplayedRange(double min, double max)
+{
+    if(min == displayedMin && max == displayedMax) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(rangeMutex);
+        displayedMin = min;
+        displayedMax = max;
+    }
+    if(zoom && automaticRange) {
+        updateTDR();
+    }
+}
+
+bool TDR::getZoomRange(double &start, double &stop, unsigned int &points) const
+{
+    std::lock_guard<std::mutex> lock(rangeMutex);
+    if(!zoom) {
+        return false;
+    }
+    if(automaticRange) {
+        // without a graph with a fixed range, the full time range is calculated
+        start = displayedMin;
+        stop = displayedMax;
+    } else {
+        start = rangeStart;
+        stop = rangeStop;
+    }
+    points = rangePoints;
+    return start < stop && points >= 2;
+}
+
 TDRThread::TDRThread(TDR &tdr)
     : tdr(tdr)
 {
@@ -256,8 +375,12 @@ void TDRThread::run()
         qDebug() << "TDR thread calculating";
         // perform calculation
         vector<complex<double>> frequencyDomain;
+        // set if the step response was calculated directly instead of from the impulse response samples
+        bool stepResponseCalculated = false;
         auto stepSize = (tdr.input->rData().back().x - tdr.input->rData().front().x) / (tdr.input->rData().size() - 1);
         if(tdr.mode == TDR::Mode::Lowpass) {
+            // The negative frequencies are the complex conjugates of the positive ones. Only the non-negative half of
+            // the spectrum is set up, frequencyDomain[0] is the DC bin
             if(tdr.stepResponse) {
                 auto steps = tdr.input->rData().size();
                 auto firstStep = tdr.input->rData().front().x;
@@ -272,20 +395,18 @@ void TDRThread::run()
                     steps = tdr.input->rData().back().x / firstStep;
                     stepSize = firstStep;
                 }
-                frequencyDomain.resize(2 * steps + 1);
-                // copy frequencies, use the flipped conjugate for negative part
+                frequencyDomain.resize(steps + 1);
+                TraceMath::Interpolator interpolator(tdr.input->rData());
                 for(unsigned int i = 1;i<=steps;i++) {
-                    auto S = tdr.input->getInterpolatedSample(stepSize * i).y;
-                    frequencyDomain[steps - i] = conj(S);
-                    frequencyDomain[steps + i] = S;
+                    frequencyDomain[i] = interpolator.at(stepSize * i).y;
                 }
                 if(tdr.automaticDC) {
                     // use simple extrapolation from lowest two points to extract DC value
-                    auto abs_DC = 2.0 * abs(frequencyDomain[steps + 1]) - abs(frequencyDomain[steps + 2]);
-                    auto phase_DC = 2.0 * arg(frequencyDomain[steps + 1]) - arg(frequencyDomain[steps + 2]);
-                    frequencyDomain[steps] = polar(abs_DC, phase_DC);
+                    auto abs_DC = 2.0 * abs(frequencyDomain[1]) - abs(frequencyDomain[2]);
+                    auto phase_DC = 2.0 * arg(frequencyDomain[1]) - arg(frequencyDomain[2]);
+                    frequencyDomain[0] = polar(abs_DC, phase_DC);
                 } else {
-                    frequencyDomain[steps] = tdr.manualDC;
+                    frequencyDomain[0] = tdr.manualDC;
                 }
             } else {
                 auto steps = tdr.input->rData().size();
@@ -296,12 +417,68 @@ void TDRThread::run()
                     offset++;
                 }
                 // no step response required, can use frequency values as they are. No extra extrapolated DC value here -> 2 values less than with step response
-                frequencyDomain.resize(2 * steps - 1);
-                frequencyDomain[steps - 1] = tdr.input->rData()[offset].y;
-                for(unsigned int i = 1;i<steps;i++) {
-                    auto S = tdr.input->rData()[i + offset].y;
-                    frequencyDomain[steps - i - 1] = conj(S);
-                    frequencyDomain[steps + i - 1] = S;
+                frequencyDomain.resize(steps);
+                for(unsigned int i = 0;i<steps;i++) {
+                    frequencyDomain[i] = tdr.input->rData()[i + offset].y;
+                }
+            }
+            tdr.window.applyOneSided(frequencyDomain);
+
+            // The last bin is used as the Nyquist bin of an even length spectrum, the inverse transform only needs a
+            // complex FFT of half the length
+            auto fft_bins = frequencyDomain.size() > 1 ? 2 * (frequencyDomain.size() - 1) : 1;
+            // the DC bin is not necessarily real, its imaginary part is a constant offset
+            auto offset = frequencyDomain[0].imag();
+            double start, stop;
+            unsigned int points;
+            if(tdr.getZoomRange(start, stop, points)) {
+                // Only evaluate the requested times, with the same scaling as the full transform:
+                // x(t) = Re(X[0]) + 2 * Re(sum over k of X[k] * exp(2*pi*i*k*stepSize*t))
+                // The Nyquist bin is not mirrored, it only contributes half as much as the other bins
+                if(frequencyDomain.size() > 1) {
+                    frequencyDomain.back() /= 2.0;
+                }
+                auto spacing = (stop - start) / (points - 1);
+                auto &plan = zoomPlan(frequencyDomain.size(), points, stepSize * start, stepSize * spacing);
+                vector<complex<double>> z;
+                plan.execute(frequencyDomain, z);
+                auto DC = frequencyDomain[0].real();
+
+                tdr.data.clear();
+                tdr.data.resize(points);
+                for(unsigned int i = 0;i<points;i++) {
+                    tdr.data.setX(i, start + spacing * i);
+                    tdr.data.setY(i, complex<double>(2.0 * z[i].real() - DC, offset) / (double) fft_bins);
+                }
+                if(tdr.stepResponse) {
+                    // The samples do not start at t=0 and their spacing is arbitrary, summing them up does not work.
+                    // Integrate the impulse response instead (scaled like the sum of the full time range samples):
+                    // s(t) = Re(X[0]) * stepSize * t + Re(sum over k of X[k] / (pi*i*k) * (exp(2*pi*i*k*stepSize*t) - 1))
+                    double constant = 0.0;
+                    frequencyDomain[0] = 0.0;
+                    for(unsigned int k = 1;k<frequencyDomain.size();k++) {
+                        frequencyDomain[k] /= complex<double>(0.0, M_PI * k);
+                        constant += frequencyDomain[k].real();
+                    }
+                    plan.execute(frequencyDomain, z);
+                    vector<double> step(points);
+                    for(unsigned int i = 0;i<points;i++) {
+                        step[i] = DC * stepSize * tdr.data.x(i) + z[i].real() - constant;
+                    }
+                    tdr.TraceMath::stepResponse = std::move(step);
+                    stepResponseCalculated = true;
+                }
+            } else {
+                // complex to real transform of the two-sided spectrum
+                const double fs = 1.0 / (stepSize * fft_bins);
+                vector<double> timeDomain;
+                Fft::InverseRealPlan::get(fft_bins)->execute(frequencyDomain, timeDomain);
+
+                tdr.data.clear();
+                tdr.data.resize(fft_bins);
+                for(unsigned int i = 0;i<fft_bins;i++) {
+                    tdr.data.setX(i, fs * i);
+                    tdr.data.setY(i, complex<double>(timeDomain[i], offset) / (double) fft_bins);
                 }
             }
         } else {
@@ -311,28 +488,56 @@ void TDRThread::run()
             for(unsigned int i=0;i<tdr.input->rData().size();i++) {
                 frequencyDomain[i] = tdr.input->rData()[i].y;
             }
-        }
 
-        tdr.window.apply(frequencyDomain);
-        Fft::shift(frequencyDomain, true);
+            tdr.window.apply(frequencyDomain);
+            auto fft_bins = frequencyDomain.size();
+
+            double start, stop;
+            unsigned int points;
+            if(tdr.getZoomRange(start, stop, points)) {
+                // The FFT treats the bin in the middle as DC, the chirp-Z transform starts at the first bin:
+                // x(t) = exp(-2*pi*i*center*stepSize*t) * sum over k of X[k] * exp(2*pi*i*k*stepSize*t)
+                auto spacing = (stop - start) / (points - 1);
+                vector<complex<double>> z;
+                zoomPlan(fft_bins, points, stepSize * start, stepSize * spacing).execute(frequencyDomain, z);
+                auto center = fft_bins / 2;
+
+                tdr.data.clear();
+                tdr.data.resize(points);
+                for(unsigned int i = 0;i<points;i++) {
+                    auto t = start + spacing * i;
+                    auto cycles = center * stepSize * t;
+                    auto phase = polar(1.0, -2.0 * M_PI * (cycles - floor(cycles)));
+                    tdr.data.setX(i, t);
+                    tdr.data.setY(i, z[i] * phase / (double) fft_bins);
+                }
+            } else {
+                Fft::shift(frequencyDomain, true);
 
-        auto fft_bins = frequencyDomain.size();
-        const double fs = 1.0 / (stepSize * fft_bins);
+                const double fs = 1.0 / (stepSize * fft_bins);
 
-        Fft::transform(frequencyDomain, true);
+                Fft::transform(frequencyDomain, true);
 
-        tdr.data.clear();
-        tdr.data.resize(fft_bins);
+                tdr.data.clear();
+                tdr.data.resize(fft_bins);
 
-        for(unsigned int i = 0;i<fft_bins;i++) {
-            tdr.data[i].x = fs * i;
-            tdr.data[i].y = frequencyDomain[i] / (double) fft_bins;
+                for(unsigned int i = 0;i<fft_bins;i++) {
+                    tdr.data.setX(i, fs * i);
+                    tdr.data.setY(i, frequencyDomain[i] / (double) fft_bins);
+                }
+            }
         }
-        if(tdr.stepResponse && tdr.mode == TDR::Mode::Lowpass) {
-            tdr.updateStepResponse(true);
-        } else {
-            tdr.updateStepResponse(false);
+        if(!stepResponseCalculated) {
+            tdr.updateStepResponse(tdr.stepResponse && tdr.mode == TDR::Mode::Lowpass);
         }
         emit tdr.outputSamplesChanged(0, tdr.data.size());
     }
 }
+
+const Fft::ChirpZ &TDRThread::zoomPlan(size_t n, size_t m, double start, double step)
+{
+    if(!chirpZ || !chirpZ->matches(n, m, start, step, true)) {
+        chirpZ.reset(new Fft::ChirpZ(n, m, start, step, true));
+    }
+    return *chirpZ;
+}
@@ -3,9 +3,12 @@
 
 #include "tracemath.h"
 #include "windowfunction.h"
+#include "Traces/fftplan.h"
 
 #include <QThread>
 #include <QSemaphore>
+#include <memory>
+#include <mutex>
 
 namespace Math {
 
@@ -19,7 +22,10 @@ public:
     ~TDRThread(){};
 private:
     void run() override;
+    // returns a chirp-Z plan for the parameters, the last one is kept as long as they do not change
+    const Fft::ChirpZ& zoomPlan(size_t n, size_t m, double start, double step);
     TDR &tdr;
+    std::unique_ptr<Fft::ChirpZ> chirpZ;
 };
 
 class TDR : public TraceMath
@@ -48,16 +54,31 @@ public:
     Mode getMode() const;
     const WindowFunction& getWindow() const;
 
+    void setDisplayedRange(double min, double max) override;
+
 public slots:
     void inputSamplesChanged(unsigned int begin, unsigned int end) override;
 
 private:
     void updateTDR();
+    // returns true if only a time range has to be calculated. Called from the worker thread, returns a
+    // consistent snapshot of the zoom settings
+    bool getZoomRange(double &start, double &stop, unsigned int &points) const;
     Mode mode;
     WindowFunction window;
     bool stepResponse;
     bool automaticDC;
     std::complex<double> manualDC;
+    // Zoom: calculate only a time range (with a chirp-Z transform instead of the FFT). The range is either
+    // set manually or follows the X axis of a graph displaying the output
+    bool zoom;
+    bool automaticRange;
+    double rangeStart, rangeStop;
+    unsigned int rangePoints;
+    // range reported by a graph, not fixed if displayedMin >= displayedMax
+    double displayedMin, displayedMax;
+    // protects the zoom settings and the displayed range, they are changed while the worker thread calculates
+    mutable std::mutex rangeMutex;
     TDRThread *thread;
     bool destructing;
     QSemaphore semphr;
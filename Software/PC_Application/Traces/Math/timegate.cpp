@@ -13,7 +13,11 @@
 #include <QDialog>
 #include <QPainter>
 #include <QMouseEvent>
+#include <QDebug>
+#include <tuple>
 
+std::mutex Math::TimeGate::cacheMutex;
+std::map<Math::TimeGate::Parameters, std::shared_ptr<const std::vector<double>>> Math::TimeGate::cache;
 
 Math::TimeGate::TimeGate()
 {
@@ -25,7 +29,23 @@ Math::TimeGate::TimeGate()
         center = 10e-9;
         span = 2e-9;
 //    }
+    filterParameters = requestedParameters = pendingParameters = calculatedParameters = {};
     connect(&window, &WindowFunction::changed, this, &TimeGate::updateFilter);
+    // emitted from the worker thread, handled in the GUI thread
+    connect(this, &TimeGate::responseAvailable, this, &TimeGate::filterCalculated, Qt::QueuedConnection);
+
+    destructing = false;
+    thread = new TimeGateThread(*this);
+    thread->start(TimeGateThread::Priority::LowestPriority);
+}
+
+Math::TimeGate::~TimeGate()
+{
+    // tell thread to exit
+    destructing = true;
+    semphr.release();
+    thread->wait();
+    delete thread;
 }
 
 TraceMath::DataType Math::TimeGate::outputType(TraceMath::DataType inputType)
@@ -80,7 +100,7 @@ void Math::TimeGate::edit()
 
     ui->span->setUnit("s");
     ui->span->setPrefixes("pnum ");
-    ui->span->setValue(center);
+    ui->span->setValue(span);
 
     if(bandpass) {
         ui->type->setCurrentIndex(0);
@@ -149,7 +169,7 @@ void Math::TimeGate::fromJSON(nlohmann::json j)
 void Math::TimeGate::setStart(double start)
 {
     if(input && input->rData().size() > 0 && start < input->rData().front().x) {
-        start = input->rData().back().x;
+        start = input->rData().front().x;
     }
 
     double stop = center + span / 2;
@@ -214,9 +234,15 @@ void Math::TimeGate::inputSamplesChanged(unsigned int begin, unsigned int end)
         data.resize(input->rData().size());
         updateFilter();
     }
+    if(!filter || filter->size() != data.size()) {
+        // the gate response for this number of samples is still being calculated, the output is updated when it is available
+        return;
+    }
+    auto &in = input->rData();
+    auto &f = *filter;
     for(auto i = begin;i<end;i++) {
-        data[i] = input->rData()[i];
-        data[i].y *= filter[i];
+        data.setX(i, in.x(i));
+        data.setY(i, in.y(i) * f[i]);
     }
     emit outputSamplesChanged(begin, end);
     if(input->rData().size() > 0) {
@@ -226,32 +252,98 @@ void Math::TimeGate::inputSamplesChanged(unsigned int begin, unsigned int end)
     }
 }
 
+const std::vector<double> &Math::TimeGate::rFilter()
+{
+    static const std::vector<double> empty;
+    return filter ? *filter : empty;
+}
+
 void Math::TimeGate::updateFilter()
 {
     if(!input) {
         return;
     }
-    std::vector<std::complex<double>> buf;
-    filter.clear();
-    buf.resize(input->rData().size() * 2);
-    if(!buf.size()) {
+    requestedParameters = currentParameters();
+    if(!requestedParameters.samples) {
+        filter = nullptr;
+        return;
+    }
+    if(filter && requestedParameters == filterParameters) {
+        // nothing changed
+        return;
+    }
+    auto response = cachedResponse(requestedParameters);
+    if(response) {
+        setFilter(response, requestedParameters);
+        return;
+    }
+    // Calculate in the worker thread. If the gate changes again before it is done (e.g. while dragging an edge),
+    // only the latest parameters are calculated
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pendingParameters = requestedParameters;
+    }
+    semphr.release();
+}
+
+void Math::TimeGate::filterCalculated()
+{
+    if(filter && filterParameters == requestedParameters) {
+        // already using the requested gate (e.g. found in the cache), this response is outdated
         return;
     }
-    auto maxX = input->rData().back().x;
-    auto minX = input->rData().front().x;
+    std::shared_ptr<const std::vector<double>> response;
+    Parameters p;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        response = calculatedResponse;
+        p = calculatedParameters;
+    }
+    if(response && p.samples == requestedParameters.samples) {
+        // use it even if it is not the latest one, the gate follows the edges while they are dragged
+        setFilter(response, p);
+    }
+}
+
+void Math::TimeGate::setFilter(std::shared_ptr<const std::vector<double>> response, const Parameters &p)
+{
+    filter = response;
+    filterParameters = p;
+    emit filterUpdated();
+
+    // needs to update output samples, pretend that input samples have changed
+    inputSamplesChanged(0, input->rData().size());
+}
+
+Math::TimeGate::Parameters Math::TimeGate::currentParameters()
+{
+    Parameters p = {};
+    p.samples = input->rData().size();
+    if(p.samples) {
+        auto maxX = input->rData().back().x;
+        auto minX = input->rData().front().x;
+        p.start = Util::Scale<double>(center - span / 2, minX, maxX, 0, 1);
+        p.stop = Util::Scale<double>(center + span / 2, minX, maxX, 0, 1);
+    }
+    p.bandpass = bandpass;
+    p.window = window.getType();
+    p.windowParameter = window.getParameter();
+    return p;
+}
 
-    auto wc1 = Util::Scale<double>(center - span / 2, minX, maxX, 0, 1);
-    auto wc2 = Util::Scale<double>(center + span / 2, minX, maxX, 0, 1);
+std::vector<double> Math::TimeGate::calculateResponse(const Parameters &p)
+{
+    std::vector<std::complex<double>> buf(p.samples * 2);
 
     // create ideal filter coefficients
     for(unsigned int i=0;i<buf.size();i++) {
         int n = i - buf.size() / 2;
         if(n == 0) {
-            buf[i] = wc2 - wc1;
+            buf[i] = p.stop - p.start;
         } else {
-            buf[i] = (sin(M_PI * wc2 * n) - sin(M_PI * wc1 * n)) / (n * M_PI);
+            buf[i] = (sin(M_PI * p.stop * n) - sin(M_PI * p.start * n)) / (n * M_PI);
         }
-        if(!bandpass) {
+        if(!p.bandpass) {
             if(n == 0) {
                 buf[i] = 1.0 - buf[i];
             } else {
@@ -260,18 +352,81 @@ void Math::TimeGate::updateFilter()
         }
     }
 
+    WindowFunction window(p.window);
+    window.setParameter(p.windowParameter);
     window.apply(buf);
     Fft::shift(buf, true);
     Fft::transform(buf, false);
 
-    filter.resize(buf.size() / 2);
-    for(unsigned int i=0;i<buf.size() / 2;i++) {
-        filter[i] = abs(buf[i]);
+    std::vector<double> response(p.samples);
+    for(unsigned int i=0;i<p.samples;i++) {
+        response[i] = abs(buf[i]);
     }
-    emit filterUpdated();
+    return response;
+}
 
-    // needs to update output samples, pretend that input samples have changed
-    inputSamplesChanged(0, input->rData().size());
+std::shared_ptr<const std::vector<double>> Math::TimeGate::cachedResponse(const Parameters &p)
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    auto it = cache.find(p);
+    if(it != cache.end()) {
+        return it->second;
+    }
+    return nullptr;
+}
+
+bool Math::TimeGate::Parameters::operator<(const Parameters &p) const
+{
+    return std::tie(samples, start, stop, bandpass, window, windowParameter)
+            < std::tie(p.samples, p.start, p.stop, p.bandpass, p.window, p.windowParameter);
+}
+
+bool Math::TimeGate::Parameters::operator==(const Parameters &p) const
+{
+    return std::tie(samples, start, stop, bandpass, window, windowParameter)
+            == std::tie(p.samples, p.start, p.stop, p.bandpass, p.window, p.windowParameter);
+}
+
+Math::TimeGateThread::TimeGateThread(Math::TimeGate &gate)
+    : gate(gate)
+{
+
+}
+
+void Math::TimeGateThread::run()
+{
+    qDebug() << "Time gate thread starting";
+    while(1) {
+        gate.semphr.acquire();
+        // clear possible additional semaphores
+        gate.semphr.tryAcquire(gate.semphr.available());
+        if(gate.destructing) {
+            // time gate about to be deleted, exit thread
+            qDebug() << "Time gate thread exiting";
+            return;
+        }
+        TimeGate::Parameters p;
+        {
+            std::lock_guard<std::mutex> lock(gate.mutex);
+            p = gate.pendingParameters;
+        }
+        // another time gate may have calculated the same response already
+        auto response = TimeGate::cachedResponse(p);
+        if(!response) {
+            response = std::make_shared<const std::vector<double>>(TimeGate::calculateResponse(p));
+            std::lock_guard<std::mutex> lock(TimeGate::cacheMutex);
+            if(TimeGate::cache.size() >= TimeGate::MaxCachedResponses) {
+                TimeGate::cache.clear();
+            }
+            TimeGate::cache.emplace(p, response);
+        }
+        {
+            std::lock_guard<std::mutex> lock(gate.mutex);
+            gate.calculatedResponse = response;
+            gate.calculatedParameters = p;
+        }
+        emit gate.responseAvailable();
+    }
 }
 
 Math::TimeGateGraph::TimeGateGraph(QWidget *parent)
@@ -289,7 +444,7 @@ QPoint Math::TimeGateGraph::plotValueToPixel(double x, double y)
         return QPoint(0, 0);
     }
 
-    auto input = gate->getInput()->rData();
+    auto &input = gate->getInput()->rData();
     auto minX = input.front().x;
     auto maxX = input.back().x;
 
@@ -310,7 +465,7 @@ QPointF Math::TimeGateGraph::pixelToPlotValue(QPoint p)
         return QPointF(0.0, 0.0);
     }
 
-    auto input = gate->getInput()->rData();
+    auto &input = gate->getInput()->rData();
     auto minX = input.front().x;
     auto maxX = input.back().x;
 
@@ -331,7 +486,7 @@ void Math::TimeGateGraph::paintEvent(QPaintEvent *event)
         return;
     }
     // grab input data
-    auto input = gate->getInput()->rData();
+    auto &input = gate->getInput()->rData();
 
     Q_UNUSED(event)
     auto pref = Preferences::getInstance();
@@ -387,7 +542,7 @@ void Math::TimeGateGraph::paintEvent(QPaintEvent *event)
         p.drawLine(p1, p2);
     }
     // plot filter shape
-    auto filter = gate->rFilter();
+    auto &filter = gate->rFilter();
     pen = QPen(Qt::red, 1);
     p.setPen(pen);
     for(unsigned int i=increment;i<filter.size() && i<input.size();i+=increment) {
@@ -4,10 +4,28 @@
 #include "tracemath.h"
 #include "windowfunction.h"
 
+#include <QThread>
+#include <QSemaphore>
+#include <memory>
+#include <mutex>
+#include <map>
+
 namespace Math {
 
 class TimeGate;
 
+// Calculates the gate responses of a time gate, the GUI stays responsive while the gate is edited
+class TimeGateThread : public QThread
+{
+    Q_OBJECT
+public:
+    TimeGateThread(TimeGate &gate);
+    ~TimeGateThread(){};
+private:
+    void run() override;
+    TimeGate &gate;
+};
+
 class TimeGateGraph : public QWidget {
 public:
     TimeGateGraph(QWidget *parent);
@@ -31,9 +49,11 @@ private:
 
 class TimeGate : public TraceMath
 {
+    friend class TimeGateThread;
     Q_OBJECT
 public:
     TimeGate();
+    ~TimeGate();
 
     virtual DataType outputType(DataType inputType) override;
     virtual QString description() override;
@@ -46,7 +66,8 @@ public:
     virtual void fromJSON(nlohmann::json j) override;
     Type getType() override {return Type::TimeGate;};
 
-    const std::vector<double> &rFilter() { return filter;};
+    // gate response for every input sample, may be empty or outdated while the gate is calculated
+    const std::vector<double> &rFilter();
 
     double getStart();
     double getStop();
@@ -62,8 +83,11 @@ public slots:
 
 private slots:
     void updateFilter();
+    void filterCalculated();
 signals:
     void filterUpdated();
+    // emitted from the worker thread when a gate response is available
+    void responseAvailable();
     void startChanged(double newval);
     void stopChanged(double newval);
     void centerChanged(double newval);
@@ -75,10 +99,43 @@ private:
         Hann
     };
 
+    // everything the gate response depends on. Responses are cached with these as the key
+    class Parameters {
+    public:
+        unsigned int samples;
+        // gate edges, normalized to the time range of the input
+        double start, stop;
+        bool bandpass;
+        WindowFunction::Type window;
+        double windowParameter;
+        bool operator<(const Parameters &p) const;
+        bool operator==(const Parameters &p) const;
+    };
+    Parameters currentParameters();
+    static std::vector<double> calculateResponse(const Parameters &p);
+    // Gate responses shared by all time gates (e.g. the same gate on several traces). Dragging an edge creates many
+    // entries, the cache is cleared when it reaches MaxCachedResponses
+    static std::mutex cacheMutex;
+    static std::map<Parameters, std::shared_ptr<const std::vector<double>>> cache;
+    static constexpr unsigned int MaxCachedResponses = 16;
+    static std::shared_ptr<const std::vector<double>> cachedResponse(const Parameters &p);
+    void setFilter(std::shared_ptr<const std::vector<double>> response, const Parameters &p);
+
     bool bandpass;
     double center, span;
     WindowFunction window;
-    std::vector<double> filter;
+    std::shared_ptr<const std::vector<double>> filter;
+    // parameters of the current filter and of the requested one
+    Parameters filterParameters, requestedParameters;
+
+    // exchange with the worker thread, protected by mutex
+    std::mutex mutex;
+    Parameters pendingParameters;
+    std::shared_ptr<const std::vector<double>> calculatedResponse;
+    Parameters calculatedParameters;
+    TimeGateThread *thread;
+    bool destructing;
+    QSemaphore semphr;
 };
 
 }
@@ -107,27 +107,43 @@ double TraceMath::getStepResponse(unsigned int index)
 }
 
 TraceMath::Data TraceMath::getInterpolatedSample(double x)
+{
+    return Interpolator(data).at(x);
+}
+
+TraceMath::Data TraceMath::Interpolator::at(double x)
 {
     Data ret;
 
-    if(data.size() == 0 || x < data.front().x || x > data.back().x) {
+    if(s.size() == 0 || x < s.x(0) || x > s.x(s.size() - 1)) {
         ret.y = std::numeric_limits<std::complex<double>>::quiet_NaN();
         ret.x = std::numeric_limits<double>::quiet_NaN();
+        return ret;
+    }
+    auto xs = s.xData();
+    if(index >= s.size() || (index > 0 && xs[index - 1] >= x)) {
+        // moved backwards, start over
+        index = 0;
+    }
+    // the next position is usually only a few samples further, only search if that is not the case
+    constexpr unsigned int maxSteps = 8;
+    unsigned int steps = 0;
+    while(xs[index] < x && steps < maxSteps) {
+        index++;
+        steps++;
+    }
+    if(xs[index] < x) {
+        index = std::lower_bound(xs + index, xs + s.size(), x) - xs;
+    }
+    if(xs[index] == x) {
+        ret = s.get(index);
     } else {
-        auto it = lower_bound(data.begin(), data.end(), x, [](const Data &lhs, const double x) -> bool {
-            return lhs.x < x;
-        });
-        if(it->x == x) {
-            ret = *it;
-        } else {
-            // no exact match, needs to interpolate
-            auto high = *it;
-            it--;
-            auto low = *it;
-            double alpha = (x - low.x) / (high.x - low.x);
-            ret.y = low.y * (1 - alpha) + high.y * alpha;
-            ret.x = x;
-        }
+        // no exact match, needs to interpolate
+        auto high = s.get(index);
+        auto low = s.get(index - 1);
+        double alpha = (x - low.x) / (high.x - low.x);
+        ret.y = low.y * (1 - alpha) + high.y * alpha;
+        ret.x = x;
     }
     return ret;
 }
@@ -230,8 +246,9 @@ void TraceMath::updateStepResponse(bool valid)
     if(valid) {
         stepResponse.resize(data.size());
         double accumulate = 0.0;
+        auto real = data.realData();
         for(unsigned int i=0;i<data.size();i++) {
-            accumulate += data[i].y.real();
+            accumulate += real[i];
             stepResponse[i] = accumulate;
         }
     } else {
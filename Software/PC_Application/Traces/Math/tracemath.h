@@ -6,6 +6,8 @@
 #include <QObject>
 #include <vector>
 #include <complex>
+#include <algorithm>
+#include <cmath>
 /*
  * How to implement a new type of math operation:
  * 1. Create your new math operation class by deriving from this class. Put the new class in the namespace
@@ -57,6 +59,80 @@ public:
         std::complex<double> y;
     };
 
+    // Samples are stored as separate arrays for X, real and imaginary part (structure of arrays). Scans that
+    // only need one component (e.g. the X values for a search or the magnitude for a peak search) run over
+    // contiguous memory and can be vectorized by the compiler.
+    class Samples {
+    public:
+        unsigned int size() const { return xs.size(); }
+        bool empty() const { return xs.empty(); }
+        void clear() { xs.clear(); re.clear(); im.clear(); }
+        // added samples are initialized to zero
+        void resize(unsigned int n) { xs.resize(n); re.resize(n); im.resize(n); }
+        void reserve(unsigned int n) { xs.reserve(n); re.reserve(n); im.reserve(n); }
+
+        Data get(unsigned int index) const { return {xs[index], std::complex<double>(re[index], im[index])}; }
+        Data operator[](unsigned int index) const { return get(index); }
+        Data front() const { return get(0); }
+        Data back() const { return get(size() - 1); }
+        double x(unsigned int index) const { return xs[index]; }
+        std::complex<double> y(unsigned int index) const { return std::complex<double>(re[index], im[index]); }
+
+        void set(unsigned int index, const Data &d) { xs[index] = d.x; setY(index, d.y); }
+        void setX(unsigned int index, double x) { xs[index] = x; }
+        void setY(unsigned int index, std::complex<double> y) { re[index] = y.real(); im[index] = y.imag(); }
+        void push_back(const Data &d) { xs.push_back(d.x); re.push_back(d.y.real()); im.push_back(d.y.imag()); }
+        void insert(unsigned int index, const Data &d) {
+            xs.insert(xs.begin() + index, d.x);
+            re.insert(re.begin() + index, d.y.real());
+            im.insert(im.begin() + index, d.y.imag());
+        }
+        // index of the first sample with an X value not less than x, size() if there is none
+        unsigned int lowerBound(double x) const { return std::lower_bound(xs.begin(), xs.end(), x) - xs.begin(); }
+
+        // direct access to the arrays, valid until the number of samples changes
+        const double *xData() const { return xs.data(); }
+        const double *realData() const { return re.data(); }
+        const double *imagData() const { return im.data(); }
+        // squared magnitude of every sample
+        void magnitudesSquared(std::vector<double> &dest) const {
+            const unsigned int samples = size();
+            dest.resize(samples);
+            const double *r = re.data(), *i = im.data();
+            double *d = dest.data();
+            for(unsigned int n=0;n<samples;n++) {
+                d[n] = r[n] * r[n] + i[n] * i[n];
+            }
+        }
+        // magnitude of every sample in dB
+        void magnitudesdB(std::vector<double> &dest) const {
+            magnitudesSquared(dest);
+            const unsigned int samples = dest.size();
+            double *d = dest.data();
+            for(unsigned int n=0;n<samples;n++) {
+                d[n] = 10.0 * log10(d[n]);
+            }
+        }
+    private:
+        std::vector<double> xs;
+        std::vector<double> re;
+        std::vector<double> im;
+    };
+
+    // Interpolates samples at a sequence of increasing X positions. Every search continues at the position
+    // of the previous one, interpolating a whole grid of k positions is O(n + k) instead of O(k log n).
+    // Decreasing positions are allowed but require a new search from the start.
+    class Interpolator {
+    public:
+        Interpolator(const Samples &samples) : s(samples), index(0) {}
+        // returns the (possibly interpolated) sample at x, NaN if x is outside of the samples
+        Data at(double x);
+    private:
+        const Samples &s;
+        // index of the first sample not less than the last queried position
+        unsigned int index;
+    };
+
     enum class DataType {
         Frequency,
         Time,
@@ -107,10 +183,14 @@ public:
     void assignInput(TraceMath *input);
 
     DataType getDataType() const;
-    std::vector<Data>& rData() { return data;};
+    Samples& rData() { return data;};
     Status getStatus() const;
     QString getStatusDescription() const;
     virtual Type getType() = 0;
+    // Range displayed by the graphs with a manually set X axis (in the unit of the output data type, time in seconds), combined
+    // by the trace (see Trace::reportDisplayedRange). Operations that can limit their calculation to a range (e.g. TDR/DFT in
+    // zoom mode) may follow it. min >= max if the range is not fixed anymore
+    virtual void setDisplayedRange(double min, double max){Q_UNUSED(min) Q_UNUSED(max)};
 
     // returns the trace this math operation is attached to
     Trace* root();
@@ -134,7 +214,7 @@ protected:
     void warning(QString warn);
     void error(QString err);
     void success();
-    std::vector<Data> data;
+    Samples data;
     // buffer for time domain step response data. This makes it possible to access an arbitrary sample of the step response without having to
     // integrate the impulse response every time. Call updateStepResponse in your derived class, if step response data is valid after updating
     // data.
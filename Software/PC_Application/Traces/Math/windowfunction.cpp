@@ -1,24 +1,68 @@
 #include "windowfunction.h"
 
 #include "CustomWidgets/siunitedit.h"
+#include "Traces/fftplan.h"
 #define _USE_MATH_DEFINES
 
 #include <math.h>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <algorithm>
 #include <QComboBox>
 #include <QLabel>
 #include <QFormLayout>
 #include <QDebug>
 
+namespace {
+
+std::mutex cacheMutex;
+std::map<std::tuple<WindowFunction::Type, unsigned int, double>, std::shared_ptr<const std::vector<double>>> cache;
+// only prevents unbounded growth if many different sizes are used
+constexpr size_t MaxCachedTables = 32;
+
+// The complex values are processed as interleaved real and imaginary parts, which allows the compiler to vectorize the loops
+void multiply(std::complex<double> *data, const double *factors, size_t n)
+{
+    auto d = reinterpret_cast<double*>(data);
+    for(size_t i=0;i<n;i++) {
+        d[2*i] *= factors[i];
+        d[2*i+1] *= factors[i];
+    }
+}
+
+void divide(std::complex<double> *data, const double *factors, size_t n)
+{
+    auto d = reinterpret_cast<double*>(data);
+    for(size_t i=0;i<n;i++) {
+        d[2*i] /= factors[i];
+        d[2*i+1] /= factors[i];
+    }
+}
+
+// modified Bessel function of the first kind, order 0 (power series, converges for all arguments)
+double besselI0(double x)
+{
+    double sum = 1.0, term = 1.0;
+    for(unsigned int k=1;term > 1e-17 * sum;k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+}
+
 QString WindowFunction::typeToName(WindowFunction::Type type)
 {
     switch(type) {
     case Type::Rectangular: return "Rectangular"; break;
-//    case Type::Kaiser: return "Kaiser"; break;
+    case Type::Kaiser: return "Kaiser"; break;
     case Type::Hamming: return "Hamming"; break;
     case Type::Hann: return "Hann"; break;
     case Type::Blackman: return "Blackman"; break;
     case Type::Gaussian: return "Gaussian"; break;
-//    case Type::Chebyshev: return "Chebyshev"; break;
+    case Type::Chebyshev: return "Chebyshev"; break;
     default: return "Invalid"; break;
     }
 }
@@ -34,18 +78,31 @@ WindowFunction::WindowFunction(WindowFunction::Type type)
 
 void WindowFunction::apply(std::vector<std::complex<double> > &data) const
 {
-    unsigned int N = data.size();
-    for(unsigned int n = 0;n<N;n++) {
-        data[n] *= getFactor(n, N);
+    if(type == Type::Rectangular || data.empty()) {
+        return;
     }
+    multiply(data.data(), coefficients(data.size())->data(), data.size());
+}
+
+void WindowFunction::applyOneSided(std::vector<std::complex<double> > &data) const
+{
+    if(type == Type::Rectangular || data.size() < 2) {
+        return;
+    }
+    unsigned int center = data.size() - 1;
+    unsigned int N = 2 * center;
+    auto factors = coefficients(N);
+    multiply(data.data(), factors->data() + center, center);
+    // the window is periodic, the last bin is at the edge of the window
+    data.back() *= (*factors)[0];
 }
 
 void WindowFunction::reverse(std::vector<std::complex<double> > &data) const
 {
-    unsigned int N = data.size();
-    for(unsigned int n = 0;n<N;n++) {
-        data[n] /= getFactor(n, N);
+    if(type == Type::Rectangular || data.empty()) {
+        return;
     }
+    divide(data.data(), coefficients(data.size())->data(), data.size());
 }
 
 QWidget *WindowFunction::createEditor()
@@ -77,17 +134,23 @@ QWidget *WindowFunction::createEditor()
                 gaussian_sigma = newval;
             });
             break;
-//        case Type::Chebyshev:
-//            paramLabel = new QLabel("Parameter α:");
-//            paramEdit = new SIUnitEdit("", " ", 3);
-//            paramEdit->setValue(chebyshev_alpha);
-//            QObject::connect(paramEdit, &SIUnitEdit::valueChanged, [=](double newval) {
-//                chebyshev_alpha = newval;
-//            });
-//            break;
-//        case Type::Kaiser:
-//            // TODO
-//            break;
+        case Type::Chebyshev:
+            paramLabel = new QLabel("Parameter α:");
+            paramEdit = new SIUnitEdit("", " ", 3);
+            paramEdit->setValue(chebyshev_alpha);
+            paramEdit->setToolTip("Sidelobe attenuation is 20·α dB");
+            QObject::connect(paramEdit, &SIUnitEdit::valueChanged, [=](double newval) {
+                chebyshev_alpha = newval;
+            });
+            break;
+        case Type::Kaiser:
+            paramLabel = new QLabel("Parameter α:");
+            paramEdit = new SIUnitEdit("", " ", 3);
+            paramEdit->setValue(kaiser_alpha);
+            QObject::connect(paramEdit, &SIUnitEdit::valueChanged, [=](double newval) {
+                kaiser_alpha = newval;
+            });
+            break;
         default:
             break;
         }
@@ -113,8 +176,10 @@ QString WindowFunction::getDescription()
     QString ret = typeToName(type);
     if(type == Type::Gaussian) {
         ret += ", σ=" + QString::number(gaussian_sigma);
-//    } else if(type == Type::Chebyshev) {
-//        ret += ", α=" + QString::number(chebyshev_alpha);
+    } else if(type == Type::Kaiser) {
+        ret += ", α=" + QString::number(kaiser_alpha);
+    } else if(type == Type::Chebyshev) {
+        ret += ", α=" + QString::number(chebyshev_alpha);
     }
     return ret;
 }
@@ -128,6 +193,12 @@ nlohmann::json WindowFunction::toJSON()
     case Type::Gaussian:
         j["sigma"] = gaussian_sigma;
         break;
+    case Type::Kaiser:
+        j["alpha"] = kaiser_alpha;
+        break;
+    case Type::Chebyshev:
+        j["alpha"] = chebyshev_alpha;
+        break;
     default:
         break;
     }
@@ -153,21 +224,28 @@ void WindowFunction::fromJSON(nlohmann::json j)
     case Type::Gaussian:
         gaussian_sigma = j.value("sigma", 0.4);
         break;
+    case Type::Kaiser:
+        kaiser_alpha = j.value("alpha", 3.0);
+        break;
+    case Type::Chebyshev:
+        chebyshev_alpha = j.value("alpha", 5.0);
+        break;
     default:
         break;
     }
 }
 
-double WindowFunction::getFactor(unsigned int n, unsigned int N) const
+double WindowFunction::getFactor(double n, unsigned int N) const
 {
     // all formulas from https://en.wikipedia.org/wiki/Window_function
     switch(type) {
     case Type::Rectangular:
         // nothing to do
         return 1.0;
-//    case Type::Kaiser:
-//        // TODO
-//        break;
+    case Type::Kaiser: {
+        double x = 2.0 * n / N - 1.0;
+        return besselI0(M_PI * kaiser_alpha * sqrt(std::max(1.0 - x * x, 0.0))) / besselI0(M_PI * kaiser_alpha);
+    }
     case Type::Hamming:
         return 25.0/46.0 - (21.0/46.0) * cos(2*M_PI*n / N);
     case Type::Hann:
@@ -176,20 +254,113 @@ double WindowFunction::getFactor(unsigned int n, unsigned int N) const
         return 0.42 - 0.5 * cos(2*M_PI*n / N) + 0.08 * cos(4*M_PI*n / N);
     case Type::Gaussian:
         return exp(-0.5 * pow((n - (double) N/2) / (gaussian_sigma * N / 2), 2));
-//    case Type::Chebyshev: {
-//        double beta = cosh(1.0 / N * acosh(pow(10, chebyshev_alpha)));
-//        double T_N_arg = beta * cos(M_PI*n/(N+1));
-//        double T_N;
-//        if(T_N_arg >= 1.0) {
-//            T_N = cosh(N * acosh(T_N_arg));
-//        } else if(T_N_arg <= -1.0) {
-//            T_N = pow(-1.0, N) * cosh(N * acosh(T_N_arg));
-//        } else {
-//            T_N = cos(N * acos(T_N_arg));
-//        }
-//        return T_N / pow(10.0, chebyshev_alpha);
-//    }
+    case Type::Chebyshev: {
+        // no closed form, interpolate between the coefficients
+        if(N == 0) {
+            return 1.0;
+        }
+        auto table = coefficients(N);
+        double pos = fmod(n, N);
+        if(pos < 0) {
+            pos += N;
+        }
+        unsigned int i = std::min((unsigned int) pos, N - 1);
+        double frac = pos - i;
+        return (*table)[i] * (1.0 - frac) + (*table)[(i + 1) % N] * frac;
+    }
     default:
         return 1.0;
     }
 }
+
+double WindowFunction::getParameter() const
+{
+    switch(type) {
+    case Type::Kaiser: return kaiser_alpha;
+    case Type::Gaussian: return gaussian_sigma;
+    case Type::Chebyshev: return chebyshev_alpha;
+    default: return 0.0;
+    }
+}
+
+void WindowFunction::setParameter(double value)
+{
+    switch(type) {
+    case Type::Kaiser: kaiser_alpha = value; break;
+    case Type::Gaussian: gaussian_sigma = value; break;
+    case Type::Chebyshev: chebyshev_alpha = value; break;
+    default: break;
+    }
+}
+
+std::shared_ptr<const std::vector<double>> WindowFunction::coefficients(unsigned int N) const
+{
+    auto key = std::make_tuple(type, N, getParameter());
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        auto it = cache.find(key);
+        if(it != cache.end()) {
+            return it->second;
+        }
+    }
+    // calculate without holding the lock, Chebyshev windows are expensive for large N
+    auto table = std::make_shared<const std::vector<double>>(calculateCoefficients(N));
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    if(cache.size() >= MaxCachedTables) {
+        cache.clear();
+    }
+    return cache.emplace(key, table).first->second;
+}
+
+std::vector<double> WindowFunction::calculateCoefficients(unsigned int N) const
+{
+    std::vector<double> table(N);
+    if(type != Type::Chebyshev) {
+        for(unsigned int n=0;n<N;n++) {
+            table[n] = getFactor(n, N);
+        }
+        return table;
+    }
+    if(N == 0) {
+        return table;
+    }
+    // Dolph-Chebyshev window: its spectrum is a Chebyshev polynomial (all sidelobes at -20*alpha dB), the window is
+    // the transform of the spectrum. Like the other windows it is periodic: a symmetric window with N+1 samples
+    // of which the last one (equal to the first one) is dropped
+    unsigned int M = N + 1;
+    double order = N;
+    double beta = cosh(acosh(pow(10.0, std::max(chebyshev_alpha, 0.0))) / order);
+    std::vector<std::complex<double>> spectrum(M);
+    for(unsigned int k=0;k<M;k++) {
+        double x = beta * cos(M_PI * k / M);
+        double T;
+        if(x > 1.0) {
+            T = cosh(order * acosh(x));
+        } else if(x < -1.0) {
+            T = (N % 2 ? -1.0 : 1.0) * cosh(order * acosh(-x));
+        } else {
+            T = cos(order * acos(x));
+        }
+        spectrum[k] = T;
+        if(M % 2 == 0) {
+            // even length: the center is between two samples
+            spectrum[k] *= std::polar(1.0, M_PI * k / M);
+        }
+    }
+    Fft::Plan::get(M, false)->execute(spectrum);
+    // the transform contains the window from its center to the end
+    for(unsigned int n=0;n<N;n++) {
+        unsigned int index;
+        if(M % 2) {
+            index = n >= M / 2 ? n - M / 2 : M / 2 - n;
+        } else {
+            index = n >= M / 2 ? n - M / 2 + 1 : M / 2 - n;
+        }
+        table[n] = spectrum[index].real();
+    }
+    auto max = *std::max_element(table.begin(), table.end());
+    for(auto &t : table) {
+        t /= max;
+    }
+    return table;
+}
@@ -6,6 +6,7 @@
 #include <QWidget>
 #include <complex>
 #include <vector>
+#include <memory>
 
 class WindowFunction : public QObject, public Savable
 {
@@ -13,9 +14,9 @@ class WindowFunction : public QObject, public Savable
 public:   
     enum class Type {
         Rectangular,
-//        Kaiser,
+        Kaiser,
         Gaussian,
-//        Chebyshev,
+        Chebyshev,
         Hann,
         Hamming,
         Blackman,
@@ -28,10 +29,19 @@ public:
 
     void apply(std::vector<std::complex<double>>& data) const;
     void reverse(std::vector<std::complex<double>>& data) const;
+    // Applies the window to the non-negative half of a symmetric two-sided spectrum. data[0] is the center bin of
+    // the two-sided spectrum with 2*(data.size()-1) bins, the last one is the Nyquist bin at the edge of the window.
+    // The bins of the negative half would use the same factors
+    void applyOneSided(std::vector<std::complex<double>>& data) const;
+    // factor at position n of a window with N samples, n does not have to be an integer
+    double getFactor(double n, unsigned int N) const;
 
     QWidget *createEditor();
 
     Type getType() const;
+    // parameter of the current type, 0 if it does not use one
+    double getParameter() const;
+    void setParameter(double value);
     QString getDescription();
 
     virtual nlohmann::json toJSON() override;
@@ -41,7 +51,10 @@ signals:
     void changed();
 
 private:
-    double getFactor(unsigned int n, unsigned int N) const;
+    // Coefficients of all positions of a window with N samples. The tables are cached for each combination of
+    // type, N and parameter, TDR/DFT/time gate use the same window for every sweep
+    std::shared_ptr<const std::vector<double>> coefficients(unsigned int N) const;
+    std::vector<double> calculateCoefficients(unsigned int N) const;
     Type type;
     // parameters for the different types. Not all windows use one and most only one.
     // But keeping all parameters for all windows allows switching between window types
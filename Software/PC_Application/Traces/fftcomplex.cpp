@@ -23,6 +23,7 @@
 
 
 #include "fftcomplex.h"
+#include "fftplan.h"
 
 #include <cstddef>
 #include <cstdint>
@@ -44,10 +45,8 @@ void Fft::transform(vector<complex<double> > &vec, bool inverse) {
     size_t n = vec.size();
     if (n == 0)
         return;
-    else if ((n & (n - 1)) == 0)  // Is power of 2
-        transformRadix2(vec, inverse);
-    else  // More complicated algorithm for arbitrary sizes
-        transformBluestein(vec, inverse);
+    // Cached plans with mixed-radix kernels, Bluestein is only used for sizes with large prime factors
+    Plan::get(n, inverse)->execute(vec);
 }
 
 
@@ -34,6 +34,7 @@ namespace Fft {
     /*
      * Computes the discrete Fourier transform (DFT) of the given complex vector, storing the result back into the vector.
      * The vector can have any length. This is a wrapper function. The inverse transform does not perform scaling, so it is not a true inverse.
+     * Uses the cached Fft::Plan for the size of the vector (see fftplan.h).
      */
     void transform(std::vector<std::complex<double> > &vec, bool inverse);
 
@@ -0,0 +1,492 @@
+#include "fftplan.h"
+
+#include <map>
+#include <mutex>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+
+mutex cacheMutex;
+map<pair<size_t, bool>, shared_ptr<const Fft::Plan>> cache;
+map<size_t, shared_ptr<const Fft::InverseRealPlan>> realCache;
+// Plans are small compared to the data that is transformed. The limit only prevents unbounded growth
+// if many different sizes are used (e.g. while changing the number of points)
+constexpr size_t MaxCachedPlans = 64;
+
+// exp(sign * 2 * pi * i * k / n), calculated from the exact angle to keep large tables accurate
+complex<double> unitRoot(uintmax_t k, uintmax_t n, bool inverse)
+{
+    double angle = (inverse ? 2.0 : -2.0) * M_PI * (double) (k % n) / n;
+    return complex<double>(cos(angle), sin(angle));
+}
+
+}
+
+shared_ptr<const Fft::Plan> Fft::Plan::get(size_t n, bool inverse)
+{
+    auto key = make_pair(n, inverse);
+    {
+        lock_guard<mutex> lock(cacheMutex);
+        auto it = cache.find(key);
+        if(it != cache.end()) {
+            return it->second;
+        }
+    }
+    // create the plan without holding the lock, Bluestein plans request further plans
+    shared_ptr<const Plan> plan(new Plan(n, inverse));
+    lock_guard<mutex> lock(cacheMutex);
+    if(cache.size() >= MaxCachedPlans) {
+        cache.clear();
+    }
+    // another thread may have created the same plan in the meantime, both are identical
+    return cache.emplace(key, plan).first->second;
+}
+
+void Fft::Plan::clearCache()
+{
+    lock_guard<mutex> lock(cacheMutex);
+    cache.clear();
+    realCache.clear();
+}
+
+Fft::Plan::Plan(size_t n, bool inverse)
+    : n(n),
+      inverse(inverse),
+      bluestein(false)
+{
+    if(n <= 1) {
+        return;
+    }
+    // factor out 4 first (the most efficient kernel), then 2, 3, 5 and any other primes
+    size_t remaining = n;
+    size_t p = 4;
+    while(remaining > 1) {
+        while(remaining % p) {
+            switch(p) {
+            case 4: p = 2; break;
+            case 2: p = 3; break;
+            default: p += 2; break;
+            }
+            if(p * p > remaining) {
+                p = remaining;
+            }
+        }
+        remaining /= p;
+        factors.push_back({p, remaining});
+    }
+    for(auto &f : factors) {
+        if(f.radix > MaxRadix) {
+            bluestein = true;
+        }
+    }
+    if(!bluestein) {
+        twiddles.resize(n);
+        for(size_t i=0;i<n;i++) {
+            twiddles[i] = unitRoot(i, n, inverse);
+        }
+        return;
+    }
+
+    // Bluestein's algorithm: the DFT is expressed as a circular convolution with a chirp. The convolution
+    // length only has to be at least 2n-1, use the next size that can be transformed with the fast kernels
+    factors.clear();
+    auto m = nextFastSize(2 * n - 1);
+    chirp.resize(n);
+    for(size_t i=0;i<n;i++) {
+        // i^2 mod 2n avoids a loss of precision for large i
+        uintmax_t k = (uintmax_t) i * i % ((uintmax_t) n * 2);
+        chirp[i] = unitRoot(k, (uintmax_t) n * 2, inverse);
+    }
+    kernel.assign(m, 0.0);
+    kernel[0] = chirp[0];
+    for(size_t i=1;i<n;i++) {
+        kernel[i] = kernel[m - i] = conj(chirp[i]);
+    }
+    forwardPadded = get(m, false);
+    inversePadded = get(m, true);
+    forwardPadded->execute(kernel);
+    // the scaling of the inverse convolution is included in the kernel
+    for(auto &k : kernel) {
+        k /= (double) m;
+    }
+}
+
+void Fft::Plan::execute(std::vector<std::complex<double>> &vec) const
+{
+    execute(vec.data());
+}
+
+void Fft::Plan::execute(std::complex<double> *data) const
+{
+    if(n <= 1) {
+        return;
+    }
+    if(bluestein) {
+        executeBluestein(data);
+        return;
+    }
+    // The algorithm works out of place, keep a copy of the input. The buffer is reused by
+    // following executions in the same thread
+    thread_local vector<complex<double>> input;
+    input.assign(data, data + n);
+    work(data, input.data(), 1, 0);
+}
+
+void Fft::Plan::executeBluestein(std::complex<double> *data) const
+{
+    thread_local vector<complex<double>> buf;
+    const size_t m = kernel.size();
+    buf.assign(m, 0.0);
+    for(size_t i=0;i<n;i++) {
+        buf[i] = data[i] * chirp[i];
+    }
+    forwardPadded->execute(buf.data());
+    for(size_t i=0;i<m;i++) {
+        buf[i] *= kernel[i];
+    }
+    inversePadded->execute(buf.data());
+    for(size_t i=0;i<n;i++) {
+        data[i] = buf[i] * chirp[i];
+    }
+}
+
+// Recursive decimation in time: the input is split into radix interleaved sequences which are transformed
+// individually, the butterfly of this stage then combines them
+void Fft::Plan::work(std::complex<double> *out, const std::complex<double> *in, size_t stride, unsigned int stage) const
+{
+    const size_t radix = factors[stage].radix;
+    const size_t m = factors[stage].m;
+    const auto end = out + radix * m;
+    if(m == 1) {
+        for(auto o = out;o != end;o++, in += stride) {
+            *o = *in;
+        }
+    } else {
+        for(auto o = out;o != end;o += m, in += stride) {
+            work(o, in, stride * radix, stage + 1);
+        }
+    }
+    switch(radix) {
+    case 2: butterfly2(out, stride, m); break;
+    case 3: butterfly3(out, stride, m); break;
+    case 4: butterfly4(out, stride, m); break;
+    case 5: butterfly5(out, stride, m); break;
+    default: butterflyGeneric(out, stride, m, radix); break;
+    }
+}
+
+void Fft::Plan::butterfly2(std::complex<double> *out, size_t stride, size_t m) const
+{
+    auto out2 = out + m;
+    auto tw = twiddles.data();
+    for(size_t k=0;k<m;k++) {
+        auto t = out2[k] * *tw;
+        tw += stride;
+        out2[k] = out[k] - t;
+        out[k] += t;
+    }
+}
+
+void Fft::Plan::butterfly3(std::complex<double> *out, size_t stride, size_t m) const
+{
+    const size_t m2 = 2 * m;
+    auto tw1 = twiddles.data();
+    auto tw2 = tw1;
+    const double epi3 = twiddles[stride * m].imag();
+    for(size_t k=0;k<m;k++, out++) {
+        auto s1 = out[m] * *tw1;
+        auto s2 = out[m2] * *tw2;
+        auto s3 = s1 + s2;
+        auto s0 = (s1 - s2) * epi3;
+        tw1 += stride;
+        tw2 += 2 * stride;
+        out[m] = out[0] - s3 * 0.5;
+        out[0] += s3;
+        out[m2] = out[m] + complex<double>(s0.imag(), -s0.real());
+        out[m] += complex<double>(-s0.imag(), s0.real());
+    }
+}
+
+void Fft::Plan::butterfly4(std::complex<double> *out, size_t stride, size_t m) const
+{
+    const size_t m2 = 2 * m, m3 = 3 * m;
+    auto tw1 = twiddles.data();
+    auto tw2 = tw1, tw3 = tw1;
+    for(size_t k=0;k<m;k++, out++) {
+        auto s0 = out[m] * *tw1;
+        auto s1 = out[m2] * *tw2;
+        auto s2 = out[m3] * *tw3;
+        auto s5 = out[0] - s1;
+        out[0] += s1;
+        auto s3 = s0 + s2;
+        auto s4 = s0 - s2;
+        out[m2] = out[0] - s3;
+        tw1 += stride;
+        tw2 += 2 * stride;
+        tw3 += 3 * stride;
+        out[0] += s3;
+        // multiplication of s4 with -i (forward) or i (inverse)
+        auto rot = inverse ? complex<double>(-s4.imag(), s4.real()) : complex<double>(s4.imag(), -s4.real());
+        out[m] = s5 + rot;
+        out[m3] = s5 - rot;
+    }
+}
+
+void Fft::Plan::butterfly5(std::complex<double> *out, size_t stride, size_t m) const
+{
+    const auto ya = twiddles[stride * m];
+    const auto yb = twiddles[stride * 2 * m];
+    auto out0 = out, out1 = out + m, out2 = out + 2 * m, out3 = out + 3 * m, out4 = out + 4 * m;
+    auto tw = twiddles.data();
+    for(size_t u=0;u<m;u++) {
+        auto s0 = out0[u];
+        auto s1 = out1[u] * tw[u * stride];
+        auto s2 = out2[u] * tw[2 * u * stride];
+        auto s3 = out3[u] * tw[3 * u * stride];
+        auto s4 = out4[u] * tw[4 * u * stride];
+
+        auto s7 = s1 + s4;
+        auto s10 = s1 - s4;
+        auto s8 = s2 + s3;
+        auto s9 = s2 - s3;
+
+        out0[u] = s0 + s7 + s8;
+
+        auto s5 = s0 + s7 * ya.real() + s8 * yb.real();
+        complex<double> s6(s10.imag() * ya.imag() + s9.imag() * yb.imag(), -s10.real() * ya.imag() - s9.real() * yb.imag());
+        out1[u] = s5 - s6;
+        out4[u] = s5 + s6;
+
+        auto s11 = s0 + s7 * yb.real() + s8 * ya.real();
+        complex<double> s12(-s10.imag() * yb.imag() + s9.imag() * ya.imag(), s10.real() * yb.imag() - s9.real() * ya.imag());
+        out2[u] = s11 + s12;
+        out3[u] = s11 - s12;
+    }
+}
+
+void Fft::Plan::butterflyGeneric(std::complex<double> *out, size_t stride, size_t m, size_t radix) const
+{
+    complex<double> scratch[MaxRadix];
+    for(size_t u=0;u<m;u++) {
+        for(size_t q=0, k=u;q<radix;q++, k+=m) {
+            scratch[q] = out[k];
+        }
+        for(size_t q=0, k=u;q<radix;q++, k+=m) {
+            size_t twidx = 0;
+            auto sum = scratch[0];
+            for(size_t j=1;j<radix;j++) {
+                twidx += stride * k;
+                if(twidx >= n) {
+                    twidx -= n;
+                }
+                sum += scratch[j] * twiddles[twidx];
+            }
+            out[k] = sum;
+        }
+    }
+}
+
+shared_ptr<const Fft::InverseRealPlan> Fft::InverseRealPlan::get(size_t n)
+{
+    {
+        lock_guard<mutex> lock(cacheMutex);
+        auto it = realCache.find(n);
+        if(it != realCache.end()) {
+            return it->second;
+        }
+    }
+    shared_ptr<const InverseRealPlan> plan(new InverseRealPlan(n));
+    lock_guard<mutex> lock(cacheMutex);
+    if(realCache.size() >= MaxCachedPlans) {
+        realCache.clear();
+    }
+    return realCache.emplace(n, plan).first->second;
+}
+
+Fft::InverseRealPlan::InverseRealPlan(size_t n)
+    : n(n),
+      method(Method::Trivial)
+{
+    if(n <= 1) {
+        return;
+    }
+    if(n % 2 == 0) {
+        method = Method::Even;
+        auto m = n / 2;
+        twiddles.resize(m);
+        for(size_t k=0;k<m;k++) {
+            twiddles[k] = unitRoot(k, n, true);
+        }
+        complexPlan = Plan::get(m, true);
+        return;
+    }
+    // Odd sizes could be split into interleaved real sequences as well, but the additional pass over the spectrum
+    // costs more than it saves: one complex transform of the full spectrum is faster for every tested size
+    method = Method::Complex;
+    complexPlan = Plan::get(n, true);
+}
+
+std::complex<double> Fft::InverseRealPlan::bin(const std::complex<double> *spectrum, size_t k) const
+{
+    if(k == 0) {
+        return spectrum[0].real();
+    } else if(2 * k < n) {
+        return spectrum[k];
+    } else if(2 * k == n) {
+        return spectrum[k].real();
+    } else {
+        return conj(spectrum[n - k]);
+    }
+}
+
+void Fft::InverseRealPlan::execute(const std::vector<std::complex<double>> &spectrum, std::vector<double> &out) const
+{
+    out.resize(n);
+    execute(spectrum.data(), out.data());
+}
+
+void Fft::InverseRealPlan::execute(const std::complex<double> *spectrum, double *out) const
+{
+    switch(method) {
+    case Method::Trivial:
+        if(n == 1) {
+            out[0] = spectrum[0].real();
+        }
+        break;
+    case Method::Even: {
+        // z[m] = x[2m] + i*x[2m+1] is the inverse transform of E + i*O, with E and O the spectra of the even and odd samples
+        const size_t m = n / 2;
+        vector<complex<double>> z(m);
+        for(size_t k=0;k<m;k++) {
+            auto a = bin(spectrum, k);
+            auto b = bin(spectrum, k + m);
+            auto e = a + b;
+            auto o = (a - b) * twiddles[k];
+            z[k] = e + complex<double>(-o.imag(), o.real());
+        }
+        complexPlan->execute(z.data());
+        for(size_t k=0;k<m;k++) {
+            out[2 * k] = z[k].real();
+            out[2 * k + 1] = z[k].imag();
+        }
+    }
+        break;
+    case Method::Complex: {
+        vector<complex<double>> z(n);
+        for(size_t k=0;k<n;k++) {
+            z[k] = bin(spectrum, k);
+        }
+        complexPlan->execute(z.data());
+        for(size_t k=0;k<n;k++) {
+            out[k] = z[k].real();
+        }
+    }
+        break;
+    }
+}
+
+Fft::ChirpZ::ChirpZ(size_t n, size_t m, double start, double step, bool inverse)
+    : n(n),
+      m(m),
+      start(start),
+      step(step),
+      inverse(inverse)
+{
+    if(n == 0 || m == 0) {
+        return;
+    }
+    // j * k = (j^2 + k^2 - (k-j)^2) / 2 turns the sum into a convolution of the weighted input with exp(-sign*pi*i*step*l^2)
+    const double sign = inverse ? 1.0 : -1.0;
+    // exp(sign * 2 * pi * i * cycles), only the fractional part of the (possibly large) number of cycles is used
+    auto rotation = [=](double cycles) {
+        double angle = sign * 2.0 * M_PI * (cycles - floor(cycles));
+        return complex<double>(cos(angle), sin(angle));
+    };
+    inputChirp.resize(n);
+    for(size_t j=0;j<n;j++) {
+        inputChirp[j] = rotation(start * j + step * 0.5 * (double) j * j);
+    }
+    outputChirp.resize(m);
+    for(size_t k=0;k<m;k++) {
+        outputChirp[k] = rotation(step * 0.5 * (double) k * k);
+    }
+    // the kernel covers the offsets -(n-1) to m-1, the padded size only has to avoid overlapping them
+    auto size = nextFastSize(n + m - 1);
+    kernel.assign(size, 0.0);
+    for(size_t l=0;l<max(n, m);l++) {
+        auto c = conj(rotation(step * 0.5 * (double) l * l));
+        if(l < m) {
+            kernel[l] = c;
+        }
+        if(l > 0 && l < n) {
+            kernel[size - l] = c;
+        }
+    }
+    forwardPadded = Plan::get(size, false);
+    inversePadded = Plan::get(size, true);
+    forwardPadded->execute(kernel);
+    for(auto &k : kernel) {
+        k /= (double) size;
+    }
+}
+
+bool Fft::ChirpZ::matches(size_t n, size_t m, double start, double step, bool inverse) const
+{
+    return this->n == n && this->m == m && this->start == start && this->step == step && this->inverse == inverse;
+}
+
+void Fft::ChirpZ::execute(const std::vector<std::complex<double>> &in, std::vector<std::complex<double>> &out) const
+{
+    out.resize(m);
+    execute(in.data(), out.data());
+}
+
+void Fft::ChirpZ::execute(const std::complex<double> *in, std::complex<double> *out) const
+{
+    if(n == 0) {
+        fill(out, out + m, 0.0);
+        return;
+    }
+    if(m == 0) {
+        return;
+    }
+    thread_local vector<complex<double>> buf;
+    buf.assign(kernel.size(), 0.0);
+    for(size_t j=0;j<n;j++) {
+        buf[j] = in[j] * inputChirp[j];
+    }
+    forwardPadded->execute(buf.data());
+    for(size_t i=0;i<buf.size();i++) {
+        buf[i] *= kernel[i];
+    }
+    inversePadded->execute(buf.data());
+    for(size_t k=0;k<m;k++) {
+        out[k] = buf[k] * outputChirp[k];
+    }
+}
+
+size_t Fft::nextFastSize(size_t n)
+{
+    if(n <= 1) {
+        return 1;
+    }
+    size_t best = SIZE_MAX;
+    // try all combinations of powers of 5 and 3, fill up with powers of 2
+    for(size_t p5=1;p5<best;p5*=5) {
+        for(size_t p35=p5;p35<best;p35*=3) {
+            size_t s = p35;
+            while(s < n) {
+                s *= 2;
+            }
+            best = min(best, s);
+            if(s == n) {
+                return n;
+            }
+        }
+    }
+    return best;
+}
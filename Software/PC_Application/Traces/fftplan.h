@@ -0,0 +1,150 @@
+#ifndef FFTPLAN_H
+#define FFTPLAN_H
+
+#include <complex>
+#include <vector>
+#include <memory>
+
+namespace Fft {
+
+/*
+ * Precomputed FFT of a fixed size and direction. Creating a plan factors the size and calculates all twiddle factors,
+ * executing it only runs the butterflies. Plans are cached, the TDR/DFT/time gate math and the de-embedding usually
+ * transform the same sizes on every sweep.
+ *
+ * Sizes consisting only of small prime factors are transformed with a mixed-radix Cooley-Tukey algorithm (dedicated
+ * kernels for the radices 2, 3, 4 and 5, a generic kernel for the other factors up to MaxRadix). All other sizes use
+ * Bluestein's algorithm with a padded size that is a product of 2, 3 and 5. The chirp and its transform are part of
+ * the plan, so only two FFTs are required per execution.
+ *
+ * Like Fft::transform, the inverse transform does not perform scaling. Plans are immutable, the same plan can be
+ * executed from several threads at the same time.
+ */
+class Plan {
+public:
+    // Returns the plan for a size and direction, it is created if it is not cached yet. Thread safe.
+    static std::shared_ptr<const Plan> get(size_t n, bool inverse);
+    // Removes all plans from the cache (plans still in use stay valid)
+    static void clearCache();
+
+    size_t size() const { return n; }
+    bool isInverse() const { return inverse; }
+
+    // transforms n values in place
+    void execute(std::complex<double> *data) const;
+    // the vector must contain size() values
+    void execute(std::vector<std::complex<double>> &vec) const;
+
+    // largest prime factor that is transformed directly, sizes with larger factors use Bluestein's algorithm
+    static constexpr size_t MaxRadix = 7;
+
+private:
+    Plan(size_t n, bool inverse);
+
+    class Factor {
+    public:
+        size_t radix;
+        // remaining size after this stage
+        size_t m;
+    };
+
+    void work(std::complex<double> *out, const std::complex<double> *in, size_t stride, unsigned int stage) const;
+    void butterfly2(std::complex<double> *out, size_t stride, size_t m) const;
+    void butterfly3(std::complex<double> *out, size_t stride, size_t m) const;
+    void butterfly4(std::complex<double> *out, size_t stride, size_t m) const;
+    void butterfly5(std::complex<double> *out, size_t stride, size_t m) const;
+    void butterflyGeneric(std::complex<double> *out, size_t stride, size_t m, size_t radix) const;
+    void executeBluestein(std::complex<double> *data) const;
+
+    size_t n;
+    bool inverse;
+    std::vector<Factor> factors;
+    std::vector<std::complex<double>> twiddles;
+
+    // only used for Bluestein's algorithm
+    bool bluestein;
+    std::vector<std::complex<double>> chirp;
+    // transformed (and scaled) convolution kernel
+    std::vector<std::complex<double>> kernel;
+    std::shared_ptr<const Plan> forwardPadded, inversePadded;
+};
+
+/*
+ * Inverse DFT of a spectrum with Hermitian symmetry (the negative frequency bins are the complex conjugates of the
+ * positive ones), the result is real. Only the bins 0 to n/2 are used, which saves half of the memory for the spectrum:
+ * - even sizes: the even and odd output samples are calculated together as a complex transform of size n/2, about
+ *   half of the calculation of a complex transform
+ * - odd sizes: complex transform of the full spectrum, the negative frequency bins are created on the fly
+ * Like Plan, these plans are cached, immutable and the inverse transform does not perform scaling.
+ */
+class InverseRealPlan {
+public:
+    static std::shared_ptr<const InverseRealPlan> get(size_t n);
+
+    size_t size() const { return n; }
+
+    // Transforms the bins 0 to size()/2 from spectrum into size() real values in out.
+    // The imaginary part of bin 0 (and of bin size()/2 for even sizes) is ignored
+    void execute(const std::complex<double> *spectrum, double *out) const;
+    void execute(const std::vector<std::complex<double>> &spectrum, std::vector<double> &out) const;
+
+private:
+    InverseRealPlan(size_t n);
+
+    enum class Method {
+        Trivial,
+        Even,
+        Complex,
+    };
+
+    // bin k of the full spectrum
+    std::complex<double> bin(const std::complex<double> *spectrum, size_t k) const;
+
+    size_t n;
+    Method method;
+    // exp(2*pi*i*k/n)
+    std::vector<std::complex<double>> twiddles;
+    std::shared_ptr<const Plan> complexPlan;
+};
+
+/*
+ * Chirp-Z transform (zoom DFT): evaluates
+ *   out[k] = sum over j of in[j] * exp(sign * 2*pi*i * j * (start + k * step)),  k = 0 to m-1
+ * for n input values. start and step are normalized frequencies (cycles per sample) and do not have to be multiples of
+ * 1/n. This evaluates an arbitrary range of the spectrum at an arbitrary resolution without zero-padding the input.
+ * Bluestein's algorithm turns the sum into a convolution, the transform of the chirp is part of the plan and every
+ * execution only needs two FFTs of a size of at least n+m-1.
+ *
+ * These plans depend on continuous parameters and are not cached, the user keeps the plan as long as the parameters
+ * do not change. Executing a plan is thread safe.
+ */
+class ChirpZ {
+public:
+    ChirpZ(size_t n, size_t m, double start, double step, bool inverse);
+
+    bool matches(size_t n, size_t m, double start, double step, bool inverse) const;
+    size_t inputSize() const { return n; }
+    size_t outputSize() const { return m; }
+
+    // transforms inputSize() values from in into outputSize() values in out
+    void execute(const std::complex<double> *in, std::complex<double> *out) const;
+    // resizes out to outputSize()
+    void execute(const std::vector<std::complex<double>> &in, std::vector<std::complex<double>> &out) const;
+
+private:
+    size_t n, m;
+    double start, step;
+    bool inverse;
+    // weights of the input and output values
+    std::vector<std::complex<double>> inputChirp, outputChirp;
+    // transformed (and scaled) convolution kernel
+    std::vector<std::complex<double>> kernel;
+    std::shared_ptr<const Plan> forwardPadded, inversePadded;
+};
+
+// returns the smallest number not less than n that has no prime factors other than 2, 3 and 5
+size_t nextFastSize(size_t n);
+
+}
+
+#endif // FFTPLAN_H
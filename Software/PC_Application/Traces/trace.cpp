@@ -6,16 +6,42 @@
 #include "traceaxis.h"
 #include "tracemodel.h"
 #include "Math/parser/mpParser.h"
+#include "Math/compiledexpression.h"
+#include "preferences.h"
 
 #include <math.h>
 #include <QDebug>
 #include <QScrollBar>
 #include <QSettings>
 #include <functional>
+#include <algorithm>
 
 using namespace std;
 using namespace mup;
 
+// Everything required to evaluate the math formula. The parser is set up in the GUI thread (muparserx creates
+// some global objects on first use), the evaluation itself only reads the source samples and writes the results
+class Trace::MathCalculation {
+public:
+    MathCalculation() : parser(pckCOMMON | pckUNIT | pckCOMPLEX) {}
+    ParserX parser;
+    map<Trace*,Value> values;
+    Value x;
+    // The output points are processed in ascending order, walk through the source samples alongside them.
+    // If a source uses the same X coordinates as this trace, its samples can be used without interpolation
+    struct SourceSamples {
+        Value *value;
+        const Samples *samples;
+        Interpolator interpolator;
+        bool direct;
+    };
+    vector<SourceSamples> sources;
+    Math::CompiledExpression compiled;
+    unsigned int begin, end;
+    vector<double> re, im;
+    QString error;
+};
+
 Trace::Trace(QString name, QColor color, LiveParameter live)
     : model(nullptr),
       _name(name),
@@ -32,6 +58,10 @@ Trace::Trace(QString name, QColor color, LiveParameter live)
       paused(false),
       reference_impedance(50.0),
       domain(DataType::Frequency),
+      nextSampleIndex(0),
+      sweepCount(0),
+      lastSamplesEnd(0),
+      historySweepCount(0),
       lastMath(nullptr)
 {
     MathInfo self = {.math = this, .enabled = true};
@@ -67,6 +97,7 @@ void Trace::clear(bool force) {
         return;
     }
     data.clear();
+    nextSampleIndex = 0;
     settings.valid = false;
     warning("No data");
     emit cleared(this);
@@ -79,55 +110,99 @@ void Trace::addData(const Trace::Data& d, DataType domain, double reference_impe
         this->domain = domain;
         emit typeChanged(this);
     }
+    index = storeSample(d, index);
+    if(index == 0) {
+        sweepCount++;
+    }
+    if(this->reference_impedance != reference_impedance) {
+        this->reference_impedance = reference_impedance;
+        emit typeChanged(this);
+    }
+    success();
+    emit outputSamplesChanged(index, index + 1);
+}
+
+void Trace::addData(const Trace::Data *d, unsigned int count, DataType domain, double reference_impedance, const int *indices)
+{
+    if(!count) {
+        return;
+    }
+    if(this->domain != domain) {
+        clear();
+        this->domain = domain;
+        emit typeChanged(this);
+    }
+    auto oldSize = data.size();
+    unsigned int begin = numeric_limits<unsigned int>::max();
+    unsigned int end = 0;
+    for(unsigned int i=0;i<count;i++) {
+        auto index = storeSample(d[i], indices ? indices[i] : -1);
+        begin = min(begin, index);
+        end = max(end, index + 1);
+    }
+    if(data.size() > oldSize) {
+        // samples may have been inserted, everything after them has moved
+        end = data.size();
+    }
+    if(begin == 0) {
+        sweepCount++;
+    }
+    if(this->reference_impedance != reference_impedance) {
+        this->reference_impedance = reference_impedance;
+        emit typeChanged(this);
+    }
+    success();
+    emit outputSamplesChanged(begin, end);
+}
+
+unsigned int Trace::storeSample(const Data &d, int index)
+{
     if(index >= 0) {
         // index position specified
-        if(data.size() <= index) {
+        if(data.size() <= (unsigned int) index) {
             data.resize(index + 1);
         }
-        data[index] = d;
+        data.set(index, d);
     } else {
-        // no index given, determine position by X-coordinate
-
-        // add or replace data in vector while keeping it sorted with increasing frequency
-        auto lower = lower_bound(data.begin(), data.end(), d, [](const Data &lhs, const Data &rhs) -> bool {
-            return lhs.x < rhs.x;
-        });
-        // calculate index now because inserting a sample into data might lead to reallocation -> arithmetic on lower not valid anymore
-        index = lower - data.begin();
-        if(lower == data.end()) {
+        // no index given, determine position by X-coordinate. Usually the sample belongs right after the last one
+        if(nextSampleIndex < data.size() && data.x(nextSampleIndex) == d.x) {
+            index = nextSampleIndex;
+        } else if(nextSampleIndex == data.size() && (data.empty() || data.x(data.size() - 1) < d.x)) {
+            index = nextSampleIndex;
+        } else {
+            // out of order, search for the position while keeping the data sorted with increasing frequency
+            index = data.lowerBound(d.x);
+        }
+        if((unsigned int) index == data.size()) {
             // highest frequency yet, add to vector
             data.push_back(d);
-        } else if(lower->x == d.x) {
+        } else if(data.x(index) == d.x) {
             switch(_liveType) {
             case LivedataType::Overwrite:
                 // replace this data element
-                *lower = d;
+                data.set(index, d);
                 break;
             case LivedataType::MaxHold:
                 // replace this data element
-                if(abs(d.y) > abs(lower->y)) {
-                    *lower = d;
+                if(abs(d.y) > abs(data.y(index))) {
+                    data.set(index, d);
                 }
                 break;
             case LivedataType::MinHold:
                 // replace this data element
-                if(abs(d.y) < abs(lower->y)) {
-                    *lower = d;
+                if(abs(d.y) < abs(data.y(index))) {
+                    data.set(index, d);
                 }
                 break;
             default: break;
             }
         } else {
             // insert at this position
-            data.insert(lower, d);
+            data.insert(index, d);
         }
+        nextSampleIndex = index + 1;
     }
-    if(this->reference_impedance != reference_impedance) {
-        this->reference_impedance = reference_impedance;
-        emit typeChanged(this);
-    }
-    success();
-    emit outputSamplesChanged(index, index + 1);
+    return index;
 }
 
 void Trace::addData(const Trace::Data &d, const Protocol::SpectrumAnalyzerSettings &s, int index)
@@ -394,6 +469,38 @@ void Trace::updateMathTracePoints()
     if(!mathSourceTraces.size()) {
         return;
     }
+    // Usually all sources share the same X coordinates (e.g. S-parameters of the same sweep). In that case,
+    // they are used for this trace as well and calculateMath() can read the source samples by index
+    // (all X coordinates are compared, sources with the same span and number of points may still differ in between,
+    // e.g. a linear and a logarithmic sweep)
+    auto &grid = mathSourceTraces.begin()->first->samples();
+    bool sharedGrid = grid.size() > 0;
+    for(auto t : mathSourceTraces) {
+        auto &s = t.first->samples();
+        if(s.size() != grid.size() || !std::equal(s.xData(), s.xData() + s.size(), grid.xData())) {
+            sharedGrid = false;
+            break;
+        }
+    }
+    if(sharedGrid) {
+        // points that are already present with the same X coordinate are kept
+        unsigned int keep = data.size();
+        if(keep > grid.size() || !std::equal(data.xData(), data.xData() + keep, grid.xData())) {
+            keep = 0;
+        }
+        if(keep < grid.size() || data.size() != grid.size()) {
+            data.resize(grid.size());
+            for(unsigned int i=keep;i<grid.size();i++) {
+                data.setX(i, grid.x(i));
+                data.setY(i, numeric_limits<complex<double>>::quiet_NaN());
+            }
+            if(keep == 0) {
+                mathUpdateBegin = 0;
+                mathUpdateEnd = data.size();
+            }
+        }
+        return;
+    }
     double startX = std::numeric_limits<double>::lowest();
     double stopX = std::numeric_limits<double>::max();
     double stepSize = std::numeric_limits<double>::max();
@@ -419,8 +526,8 @@ void Trace::updateMathTracePoints()
         data.resize(samples);
         if(oldSize < samples) {
             for(unsigned int i=oldSize;i<samples;i++) {
-                data[i].x = startX + i * stepSize;
-                data[i].y = numeric_limits<complex<double>>::quiet_NaN();
+                data.setX(i, startX + i * stepSize);
+                data.setY(i, numeric_limits<complex<double>>::quiet_NaN());
             }
         }
     }
@@ -451,6 +558,11 @@ void Trace::scheduleMathCalculation(unsigned int begin, unsigned int end)
     if(end > mathUpdateEnd) {
         mathUpdateEnd = end;
     }
+    if(model) {
+        // the model calculates all of its math traces together, in the order of their dependencies
+        model->getMathScheduler()->schedule();
+        return;
+    }
     auto now = QTime::currentTime();
     if (lastMathUpdate.msecsTo(now) >= MinMathUpdateInterval) {
         calculateMath();
@@ -461,43 +573,136 @@ void Trace::scheduleMathCalculation(unsigned int begin, unsigned int end)
 
 void Trace::calculateMath()
 {
+    if(prepareMathCalculation()) {
+        evaluateMathCalculation();
+        finishMathCalculation();
+    }
+}
+
+bool Trace::prepareMathCalculation()
+{
+    mathCalculation.reset();
+    if(mathUpdateBegin >= mathUpdateEnd) {
+        // nothing changed since the last calculation
+        return false;
+    }
     lastMathUpdate = QTime::currentTime();
     if(mathUpdateBegin >= data.size() || mathUpdateEnd >= data.size() + 1) {
         qWarning() << "Not calculating math trace, out of limits. Requested from" << mathUpdateBegin << "to" << mathUpdateEnd <<" but data is of size" << data.size();
-        return;
+        return false;
     }
     if(mathFormula.isEmpty()) {
         error("Expression is empty");
+        return false;
+    }
+    if(isPaused()) {
+        mathUpdateBegin = data.size();
+        mathUpdateEnd = 0;
+        return false;
+    }
+    auto c = make_unique<MathCalculation>();
+    c->begin = mathUpdateBegin;
+    c->end = mathUpdateEnd;
+    try {
+        c->parser.SetExpr(mathFormula.toStdString());
+        c->parser.DefineVar("x", Variable(&c->x));
+        for(const auto &ts : mathSourceTraces) {
+            c->values[ts.first] = Value();
+            c->parser.DefineVar(ts.second.toStdString(), Variable(&c->values[ts.first]));
+        }
+        c->sources.reserve(c->values.size());
+        for(auto &val : c->values) {
+            auto &s = val.first->samples();
+            bool direct = s.size() == data.size()
+                    && std::equal(data.xData() + c->begin, data.xData() + c->end, s.xData() + c->begin);
+            c->sources.push_back({&val.second, &s, Interpolator(s), direct});
+        }
+        vector<const IValue*> variables = {&c->x};
+        for(auto &src : c->sources) {
+            variables.push_back(src.value);
+        }
+        c->compiled.compile(c->parser, variables);
+    } catch (const ParserError &e) {
+        c->error = QString::fromStdString(e.GetMsg());
+    }
+    mathCalculation = std::move(c);
+    return true;
+}
+
+void Trace::evaluateMathCalculation()
+{
+    auto c = mathCalculation.get();
+    if(!c || !c->error.isEmpty()) {
         return;
     }
-    if(!isPaused()) {
-        try {
-            ParserX parser(pckCOMMON | pckUNIT | pckCOMPLEX);
-            parser.SetExpr(mathFormula.toStdString());
-            map<Trace*,Value> values;
-            Value x;
-            parser.DefineVar("x", Variable(&x));
-            for(const auto &ts : mathSourceTraces) {
-                values[ts.first] = Value();
-                parser.DefineVar(ts.second.toStdString(), Variable(&values[ts.first]));
+    const unsigned int n = c->end - c->begin;
+    c->re.resize(n);
+    c->im.resize(n);
+    try {
+        if(c->compiled.isCompiled()) {
+            // evaluate all points at once, only sources that need interpolation are copied
+            vector<Math::CompiledExpression::Input> inputs = {{data.xData() + c->begin, nullptr}};
+            vector<vector<double>> interpolated;
+            interpolated.reserve(2 * c->sources.size());
+            for(auto &src : c->sources) {
+                if(src.direct) {
+                    inputs.push_back({src.samples->realData() + c->begin, src.samples->imagData() + c->begin});
+                } else {
+                    interpolated.emplace_back(n);
+                    auto &re = interpolated.back();
+                    interpolated.emplace_back(n);
+                    auto &im = interpolated.back();
+                    for(unsigned int i=0;i<n;i++) {
+                        auto y = src.interpolator.at(data.x(c->begin + i)).y;
+                        re[i] = y.real();
+                        im[i] = y.imag();
+                    }
+                    inputs.push_back({re.data(), im.data()});
+                }
             }
-            for(unsigned int i=mathUpdateBegin;i<mathUpdateEnd;i++) {
-                x = data[i].x;
-                for(auto &val : values) {
-                    val.second = val.first->interpolatedSample(data[i].x).y;
+            c->compiled.evaluate(inputs, n, c->re.data(), c->im.data());
+        } else {
+            for(unsigned int i=0;i<n;i++) {
+                c->x = data.x(c->begin + i);
+                for(auto &src : c->sources) {
+                    *src.value = src.direct ? src.samples->y(c->begin + i) : src.interpolator.at(data.x(c->begin + i)).y;
                 }
-                Value res = parser.Eval();
-                data[i].y = res.GetComplex();
+                auto res = c->parser.Eval().GetComplex();
+                c->re[i] = res.real();
+                c->im[i] = res.imag();
             }
-        } catch (const ParserError &e) {
-            error(QString::fromStdString(e.GetMsg()));
+        }
+    } catch (const ParserError &e) {
+        c->error = QString::fromStdString(e.GetMsg());
+    }
+}
+
+void Trace::finishMathCalculation()
+{
+    if(!mathCalculation) {
+        return;
+    }
+    auto c = std::move(mathCalculation);
+    if(c->end <= data.size()) {
+        if(c->error.isEmpty()) {
+            for(unsigned int i=c->begin;i<c->end;i++) {
+                data.setY(i, complex<double>(c->re[i - c->begin], c->im[i - c->begin]));
+            }
+            success();
+            // the sweeps of a math trace follow the sweeps of its sources
+            unsigned int sourceSweeps = 0;
+            for(auto &t : mathSourceTraces) {
+                sourceSweeps = max(sourceSweeps, t.first->sweepCount);
+            }
+            sweepCount = sourceSweeps;
+        } else {
+            error(c->error);
             // parser error occurred
-            for(unsigned int i=mathUpdateBegin;i<mathUpdateEnd;i++) {
-                data[i].y = numeric_limits<complex<double>>::quiet_NaN();
+            for(unsigned int i=c->begin;i<c->end;i++) {
+                data.setY(i, numeric_limits<complex<double>>::quiet_NaN());
             }
         }
-        success();
-        emit outputSamplesChanged(mathUpdateBegin, mathUpdateEnd + 1);
+        emit outputSamplesChanged(c->begin, c->end + 1);
     }
     mathUpdateBegin = data.size();
     mathUpdateEnd = 0;
@@ -583,14 +788,12 @@ bool Trace::addMathSource(Trace *t, QString variableName)
             if(data.size() == 0) {
                 return 0;
             }
-            auto lower = lower_bound(data.begin(), data.end(), x, [](const Data &lhs, const double x) -> bool {
-                return lhs.x < x;
-            });
-            if(lower == data.end()) {
+            auto lower = data.lowerBound(x);
+            if(lower == data.size()) {
                 // actually beyond the last sample, return the index of the last anyway to avoid access past data
                 return data.size() - 1;
             }
-            return lower - data.begin();
+            return lower;
         };
 
         scheduleMathCalculation(calcIndex(startX), calcIndex(stopX)+1);
@@ -1026,10 +1229,12 @@ void Trace::updateLastMath(vector<MathInfo>::reverse_iterator start)
         }
         lastMath = newLast;
         // relay signals of end of math chain
-        connect(lastMath, &TraceMath::outputSamplesChanged, this, &Trace::dataChanged);
+        connect(lastMath, &TraceMath::outputSamplesChanged, this, &Trace::lastMathSamplesChanged);
         emit typeChanged(this);
         emit outputSamplesChanged(0, data.size());
     }
+    // the math chain changed, operations might have been added, enabled or moved to a different domain
+    updateDisplayedRanges();
 }
 
 void Trace::setReflection(bool value)
@@ -1247,17 +1452,20 @@ double Trace::maxX()
 
 double Trace::findExtremum(bool max)
 {
-    double compare = max ? numeric_limits<double>::min() : numeric_limits<double>::max();
-    double freq = 0.0;
-    for(auto sample : lastMath->rData()) {
-        double amplitude = abs(sample.y);
-        if((max && (amplitude > compare)) || (!max && (amplitude < compare))) {
+    auto &samples = lastMath->rData();
+    // the squared magnitude has its extrema at the same samples, no need to calculate the square root
+    vector<double> amplitudes;
+    samples.magnitudesSquared(amplitudes);
+    double compare = max ? 0.0 : numeric_limits<double>::max();
+    int index = -1;
+    for(unsigned int i=0;i<amplitudes.size();i++) {
+        if((max && (amplitudes[i] > compare)) || (!max && (amplitudes[i] < compare))) {
             // higher/lower extremum found
-            compare = amplitude;
-            freq = sample.x;
+            compare = amplitudes[i];
+            index = i;
         }
     }
-    return freq;
+    return index >= 0 ? samples.x(index) : 0.0;
 }
 
 std::vector<double> Trace::findPeakFrequencies(unsigned int maxPeaks, double minLevel, double minValley)
@@ -1274,11 +1482,15 @@ std::vector<double> Trace::findPeakFrequencies(unsigned int maxPeaks, double min
     double frequency = 0.0;
     double max_dbm = -200.0;
     double min_dbm = 200.0;
-    for(auto d : lastMath->rData()) {
-        double dbm = Util::SparamTodB(d.y);
+    auto &samples = lastMath->rData();
+    vector<double> levels;
+    samples.magnitudesdB(levels);
+    auto x = samples.xData();
+    for(unsigned int i=0;i<levels.size();i++) {
+        double dbm = levels[i];
         if((dbm >= max_dbm) && (min_dbm <= dbm - minValley)) {
             // potential peak frequency
-            frequency = d.x;
+            frequency = x[i];
             max_dbm = dbm;
         }
         if(dbm <= min_dbm) {
@@ -1326,6 +1538,115 @@ Trace::Data Trace::sample(unsigned int index, bool getStepResponse) const
     return data;
 }
 
+void Trace::requestHistory(const QObject *user, unsigned int sweeps)
+{
+    auto it = historyRequests.find(user);
+    if(it != historyRequests.end() && it->second == sweeps) {
+        // nothing changed, keep the recorded sweeps
+        return;
+    }
+    historyRequests[user] = sweeps;
+    configureHistory();
+}
+
+void Trace::releaseHistory(const QObject *user)
+{
+    if(historyRequests.erase(user)) {
+        configureHistory();
+    }
+}
+
+void Trace::reportDisplayedRange(const QObject *user, DataType domain, double min, double max)
+{
+    DisplayedRange r = {.domain = domain, .min = min, .max = max};
+    displayedRanges[user] = r;
+    updateDisplayedRanges();
+}
+
+void Trace::releaseDisplayedRange(const QObject *user)
+{
+    if(displayedRanges.erase(user)) {
+        updateDisplayedRanges();
+    }
+}
+
+void Trace::updateDisplayedRanges()
+{
+    // the first entry is the trace itself
+    for(unsigned int i=1;i<mathOps.size();i++) {
+        auto &m = mathOps[i];
+        double min = 0, max = 0;
+        bool found = false;
+        if(m.enabled) {
+            for(auto &r : displayedRanges) {
+                if(r.second.domain != m.math->getDataType() || r.second.min >= r.second.max) {
+                    continue;
+                }
+                if(!found) {
+                    min = r.second.min;
+                    max = r.second.max;
+                    found = true;
+                } else {
+                    // several graphs show this trace, calculate everything any of them displays
+                    min = std::min(min, r.second.min);
+                    max = std::max(max, r.second.max);
+                }
+            }
+        }
+        m.math->setDisplayedRange(min, max);
+    }
+}
+
+void Trace::configureHistory()
+{
+    unsigned int depth = 0;
+    for(auto r : historyRequests) {
+        depth = max(depth, r.second);
+    }
+    if(depth == 0) {
+        // nobody needs the history, free the memory
+        _history.configure(0, 0, 0);
+        return;
+    }
+    auto &pref = Preferences::getInstance();
+    size_t budget = (size_t) pref.Graphs.sweepHistoryMemory * 1024 * 1024;
+    _history.configure(size(), depth, budget, pref.Graphs.sweepHistorySpill);
+}
+
+void Trace::lastMathSamplesChanged(unsigned int begin, unsigned int end)
+{
+    auto &s = samples();
+    if(!historyRequests.empty()) {
+        if(s.size() != _history.points() && begin == 0 && s.size() > 0 && lastSamplesEnd == s.size()) {
+            // The number of samples changed, the old sweeps no longer fit. During the first sweep after the change,
+            // the trace grows with every update. The number of samples is only settled once the previous sweep
+            // reached the end of the samples and a new sweep starts. Until then, nothing is recorded
+            configureHistory();
+        }
+        if(s.size() > 0 && s.size() == _history.points() && _history.capacity() > 0) {
+            // A new sweep only starts when the source data starts over at the first sample. All other changes
+            // (including recalculations of the whole range by math operations) update the current sweep
+            Data *sweep;
+            unsigned int first = begin;
+            unsigned int last = min(end, s.size());
+            if(sweepCount != historySweepCount || _history.empty()) {
+                // the remaining samples still contain the previous sweep, copy them as well
+                sweep = _history.newSweep();
+                historySweepCount = sweepCount;
+                first = 0;
+                last = s.size();
+            } else {
+                sweep = _history.latest();
+            }
+            for(unsigned int i=first;i<last;i++) {
+                sweep[i] = s.get(i);
+            }
+        }
+    }
+    lastSamplesEnd = min(end, s.size());
+    emit dataChanged(begin, end);
+}
+
 double Trace::getUnwrappedPhase(unsigned int index)
 {
     if(index >= size()) {
@@ -1378,12 +1699,11 @@ double Trace::getNoise(double frequency)
 
 int Trace::index(double x)
 {
-    auto lower = lower_bound(lastMath->rData().begin(), lastMath->rData().end(), x, [](const Data &lhs, const double x) -> bool {
-        return lhs.x < x;
-    });
-    if(lower == lastMath->rData().end()) {
+    auto &samples = lastMath->rData();
+    auto lower = samples.lowerBound(x);
+    if(lower == samples.size()) {
         // actually beyond the last sample, return the index of the last anyway to avoid access past data
-        return lastMath->rData().size() - 1;
+        return samples.size() - 1;
     }
-    return lower - lastMath->rData().begin();
+    return lower;
 }
@@ -7,12 +7,14 @@
 #include "Math/tracemath.h"
 #include "Tools/parameters.h"
 #include "VNA/vnadata.h"
+#include "Util/sweephistory.h"
 
 #include <QObject>
 #include <complex>
 #include <map>
 #include <QColor>
 #include <set>
+#include <memory>
 #include <QTime>
 
 class Marker;
@@ -56,6 +58,9 @@ public:
     void clear(bool force = false);
     void addData(const Data& d, DataType domain, double reference_impedance = 50.0, int index = -1);
     void addData(const Data& d, const Protocol::SpectrumAnalyzerSettings& s, int index = -1);
+    // Adds several samples at once (e.g. a complete sweep) and only signals a single change for all of them.
+    // If indices is not null, it contains the index position of every sample (same as index for a single sample)
+    void addData(const Data *d, unsigned int count, DataType domain, double reference_impedance = 50.0, const int *indices = nullptr);
     void setName(QString name);
     void setVelocityFactor(double v);
     void fillFromTouchstone(Touchstone &t, unsigned int parameter);
@@ -76,6 +81,8 @@ public:
     LivedataType liveType() { return _liveType; }
     TraceMath::DataType outputType() const { return lastMath->getDataType(); }
     unsigned int size() const;
+    // output samples of the last math operation (the trace data itself if math is disabled)
+    const Samples& samples() const { return lastMath->rData(); }
     double minX();
     double maxX();
     double findExtremum(bool max);
@@ -92,6 +99,18 @@ public:
     };
 
     Data sample(unsigned int index, bool getStepResponse = false) const;
+
+    // Past sweeps of the output samples. The history is only recorded while at least one user requested it.
+    // Every user specifies how many sweeps it needs, the longest request determines the history depth
+    // (possibly limited by the memory budget from the preferences)
+    void requestHistory(const QObject *user, unsigned int sweeps);
+    void releaseHistory(const QObject *user);
+    const SweepHistory<Data>& history() const { return _history; }
+    // Graphs with a manually set X axis report the range they display (in the unit of the domain, time in seconds).
+    // The ranges of all graphs showing this trace are combined per domain and passed on to the math operations
+    // (see TraceMath::setDisplayedRange), also whenever the math operations change
+    void reportDisplayedRange(const QObject *user, DataType domain, double min, double max);
+    void releaseDisplayedRange(const QObject *user);
     double getUnwrappedPhase(unsigned int index);
     // returns a (possibly interpolated sample) at a specified frequency/time/power
     Data interpolatedSample(double x);
@@ -209,6 +228,8 @@ signals:
 
 private slots:
     void markerVisibilityChanged(Marker *m);
+    // Adds changed output samples to the sweep history and passes the change on through dataChanged
+    void lastMathSamplesChanged(unsigned int begin, unsigned int end);
 
     // Functions for handling source == Source::Math
 
@@ -221,7 +242,8 @@ private slots:
     // Schedules an update of this trace, should be called whenever any source data changes.
     // As it is likely that multiple source traces will change directly after each other, no
     // calculation is performed directly. Instead the calculation is only scheduled and executed
-    // shortly after. This prevents calculating data that will be overwritten immediately afterwards
+    // shortly after. This prevents calculating data that will be overwritten immediately afterwards.
+    // Traces that are part of a model are calculated by the TraceMathScheduler of the model
     void scheduleMathCalculation(unsigned int begin, unsigned int end);
     // Actually calculates the Y coordinate values of this trace. It expects that the data vector is
     // already set up with the required amount of points and X coordinates
@@ -231,6 +253,17 @@ private slots:
     // Attempts to add a math source using the trace hash instead of a pointer (when loading setups)
     bool addMathSource(unsigned int hash, QString variableName);
 
+public:
+    // Math trace calculation in three steps, used by the TraceMathScheduler to evaluate several math traces in parallel.
+    // prepareMathCalculation() and finishMathCalculation() must be called from the GUI thread, evaluateMathCalculation()
+    // may run in any thread while the source traces are not modified.
+    // Sets up the calculation of all pending samples. Returns false if nothing has to be calculated
+    bool prepareMathCalculation();
+    // Calculates the Y coordinates of the prepared samples without modifying the trace data
+    void evaluateMathCalculation();
+    // Copies the calculated samples into the trace data and signals the change
+    void finishMathCalculation();
+
 private:
     TraceModel *model; // model which this trace will be part of
     QString _name;
@@ -262,6 +295,9 @@ private:
     QTimer mathCalcTimer;
     unsigned int mathUpdateBegin;
     unsigned int mathUpdateEnd;
+    // state of a prepared calculation, only valid between prepareMathCalculation() and finishMathCalculation()
+    class MathCalculation;
+    std::unique_ptr<MathCalculation> mathCalculation;
 
     double vFactor;
     bool reflection;
@@ -278,6 +314,32 @@ private:
         bool valid;
     } settings;
 
+    // Stores the sample without signaling the change, returns the index where it was stored
+    unsigned int storeSample(const Data &d, int index);
+    // Sweeps deliver their points in ascending order. The next sample is usually located right after
+    // the previous one, either replacing the sample from the last sweep or appended at the end
+    unsigned int nextSampleIndex;
+    // Incremented whenever new data is written to the first sample, i.e. a new sweep starts
+    unsigned int sweepCount;
+
+    // sets up the sweep history for the current number of output samples and the requested depth
+    void configureHistory();
+    SweepHistory<Data> _history;
+    // end of the last change of the output samples, used to detect when the number of samples has settled
+    unsigned int lastSamplesEnd;
+    // sweepCount of the data in the latest sweep of the history
+    unsigned int historySweepCount;
+    std::map<const QObject*, unsigned int> historyRequests;
+
+    class DisplayedRange {
+    public:
+        DataType domain;
+        double min, max;
+    };
+    std::map<const QObject*, DisplayedRange> displayedRanges;
+    // passes the combined displayed ranges on to the math operations
+    void updateDisplayedRanges();
+
     std::vector<MathInfo> mathOps;
     TraceMath *lastMath;
     std::vector<double> unwrappedPhase;
@@ -176,6 +176,44 @@ double YAxis::sampleToCoordinate(Trace::Data data, Trace *t, unsigned int sample
     return 0.0;
 }
 
+void YAxis::samplesToCoordinates(Trace *t, std::vector<double> &dest)
+{
+    auto &samples = t->samples();
+    const unsigned int n = samples.size();
+    switch(type) {
+    case YAxis::Type::Magnitude:
+    case YAxis::Type::ImpulseMag:
+        samples.magnitudesdB(dest);
+        break;
+    case YAxis::Type::MagnitudedBuV:
+        samples.magnitudesdB(dest);
+        for(unsigned int i=0;i<n;i++) {
+            dest[i] = Util::dBmTodBuV(dest[i]);
+        }
+        break;
+    case YAxis::Type::MagnitudeLinear:
+        samples.magnitudesSquared(dest);
+        for(unsigned int i=0;i<n;i++) {
+            dest[i] = sqrt(dest[i]);
+        }
+        break;
+    case YAxis::Type::Real:
+    case YAxis::Type::ImpulseReal:
+        dest.assign(samples.realData(), samples.realData() + n);
+        break;
+    case YAxis::Type::Imaginary:
+        dest.assign(samples.imagData(), samples.imagData() + n);
+        break;
+    default:
+        // depends on more than the sample itself, convert one by one
+        dest.resize(n);
+        for(unsigned int i=0;i<n;i++) {
+            dest[i] = sampleToCoordinate(t->sample(i), t, i);
+        }
+        break;
+    }
+}
+
 void YAxis::set(Type type, bool log, bool autorange, double min, double max, double div)
 {
     this->type = type;
@@ -472,6 +510,18 @@ double XAxis::sampleToCoordinate(Trace::Data data, Trace *t, unsigned int sample
     }
 }
 
+void XAxis::samplesToCoordinates(Trace *t, std::vector<double> &dest)
+{
+    auto &samples = t->samples();
+    const unsigned int n = samples.size();
+    dest.assign(samples.xData(), samples.xData() + n);
+    if(type == Type::Distance) {
+        for(unsigned int i=0;i<n;i++) {
+            dest[i] = t->timeToDistance(dest[i]);
+        }
+    }
+}
+
 void XAxis::set(Type type, bool log, bool autorange, double min, double max, double div)
 {
     this->type = type;
@@ -10,6 +10,8 @@ class Axis {
 public:
     Axis();
     virtual double sampleToCoordinate(Trace::Data data, Trace *t = nullptr, unsigned int sample = 0) = 0;
+    // Converts all samples of a trace at once. Same result as calling sampleToCoordinate for every sample
+    virtual void samplesToCoordinates(Trace *t, std::vector<double> &dest) = 0;
     double transform(double value, double to_low, double to_high);
     double inverseTransform(double value, double to_low, double to_high);
     bool getLog() const;
@@ -41,6 +43,7 @@ public:
     };
     XAxis();
     double sampleToCoordinate(Trace::Data data, Trace *t = nullptr, unsigned int sample = 0) override;
+    void samplesToCoordinates(Trace *t, std::vector<double> &dest) override;
     void set(Type type, bool log, bool autorange, double min, double max, double div);
     static QString TypeToName(Type type);
     static Type TypeFromName(QString name);
@@ -85,6 +88,7 @@ public:
     };
     YAxis();
     double sampleToCoordinate(Trace::Data data, Trace *t = nullptr, unsigned int sample = 0) override;
+    void samplesToCoordinates(Trace *t, std::vector<double> &dest) override;
 
     void set(Type type, bool log, bool autorange, double min, double max, double div);
     static QString TypeToName(Type type);
@@ -0,0 +1,126 @@
+#include "tracemathscheduler.h"
+
+#include "trace.h"
+#include "tracemodel.h"
+#include "Math/parser/mpError.h"
+
+#include <QRunnable>
+#include <map>
+#include <functional>
+
+using namespace std;
+
+namespace {
+
+class EvaluationTask : public QRunnable {
+public:
+    EvaluationTask(Trace *t) : t(t) {}
+    void run() override {
+        t->evaluateMathCalculation();
+    }
+private:
+    Trace *t;
+};
+
+}
+
+TraceMathScheduler::TraceMathScheduler(TraceModel &model)
+    : model(model),
+      running(false),
+      rescheduled(false)
+{
+    // muparserx creates its error messages on first use, make sure this does not happen in a worker thread
+    mup::ParserErrorMsg::Instance();
+    lastRun = QTime::currentTime();
+    timer.setSingleShot(true);
+    connect(&timer, &QTimer::timeout, this, &TraceMathScheduler::run);
+}
+
+void TraceMathScheduler::schedule()
+{
+    if(running) {
+        // traces depending on the ones that just changed are calculated in the same run, others in the next one
+        rescheduled = true;
+        return;
+    }
+    if(timer.isActive()) {
+        return;
+    }
+    auto elapsed = lastRun.msecsTo(QTime::currentTime());
+    if(elapsed < 0 || elapsed >= MinUpdateInterval) {
+        timer.start(0);
+    } else {
+        timer.start(MinUpdateInterval - elapsed);
+    }
+}
+
+void TraceMathScheduler::run()
+{
+    lastRun = QTime::currentTime();
+    running = true;
+    rescheduled = false;
+    for(auto &level : buildLevels()) {
+        vector<Trace*> pending;
+        for(auto t : level) {
+            if(t->prepareMathCalculation()) {
+                pending.push_back(t);
+            }
+        }
+        if(pending.empty()) {
+            continue;
+        }
+        // this thread evaluates one trace itself instead of waiting idle
+        for(unsigned int i=1;i<pending.size();i++) {
+            pool.start(new EvaluationTask(pending[i]));
+        }
+        pending[0]->evaluateMathCalculation();
+        pool.waitForDone();
+        // Publish the results. This may schedule traces of higher levels which will be handled in this run
+        for(auto t : pending) {
+            t->finishMathCalculation();
+        }
+    }
+    running = false;
+    if(rescheduled) {
+        schedule();
+    }
+}
+
+vector<vector<Trace*>> TraceMathScheduler::buildLevels()
+{
+    // The graph is small (rarely more than a few dozen traces) and built again for every run.
+    // This way, no changes of the traces or their math sources have to be tracked
+    vector<Trace*> mathTraces;
+    for(auto t : model.getTraces()) {
+        if(t->getSource() == Trace::Source::Math) {
+            mathTraces.push_back(t);
+        }
+    }
+    map<Trace*, int> level;
+    // returns the level of a trace, 0 if it does not depend on any other math trace
+    function<int(Trace*)> getLevel = [&](Trace *t) -> int {
+        auto it = level.find(t);
+        if(it != level.end()) {
+            return it->second;
+        }
+        // mark as visited, breaks loops of traces depending on each other (which should not exist anyway)
+        level[t] = 0;
+        int l = 0;
+        for(auto s : mathTraces) {
+            if(s != t && t->mathDependsOn(s, true)) {
+                l = max(l, getLevel(s) + 1);
+            }
+        }
+        level[t] = l;
+        return l;
+    };
+    vector<vector<Trace*>> levels;
+    for(auto t : mathTraces) {
+        unsigned int l = getLevel(t);
+        if(l >= levels.size()) {
+            levels.resize(l + 1);
+        }
+        levels[l].push_back(t);
+    }
+    return levels;
+}
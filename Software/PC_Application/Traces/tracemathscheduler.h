@@ -0,0 +1,48 @@
+#ifndef TRACEMATHSCHEDULER_H
+#define TRACEMATHSCHEDULER_H
+
+#include <QObject>
+#include <QTimer>
+#include <QTime>
+#include <QThreadPool>
+#include <vector>
+
+class Trace;
+class TraceModel;
+
+// Calculates the math traces (Trace::Source::Math) of a model. Math traces may use other math traces as their
+// sources, together they form a dependency graph. Instead of recalculating a math trace whenever one of its sources
+// changes, all pending calculations are collected and executed together:
+// - the math traces are grouped into levels, every trace only depends on traces from lower levels
+// - the levels are processed in ascending order, every trace is calculated at most once per run
+// - the traces of one level do not depend on each other, they are evaluated in parallel
+// - the results of a level are published to the GUI together, after all of its traces have been evaluated
+class TraceMathScheduler : public QObject
+{
+    Q_OBJECT
+public:
+    TraceMathScheduler(TraceModel &model);
+
+    // Requests a calculation of all math traces with pending updates. Usually, several source traces change directly
+    // after each other (e.g. all S-parameters of a sweep). The calculation is deferred until control returns to the event
+    // loop and limited to one run every MinUpdateInterval
+    void schedule();
+
+public slots:
+    void run();
+
+private:
+    // groups the math traces by their dependencies, traces in levels[0] only depend on non-math traces
+    std::vector<std::vector<Trace*>> buildLevels();
+
+    static constexpr int MinUpdateInterval = 100;
+    TraceModel &model;
+    QTimer timer;
+    QTime lastRun;
+    bool running;
+    // set when a calculation was scheduled while already running
+    bool rescheduled;
+    QThreadPool pool;
+};
+
+#endif // TRACEMATHSCHEDULER_H
@@ -6,7 +6,8 @@
 using namespace std;
 
 TraceModel::TraceModel(QObject *parent)
-    : QAbstractTableModel(parent)
+    : QAbstractTableModel(parent),
+      mathScheduler(*this)
 {
     traces.clear();
     source = DataSource::Unknown;
@@ -250,6 +251,57 @@ void TraceModel::addVNAData(const VNAData& d, TraceMath::DataType datatype)
     }
 }
 
+void TraceModel::addVNAData(const std::vector<VNAData> &d, TraceMath::DataType datatype)
+{
+    if(d.empty()) {
+        return;
+    }
+    source = DataSource::VNA;
+    switch(datatype) {
+    case TraceMath::DataType::Frequency:
+    case TraceMath::DataType::Power:
+    case TraceMath::DataType::TimeZeroSpan:
+        break;
+    default:
+        // invalid type, can not add
+        return;
+    }
+    std::vector<Trace::Data> td(d.size());
+    // the X coordinate and the position are the same for all traces
+    for(unsigned int i=0;i<d.size();i++) {
+        switch(datatype) {
+        case TraceMath::DataType::Frequency: td[i].x = d[i].frequency; break;
+        case TraceMath::DataType::Power: td[i].x = (double) d[i].cdbm / 100.0; break;
+        default: td[i].x = d[i].time; break;
+        }
+    }
+    std::vector<int> indices;
+    if(datatype == TraceMath::DataType::TimeZeroSpan) {
+        for(auto &p : d) {
+            indices.push_back(p.pointNum);
+        }
+    }
+    for(auto t : traces) {
+        if (t->getSource() != Trace::Source::Live || t->isPaused()) {
+            continue;
+        }
+        auto param = t->liveParameter();
+        if(!Trace::isVNAParameter(param)) {
+            // not a VNA trace, skip
+            continue;
+        }
+        for(unsigned int i=0;i<d.size();i++) {
+            switch(param) {
+            case Trace::LiveParameter::S11: td[i].y = d[i].S.m11; break;
+            case Trace::LiveParameter::S12: td[i].y = d[i].S.m12; break;
+            case Trace::LiveParameter::S21: td[i].y = d[i].S.m21; break;
+            default: td[i].y = d[i].S.m22; break;
+            }
+        }
+        t->addData(td.data(), td.size(), datatype, d[0].reference_impedance, indices.empty() ? nullptr : indices.data());
+    }
+}
+
 void TraceModel::addSAData(const Protocol::SpectrumAnalyzerResult& d, const Protocol::SpectrumAnalyzerSettings& settings)
 {
     source = DataSource::SA;
@@ -295,3 +347,8 @@ void TraceModel::setMarkerModel(MarkerModel *value)
 {
     markerModel = value;
 }
+
+TraceMathScheduler *TraceModel::getMathScheduler()
+{
+    return &mathScheduler;
+}
@@ -4,6 +4,7 @@
 #include "Device/device.h"
 #include "savable.h"
 #include "trace.h"
+#include "tracemathscheduler.h"
 #include "VNA/vnadata.h"
 
 #include <QAbstractTableModel>
@@ -56,6 +57,8 @@ public:
     DataSource getSource() const;
     void setSource(const DataSource &value);
 
+    TraceMathScheduler *getMathScheduler();
+
 signals:
     void SpanChanged(double fmin, double fmax);
     void traceAdded(Trace *t);
@@ -66,12 +69,15 @@ signals:
 public slots:
     void clearLiveData();
     void addVNAData(const VNAData& d, TraceMath::DataType datatype);
+    // Adds several points (e.g. a whole sweep or segment) with a single update of every trace
+    void addVNAData(const std::vector<VNAData>& d, TraceMath::DataType datatype);
     void addSAData(const Protocol::SpectrumAnalyzerResult& d, const Protocol::SpectrumAnalyzerSettings& settings);
 
 private:
     DataSource source;
     std::vector<Trace*> traces;
     MarkerModel *markerModel;
+    TraceMathScheduler mathScheduler;
 };
 
 #endif // TRACEMODEL_H
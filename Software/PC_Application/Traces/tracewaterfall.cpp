@@ -17,6 +17,7 @@ TraceWaterfall::TraceWaterfall(TraceModel &model, QWidget *parent)
       dir(Direction::TopToBottom),
       align(Alignment::PrimaryOnly),
       trace(nullptr),
+      firstSweep(0),
       pixelsPerLine(1),
       keepDataBeyondPlotSize(false),
       maxDataSweeps(500)
@@ -39,22 +40,24 @@ void TraceWaterfall::enableTrace(Trace *t, bool enabled)
             if(t.second) {
                 TracePlot::enableTrace(t.first, false);
                 disconnect(t.first, &Trace::dataChanged, this, &TraceWaterfall::traceDataChanged);
+                t.first->releaseHistory(this);
                 break;
             }
         }
     }
     TracePlot::enableTrace(t, enabled);
-    resetWaterfall();
     if(enabled) {
         trace = t;
+        trace->requestHistory(this, maxDataSweeps);
         connect(t, &Trace::dataChanged, this, &TraceWaterfall::traceDataChanged);
     } else {
         if(trace) {
             disconnect(trace, &Trace::dataChanged, this, &TraceWaterfall::traceDataChanged);
+            trace->releaseHistory(this);
         }
         trace = nullptr;
     }
-
+    resetWaterfall();
 }
 
 void TraceWaterfall::replot()
@@ -122,7 +125,8 @@ void TraceWaterfall::axisSetupDialog()
 
 void TraceWaterfall::resetWaterfall()
 {
-    data.clear();
+    // hide all sweeps that have been recorded so far
+    firstSweep = trace ? trace->history().sequence() : 0;
     updateYAxis();
 }
 
@@ -355,8 +359,10 @@ void TraceWaterfall::draw(QPainter &p)
     }
 
     p.setClipRect(QRect(plotRect.x()+1, plotRect.y()+1, plotRect.width()-1, plotRect.height()-1));
-    if(data.size()) {
+    auto sweeps = numSweeps();
+    if(sweeps) {
         // plot waterfall data
+        auto points = trace->history().points();
         int ytop, ybottom;
         bool lastLine = false;
         if(dir == Direction::TopToBottom) {
@@ -367,10 +373,10 @@ void TraceWaterfall::draw(QPainter &p)
             ytop = ybottom - pixelsPerLine + 1;
         }
         int i;
-        for(i=data.size() - 1;i>=0;i--) {
-            auto sweep = data[i];
-            for(unsigned int s=0;s<sweep.size();s++) {
-                auto x = xAxis.sampleToCoordinate(sweep[s], trace);
+        for(i=sweeps - 1;i>=0;i--) {
+            auto samples = sweep(i);
+            for(unsigned int s=0;s<points;s++) {
+                auto x = xAxis.sampleToCoordinate(samples[s], trace);
                 double x_start;
                 double x_stop;
                 if(x < xAxis.getRangeMin() || x > xAxis.getRangeMax()) {
@@ -380,18 +386,18 @@ void TraceWaterfall::draw(QPainter &p)
                 if(s == 0) {
                     x_start = x;
                 } else {
-                    auto prev_x = xAxis.sampleToCoordinate(sweep[s-1], trace);
+                    auto prev_x = xAxis.sampleToCoordinate(samples[s-1], trace);
                     x_start = (prev_x + x) / 2.0;
                 }
                 x_start = xAxis.transform(x_start, plotAreaLeft, plotAreaLeft + plotAreaWidth);
-                if(s == sweep.size() - 1) {
+                if(s == points - 1) {
                     x_stop = x;
                 } else {
-                    auto next_x = xAxis.sampleToCoordinate(sweep[s+1], trace);
+                    auto next_x = xAxis.sampleToCoordinate(samples[s+1], trace);
                     x_stop = (next_x + x) / 2.0;
                 }
                 x_stop = xAxis.transform(x_stop, plotAreaLeft, plotAreaLeft + plotAreaWidth);
-                auto y = yAxis.sampleToCoordinate(sweep[s]);
+                auto y = yAxis.sampleToCoordinate(samples[s]);
                 auto color = getColor(yAxis.transform(y, 0.0, 1.0));
                 auto rect = QRect(round(x_start), ytop, round(x_stop - x_start) + 1, ybottom - ytop + 1);
                 p.fillRect(rect, QBrush(color));
@@ -417,8 +423,8 @@ void TraceWaterfall::draw(QPainter &p)
             }
         }
         if(!keepDataBeyondPlotSize && i >= 0) {
-            // not all data could be plotted, drop
-            data.erase(data.begin(), data.begin() + i);
+            // not all data could be plotted, skip the sweeps that are no longer visible from now on
+            firstSweep = trace->history().sequence() - sweeps + i;
             updateYAxis();
         }
     }
@@ -505,31 +511,31 @@ void TraceWaterfall::traceDataChanged(unsigned int begin, unsigned int end)
         double max_x = trace->sample(trace->size() - 1).x;
         if(min_x != xAxis.getRangeMin() || max_x != xAxis.getRangeMax()) {
             resetWaterfall();
+            // keep the sweep that caused the change
+            if(!trace->history().empty()) {
+                firstSweep--;
+            }
             // adjust axis
             xAxis.set(xAxis.getType(), xAxis.getLog(), true, min_x, max_x, 0);
         }
     }
+    // the trace has already added the new data to its history
+    auto sweeps = numSweeps();
+    if(sweeps == 0) {
+        return;
+    }
     bool YAxisUpdateRequired = false;
-    if (begin == 0 || data.size() == 0) {
-        if(data.size() == 1) {
-            YAxisUpdateRequired = true;
-        }
-        // start new row
-        data.push_back(std::vector<Trace::Data>());
-        while (data.size() > maxDataSweeps) {
-            data.pop_front();
-            // min/max might have changed due to removed data
-            YAxisUpdateRequired = true;
-        }
+    if(begin == 0 && (sweeps == 1 || trace->history().full())) {
+        // first sweep or the oldest sweep has been dropped, min/max might have changed
+        YAxisUpdateRequired = true;
     }
-    // grab trace data
-    data.back().resize(trace->size());
+    auto latest = sweep(sweeps - 1);
+    end = std::min(end, trace->history().points());
     double min = yAxis.getRangeMin();
     double max = yAxis.getRangeMax();
     for(unsigned int i=begin;i<end;i++) {
-        data.back()[i] = trace->sample(i);
         if(yAxis.getAutorange() && !YAxisUpdateRequired) {
-            double val = yAxis.sampleToCoordinate(trace->sample(i));
+            double val = yAxis.sampleToCoordinate(latest[i]);
             if(isnan(val) || isinf(val)) {
                 continue;
             }
@@ -554,9 +560,12 @@ void TraceWaterfall::updateYAxis()
     if(yAxis.getAutorange()) {
         double min = std::numeric_limits<double>::max();
         double max = std::numeric_limits<double>::lowest();
-        for(auto sweep : data) {
-            for(unsigned int i=0;i<sweep.size();i++) {
-                double val = yAxis.sampleToCoordinate(sweep[i]);
+        auto sweeps = numSweeps();
+        auto points = sweeps ? trace->history().points() : 0;
+        for(unsigned int s=0;s<sweeps;s++) {
+            auto samples = sweep(s);
+            for(unsigned int i=0;i<points;i++) {
+                double val = yAxis.sampleToCoordinate(samples[i]);
                 if(isnan(val) || isinf(val)) {
                     continue;
                 }
@@ -574,6 +583,33 @@ void TraceWaterfall::updateYAxis()
     }
 }
 
+void TraceWaterfall::setMaxSweeps(unsigned int sweeps)
+{
+    maxDataSweeps = sweeps;
+    if(trace) {
+        trace->requestHistory(this, maxDataSweeps);
+    }
+}
+
+unsigned int TraceWaterfall::numSweeps()
+{
+    if(!trace) {
+        return 0;
+    }
+    auto &history = trace->history();
+    auto available = history.sequence() - firstSweep;
+    if(firstSweep > history.sequence()) {
+        available = 0;
+    }
+    return std::min((unsigned long) history.size(), available);
+}
+
+const Trace::Data *TraceWaterfall::sweep(unsigned int index)
+{
+    auto &history = trace->history();
+    return history.sweep(history.size() - numSweeps() + index);
+}
+
 QColor TraceWaterfall::getColor(double scale)
 {
     if(scale < 0.0) {
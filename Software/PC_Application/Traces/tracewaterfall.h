@@ -5,8 +5,6 @@
 
 #include "traceaxis.h"
 
-#include <deque>
-
 class TraceWaterfall : public TracePlot
 {
     friend class WaterfallAxisDialog;
@@ -44,6 +42,12 @@ protected slots:
 private slots:
     void updateYAxis();
 private:
+    void setMaxSweeps(unsigned int sweeps);
+    // The sweeps are taken from the history of the trace. Sweeps that were recorded before the waterfall was reset
+    // (or that were dropped because they did not fit into the plot) are skipped. Index 0 is the oldest sweep
+    unsigned int numSweeps();
+    const Trace::Data *sweep(unsigned int index);
+
     // color scale, input value from 0.0 to 1.0
     QColor getColor(double scale);
 
@@ -71,7 +75,8 @@ private:
     XAxis xAxis;
     YAxis yAxis;
 
-    std::deque<std::vector<Trace::Data>> data;
+    // running number (see SweepHistory::sequence()) of the oldest sweep that is displayed
+    unsigned long firstSweep;
     unsigned int pixelsPerLine;
     int plotAreaLeft, plotAreaWidth, plotAreaBottom, plotAreaTop;
     bool keepDataBeyondPlotSize;
@@ -35,6 +35,9 @@ TraceXYPlot::TraceXYPlot(TraceModel &model, QWidget *parent)
 
 TraceXYPlot::~TraceXYPlot()
 {
+    for(auto t : tracesAxis[0]) {
+        t->releaseDisplayedRange(this);
+    }
     for(auto l : constantLines) {
         delete l;
     }
@@ -70,6 +73,9 @@ void TraceXYPlot::setXAxis(XAxis::Type type, XAxisMode mode, bool log, double mi
     }
     xAxis.set(type, log, autorange, min, max, div);
     xAxisMode = mode;
+    for(auto t : tracesAxis[0]) {
+        reportDisplayedRange(t, true);
+    }
     traceRemovalPending = true;
     updateContextMenu();
     replot();
@@ -352,6 +358,9 @@ void TraceXYPlot::draw(QPainter &p)
 
     limitPassing = true;
 
+    // plot coordinates of the trace that is currently drawn
+    std::vector<QPointF> points;
+
     auto w = p.window();
     auto pen = QPen(pref.Graphs.Color.axis, 0);
     pen.setCosmetic(true);
@@ -470,9 +479,10 @@ void TraceXYPlot::draw(QPainter &p)
             }
             p.setPen(pen);
             auto nPoints = t->size();
+            traceToCoordinates(t, yAxis[i], points);
             for(unsigned int j=1;j<nPoints;j++) {
-                auto last = traceToCoordinate(t, j-1, yAxis[i]);
-                auto now = traceToCoordinate(t, j, yAxis[i]);
+                auto last = points[j-1];
+                auto now = points[j];
 
                 if(isnan(last.y()) || isnan(now.y()) || isinf(last.y()) || isinf(now.y())) {
                     continue;
@@ -725,6 +735,7 @@ void TraceXYPlot::draw(QPainter &p)
 
 void TraceXYPlot::updateAxisTicks()
 {
+    std::vector<QPointF> points;
     if(xAxisMode != XAxisMode::Manual) {
         // automatic mode, figure out limits
         double max = std::numeric_limits<double>::lowest();
@@ -773,8 +784,9 @@ void TraceXYPlot::updateAxisTicks()
                     continue;
                 }
                 unsigned int samples = t->size();
+                traceToCoordinates(t, yAxis[i], points);
                 for(unsigned int j=0;j<samples;j++) {
-                    auto point = traceToCoordinate(t, j, yAxis[i]);
+                    auto point = points[j];
 
                     if(point.x() < xAxis.getRangeMin() || point.x() > xAxis.getRangeMax()) {
                         // this point is not in the displayed X range, skip for auto Y range calculation
@@ -856,9 +868,13 @@ void TraceXYPlot::enableTraceAxis(Trace *t, int axis, bool enabled)
     if(alreadyEnabled != enabled) {
         if(enabled) {
             tracesAxis[axis].insert(t);
+            if(axis == 0) {
+                reportDisplayedRange(t, true);
+            }
         } else {
             tracesAxis[axis].erase(t);
             if(axis == 0) {
+                reportDisplayedRange(t, false);
                 disconnect(t, &Trace::markerAdded, this, &TraceXYPlot::markerAdded);
                 disconnect(t, &Trace::markerRemoved, this, &TraceXYPlot::markerRemoved);
                 auto tracemarkers = t->getMarkers();
@@ -873,6 +889,28 @@ void TraceXYPlot::enableTraceAxis(Trace *t, int axis, bool enabled)
     }
 }
 
+void TraceXYPlot::reportDisplayedRange(Trace *t, bool displayed)
+{
+    if(!displayed || xAxisMode != XAxisMode::Manual) {
+        t->releaseDisplayedRange(this);
+        return;
+    }
+    switch(xAxis.getType()) {
+    case XAxis::Type::Frequency:
+        t->reportDisplayedRange(this, TraceMath::DataType::Frequency, xAxis.getRangeMin(), xAxis.getRangeMax());
+        break;
+    case XAxis::Type::Time:
+        t->reportDisplayedRange(this, TraceMath::DataType::Time, xAxis.getRangeMin(), xAxis.getRangeMax());
+        break;
+    case XAxis::Type::Distance:
+        t->reportDisplayedRange(this, TraceMath::DataType::Time, t->distanceToTime(xAxis.getRangeMin()), t->distanceToTime(xAxis.getRangeMax()));
+        break;
+    default:
+        t->releaseDisplayedRange(this);
+        break;
+    }
+}
+
 bool TraceXYPlot::domainMatch(Trace *t)
 {
     switch(xAxis.getType()) {
@@ -929,6 +967,17 @@ QPointF TraceXYPlot::traceToCoordinate(Trace *t, unsigned int sample, YAxis &yax
     return ret;
 }
 
+void TraceXYPlot::traceToCoordinates(Trace *t, YAxis &yaxis, std::vector<QPointF> &dest)
+{
+    std::vector<double> x, y;
+    xAxis.samplesToCoordinates(t, x);
+    yaxis.samplesToCoordinates(t, y);
+    dest.resize(x.size());
+    for(unsigned int i=0;i<x.size();i++) {
+        dest[i] = QPointF(x[i], y[i]);
+    }
+}
+
 QPoint TraceXYPlot::plotValueToPixel(QPointF plotValue, int Yaxis)
 {
     QPoint p;
@@ -98,10 +98,14 @@ private:
     static QString AxisModeToName(XAxisMode mode);
     static XAxisMode AxisModeFromName(QString name);
     void enableTraceAxis(Trace *t, int axis, bool enabled);
+    // reports the X axis range to a trace if it is set manually, releases the reported range otherwise
+    void reportDisplayedRange(Trace *t, bool displayed);
     bool domainMatch(Trace *t);
     bool supported(Trace *t) override;
     bool supported(Trace *t, YAxis::Type type);
     QPointF traceToCoordinate(Trace *t, unsigned int sample, YAxis &yaxis);
+    // converts all samples of the trace, considerably faster than calling traceToCoordinate for every sample
+    void traceToCoordinates(Trace *t, YAxis &yaxis, std::vector<QPointF> &dest);
     QPoint plotValueToPixel(QPointF plotValue, int Yaxis);
     QPointF pixelToPlotValue(QPoint pixel, int YAxis);
     QPoint markerToPixel(Marker *m) override;
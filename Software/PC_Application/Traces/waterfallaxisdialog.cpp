@@ -118,7 +118,7 @@ void WaterfallAxisDialog::on_buttonBox_accepted()
         plot->dir = TraceWaterfall::Direction::BottomToTop;
     }
     plot->pixelsPerLine = ui->Wpixels->value();
-    plot->maxDataSweeps = ui->WmaxSweeps->value();
+    plot->setMaxSweeps(ui->WmaxSweeps->value());
     if(ui->Wmode->currentIndex() == 0) {
         plot->keepDataBeyondPlotSize = false;
     } else {
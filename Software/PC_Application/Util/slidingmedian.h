@@ -0,0 +1,155 @@
+#ifndef SLIDINGMEDIAN_H
+#define SLIDINGMEDIAN_H
+
+#include <vector>
+
+// Median of the last "capacity" keys added to a window. Adding a key to a full window removes the oldest one.
+// The keys are calculated once by the caller (e.g. the magnitude of a complex value) instead of in every comparison.
+//
+// Only the keys are stored. They are placed in the slots of a ring buffer (slot = number of added keys modulo capacity)
+// and the median is returned as a slot, the caller keeps the corresponding values in a ring buffer of the same size.
+//
+// The slots are kept in two heaps: a max-heap with the smaller half and a min-heap with the larger half of the keys.
+// Every slot knows its position in the heaps, so the oldest key can be removed directly. Adding a key is
+// O(log capacity), the median is available in O(1).
+class SlidingMedian {
+public:
+    explicit SlidingMedian(unsigned int capacity = 1) {
+        reset(capacity);
+    }
+
+    // removes all keys and changes the window size
+    void reset(unsigned int capacity) {
+        if(capacity < 1) {
+            capacity = 1;
+        }
+        keys.resize(capacity);
+        position.resize(capacity);
+        lower.reserve(capacity / 2 + 1);
+        upper.reserve(capacity / 2 + 1);
+        clear();
+    }
+    // removes all keys, the next key is placed in firstSlot
+    void clear(unsigned int firstSlot = 0) {
+        lower.clear();
+        upper.clear();
+        next = firstSlot % capacity();
+    }
+
+    // adds a key and returns its slot
+    unsigned int add(double key) {
+        if(size() == capacity()) {
+            remove(next);
+        }
+        auto slot = next;
+        keys[slot] = key;
+        if(lower.empty() || key <= keys[lower[0]]) {
+            insert(lower, true, slot);
+        } else {
+            insert(upper, false, slot);
+        }
+        balance();
+        next = (next + 1) % capacity();
+        return slot;
+    }
+
+    unsigned int size() const { return lower.size() + upper.size(); }
+    unsigned int capacity() const { return keys.size(); }
+    bool empty() const { return lower.empty(); }
+    // slot of the next key, the oldest key is removed from this slot if the window is full
+    unsigned int nextSlot() const { return next; }
+
+    // For odd sizes, both return the slot with the middle key. For even sizes, they return the slots with the two
+    // middle keys. Must not be called on an empty window
+    unsigned int lowerMedian() const { return lower[0]; }
+    unsigned int upperMedian() const { return upper.size() == lower.size() ? upper[0] : lower[0]; }
+
+private:
+    // lower holds the additional key if the size is odd
+    void balance() {
+        if(lower.size() > upper.size() + 1) {
+            auto slot = lower[0];
+            erase(lower, true, 0);
+            insert(upper, false, slot);
+        } else if(upper.size() > lower.size()) {
+            auto slot = upper[0];
+            erase(upper, false, 0);
+            insert(lower, true, slot);
+        }
+    }
+
+    void remove(unsigned int slot) {
+        auto p = position[slot];
+        if(p & UpperHeap) {
+            erase(upper, false, p & ~UpperHeap);
+        } else {
+            erase(lower, true, p);
+        }
+        balance();
+    }
+
+    // max-heap ordering for the lower half, min-heap ordering for the upper half
+    bool before(bool isLower, unsigned int a, unsigned int b) const {
+        return isLower ? keys[a] > keys[b] : keys[a] < keys[b];
+    }
+    void place(std::vector<unsigned int> &heap, bool isLower, unsigned int index, unsigned int slot) {
+        heap[index] = slot;
+        position[slot] = isLower ? index : index | UpperHeap;
+    }
+    void insert(std::vector<unsigned int> &heap, bool isLower, unsigned int slot) {
+        heap.push_back(slot);
+        siftUp(heap, isLower, heap.size() - 1);
+    }
+    void erase(std::vector<unsigned int> &heap, bool isLower, unsigned int index) {
+        auto last = heap.back();
+        heap.pop_back();
+        if(index == heap.size()) {
+            // removed the last element, nothing to restore
+            return;
+        }
+        // the moved element may belong above or below its new position
+        place(heap, isLower, index, last);
+        siftUp(heap, isLower, index);
+        siftDown(heap, isLower, position[last] & ~UpperHeap);
+    }
+    void siftUp(std::vector<unsigned int> &heap, bool isLower, unsigned int index) {
+        auto slot = heap[index];
+        while(index > 0) {
+            auto parent = (index - 1) / 2;
+            if(!before(isLower, slot, heap[parent])) {
+                break;
+            }
+            place(heap, isLower, index, heap[parent]);
+            index = parent;
+        }
+        place(heap, isLower, index, slot);
+    }
+    void siftDown(std::vector<unsigned int> &heap, bool isLower, unsigned int index) {
+        auto slot = heap[index];
+        while(true) {
+            auto child = 2 * index + 1;
+            if(child >= heap.size()) {
+                break;
+            }
+            if(child + 1 < heap.size() && before(isLower, heap[child + 1], heap[child])) {
+                child++;
+            }
+            if(!before(isLower, heap[child], slot)) {
+                break;
+            }
+            place(heap, isLower, index, heap[child]);
+            index = child;
+        }
+        place(heap, isLower, index, slot);
+    }
+
+    // set in the position of slots in the upper heap
+    static constexpr unsigned int UpperHeap = 0x80000000;
+    std::vector<double> keys;
+    // index of every slot within its heap
+    std::vector<unsigned int> position;
+    std::vector<unsigned int> lower, upper;
+    unsigned int next;
+};
+
+#endif // SLIDINGMEDIAN_H
@@ -0,0 +1,81 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread.
+// push() may only be called from the producer, pop() only from the consumer.
+template<typename T> class SPSCQueue {
+public:
+    // capacity is rounded up to the next power of two
+    explicit SPSCQueue(size_t capacity) :
+        readIndex(0),
+        writeIndex(0),
+        highWater(0),
+        overflowCnt(0)
+    {
+        size_t size = 1;
+        while(size < capacity) {
+            size <<= 1;
+        }
+        buffer.resize(size);
+        mask = size - 1;
+    }
+
+    // Returns false (and counts an overflow) if the queue is full, the item is dropped in that case
+    bool push(const T &item) {
+        auto write = writeIndex.load(std::memory_order_relaxed);
+        auto read = readIndex.load(std::memory_order_acquire);
+        if(write - read >= buffer.size()) {
+            overflowCnt.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        buffer[write & mask] = item;
+        writeIndex.store(write + 1, std::memory_order_release);
+        auto level = write + 1 - read;
+        if(level > highWater.load(std::memory_order_relaxed)) {
+            highWater.store(level, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    bool pop(T &item) {
+        auto read = readIndex.load(std::memory_order_relaxed);
+        if(read == writeIndex.load(std::memory_order_acquire)) {
+            // empty
+            return false;
+        }
+        item = buffer[read & mask];
+        readIndex.store(read + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t size() const {
+        return writeIndex.load(std::memory_order_acquire) - readIndex.load(std::memory_order_acquire);
+    }
+    size_t capacity() const {
+        return buffer.size();
+    }
+    // highest number of items that were queued at the same time
+    size_t highWaterMark() const {
+        return highWater.load(std::memory_order_relaxed);
+    }
+    // number of items dropped because the queue was full
+    unsigned long overflows() const {
+        return overflowCnt.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::vector<T> buffer;
+    size_t mask;
+    // read and write index are only ever incremented, the buffer position is determined by the mask.
+    // Keep them on separate cache lines to avoid false sharing between producer and consumer
+    alignas(64) std::atomic<size_t> readIndex;
+    alignas(64) std::atomic<size_t> writeIndex;
+    std::atomic<size_t> highWater;
+    std::atomic<unsigned long> overflowCnt;
+};
+
+#endif // SPSCQUEUE_H
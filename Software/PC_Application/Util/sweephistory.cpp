@@ -0,0 +1,49 @@
+#include "sweephistory.h"
+
+#include <QTemporaryFile>
+#include <QDir>
+#include <QDebug>
+#include <cstdlib>
+
+SweepHistoryStorage::SweepHistoryStorage()
+    : mem(nullptr),
+      file(nullptr)
+{
+
+}
+
+SweepHistoryStorage::~SweepHistoryStorage()
+{
+    release();
+}
+
+bool SweepHistoryStorage::allocate(size_t bytes, bool mapped)
+{
+    release();
+    if(mapped) {
+        file = new QTemporaryFile(QDir::tempPath() + "/LibreVNA-history-XXXXXX");
+        if(file->open() && file->resize(bytes)) {
+            mem = file->map(0, bytes);
+        }
+        if(mem) {
+            return true;
+        }
+        qWarning() << "Unable to map sweep history file, falling back to RAM";
+        delete file;
+        file = nullptr;
+    }
+    mem = malloc(bytes);
+    return mem != nullptr;
+}
+
+void SweepHistoryStorage::release()
+{
+    if(file) {
+        // closing/deleting the temporary file also unmaps the memory
+        delete file;
+        file = nullptr;
+    } else {
+        free(mem);
+    }
+    mem = nullptr;
+}
@@ -0,0 +1,136 @@
+#ifndef SWEEPHISTORY_H
+#define SWEEPHISTORY_H
+
+#include <cstddef>
+#include <type_traits>
+
+class QTemporaryFile;
+
+// Untyped memory block of a sweep history. The memory is either allocated on the heap or
+// placed in a memory mapped temporary file (which allows the operating system to page out
+// sweeps that are not accessed)
+class SweepHistoryStorage {
+public:
+    SweepHistoryStorage(const SweepHistoryStorage&) = delete;
+    SweepHistoryStorage& operator=(const SweepHistoryStorage&) = delete;
+
+protected:
+    SweepHistoryStorage();
+    ~SweepHistoryStorage();
+
+    // Replaces the current memory block, returns false if the memory could not be allocated
+    bool allocate(size_t bytes, bool mapped);
+    void release();
+    void *memory() const { return mem; }
+
+private:
+    void *mem;
+    QTemporaryFile *file;
+};
+
+// Ring buffer of complete sweeps with a fixed capacity. All sweeps have the same number of points and are
+// stored back to back in a single block that is allocated once in configure(). Adding sweeps never
+// allocates memory, starting a new sweep when the buffer is full overwrites the oldest one.
+template<typename T> class SweepHistory : private SweepHistoryStorage {
+    static_assert(std::is_trivially_copyable<T>::value, "sweeps are stored as raw memory");
+public:
+    SweepHistory() :
+        _points(0),
+        _capacity(0),
+        first(0),
+        count(0),
+        total(0) {}
+
+    // Sets up the buffer for sweeps with the given number of points and drops all stored sweeps.
+    // Up to maxSweeps are kept, fewer if they do not fit into byteBudget. If mapped is true, the
+    // buffer is placed in a memory mapped temporary file instead of the heap.
+    // Returns the number of sweeps that can be stored
+    unsigned int configure(unsigned int points, unsigned int maxSweeps, size_t byteBudget, bool mapped = false) {
+        clear();
+        _points = points;
+        size_t sweepBytes = (size_t) points * sizeof(T);
+        size_t sweeps = maxSweeps;
+        if(sweepBytes == 0) {
+            sweeps = 0;
+        } else if(sweeps > byteBudget / sweepBytes) {
+            sweeps = byteBudget / sweepBytes;
+        }
+        if(sweeps == 0 || !allocate(sweeps * sweepBytes, mapped)) {
+            release();
+            sweeps = 0;
+        }
+        _capacity = sweeps;
+        return _capacity;
+    }
+    // Drops all sweeps, the memory stays allocated
+    void clear() {
+        first = 0;
+        count = 0;
+    }
+    unsigned int points() const { return _points; }
+    // maximum number of sweeps
+    unsigned int capacity() const { return _capacity; }
+    // number of stored sweeps (including a sweep that might still be in progress)
+    unsigned int size() const { return count; }
+    bool empty() const { return count == 0; }
+    bool full() const { return _capacity > 0 && count == _capacity; }
+    size_t bytes() const { return (size_t) _capacity * _points * sizeof(T); }
+    // Number of sweeps started so far (not reset by configure() or clear()). The sweep at index i has the
+    // running number sequence() - size() + i, this allows users to keep track of individual sweeps
+    // while old sweeps are dropped.
+    unsigned long sequence() const { return total; }
+
+    // Starts a new sweep and returns its samples (uninitialized, they still contain the values
+    // of the overwritten sweep). Returns nullptr if nothing can be stored
+    T *newSweep() {
+        if(_capacity == 0) {
+            return nullptr;
+        }
+        if(count == _capacity) {
+            // drop the oldest sweep
+            first = (first + 1) % _capacity;
+        } else {
+            count++;
+        }
+        total++;
+        return sweep(count - 1);
+    }
+    void dropOldest(unsigned int sweeps) {
+        if(sweeps >= count) {
+            clear();
+        } else {
+            first = (first + sweeps) % _capacity;
+            count -= sweeps;
+        }
+    }
+    // Index 0 is the oldest sweep, size() - 1 the newest
+    T *sweep(unsigned int index) {
+        return slot((first + index) % _capacity);
+    }
+    const T *sweep(unsigned int index) const {
+        return slot((first + index) % _capacity);
+    }
+    T *latest() {
+        return count ? sweep(count - 1) : nullptr;
+    }
+    const T *latest() const {
+        return count ? sweep(count - 1) : nullptr;
+    }
+    // Direct access to the storage location s (0 <= s < capacity()), independent of the sweep order
+    T *slot(unsigned int s) {
+        return static_cast<T*>(memory()) + (size_t) s * _points;
+    }
+    const T *slot(unsigned int s) const {
+        return static_cast<const T*>(memory()) + (size_t) s * _points;
+    }
+
+private:
+    unsigned int _points;
+    unsigned int _capacity;
+    // storage location of the oldest sweep
+    unsigned int first;
+    unsigned int count;
+    unsigned long total;
+};
+
+#endif // SWEEPHISTORY_H
@@ -675,7 +675,7 @@ void VNA::deactivate()
 void VNA::initializeDevice()
 {
     defaultCalMenu->setEnabled(true);
-    connect(window->getDevice(), &Device::DatapointReceived, this, &VNA::NewDatapoint, Qt::UniqueConnection);
+    connect(window->getDevice(), &Device::DatapointsReceived, this, &VNA::NewDatapoints, Qt::UniqueConnection);
     // Check if default calibration exists and attempt to load it
     QSettings s;
     auto key = "DefaultCalibration"+window->getDevice()->serial();
@@ -887,9 +887,14 @@ void VNA::NewDatapoint(Protocol::Datapoint d)
         }
     }
 
-    traceModel.addVNAData(vd, type);
-    emit dataChanged();
+    if(!pendingDatapoints.empty() && pendingType != type) {
+        FlushDatapoints();
+    }
+    pendingDatapoints.push_back(vd);
+    pendingType = type;
     if(vd.pointNum == settings.npoints - 1) {
+        // sweep complete, the traces have to be up to date for the markers
+        FlushDatapoints();
         UpdateAverageCount();
         markerModel->updateMarkers();
     }
@@ -900,6 +905,7 @@ void VNA::NewDatapoint(Protocol::Datapoint d)
     lastPoint = vd.pointNum;
 
     if (needsSegmentUpdate) {
+        FlushDatapoints();
         changingSettings = true;
         if( settings.activeSegment < settings.segments - 1) {
             settings.activeSegment++;
@@ -910,6 +916,24 @@ void VNA::NewDatapoint(Protocol::Datapoint d)
     }
 }
 
+void VNA::NewDatapoints(const std::vector<Protocol::Datapoint> &points)
+{
+    for(auto &d : points) {
+        NewDatapoint(d);
+    }
+    FlushDatapoints();
+}
+
+void VNA::FlushDatapoints()
+{
+    if(pendingDatapoints.empty()) {
+        return;
+    }
+    traceModel.addVNAData(pendingDatapoints, pendingType);
+    pendingDatapoints.clear();
+    emit dataChanged();
+}
+
 void VNA::UpdateAverageCount()
 {
     lAverages->setText(QString::number(average.getLevel()) + "/");
@@ -75,9 +75,11 @@ public:
 
 public slots:
     bool LoadCalibration(QString filename);
+    void SetSingleSweep(bool single);
 
 private slots:
     void NewDatapoint(Protocol::Datapoint d);
+    void NewDatapoints(const std::vector<Protocol::Datapoint> &points);
     void StartImpedanceMatching();
     // Sweep control
     void SetSweepType(SweepType sw);
@@ -115,6 +117,8 @@ private:
     bool CalibrationMeasurementActive() { return calWaitFirst || calMeasuring; }
     void SetupSCPI();
     void UpdateAverageCount();
+    // passes the processed datapoints on to the traces
+    void FlushDatapoints();
     void SettingsChanged(bool resetTraces = true, std::function<void (Device::TransmissionResult)> cb = nullptr);
     void ConstrainAndUpdateFrequencies();
     void LoadSweepSettings();
@@ -125,7 +129,6 @@ private:
 private slots:
     void EnableDeembedding(bool enable);
     void UpdateStatusbar();
-    void SetSingleSweep(bool single);
 private:
     Settings settings;
     unsigned int averages;
@@ -134,6 +137,10 @@ private:
     MarkerModel *markerModel;
     Averaging average;
     bool singleSweep;
+    // Processed datapoints that have not been added to the traces yet. Datapoints arrive in batches,
+    // the traces are only updated once per batch (or at the end of a sweep/segment)
+    std::vector<VNAData> pendingDatapoints;
+    TraceMath::DataType pendingType;
 
     // Calibration
     Calibration cal;
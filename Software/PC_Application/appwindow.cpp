@@ -15,6 +15,8 @@
 #include "Calibration/calibrationtracedialog.h"
 #include "ui_main.h"
 #include "Device/firmwareupdatedialog.h"
+#include "Device/virtualdevice.h"
+#include "Device/deviceregistry.h"
 #include "preferences.h"
 #include "Generator/signalgenwidget.h"
 #include "VNA/vna.h"
@@ -180,7 +182,8 @@ AppWindow::AppWindow(QWidget *parent)
     parser.addHelpOption();
     parser.addVersionOption();
     parser.addOption(QCommandLineOption({"p","port"}, "Specify port to listen for SCPI commands", "port"));
-    parser.addOption(QCommandLineOption({"d","device"}, "Only allow connections to the specified device", "device"));
+    parser.addOption(QCommandLineOption({"d","device"}, "Only allow connections to the specified device (VIRTUAL for a simulated device, REPLAY:<file> to play back a capture)", "device"));
+    parser.addOption(QCommandLineOption("capture", "Records the USB traffic of the connected device into the specified file", "capture"));
     parser.addOption(QCommandLineOption("no-gui", "Disables the graphical interface"));
     parser.addOption(QCommandLineOption("cal", "Calibration file to load on startup", "cal"));
     parser.addOption(QCommandLineOption("setup", "Setup file to load on startup", "setup"));
@@ -262,13 +265,19 @@ AppWindow::AppWindow(QWidget *parent)
         restoreGeometry(settings.value("geometry").toByteArray());
     }
 
+    deviceManager = new DeviceManager(scpi, this);
+    connect(deviceManager, &DeviceManager::LogLineReceived, &deviceLog, &DeviceLog::addLine);
+
     SetupSCPI();
 
     auto pref = Preferences::getInstance();
     if(pref.Startup.UseSetupFile) {
         LoadSetup(pref.Startup.SetupFile);
     }
-    // List available devices
+    // List available devices and keep the list up to date when devices are attached or detached
+    auto &registry = DeviceRegistry::getInstance();
+    connect(&registry, &DeviceRegistry::DevicesChanged, this, &AppWindow::UpdateDeviceList);
+    connect(&registry, &DeviceRegistry::DeviceAttached, this, &AppWindow::DeviceAttached);
     UpdateDeviceList();
     if(pref.Startup.ConnectToFirstDevice) {
         // at least one device available
@@ -301,7 +310,10 @@ AppWindow::~AppWindow()
 void AppWindow::SetupMenu()
 {
     // UI connections
-    connect(ui->actionUpdate_Device_List, &QAction::triggered, this, &AppWindow::UpdateDeviceList);
+    connect(ui->actionUpdate_Device_List, &QAction::triggered, [=](){
+        DeviceRegistry::getInstance().rescan();
+        UpdateDeviceList();
+    });
     connect(ui->actionDisconnect, &QAction::triggered, this, &AppWindow::DisconnectDevice);
     connect(ui->actionQuit, &QAction::triggered, this, &AppWindow::close);
     connect(ui->actionSave_setup, &QAction::triggered, [=](){
@@ -396,6 +408,7 @@ void AppWindow::closeEvent(QCloseEvent *event)
     if(modeHandler->getActiveMode()) {
         modeHandler->deactivate(modeHandler->getActiveMode());
     }
+    deviceManager->removeAllDevices();
     delete device;
     delete modeHandler;
     modeHandler = nullptr;
@@ -405,6 +418,10 @@ void AppWindow::closeEvent(QCloseEvent *event)
 
 bool AppWindow::ConnectToDevice(QString serial)
 {
+    if(serial.isEmpty() && !parser.value("device").isEmpty()) {
+        // only the device specified on the command line is allowed
+        serial = parser.value("device");
+    }
     if(serial.isEmpty()) {
         qDebug() << "Trying to connect to any device";
     } else {
@@ -418,10 +435,14 @@ bool AppWindow::ConnectToDevice(QString serial)
         qDebug() << "Attempting to connect to device...";
         device = new Device(serial);
         UpdateStatusBar(AppWindow::DeviceStatusBar::Connected);
+        lostDeviceSerial.clear();
         connect(device, &Device::LogLineReceived, &deviceLog, &DeviceLog::addLine);
         connect(device, &Device::ConnectionLost, this, &AppWindow::DeviceConnectionLost);
         connect(device, &Device::DeviceStatusUpdated, this, &AppWindow::DeviceStatusUpdated);
         connect(device, &Device::NeedsFirmwareUpdate, this, &AppWindow::DeviceNeedsUpdate);
+        if(parser.isSet("capture")) {
+            device->StartCapture(parser.value("capture"));
+        }
         ui->actionDisconnect->setEnabled(true);
         ui->actionManual_Control->setEnabled(true);
         ui->actionFirmware_Update->setEnabled(true);
@@ -477,6 +498,7 @@ void AppWindow::DisconnectDevice()
 
 void AppWindow::DeviceConnectionLost()
 {
+    lostDeviceSerial = device->serial();
     DisconnectDevice();
     InformationBox::ShowError("Disconnected", "The USB connection to the device has been lost");
     UpdateDeviceList();
@@ -544,6 +566,89 @@ void AppWindow::SetupSCPI()
         ret.chop(1);
         return ret;
     }));
+    auto scpi_multi = new SCPINode("MULTi");
+    scpi_dev->add(scpi_multi);
+    scpi_multi->add(new SCPICommand("ADD", [=](QStringList params) -> QString {
+        if(params.size() != 1) {
+            return SCPI::getResultName(SCPI::Result::Error);
+        }
+        if(device && device->serial() == params[0]) {
+            // already used by the modes
+            return SCPI::getResultName(SCPI::Result::Error);
+        }
+        if(!deviceManager->addDevice(params[0])) {
+            return "Device not found";
+        }
+        return SCPI::getResultName(SCPI::Result::Empty);
+    }, nullptr));
+    scpi_multi->add(new SCPICommand("REMove", [=](QStringList params) -> QString {
+        unsigned long long number;
+        if(!SCPI::paramToULongLong(params, 0, number) || !deviceManager->removeDevice(number)) {
+            return SCPI::getResultName(SCPI::Result::Error);
+        }
+        return SCPI::getResultName(SCPI::Result::Empty);
+    }, nullptr));
+    scpi_multi->add(new SCPICommand("LIST", nullptr, [=](QStringList) -> QString {
+        QString ret;
+        for(auto n : deviceManager->getDeviceNumbers()) {
+            ret += QString::number(n) + ":" + deviceManager->getDevice(n)->serial() + ",";
+        }
+        ret.chop(1);
+        return ret;
+    }));
+    scpi_multi->add(new SCPICommand("START", [=](QStringList params) -> QString {
+        bool single = false;
+        if(params.size() > 0 && !SCPI::paramToBool(params, 0, single)) {
+            return SCPI::getResultName(SCPI::Result::Error);
+        }
+        // the device used by the modes sweeps along if the VNA mode is active
+        auto active = modeHandler->getActiveMode();
+        if(device && active && active->getType() == Mode::Type::VNA) {
+            auto vna = static_cast<VNA*>(active);
+            deviceManager->startSweeps(single, device, [=]() {
+                vna->SetSingleSweep(single);
+            });
+        } else {
+            deviceManager->startSweeps(single);
+        }
+        return SCPI::getResultName(SCPI::Result::Empty);
+    }, nullptr));
+    scpi_multi->add(new SCPICommand("STOP", [=](QStringList) -> QString {
+        deviceManager->stopSweeps();
+        auto active = modeHandler->getActiveMode();
+        if(device && active && active->getType() == Mode::Type::VNA) {
+            device->SetIdle();
+        }
+        return SCPI::getResultName(SCPI::Result::Empty);
+    }, nullptr));
+    scpi_multi->add(new SCPICommand("FINished", nullptr, [=](QStringList) -> QString {
+        return deviceManager->sweepsFinished() ? "TRUE" : "FALSE";
+    }));
+    auto scpi_capture = new SCPINode("CAPture");
+    scpi_dev->add(scpi_capture);
+    scpi_capture->add(new SCPICommand("STARt", [=](QStringList params) -> QString {
+        if(params.size() != 1 || !device) {
+            return SCPI::getResultName(SCPI::Result::Error);
+        }
+        if(!device->StartCapture(params[0])) {
+            return SCPI::getResultName(SCPI::Result::Error);
+        }
+        return SCPI::getResultName(SCPI::Result::Empty);
+    }, nullptr));
+    scpi_capture->add(new SCPICommand("STOP", [=](QStringList) -> QString {
+        if(device) {
+            device->StopCapture();
+        }
+        return SCPI::getResultName(SCPI::Result::Empty);
+    }, nullptr));
+    scpi_capture->add(new SCPICommand("ACTive", nullptr, [=](QStringList) -> QString {
+        return device && device->isCapturing() ? "TRUE" : "FALSE";
+    }));
+    auto scpi_replay = new SCPINode("REPlay");
+    scpi_dev->add(scpi_replay);
+    scpi_replay->add(new SCPICommand("FINished", nullptr, [=](QStringList) -> QString {
+        return device && device->isReplayFinished() ? "TRUE" : "FALSE";
+    }));
     auto scpi_ref = new SCPINode("REFerence");
     scpi_dev->add(scpi_ref);
     scpi_ref->add(new SCPICommand("OUT", [=](QStringList params) -> QString {
@@ -649,6 +754,20 @@ void AppWindow::SetupSCPI()
     scpi_info->add(new SCPICommand("TEMPeratures", nullptr, [=](QStringList){
         return QString::number(Device::StatusV1(getDevice()).temp_source)+"/"+QString::number(Device::StatusV1(getDevice()).temp_LO1)+"/"+QString::number(Device::StatusV1(getDevice()).temp_MCU);
     }));
+    scpi_info->add(new SCPICommand("USBDRYcount", nullptr, [=](QStringList){
+        if(!getDevice()) {
+            return QString("0");
+        }
+        return QString::number(getDevice()->getUSBRanDryCount());
+    }));
+    scpi_info->add(new SCPICommand("QUEUEstatistics", nullptr, [=](QStringList){
+        if(!getDevice()) {
+            return QString("0/0/0/0");
+        }
+        auto dp = getDevice()->getDatapointQueueStatistics();
+        auto sa = getDevice()->getSpectrumQueueStatistics();
+        return QString::number(dp.highWaterMark)+"/"+QString::number(dp.overflows)+"/"+QString::number(sa.highWaterMark)+"/"+QString::number(sa.overflows);
+    }));
     auto scpi_limits = new SCPINode("LIMits");
     scpi_info->add(scpi_limits);
     scpi_limits->add(new SCPICommand("MINFrequency", nullptr, [=](QStringList){
@@ -933,6 +1052,14 @@ void AppWindow::setModeStatus(QString msg)
     lModeInfo.setText(msg);
 }
 
+void AppWindow::DeviceAttached(QString serial)
+{
+    if(!device && !lostDeviceSerial.isEmpty() && serial == lostDeviceSerial) {
+        qInfo() << "Device" << serial << "is available again, reconnecting";
+        ConnectToDevice(serial);
+    }
+}
+
 int AppWindow::UpdateDeviceList()
 {
     deviceActionGroup->setExclusive(true);
@@ -941,6 +1068,10 @@ int AppWindow::UpdateDeviceList()
     if(device) {
         devices.insert(device->serial());
     }
+    if(parser.value("device") == VirtualDevice::serial || parser.value("device").startsWith(USBReplay::serialPrefix)) {
+        // the virtual device and replays are only offered when explicitly requested
+        devices.insert(parser.value("device"));
+    }
     int available = 0;
     bool found = false;
     if(devices.size()) {
@@ -8,6 +8,7 @@
 #include "Traces/Marker/markermodel.h"
 #include "averaging.h"
 #include "Device/devicelog.h"
+#include "Device/devicemanager.h"
 #include "preferences.h"
 #include "scpi.h"
 #include "tcpserver.h"
@@ -61,6 +62,7 @@ private slots:
     bool ConnectToDevice(QString serial = QString());
     void DisconnectDevice();
     int UpdateDeviceList();
+    void DeviceAttached(QString serial);
     void StartManualControl();
     void UpdateReference();
     void UpdateAcquisitionFrequencies();
@@ -103,8 +105,12 @@ private:
 
     ModeHandler *modeHandler;
     Device *device;
+    // additional devices, operated only through SCPI
+    DeviceManager *deviceManager;
     DeviceLog deviceLog;
     QString deviceSerial;
+    // serial number of the device whose connection was lost, it is reconnected as soon as it is attached again
+    QString lostDeviceSerial;
     QActionGroup *deviceActionGroup;
 
     ManualControlDialog *manual;
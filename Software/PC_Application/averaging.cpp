@@ -1,5 +1,7 @@
 #include "averaging.h"
 
+#include <algorithm>
+
 using namespace std;
 
 Averaging::Averaging()
@@ -10,16 +12,58 @@ Averaging::Averaging()
 
 void Averaging::reset(unsigned int points)
 {
-    avg.clear();
-    for(unsigned int i = 0;i<points;i++) {
-        avg.push_back(deque<array<complex<double>, 4>>());
-    }
+    // the stored samples are never read before being overwritten, only the counters need to be cleared
+    added.assign(points, 0);
+    history.resize(points * averages);
+    medians.clear();
 }
 
 void Averaging::setAverages(unsigned int a)
 {
-    averages = a;
-    reset(avg.size());
+    averages = max(a, 1U);
+    reset(added.size());
+}
+
+const Averaging::Sample *Averaging::addSample(unsigned int pointNum, const Sample &s, unsigned int &count)
+{
+    auto ring = &history[pointNum * averages];
+    ring[added[pointNum] % averages] = s;
+    added[pointNum]++;
+    count = min(added[pointNum], averages);
+    return ring;
+}
+
+Averaging::Sample Averaging::addMedian(unsigned int pointNum)
+{
+    constexpr unsigned int windowsPerPoint = std::tuple_size<Sample>::value;
+    if(medians.size() < added.size() * windowsPerPoint) {
+        medians.resize(added.size() * windowsPerPoint, SlidingMedian(averages));
+    }
+    auto windows = &medians[pointNum * windowsPerPoint];
+    auto ring = &history[pointNum * averages];
+    auto count = min(added[pointNum], averages);
+    if(windows[0].size() == min(added[pointNum] - 1, averages)) {
+        // windows contain the previous samples of the history, only add the new one
+        auto &s = ring[(added[pointNum] - 1) % averages];
+        for(unsigned int i=0;i<windowsPerPoint;i++) {
+            windows[i].add(abs(s[i]));
+        }
+    } else {
+        // windows not in sync with the history (e.g. after switching to median mode), fill with the history in
+        // chronological order. The oldest sample is not necessarily in the first slot of the ring buffer
+        auto oldest = added[pointNum] - count;
+        for(unsigned int i=0;i<windowsPerPoint;i++) {
+            windows[i].clear(oldest);
+            for(unsigned int j=0;j<count;j++) {
+                windows[i].add(abs(ring[(oldest + j) % averages][i]));
+            }
+        }
+    }
+    Sample median;
+    for(unsigned int i=0;i<windowsPerPoint;i++) {
+        median[i] = (ring[windows[i].lowerMedian()][i] + ring[windows[i].upperMedian()][i]) / 2.0;
+    }
+    return median;
 }
 
 VNAData Averaging::process(VNAData d)
@@ -29,71 +73,41 @@ VNAData Averaging::process(VNAData d)
     auto S21 = d.S.m21;
     auto S22 = d.S.m22;
 
-    if (d.pointNum == avg.size()) {
+    if (d.pointNum == added.size()) {
         // add moving average entry
-        deque<array<complex<double>, 4>> deque;
-        avg.push_back(deque);
+        added.push_back(0);
+        history.resize(added.size() * averages);
     }
 
-    if (d.pointNum < avg.size()) {
+    if (d.pointNum < added.size()) {
         // can compute average
-        // get correct queue
-        auto deque = &avg[d.pointNum];
-        // add newest sample to queue
-        array<complex<double>, 4> sample = {S11, S12, S21, S22};
-        deque->push_back(sample);
-        if(deque->size() > averages) {
-            deque->pop_front();
-        }
+        // add newest sample to the history of this point
+        unsigned int size;
+        auto samples = addSample(d.pointNum, {S11, S12, S21, S22}, size);
 
         switch(mode) {
         case Mode::Mean: {
             // calculate average
             complex<double> sum[4];
-            for(auto s : *deque) {
+            for(unsigned int i=0;i<size;i++) {
+                auto &s = samples[i];
                 sum[0] += s[0];
                 sum[1] += s[1];
                 sum[2] += s[2];
                 sum[3] += s[3];
             }
-            S11 = sum[0] / (double) (deque->size());
-            S12 = sum[1] / (double) (deque->size());
-            S21 = sum[2] / (double) (deque->size());
-            S22 = sum[3] / (double) (deque->size());
+            S11 = sum[0] / (double) (size);
+            S12 = sum[1] / (double) (size);
+            S21 = sum[2] / (double) (size);
+            S22 = sum[3] / (double) (size);
         }
             break;
         case Mode::Median: {
-            auto size = deque->size();
-            // create sorted arrays
-            std::vector<complex<double>> S11sorted, S12sorted, S21sorted, S22sorted;
-            S11sorted.reserve(size);
-            S12sorted.reserve(size);
-            S21sorted.reserve(size);
-            S22sorted.reserve(size);
-
-            auto comp = [=](const complex<double>&a, const complex<double>&b){
-                return abs(a) < abs(b);
-            };
-
-            for(auto d : *deque) {
-                S11sorted.insert(upper_bound(S11sorted.begin(), S11sorted.end(), d[0], comp), d[0]);
-                S12sorted.insert(upper_bound(S12sorted.begin(), S12sorted.end(), d[1], comp), d[1]);
-                S21sorted.insert(upper_bound(S21sorted.begin(), S21sorted.end(), d[2], comp), d[2]);
-                S22sorted.insert(upper_bound(S22sorted.begin(), S22sorted.end(), d[3], comp), d[3]);
-            }
-            if(size & 0x01) {
-                // odd number of samples
-                S11 = S11sorted[size / 2];
-                S12 = S12sorted[size / 2];
-                S21 = S21sorted[size / 2];
-                S22 = S22sorted[size / 2];
-            } else {
-                // even number, use average of middle samples
-                S11 = (S11sorted[size / 2 - 1] + S11sorted[size / 2]) / 2.0;
-                S12 = (S12sorted[size / 2 - 1] + S12sorted[size / 2]) / 2.0;
-                S21 = (S21sorted[size / 2 - 1] + S21sorted[size / 2]) / 2.0;
-                S22 = (S22sorted[size / 2 - 1] + S22sorted[size / 2]) / 2.0;
-            }
+            auto median = addMedian(d.pointNum);
+            S11 = median[0];
+            S12 = median[1];
+            S21 = median[2];
+            S22 = median[3];
         }
             break;
         }
@@ -106,54 +120,35 @@ VNAData Averaging::process(VNAData d)
 
 Protocol::SpectrumAnalyzerResult Averaging::process(Protocol::SpectrumAnalyzerResult d)
 {
-    if (d.pointNum == avg.size()) {
+    if (d.pointNum == added.size()) {
         // add moving average entry
-        deque<array<complex<double>, 4>> deque;
-        avg.push_back(deque);
+        added.push_back(0);
+        history.resize(added.size() * averages);
     }
 
-    if (d.pointNum < avg.size()) {
+    if (d.pointNum < added.size()) {
         // can compute average
-        // get correct queue
-        auto deque = &avg[d.pointNum];
-        // add newest sample to queue
-        array<complex<double>, 4> sample = {d.port1, d.port2, 0, 0};
-        deque->push_back(sample);
-        if(deque->size() > averages) {
-            deque->pop_front();
-        }
+        // add newest sample to the history of this point
+        unsigned int size;
+        auto samples = addSample(d.pointNum, {d.port1, d.port2, 0, 0}, size);
 
         switch(mode) {
         case Mode::Mean: {
             // calculate average
             complex<double> sum[2];
-            for(auto s : *deque) {
+            for(unsigned int i=0;i<size;i++) {
+                auto &s = samples[i];
                 sum[0] += s[0];
                 sum[1] += s[1];
             }
-            d.port1 = abs(sum[0] / (double) (deque->size()));
-            d.port2 = abs(sum[1] / (double) (deque->size()));
+            d.port1 = abs(sum[0] / (double) (size));
+            d.port2 = abs(sum[1] / (double) (size));
         }
             break;
         case Mode::Median: {
-            auto size = deque->size();
-            // create sorted arrays
-            std::vector<double> port1, port2;
-            port1.reserve(size);
-            port2.reserve(size);
-            for(auto d : *deque) {
-                port1.insert(upper_bound(port1.begin(), port1.end(), abs(d[0])), abs(d[0]));
-                port2.insert(upper_bound(port2.begin(), port2.end(), abs(d[0])), abs(d[0]));
-            }
-            if(size & 0x01) {
-                // odd number of samples
-                d.port1 = port1[size / 2];
-                d.port2 = port1[size / 2];
-            } else {
-                // even number, use average of middle samples
-                d.port1 = (port1[size / 2 - 1] + port1[size / 2]) / 2;
-                d.port2 = (port2[size / 2 - 1] + port2[size / 2]) / 2;
-            }
+            auto median = addMedian(d.pointNum);
+            d.port1 = abs(median[0]);
+            d.port2 = abs(median[1]);
         }
             break;
         }
@@ -164,8 +159,8 @@ Protocol::SpectrumAnalyzerResult Averaging::process(Protocol::SpectrumAnalyzerRe
 
 unsigned int Averaging::getLevel()
 {
-    if(avg.size() > 0) {
-        return avg.back().size();
+    if(added.size() > 0) {
+        return min(added.back(), averages);
     } else {
         return 0;
     }
@@ -173,8 +168,8 @@ unsigned int Averaging::getLevel()
 
 unsigned int Averaging::currentSweep()
 {
-    if(avg.size() > 0) {
-        return avg.front().size();
+    if(added.size() > 0) {
+        return min(added.front(), averages);
     } else {
         return 0;
     }
@@ -187,5 +182,9 @@ Averaging::Mode Averaging::getMode() const
 
 void Averaging::setMode(const Mode &value)
 {
+    if(value != mode) {
+        // the median windows are filled from the history on the next sample
+        medians.clear();
+    }
     mode = value;
 }
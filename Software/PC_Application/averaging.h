@@ -3,9 +3,10 @@
 
 #include "Device/device.h"
 #include "VNA/vnadata.h"
+#include "Util/slidingmedian.h"
 
 #include <array>
-#include <deque>
+#include <vector>
 #include <complex>
 
 class Averaging
@@ -31,8 +32,21 @@ public:
     void setMode(const Mode &value);
 
 private:
-    std::vector<std::deque<std::array<std::complex<double>, 4>>> avg;
-    int maxPoints;
+    using Sample = std::array<std::complex<double>, 4>;
+    // Adds the sample to the history of the point and returns the stored samples of this point
+    const Sample *addSample(unsigned int pointNum, const Sample &s, unsigned int &count);
+    // Adds the newest sample of the point (already in the history) to its median windows and returns the median.
+    // For an even number of samples, this is the average of the two middle samples
+    Sample addMedian(unsigned int pointNum);
+
+    // Past samples of all points in a single block. Each point has space for the last "averages" samples
+    // (at [pointNum * averages, (pointNum + 1) * averages)) which is used as a ring buffer
+    std::vector<Sample> history;
+    // number of samples added to each point since the last reset
+    std::vector<unsigned int> added;
+    // Median windows (sorted by magnitude) of the samples in the history, four per point. Their slots are the
+    // same as in the ring buffer of the point. Only used in median mode, they are created on demand
+    std::vector<SlidingMedian> medians;
     unsigned int averages;
     Mode mode;
 };
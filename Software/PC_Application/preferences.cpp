@@ -70,6 +70,10 @@ PreferencesDialog::PreferencesDialog(Preferences *pref, QWidget *parent) :
     connect(ui->StartupBrowse, &QPushButton::clicked, [=](){
        ui->StartupSetupFile->setText(QFileDialog::getOpenFileName(nullptr, "Select startup setup file", "", "Setup files (*.setup)", nullptr, QFileDialog::DontUseNativeDialog));
     });
+    // Acquisition page
+    connect(ui->AcquisitionVirtualDUTBrowse, &QPushButton::clicked, [=](){
+       ui->AcquisitionVirtualDUT->setText(QFileDialog::getOpenFileName(nullptr, "Select touchstone file of the simulated DUT", "", "Touchstone files (*.s1p *.s2p)", nullptr, QFileDialog::DontUseNativeDialog));
+    });
     ui->StartupSweepStart->setUnit("Hz");
     ui->StartupSweepStart->setPrefixes(" kMG");
     ui->StartupSweepStop->setUnit("Hz");
@@ -240,6 +244,12 @@ void PreferencesDialog::setInitialGUIState()
     ui->AcquisitionIF1->setValue(p->Acquisition.IF1);
     ui->AcquisitionADCpresc->setValue(p->Acquisition.ADCprescaler);
     ui->AcquisitionADCphaseInc->setValue(p->Acquisition.DFTPhaseInc);
+    ui->AcquisitionUSBTransfers->setValue(p->Acquisition.USBTransfers);
+    ui->AcquisitionDatapointCRC->setChecked(p->Acquisition.datapointCRC);
+    ui->AcquisitionOutstandingCommands->setValue(p->Acquisition.outstandingCommands);
+    ui->AcquisitionVirtualRate->setValue(p->Acquisition.virtualDeviceRate);
+    ui->AcquisitionVirtualDUT->setText(p->Acquisition.virtualDeviceDUT);
+    ui->AcquisitionReplayRealtime->setChecked(p->Acquisition.replayRealtime);
 
     ui->GraphsShowUnit->setChecked(p->Graphs.showUnits);
     ui->GraphsColorBackground->setColor(p->Graphs.Color.background);
@@ -254,6 +264,8 @@ void PreferencesDialog::setInitialGUIState()
     ui->GraphsFontSizeCursorOverlay->setValue(p->Graphs.fontSizeCursorOverlay);
     ui->GraphsFontSizeMarkerData->setValue(p->Graphs.fontSizeMarkerData);
     ui->GraphsFontSizeTraceNames->setValue(p->Graphs.fontSizeTraceNames);
+    ui->GraphsSweepHistoryMemory->setValue(p->Graphs.sweepHistoryMemory);
+    ui->GraphsSweepHistorySpill->setChecked(p->Graphs.sweepHistorySpill);
 
     ui->MarkerShowMarkerData->setChecked(p->Marker.defaultBehavior.showDataOnGraphs);
     ui->MarkerShowAllMarkerData->setChecked(p->Marker.defaultBehavior.showAllData);
@@ -306,6 +318,12 @@ void PreferencesDialog::updateFromGUI()
     p->Acquisition.IF1 = ui->AcquisitionIF1->value();
     p->Acquisition.ADCprescaler = ui->AcquisitionADCpresc->value();
     p->Acquisition.DFTPhaseInc = ui->AcquisitionADCphaseInc->value();
+    p->Acquisition.USBTransfers = ui->AcquisitionUSBTransfers->value();
+    p->Acquisition.datapointCRC = ui->AcquisitionDatapointCRC->isChecked();
+    p->Acquisition.outstandingCommands = ui->AcquisitionOutstandingCommands->value();
+    p->Acquisition.virtualDeviceRate = ui->AcquisitionVirtualRate->value();
+    p->Acquisition.virtualDeviceDUT = ui->AcquisitionVirtualDUT->text();
+    p->Acquisition.replayRealtime = ui->AcquisitionReplayRealtime->isChecked();
 
     p->Graphs.showUnits = ui->GraphsShowUnit->isChecked();
     p->Graphs.Color.background = ui->GraphsColorBackground->getColor();
@@ -320,6 +338,8 @@ void PreferencesDialog::updateFromGUI()
     p->Graphs.fontSizeCursorOverlay = ui->GraphsFontSizeCursorOverlay->value();
     p->Graphs.fontSizeMarkerData = ui->GraphsFontSizeMarkerData->value();
     p->Graphs.fontSizeTraceNames = ui->GraphsFontSizeTraceNames->value();
+    p->Graphs.sweepHistoryMemory = ui->GraphsSweepHistoryMemory->value();
+    p->Graphs.sweepHistorySpill = ui->GraphsSweepHistorySpill->isChecked();
 
     p->Marker.defaultBehavior.showDataOnGraphs = ui->MarkerShowMarkerData->isChecked();
     p->Marker.defaultBehavior.showAllData = ui->MarkerShowAllMarkerData->isChecked();
@@ -94,6 +94,19 @@ public:
         double IF1;
         int ADCprescaler;
         int DFTPhaseInc;
+
+        // number of concurrently queued USB receive transfers
+        int USBTransfers;
+        // request a CRC for datapoints (if supported by the device)
+        bool datapointCRC;
+        // commands sent without waiting for the answer of the previous one (if supported by the device)
+        int outstandingCommands;
+
+        // virtual device: datapoints per second (0 for unlimited) and touchstone file of the simulated DUT
+        int virtualDeviceRate;
+        QString virtualDeviceDUT;
+        // replay captures with the recorded timing instead of as fast as possible
+        bool replayRealtime;
     } Acquisition;
     struct {
         bool showUnits;
@@ -116,6 +129,10 @@ public:
         int fontSizeMarkerData;
         int fontSizeTraceNames;
         int fontSizeCursorOverlay;
+
+        // memory limit (in MB) for the past sweeps kept by every trace and whether they are kept in a mapped file
+        int sweepHistoryMemory;
+        bool sweepHistorySpill;
     } Graphs;
     struct {
         struct {
@@ -177,6 +194,12 @@ private:
         {&Acquisition.IF1, "Acquisition.IF1", 62000000},
         {&Acquisition.ADCprescaler, "Acquisition.ADCprescaler", 128},
         {&Acquisition.DFTPhaseInc, "Acquisition.DFTPhaseInc", 1280},
+        {&Acquisition.USBTransfers, "Acquisition.USBTransfers", 4},
+        {&Acquisition.datapointCRC, "Acquisition.datapointCRC", true},
+        {&Acquisition.outstandingCommands, "Acquisition.outstandingCommands", 1},
+        {&Acquisition.virtualDeviceRate, "Acquisition.virtualDeviceRate", 10000},
+        {&Acquisition.virtualDeviceDUT, "Acquisition.virtualDeviceDUT", ""},
+        {&Acquisition.replayRealtime, "Acquisition.replayRealtime", false},
         {&Graphs.showUnits, "Graphs.showUnits", true},
         {&Graphs.Color.background, "Graphs.Color.background", QColor(Qt::black)},
         {&Graphs.Color.axis, "Graphs.Color.axis", QColor(Qt::white)},
@@ -190,6 +213,8 @@ private:
         {&Graphs.fontSizeCursorOverlay, "Graphs.fontSizeCursorOverlay", 12},
         {&Graphs.fontSizeMarkerData, "Graphs.fontSizeMarkerData", 12},
         {&Graphs.fontSizeTraceNames, "Graphs.fontSizeTraceNames", 12},
+        {&Graphs.sweepHistoryMemory, "Graphs.sweepHistoryMemory", 64},
+        {&Graphs.sweepHistorySpill, "Graphs.sweepHistorySpill", false},
         {&Marker.defaultBehavior.showDataOnGraphs, "Marker.defaultBehavior.ShowDataOnGraphs", true},
         {&Marker.defaultBehavior.showAllData, "Marker.defaultBehavior.ShowAllData", false},
         {&Marker.interpolatePoints, "Marker.interpolatePoints", false},
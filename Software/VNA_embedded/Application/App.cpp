@@ -38,14 +38,58 @@ static bool sweepActive;
 extern ADC_HandleTypeDef hadc1;
 
 #define FLAG_USB_PACKET		0x01
+#define FLAG_RESTART		0x02
 
-static void USBPacketReceived(const Protocol::PacketInfo &p) {
-	recv_packet = p;
+// The host may send several packets without waiting for the answers, received packets are queued.
+// Only the USB interrupt adds packets, only the application task removes them
+static constexpr uint8_t receiveQueueLength = Protocol::MaxOutstandingPackets;
+static struct {
+	Protocol::PacketInfo packet;
+	int16_t sequenceNumber;
+} receiveQueue[receiveQueueLength];
+// only ever incremented, the position in the queue is the index modulo the queue length
+static volatile uint8_t receiveQueueWrite, receiveQueueRead;
+
+static void USBPacketReceived(const Protocol::PacketInfo &p, int16_t sequenceNumber) {
+	if((uint8_t) (receiveQueueWrite - receiveQueueRead) >= receiveQueueLength) {
+		// more packets than allowed are outstanding, drop this one (the host will time out)
+		return;
+	}
+	auto &entry = receiveQueue[receiveQueueWrite % receiveQueueLength];
+	entry.packet = p;
+	entry.sequenceNumber = sequenceNumber;
+	receiveQueueWrite++;
 	BaseType_t woken = false;
 	xTaskNotifyFromISR(handle, FLAG_USB_PACKET, eSetBits, &woken);
 	portYIELD_FROM_ISR(woken);
 }
 
+// Takes the next packet to handle into recv_packet. Packets from the host are handled before the
+// restart of a timed out operation (replay of the last measurement command)
+static bool NextPacket(uint32_t notification) {
+	if((notification & FLAG_USB_PACKET) && receiveQueueRead != receiveQueueWrite) {
+		auto &entry = receiveQueue[receiveQueueRead % receiveQueueLength];
+		recv_packet = entry.packet;
+		Communication::SetAnswerSequenceNumber(entry.sequenceNumber);
+		receiveQueueRead++;
+		if(receiveQueueRead != receiveQueueWrite) {
+			// more packets pending, handle them in the next iteration
+			xTaskNotify(handle, FLAG_USB_PACKET, eSetBits);
+		}
+		if(notification & FLAG_RESTART) {
+			// the notification bits have been cleared, keep the restart for later
+			xTaskNotify(handle, FLAG_RESTART, eSetBits);
+		}
+		return true;
+	}
+	if(notification & FLAG_RESTART) {
+		recv_packet = last_measure_packet;
+		Communication::SetAnswerSequenceNumber(Protocol::NoSequenceNumber);
+		return true;
+	}
+	return false;
+}
+
 inline void App_Init() {
 	STM::Init();
 	Delay::Init();
@@ -110,7 +154,7 @@ inline void App_Process() {
 		uint32_t notification;
 		if(xTaskNotifyWait(0x00, UINT32_MAX, &notification, 100) == pdPASS) {
 			// something happened
-			if(notification & FLAG_USB_PACKET) {
+			if(NextPacket(notification)) {
 				switch(recv_packet.type) {
 				case Protocol::PacketType::SweepSettings:
 					LOG_INFO("New settings received");
@@ -181,7 +225,7 @@ inline void App_Process() {
 					}
 					break;
 				case Protocol::PacketType::FirmwarePacket:
-					LOG_INFO("Writing firmware packet at address %u", recv_packet.firmware.address);
+					LOG_DEBUG("Writing firmware packet at address %u", recv_packet.firmware.address);
 					if(HWHAL::flash.write(recv_packet.firmware.address, sizeof(recv_packet.firmware.data), recv_packet.firmware.data)) {
 						Communication::SendWithoutPayload(Protocol::PacketType::Ack);
 					} else {
@@ -189,6 +233,14 @@ inline void App_Process() {
 						Communication::SendWithoutPayload(Protocol::PacketType::Nack);
 					}
 					break;
+				case Protocol::PacketType::VerifyFirmware:
+					LOG_INFO("Verifying firmware image (%lu bytes)", recv_packet.firmwareVerify.size);
+					if(Firmware::VerifyImage(recv_packet.firmwareVerify.size, recv_packet.firmwareVerify.crc)) {
+						Communication::SendWithoutPayload(Protocol::PacketType::Ack);
+					} else {
+						Communication::SendWithoutPayload(Protocol::PacketType::Nack);
+					}
+					break;
 				case Protocol::PacketType::PerformFirmwareUpdate: {
 					LOG_INFO("Firmware update process triggered");
 					auto fw_info = Firmware::GetFlashContentInfo();
@@ -256,8 +308,9 @@ inline void App_Process() {
 		}
 		if(HW::TimedOut()) {
 			HW::SetMode(HW::Mode::Idle);
-			// insert the last received packet (restarts the timed out operation)
-			USBPacketReceived(last_measure_packet);
+			// handle the last received packet again (restarts the timed out operation). The receive queue is
+			// only filled by the USB interrupt, the restart is signaled separately
+			xTaskNotify(handle, FLAG_RESTART, eSetBits);
 		}
 		HW::updateDeviceStatus();
 	}
@@ -6,8 +6,10 @@
 #include "USB/usb.h"
 
 static uint8_t inputBuffer[1024];
-uint16_t inputCnt = 0;
+static Protocol::FrameBuffer input(inputBuffer, sizeof(inputBuffer));
 static uint8_t outputBuffer[1024];
+static bool datapointCRC = false;
+static int16_t answerSequenceNumber = Protocol::NoSequenceNumber;
 
 static Communication::Callback callback = nullptr;
 
@@ -17,36 +19,37 @@ void Communication::SetCallback(Callback cb) {
 
 
 void Communication::Input(const uint8_t *buf, uint16_t len) {
-	if (inputCnt + len < sizeof(inputBuffer)) {
-		// add received data to input buffer
-		memcpy(&inputBuffer[inputCnt], buf, len);
-		inputCnt += len;
-	}
 	Protocol::PacketInfo packet;
-	uint16_t handled_len;
+	int16_t sequenceNumber;
 	do {
-		handled_len = Protocol::DecodeBuffer(inputBuffer, inputCnt, &packet);
-		if (handled_len == inputCnt) {
-			// complete input buffer used up, reset counter
-			inputCnt = 0;
-		} else {
-			// only used part of the buffer, move up remaining bytes
-			uint16_t remaining = inputCnt - handled_len;
-			memmove(inputBuffer, &inputBuffer[handled_len], remaining);
-			inputCnt = remaining;
-		}
-		if(packet.type != Protocol::PacketType::None) {
+		// add as much as fits, decoding frees up space for the rest
+		uint16_t added = input.Add(buf, len);
+		buf += added;
+		len -= added;
+		bool decoded = false;
+		while (input.Decode(&packet, &sequenceNumber)) {
+			decoded = true;
 			if(callback) {
-				callback(packet);
+				callback(packet, sequenceNumber);
 			}
 		}
-	} while (handled_len > 0);
+		if (len > 0 && !added && !decoded) {
+			// no progress possible, drop the buffered data
+			input.Clear();
+		}
+	} while (len > 0);
 }
 #include "Hardware.hpp"
 bool Communication::Send(const Protocol::PacketInfo &packet) {
+	int16_t sequenceNumber = Protocol::NoSequenceNumber;
+	if(packet.type == Protocol::PacketType::Ack || packet.type == Protocol::PacketType::Nack) {
+		// only the first answer to a packet carries its sequence number
+		sequenceNumber = answerSequenceNumber;
+		answerSequenceNumber = Protocol::NoSequenceNumber;
+	}
 //	DEBUG1_HIGH();
 	uint16_t len = Protocol::EncodePacket(packet, outputBuffer,
-					sizeof(outputBuffer));
+					sizeof(outputBuffer), datapointCRC, sequenceNumber);
 //	DEBUG1_LOW();
 	return usb_transmit(outputBuffer, len);
 //	if (hUsbDeviceFS.dev_state == USBD_STATE_CONFIGURED) {
@@ -70,3 +73,11 @@ bool Communication::SendWithoutPayload(Protocol::PacketType type) {
 	p.type = type;
 	return Send(p);
 }
+
+void Communication::SetAnswerSequenceNumber(int16_t sequenceNumber) {
+	answerSequenceNumber = sequenceNumber;
+}
+
+void Communication::EnableDatapointCRC(bool enable) {
+	datapointCRC = enable;
+}
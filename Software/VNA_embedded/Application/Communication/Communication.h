@@ -8,12 +8,17 @@
 
 namespace Communication {
 
-using Callback = void(*)(const Protocol::PacketInfo&);
+// sequenceNumber is Protocol::NoSequenceNumber if the host did not include one
+using Callback = void(*)(const Protocol::PacketInfo&, int16_t sequenceNumber);
 
 void SetCallback(Callback cb);
 void Input(const uint8_t *buf, uint16_t len);
 bool Send(const Protocol::PacketInfo &packet);
 bool SendWithoutPayload(Protocol::PacketType type);
+// Sequence number of the packet that is currently handled. The next Ack/Nack carries this sequence number
+void SetAnswerSequenceNumber(int16_t sequenceNumber);
+// Calculate the CRC for datapoints as well (requested by the host in the sweep settings)
+void EnableDatapointCRC(bool enable);
 
 }
 
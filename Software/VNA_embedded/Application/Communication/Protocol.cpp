@@ -1,6 +1,7 @@
 #include "Protocol.hpp"
 
 #include <cstring>
+#include <cmath>
 
 /*
  * General packet format:
@@ -15,22 +16,105 @@ static constexpr uint8_t header = 0x5A;
 static constexpr uint8_t header_size = 4;
 
 #define CRC32_POLYGON 0xEDB88320
+
+// Slicing-by-N CRC: each table slice costs 1kB. On the MCU the tables are constexpr and placed in flash
+#if defined(__ARM_ARCH_7EM__)
+static constexpr uint8_t CRC32Slices = 4;
+#else
+static constexpr uint8_t CRC32Slices = 8;
+#endif
+static_assert(CRC32Slices >= 4 && CRC32Slices % 4 == 0, "Number of CRC slices must be a multiple of 4");
+
+namespace {
+struct CRC32Table {
+	uint32_t slice[CRC32Slices][256];
+	constexpr CRC32Table() : slice() {
+		for(uint32_t i = 0; i < 256; i++) {
+			uint32_t crc = i;
+			for(uint8_t k = 0; k < 8; k++) {
+				crc = crc & 1 ? (crc >> 1) ^ CRC32_POLYGON : crc >> 1;
+			}
+			slice[0][i] = crc;
+		}
+		for(uint8_t s = 1; s < CRC32Slices; s++) {
+			for(uint32_t i = 0; i < 256; i++) {
+				slice[s][i] = (slice[s - 1][i] >> 8) ^ slice[0][slice[s - 1][i] & 0xFF];
+			}
+		}
+	}
+};
+}
+
+static constexpr CRC32Table crcTable;
+
 uint32_t Protocol::CRC32(uint32_t crc, const void *data, uint32_t len) {
-	uint8_t *u8buf = (uint8_t*) data;
-	int k;
+	auto u8buf = (const uint8_t*) data;
 
 	crc = ~crc;
+	while (len >= CRC32Slices) {
+		// the first four bytes are combined with the current CRC, the remaining bytes are looked up directly
+		uint32_t first = crc ^ ((uint32_t) u8buf[0] | (uint32_t) u8buf[1] << 8 | (uint32_t) u8buf[2] << 16 | (uint32_t) u8buf[3] << 24);
+		crc = 0;
+		for (uint8_t i = 0; i < 4; i++) {
+			crc ^= crcTable.slice[CRC32Slices - 1 - i][(first >> (8 * i)) & 0xFF];
+		}
+		for (uint8_t i = 4; i < CRC32Slices; i++) {
+			crc ^= crcTable.slice[CRC32Slices - 1 - i][u8buf[i]];
+		}
+		u8buf += CRC32Slices;
+		len -= CRC32Slices;
+	}
 	while (len--) {
-		crc ^= *u8buf++;
-		for (k = 0; k < 8; k++)
-			crc = crc & 1 ? (crc >> 1) ^ CRC32_POLYGON : crc >> 1;
+		crc = (crc >> 8) ^ crcTable.slice[0][(crc ^ *u8buf++) & 0xFF];
 	}
 	return ~crc;
 }
 
-uint16_t Protocol::DecodeBuffer(uint8_t *buf, uint16_t len, PacketInfo *info) {
-    if (!info || !len) {
-        info->type = PacketType::None;
+// Bit 7 of the type byte is set if a sequence number follows the type byte
+static constexpr uint8_t sequenceNumberFlag = 0x80;
+
+static bool validFrameLength(uint16_t length) {
+	// one byte more than the biggest packet if a sequence number is included
+	return length >= header_size + 4 && (size_t) (length - 8) <= sizeof(Protocol::PacketInfo);
+}
+
+// Evaluates the type byte of a frame. Returns false if the payload does not fit into PacketInfo
+static bool frameLayout(uint8_t typeByte, uint16_t length, Protocol::PacketType &type, uint16_t &payloadOffset, uint16_t &payloadLength) {
+	type = (Protocol::PacketType) (typeByte & ~sequenceNumberFlag);
+	payloadOffset = typeByte & sequenceNumberFlag ? header_size + 1 : header_size;
+	if(length < payloadOffset + 4) {
+		return false;
+	}
+	payloadLength = length - payloadOffset - 4;
+	return payloadLength <= sizeof(Protocol::PacketInfo) - sizeof(Protocol::PacketType);
+}
+
+static void copyPayload(Protocol::PacketInfo *info, Protocol::PacketType type, const void *payload, uint16_t payloadLength) {
+	info->type = type;
+	auto dest = (uint8_t*) info + sizeof(Protocol::PacketType);
+	memcpy(dest, payload, payloadLength);
+	// Clear anything not contained in the payload. Fields that were appended to a packet in a
+	// later version are then zero when the other side uses an older version.
+	memset(dest + payloadLength, 0, sizeof(Protocol::PacketInfo) - sizeof(Protocol::PacketType) - payloadLength);
+}
+
+static bool isDatapointType(Protocol::PacketType type) {
+	return type == Protocol::PacketType::Datapoint || type == Protocol::PacketType::DatapointBatch
+			|| type == Protocol::PacketType::CompactDatapoints;
+}
+
+static bool validCRC(Protocol::PacketType type, uint32_t received, uint32_t calculated, bool requireDatapointCRC) {
+	if(isDatapointType(type) && !requireDatapointCRC) {
+		// Datapoints have the CRC set to zero unless the CRC has been enabled on the device
+		return received == 0x00000000 || received == calculated;
+	} else {
+		return received == calculated;
+	}
+}
+
+uint16_t Protocol::DecodeBuffer(uint8_t *buf, uint16_t len, PacketView *view, int16_t *sequenceNumber, bool requireDatapointCRC) {
+	view->type = PacketType::None;
+	if (!len) {
 		return 0;
 	}
 	uint8_t *data = buf;
@@ -40,54 +124,84 @@ uint16_t Protocol::DecodeBuffer(uint8_t *buf, uint16_t len, PacketInfo *info) {
 		if(--len == 0) {
 			/* Reached end of data */
 			/* No frame contained in data */
-			info->type = PacketType::None;
 			return data - buf;
 		}
 	}
 	/* At this point, data points to the beginning of the frame */
 	if(len < header_size) {
 		/* the frame header has not been completely received */
-		info->type = PacketType::None;
 		return data - buf;
 	}
 
 	/* Evaluate frame size */
 	uint16_t length = *(uint16_t*) &data[1];
+	if(!validFrameLength(length)) {
+		/* Impossible frame size, remove header */
+		data += 1;
+		return data - buf;
+	}
 	if(len < length) {
 		/* The frame payload has not been completely received */
-		info->type = PacketType::None;
 		return data - buf;
 	}
 
 	/* The complete frame has been received, check checksum */
-	auto type = (PacketType) data[3];
+	PacketType type;
+	uint16_t payloadOffset, payloadLength;
+	bool validLayout = frameLayout(data[3], length, type, payloadOffset, payloadLength);
 	uint32_t crc = *(uint32_t*) &data[length - 4];
-	if(type != PacketType::Datapoint) {
-		uint32_t compare = CRC32(0, data, length - 4);
-		if(crc != compare) {
-			// CRC mismatch, remove header
-			data += 1;
-			info->type = PacketType::None;
-			return data - buf;
-		}
-	} else {
-		// Datapoint has the CRC set to zero
-		if(crc != 0x00000000) {
-			data += 1;
-			info->type = PacketType::None;
-			return data - buf;
-		}
+	if(!validLayout || !validCRC(type, crc, CRC32(0, data, length - 4), requireDatapointCRC)) {
+		// CRC mismatch, remove header
+		data += 1;
+		return data - buf;
 	}
 
-	// Valid packet, copy packet type and payload
-	memcpy(info, &data[3], length - 7);
+	// Valid packet, the view points to the payload
+	view->type = type;
+	view->payload = &data[payloadOffset];
+	view->length = payloadLength;
+	if(sequenceNumber) {
+		*sequenceNumber = payloadOffset > header_size ? data[header_size] : NoSequenceNumber;
+	}
 	return data - buf + length;
 }
 
-uint16_t Protocol::EncodePacket(const PacketInfo &packet, uint8_t *dest, uint16_t destsize) {
+uint16_t Protocol::DecodeBuffer(uint8_t *buf, uint16_t len, PacketInfo *info, int16_t *sequenceNumber, bool requireDatapointCRC) {
+	PacketView view;
+	auto used = DecodeBuffer(buf, len, &view, sequenceNumber, requireDatapointCRC);
+	view.CopyTo(info);
+	return used;
+}
+
+void Protocol::PacketView::CopyTo(PacketInfo *info) const {
+	if(type == PacketType::None) {
+		info->type = PacketType::None;
+		return;
+	}
+	copyPayload(info, type, payload, length);
+}
+
+uint16_t Protocol::EncodePacket(const PacketInfo &packet, uint8_t *dest, uint16_t destsize, bool datapointCRC, int16_t sequenceNumber) {
    int16_t payload_size = 0;
 	switch (packet.type) {
 	case PacketType::Datapoint: payload_size = sizeof(packet.datapoint); break;
+	case PacketType::DatapointBatch:
+		if(packet.datapointBatch.numPoints > MaxBatchedDatapoints) {
+			return 0;
+		}
+		// only the used part of the points array is transmitted
+		payload_size = sizeof(packet.datapointBatch.numPoints) + packet.datapointBatch.numPoints * sizeof(Datapoint);
+		break;
+	case PacketType::CompactDatapoints: {
+		uint16_t values = packet.compactDatapoints.numPoints
+				* CompactValuesPerPoint(packet.compactDatapoints.port1, packet.compactDatapoints.port2);
+		if(values > MaxCompactValues) {
+			return 0;
+		}
+		// only the used part of the values array is transmitted
+		payload_size = sizeof(packet.compactDatapoints) - sizeof(packet.compactDatapoints.values) + values * sizeof(float);
+		break;
+	}
 	case PacketType::SweepSettings: payload_size = sizeof(packet.settings); break;
 	case PacketType::Reference:	payload_size = sizeof(packet.reference); break;
     case PacketType::DeviceInfo: payload_size = sizeof(packet.info); break;
@@ -95,6 +209,7 @@ uint16_t Protocol::EncodePacket(const PacketInfo &packet, uint8_t *dest, uint16_
     case PacketType::ManualStatusV1: payload_size = sizeof(packet.manualStatusV1); break;
     case PacketType::ManualControlV1: payload_size = sizeof(packet.manual); break;
     case PacketType::FirmwarePacket: payload_size = sizeof(packet.firmware); break;
+    case PacketType::VerifyFirmware: payload_size = sizeof(packet.firmwareVerify); break;
     case PacketType::Generator:	payload_size = sizeof(packet.generator); break;
     case PacketType::SpectrumAnalyzerSettings: payload_size = sizeof(packet.spectrumSettings); break;
     case PacketType::SpectrumAnalyzerResult: payload_size = sizeof(packet.spectrumResult); break;
@@ -117,20 +232,26 @@ uint16_t Protocol::EncodePacket(const PacketInfo &packet, uint8_t *dest, uint16_
     case PacketType::None:
         break;
     }
-    if (payload_size < 0 || payload_size + 8 > destsize) {
+    uint16_t payloadOffset = sequenceNumber == NoSequenceNumber ? header_size : header_size + 1;
+    if (payload_size < 0 || payload_size + payloadOffset + 4 > destsize) {
 		// encoding failed, buffer too small
 		return 0;
 	}
 	// Write header
 	dest[0] = header;
-	uint16_t overall_size = payload_size + 8;
+	uint16_t overall_size = payload_size + payloadOffset + 4;
 	memcpy(&dest[1], &overall_size, 2);
-	memcpy(&dest[3], &packet, payload_size + 1); // one additional byte for the packet type
+	dest[3] = (uint8_t) packet.type;
+	if(sequenceNumber != NoSequenceNumber) {
+		dest[3] |= sequenceNumberFlag;
+		dest[header_size] = sequenceNumber;
+	}
+	memcpy(&dest[payloadOffset], (const uint8_t*) &packet + sizeof(PacketType), payload_size);
 	// Calculate checksum
 	uint32_t crc = 0x00000000;
-	if(packet.type == PacketType::Datapoint) {
-		// CRC calculation takes about 18us which is the bulk of the time required to encode and transmit a datapoint.
-		// Skip CRC for data points to optimize throughput
+	if(!datapointCRC && isDatapointType(packet.type)) {
+		// CRC calculation used to be the bulk of the time required to encode and transmit a datapoint.
+		// Unless requested, skip CRC for data points to optimize throughput
 		crc = 0x00000000;
 	} else {
 		crc = CRC32(0, dest, overall_size - 4);
@@ -139,3 +260,173 @@ uint16_t Protocol::EncodePacket(const PacketInfo &packet, uint8_t *dest, uint16_
 	return overall_size;
 }
 
+uint16_t Protocol::FrameBuffer::Add(const uint8_t *data, uint16_t len) {
+	if(len > size - used) {
+		len = size - used;
+	}
+	uint16_t write = (read + used) % size;
+	uint16_t first = len;
+	if(write + first > size) {
+		// wraps around the end of the buffer
+		first = size - write;
+	}
+	memcpy(&buf[write], data, first);
+	memcpy(buf, &data[first], len - first);
+	used += len;
+	return len;
+}
+
+bool Protocol::FrameBuffer::nextFrame(Frame &frame) {
+	while(used > 0) {
+		if(pendingLength) {
+			// frame header has already been checked, just waiting for the rest of the frame
+			if(used < pendingLength) {
+				return false;
+			}
+		} else {
+			/* Remove any out-of-order bytes in front of the frame */
+			while(used > 0 && buf[read] != header) {
+				consume(1);
+			}
+			if(used < header_size) {
+				/* the frame header has not been completely received */
+				return false;
+			}
+			uint16_t length = at(1) | (uint16_t) at(2) << 8;
+			if(!validFrameLength(length) || length > size) {
+				/* Impossible frame size, remove header */
+				consume(1);
+				continue;
+			}
+			pendingLength = length;
+			if(used < length) {
+				/* The frame payload has not been completely received */
+				return false;
+			}
+		}
+		frame.length = pendingLength;
+		pendingLength = 0;
+		bool validLayout = frameLayout(at(3), frame.length, frame.type, frame.payloadOffset, frame.payloadLength);
+		uint32_t received;
+		copyOut(frame.length - 4, 4, &received);
+		if(!validLayout || !validCRC(frame.type, received, crc(frame.length - 4), requireDatapointCRC)) {
+			// CRC mismatch, remove header and search for the next frame
+			consume(1);
+			continue;
+		}
+		frame.sequenceNumber = frame.payloadOffset > header_size ? at(header_size) : NoSequenceNumber;
+		return true;
+	}
+	return false;
+}
+
+bool Protocol::FrameBuffer::Decode(PacketInfo *info, int16_t *sequenceNumber) {
+	Frame frame;
+	if(!nextFrame(frame)) {
+		info->type = PacketType::None;
+		return false;
+	}
+	// copy packet type and payload
+	info->type = frame.type;
+	auto payload = (uint8_t*) info + sizeof(PacketType);
+	copyOut(frame.payloadOffset, frame.payloadLength, payload);
+	memset(payload + frame.payloadLength, 0, sizeof(PacketInfo) - sizeof(PacketType) - frame.payloadLength);
+	if(sequenceNumber) {
+		*sequenceNumber = frame.sequenceNumber;
+	}
+	consume(frame.length);
+	return true;
+}
+
+bool Protocol::FrameViewBuffer::Decode(PacketView *view, int16_t *sequenceNumber) {
+	Frame frame;
+	if(!nextFrame(frame)) {
+		view->type = PacketType::None;
+		return false;
+	}
+	view->type = frame.type;
+	view->length = frame.payloadLength;
+	uint16_t start = (read + frame.payloadOffset) % size;
+	if(start + frame.payloadLength <= size) {
+		// payload is contiguous, point directly into the buffer
+		view->payload = &buf[start];
+	} else {
+		// payload wraps around the end of the buffer
+		copyOut(frame.payloadOffset, frame.payloadLength, linear);
+		view->payload = linear;
+	}
+	if(sequenceNumber) {
+		*sequenceNumber = frame.sequenceNumber;
+	}
+	// the payload stays in the buffer until it is overwritten by newly added data
+	consume(frame.length);
+	return true;
+}
+
+void Protocol::FrameBuffer::Clear() {
+	read = 0;
+	used = 0;
+	pendingLength = 0;
+}
+
+uint8_t Protocol::FrameBuffer::at(uint16_t offset) const {
+	return buf[(read + offset) % size];
+}
+
+void Protocol::FrameBuffer::copyOut(uint16_t offset, uint16_t len, void *dest) const {
+	uint16_t start = (read + offset) % size;
+	uint16_t first = len;
+	if(start + first > size) {
+		first = size - start;
+	}
+	memcpy(dest, &buf[start], first);
+	memcpy((uint8_t*) dest + first, buf, len - first);
+}
+
+uint32_t Protocol::FrameBuffer::crc(uint16_t len) const {
+	uint16_t first = len;
+	if(read + first > size) {
+		first = size - read;
+	}
+	// the CRC can be continued across the wrap point
+	return CRC32(CRC32(0, &buf[read], first), buf, len - first);
+}
+
+void Protocol::FrameBuffer::consume(uint16_t len) {
+	read = (read + len) % size;
+	used -= len;
+	if(used == 0) {
+		// start at the beginning again, keeps most frames from wrapping
+		read = 0;
+	}
+}
+
+void Protocol::PointFrequency::Setup(const SweepSettings &s) {
+	f_start = s.f_start;
+	f_stop = s.f_stop;
+	points = s.points;
+	logSweep = s.logSweep;
+	// factor between adjacent points of a log sweep
+	logMultiplier = points > 1 ? pow((double) f_stop / f_start, 1.0 / (points - 1)) : 1.0;
+	logFrequency = f_start;
+	lastPointNum = 0;
+}
+
+uint64_t Protocol::PointFrequency::Get(uint16_t pointNum) {
+	if(points <= 1) {
+		return f_start;
+	}
+	if(!logSweep) {
+		return f_start + (f_stop - f_start) * pointNum / (points - 1);
+	}
+	if(pointNum < lastPointNum) {
+		// start again from the first point
+		logFrequency = f_start;
+		lastPointNum = 0;
+	}
+	while(lastPointNum < pointNum) {
+		logFrequency *= logMultiplier;
+		lastPointNum++;
+	}
+	return logFrequency;
+}
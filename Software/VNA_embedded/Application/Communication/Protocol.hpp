@@ -6,6 +6,11 @@ namespace Protocol {
 
 static constexpr uint16_t Version = 11;
 
+// Packets may carry a sequence number (only if the device reports supportsSequenceNumbers). The answer
+// (Ack/Nack) to such a packet carries the same sequence number, allowing multiple outstanding packets
+static constexpr int16_t NoSequenceNumber = -1;
+static constexpr uint8_t MaxOutstandingPackets = 4;
+
 #pragma pack(push, 1)
 
 using Datapoint = struct _datapoint {
@@ -38,9 +43,52 @@ using SweepSettings = struct _sweepSettings {
 	uint8_t suppressPeaks:1;
 	uint8_t fixedPowerSetting:1; // if set the attenuator and source PLL power will not be changed across the sweep
 	uint8_t logSweep:1;
+	uint8_t batchDatapoints:1; // only set if the device reports supportsDatapointBatch
+	uint8_t datapointCRC:1; // only set if the device reports supportsDatapointCRC
+	uint8_t compactDatapoints:1; // only set if the device reports supportsCompactDatapoints
     int16_t cdbm_excitation_stop; // in 1/100 dbm
 };
 
+// Keeps the batch no larger than the biggest packet (FirmwarePacket), PacketInfo does not grow
+static constexpr uint8_t MaxBatchedDatapoints = 5;
+using DatapointBatch = struct _datapointBatch {
+	uint8_t numPoints;
+	Datapoint points[MaxBatchedDatapoints];
+};
+
+// Consecutive datapoints without frequency and power, the receiver calculates them from the sweep settings.
+// Only the S-parameters of the excited ports are included. Not used for zero span sweeps.
+static constexpr uint8_t MaxCompactValues = 64;
+using CompactDatapoints = struct _compactDatapoints {
+	uint16_t firstPointNum;
+	uint8_t numPoints;
+	uint8_t port1:1; // S11 and S21 included
+	uint8_t port2:1; // S12 and S22 included
+	// for every point: real/imag of S11 and S21 (if port1 is set) followed by real/imag of S12 and S22 (if port2 is set)
+	float values[MaxCompactValues];
+};
+
+constexpr uint8_t CompactValuesPerPoint(bool port1, bool port2) {
+	return (port1 ? 4 : 0) + (port2 ? 4 : 0);
+}
+
+// Frequency of the points of a sweep. For logarithmic sweeps, each point is calculated from the previous one by
+// a multiplication. Compact datapoints do not contain the frequency, the host uses this class as well to get
+// exactly the same frequencies as the firmware
+class PointFrequency {
+public:
+	void Setup(const SweepSettings &s);
+	// fastest if called for consecutive points
+	uint64_t Get(uint16_t pointNum);
+private:
+	uint64_t f_start, f_stop;
+	uint16_t points;
+	bool logSweep;
+	double logMultiplier;
+	double logFrequency;
+	uint16_t lastPointNum;
+};
+
 using ReferenceSettings = struct _referenceSettings {
 	uint32_t ExtRefOuputFreq;
 	uint8_t AutomaticSwitch:1;
@@ -72,6 +120,12 @@ using DeviceInfo = struct _deviceInfo {
 	uint32_t limits_maxRBW;
     uint8_t limits_maxAmplitudePoints;
     uint64_t limits_maxFreqHarmonic;
+    // Capabilities, older firmware does not send these fields and they decode as zero
+    uint8_t supportsDatapointBatch:1;
+    uint8_t supportsDatapointCRC:1;
+    uint8_t supportsCompactDatapoints:1;
+    uint8_t supportsSequenceNumbers:1;
+    uint8_t supportsFirmwareVerify:1;
 };
 
 using DeviceStatusV1 = struct _deviceStatusV1 {
@@ -171,6 +225,13 @@ using FirmwarePacket = struct _firmwarePacket {
     uint8_t data[FirmwareChunkSize];
 };
 
+// Sent after all firmware packets have been transferred. The device answers with an Ack if the CRC32 over the
+// first size bytes of the FLASH matches crc, otherwise with a Nack
+using FirmwareVerify = struct _firmwareVerify {
+    uint32_t size;
+    uint32_t crc;
+};
+
 using AmplitudeCorrectionPoint = struct _amplitudecorrectionpoint {
 	uint8_t totalPoints;
 	uint8_t pointNum;
@@ -217,12 +278,17 @@ enum class PacketType : uint8_t {
 	AcquisitionFrequencySettings = 24,
 	DeviceStatusV1 = 25,
 	RequestDeviceStatus = 26,
+	DatapointBatch = 27,
+	CompactDatapoints = 28,
+	VerifyFirmware = 29,
 };
 
 using PacketInfo = struct _packetinfo {
 	PacketType type;
 	union {
 		Datapoint datapoint;
+		DatapointBatch datapointBatch;
+		CompactDatapoints compactDatapoints;
 		SweepSettings settings;
 		ReferenceSettings reference;
 		GeneratorSettings generator;
@@ -230,6 +296,7 @@ using PacketInfo = struct _packetinfo {
         DeviceInfo info;
         ManualControlV1 manual;
         FirmwarePacket firmware;
+        FirmwareVerify firmwareVerify;
         ManualStatusV1 manualStatusV1;
         SpectrumAnalyzerSettings spectrumSettings;
         SpectrumAnalyzerResult spectrumResult;
@@ -241,8 +308,85 @@ using PacketInfo = struct _packetinfo {
 
 #pragma pack(pop)
 
+// Decoded packet whose payload still resides in the receive buffer. Avoids copying the payload into
+// a PacketInfo (which is sized for the biggest packet) when the receiver only needs to read a few fields.
+class PacketView {
+public:
+	PacketType type;
+	const uint8_t *payload;
+	uint16_t length;
+
+	// Returns the payload as T if it contains at least minLength bytes, nullptr otherwise (e.g. a shorter
+	// packet sent by an older version). Packets with a variable length (DatapointBatch, CompactDatapoints)
+	// have to check that the used part of the payload has actually been received.
+	template<typename T> const T* As(uint16_t minLength = sizeof(T)) const {
+		return length >= minLength ? (const T*) payload : nullptr;
+	}
+	// Copies the packet, anything not contained in the payload is set to zero
+	void CopyTo(PacketInfo *info) const;
+};
+
 uint32_t CRC32(uint32_t crc, const void *data, uint32_t len);
-uint16_t DecodeBuffer(uint8_t *buf, uint16_t len, PacketInfo *info);
-uint16_t EncodePacket(const PacketInfo &packet, uint8_t *dest, uint16_t destsize);
+// sequenceNumber (if not null) is set to the sequence number of the packet or NoSequenceNumber.
+// Datapoints with a zero CRC are accepted unless requireDatapointCRC is set (i.e. the datapoint CRC has been negotiated)
+uint16_t DecodeBuffer(uint8_t *buf, uint16_t len, PacketInfo *info, int16_t *sequenceNumber = nullptr,
+		bool requireDatapointCRC = false);
+// Same as above but without copying the payload, the view points into buf
+uint16_t DecodeBuffer(uint8_t *buf, uint16_t len, PacketView *view, int16_t *sequenceNumber = nullptr,
+		bool requireDatapointCRC = false);
+// Datapoints are sent with a zero CRC unless datapointCRC is set
+uint16_t EncodePacket(const PacketInfo &packet, uint8_t *dest, uint16_t destsize, bool datapointCRC = false,
+		int16_t sequenceNumber = NoSequenceNumber);
+
+// Circular receive buffer that extracts frames in place. Received data is never moved and frames
+// may wrap around the end of the buffer. The buffer must be able to hold the largest possible frame.
+class FrameBuffer {
+public:
+	constexpr FrameBuffer(uint8_t *buffer, uint16_t size)
+		: buf(buffer), size(size), read(0), used(0), pendingLength(0), requireDatapointCRC(false) {}
+	// Adds received data. Returns the number of bytes added, less than len if the buffer is full
+	uint16_t Add(const uint8_t *data, uint16_t len);
+	// Extracts the next valid frame. Returns false (and sets the type to None) if no complete frame is available
+	bool Decode(PacketInfo *info, int16_t *sequenceNumber = nullptr);
+	uint16_t Used() const { return used; }
+	uint16_t Free() const { return size - used; }
+	void Clear();
+	// Once the datapoint CRC has been negotiated, datapoints with a zero CRC are discarded as well
+	void RequireDatapointCRC(bool require) { requireDatapointCRC = require; }
+protected:
+	using Frame = struct {
+		uint16_t length;
+		PacketType type;
+		uint16_t payloadOffset;
+		uint16_t payloadLength;
+		int16_t sequenceNumber;
+	};
+	// Searches the next valid frame, it stays in the buffer until consumed
+	bool nextFrame(Frame &frame);
+	uint8_t at(uint16_t offset) const;
+	void copyOut(uint16_t offset, uint16_t len, void *dest) const;
+	uint32_t crc(uint16_t len) const;
+	void consume(uint16_t len);
+	uint8_t *buf;
+	uint16_t size;
+	uint16_t read;
+	uint16_t used;
+	// length of the frame at the read position if it is not completely received yet, zero otherwise
+	uint16_t pendingLength;
+	bool requireDatapointCRC;
+};
+
+// FrameBuffer that can also decode into views of the payload. The payload is only copied if the frame
+// wraps around the end of the buffer.
+class FrameViewBuffer : public FrameBuffer {
+public:
+	constexpr FrameViewBuffer(uint8_t *buffer, uint16_t size)
+		: FrameBuffer(buffer, size), linear{} {}
+	using FrameBuffer::Decode;
+	// The view stays valid until the next call to Add, Decode or Clear
+	bool Decode(PacketView *view, int16_t *sequenceNumber = nullptr);
+private:
+	uint8_t linear[sizeof(PacketInfo)];
+};
 
 }
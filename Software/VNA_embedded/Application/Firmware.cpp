@@ -73,6 +73,30 @@ Firmware::Info Firmware::GetFlashContentInfo() {
 	return ret;
 }
 
+bool Firmware::VerifyImage(uint32_t size, uint32_t crc) {
+	if(size > maxSize) {
+		LOG_ERR("Image size %lu exceeds FLASH size", size);
+		return false;
+	}
+	uint32_t calculated = 0;
+	uint8_t buf[128];
+	uint32_t checked_size = 0;
+	while (checked_size < size) {
+		uint16_t read_size = sizeof(buf);
+		if (size - checked_size < read_size) {
+			read_size = size - checked_size;
+		}
+		HWHAL::flash.read(checked_size, read_size, buf);
+		calculated = Protocol::CRC32(calculated, buf, read_size);
+		checked_size += read_size;
+	}
+	if(calculated != crc) {
+		LOG_ERR("Image CRC mismatch: expected 0x%08lx, FLASH contains 0x%08lx", crc, calculated);
+		return false;
+	}
+	return true;
+}
+
 static void copy_flash(uint32_t size, SPI_TypeDef *spi) __attribute__ ((noinline, section (".data")));
 
 /* This function is executed from RAM as it possibly overwrites the whole FLASH.
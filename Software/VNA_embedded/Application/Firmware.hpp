@@ -24,6 +24,8 @@ using Info = struct info {
 };
 
 Info GetFlashContentInfo();
+// Checks the CRC32 over the first size bytes of the FLASH (the complete image as it was transferred)
+bool VerifyImage(uint32_t size, uint32_t crc);
 void PerformUpdate(Info info);
 
 }
@@ -83,6 +83,11 @@ static constexpr Protocol::DeviceInfo Info = {
 		.limits_maxRBW = (uint32_t) (DefaultADCSamplerate * 2.23f / MinSamples),
 		.limits_maxAmplitudePoints = Cal::maxPoints,
 		.limits_maxFreqHarmonic = 18000000000,
+		.supportsDatapointBatch = 1,
+		.supportsDatapointCRC = 1,
+		.supportsCompactDatapoints = 1,
+		.supportsSequenceNumbers = 1,
+		.supportsFirmwareVerify = 1,
 };
 
 enum class Mode {
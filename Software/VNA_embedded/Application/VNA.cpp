@@ -23,8 +23,24 @@ static Protocol::SweepSettings settings;
 static uint16_t pointCnt;
 static uint8_t stageCnt;
 static uint8_t stages;
-static double logMultiplier, logFrequency;
+static Protocol::PointFrequency pointFrequency;
 static Protocol::Datapoint data;
+// Double buffered datapoint batches: one is filled while the other one is being transmitted
+static bool batchDatapoints;
+static bool compactDatapoints;
+static uint8_t compactValuesPerPoint;
+static union {
+	Protocol::DatapointBatch batch;
+	Protocol::CompactDatapoints compact;
+} batches[2];
+static uint8_t batchFillIndex;
+static uint8_t batchSendIndex;
+// set while the send buffer has not been passed on yet, it must not be filled again until then
+static volatile bool batchInFlight;
+// a full batch is waiting for the send buffer, no more points can be added to it
+static volatile bool batchFlushPending;
+// the sweep is halted until the full batch could be passed on, PassOnBatch resumes it
+static volatile bool batchResumePending;
 static bool active = false;
 static Si5351C::DriveStrength fixedPowerLowband;
 static bool adcShifted;
@@ -59,22 +75,8 @@ static constexpr uint32_t reservedUSBbuffer = maxPointsBetweenHalts * (sizeof(Pr
 using namespace HWHAL;
 
 static uint64_t getPointFrequency(uint16_t pointNum) {
-	if(!settings.logSweep) {
-		return settings.f_start + (settings.f_stop - settings.f_start) * pointNum / (settings.points - 1);
-	} else {
-		static uint16_t lastPointNum = 0;
-		if (pointNum == 0) {
-			logFrequency = settings.f_start;
-		} else if(pointNum == lastPointNum) {
-			// nothing to do
-		} else if(pointNum == lastPointNum + 1) {
-			logFrequency *= logMultiplier;
-		} else {
-			logFrequency = settings.f_start * pow(10.0, pointNum * log10((double)settings.f_stop / settings.f_start) / (settings.points - 1));
-		}
-		lastPointNum = pointNum;
-		return logFrequency;
-	}
+	// the host calculates the frequencies of compact datapoints the same way
+	return pointFrequency.Get(pointNum);
 }
 
 bool VNA::Setup(Protocol::SweepSettings s) {
@@ -95,8 +97,21 @@ bool VNA::Setup(Protocol::SweepSettings s) {
 		settings.points = FPGA::MaxPoints;
 	}
 	settings = s;
-	// calculate factor between adjacent points for log sweep for faster calculation when sweeping
-	logMultiplier = pow((double) settings.f_stop / settings.f_start, 1.0 / (settings.points-1));
+	batchDatapoints = s.batchDatapoints;
+	Communication::EnableDatapointCRC(s.datapointCRC);
+	// a batch of the previous settings might still be in flight (and another one waiting for it), the buffers can
+	// only be reset once PassOnBatch is done with them
+	while(batchInFlight) {
+		vTaskDelay(1);
+	}
+	for(auto &b : batches) {
+		b.batch.numPoints = 0;
+		b.compact.numPoints = 0;
+	}
+	batchFillIndex = 0;
+	batchFlushPending = false;
+	// calculates the factor between adjacent points for log sweep for faster calculation when sweeping
+	pointFrequency.Setup(settings);
 	// Configure sweep
 	FPGA::SetNumberOfPoints(settings.points);
 	uint32_t samplesPerPoint = (HW::getADCRate() / s.if_bandwidth);
@@ -145,6 +160,10 @@ bool VNA::Setup(Protocol::SweepSettings s) {
 	IFTableIndexCnt = 0;
 
 	zerospan = (s.f_start == s.f_stop) && (s.cdbm_excitation_start == s.cdbm_excitation_stop);
+	// the time of a zero span datapoint is not implied by the settings, always send complete datapoints
+	compactValuesPerPoint = Protocol::CompactValuesPerPoint(s.excitePort1, s.excitePort2);
+	// without any excited port, a compact point would have no values and the batch size could not be limited
+	compactDatapoints = s.compactDatapoints && !zerospan && compactValuesPerPoint > 0;
 
 	bool last_lowband = false;
 
@@ -152,6 +171,19 @@ bool VNA::Setup(Protocol::SweepSettings s) {
 	IFTable[0].pointCnt = 0xFFFF;
 
 	uint16_t pointsWithoutHalt = 0;
+	// With batches, the sweep also halts before the batch could overflow. Every halt flushes the batch and the sweep
+	// only resumes once its buffer is free again, no point has to be dropped if passing on a batch takes longer
+	uint16_t maxPointsWithoutHalt = maxPointsBetweenHalts;
+	uint16_t batchCapacity = maxPointsBetweenHalts + 1;
+	if(compactDatapoints) {
+		batchCapacity = Protocol::MaxCompactValues / compactValuesPerPoint;
+	} else if(batchDatapoints) {
+		batchCapacity = Protocol::MaxBatchedDatapoints;
+	}
+	if(batchCapacity - 1 < maxPointsWithoutHalt) {
+		// the halted point and the points without halt after it have to fit into one batch
+		maxPointsWithoutHalt = batchCapacity - 1;
+	}
 
 	// Transfer PLL configuration to FPGA
 	for (uint16_t i = 0; i < settings.points; i++) {
@@ -241,7 +273,7 @@ bool VNA::Setup(Protocol::SweepSettings s) {
 		// halt on regular intervals to prevent USB buffer overflow
 		if(!needs_halt) {
 			pointsWithoutHalt++;
-			if(pointsWithoutHalt > maxPointsBetweenHalts) {
+			if(pointsWithoutHalt > maxPointsWithoutHalt) {
 				needs_halt = true;
 			}
 		}
@@ -320,6 +352,82 @@ static void PassOnData() {
 	Communication::Send(info);
 }
 
+static void FlushBatch();
+static void ResumeSweep();
+
+static void PassOnBatch() {
+	Protocol::PacketInfo info;
+	if(compactDatapoints) {
+		info.type = Protocol::PacketType::CompactDatapoints;
+		info.compactDatapoints = batches[batchSendIndex].compact;
+	} else {
+		info.type = Protocol::PacketType::DatapointBatch;
+		info.datapointBatch = batches[batchSendIndex].batch;
+	}
+	Communication::Send(info);
+	batchInFlight = false;
+	if(batchFlushPending) {
+		// The next batch was completed in the meantime. The batches are filled from interrupts with a higher priority,
+		// they must not interrupt the buffer swap
+		__disable_irq();
+		FlushBatch();
+		__enable_irq();
+	}
+	if(batchResumePending && !batchFlushPending) {
+		// the sweep was halted because both buffers were in use, the batch has been passed on now
+		batchResumePending = false;
+		ResumeSweep();
+	}
+}
+
+static uint8_t& BatchPoints(uint8_t index) {
+	return compactDatapoints ? batches[index].compact.numPoints : batches[index].batch.numPoints;
+}
+
+static void FlushBatch() {
+	if(BatchPoints(batchFillIndex) == 0) {
+		// nothing to send
+		batchFlushPending = false;
+		return;
+	}
+	if(batchInFlight) {
+		// the previous batch has not been passed on yet, PassOnBatch flushes this one once it is done
+		batchFlushPending = true;
+		return;
+	}
+	batchFlushPending = false;
+	batchSendIndex = batchFillIndex;
+	batchFillIndex ^= 1;
+	BatchPoints(batchFillIndex) = 0;
+	batchInFlight = STM::DispatchToInterrupt(PassOnBatch);
+	if(!batchInFlight) {
+		LOG_WARN("Failed to pass on batch, %d points lost", BatchPoints(batchSendIndex));
+	}
+}
+
+static void AddToCompactBatch() {
+	auto &compact = batches[batchFillIndex].compact;
+	if(compact.numPoints == 0) {
+		compact.firstPointNum = data.pointNum;
+		compact.port1 = settings.excitePort1;
+		compact.port2 = settings.excitePort2;
+	}
+	float *values = &compact.values[compact.numPoints * compactValuesPerPoint];
+	if(settings.excitePort1) {
+		*values++ = data.real_S11;
+		*values++ = data.imag_S11;
+		*values++ = data.real_S21;
+		*values++ = data.imag_S21;
+	}
+	if(settings.excitePort2) {
+		*values++ = data.real_S12;
+		*values++ = data.imag_S12;
+		*values++ = data.real_S22;
+		*values++ = data.imag_S22;
+	}
+	compact.numPoints++;
+}
+
 bool VNA::MeasurementDone(const FPGA::SamplingResult &result) {
 	if(!active) {
 		return false;
@@ -368,7 +476,23 @@ bool VNA::MeasurementDone(const FPGA::SamplingResult &result) {
 	if(stageCnt == stages) {
 		// point is complete
 		stageCnt = 0;
-		STM::DispatchToInterrupt(PassOnData);
+		// The batch in the fill buffer can not be full here: the sweep halts at least once per batch and only resumes
+		// with an empty fill buffer
+		if(compactDatapoints) {
+			AddToCompactBatch();
+			auto &compact = batches[batchFillIndex].compact;
+			if((compact.numPoints + 1) * compactValuesPerPoint > Protocol::MaxCompactValues || pointCnt + 1 >= settings.points) {
+				FlushBatch();
+			}
+		} else if(batchDatapoints) {
+			auto &batch = batches[batchFillIndex].batch;
+			batch.points[batch.numPoints++] = data;
+			if(batch.numPoints >= Protocol::MaxBatchedDatapoints || pointCnt + 1 >= settings.points) {
+				FlushBatch();
+			}
+		} else {
+			STM::DispatchToInterrupt(PassOnData);
+		}
 		pointCnt++;
 		if (pointCnt >= settings.points) {
 			// reached end of sweep, start again
@@ -399,6 +523,8 @@ void VNA::SweepHalted() {
 		return;
 	}
 	LOG_DEBUG("Halted before point %d", pointCnt);
+	// do not hold back already measured points while the sweep is halted
+	FlushBatch();
 	// Check if IF table has entry at this point
 	if (IFTableIndexCnt < IFTableNumEntries && IFTable[IFTableIndexCnt].pointCnt == pointCnt) {
 		Si5351.WriteRawCLKConfig(SiChannel::Port1LO2, IFTable[IFTableIndexCnt].clkconfig);
@@ -470,6 +596,16 @@ void VNA::SweepHalted() {
 		adcShifted = false;
 	}
 
+	if(batchFlushPending) {
+		// Both batch buffers are in use, the points until the next halt would not fit. Keep the sweep halted,
+		// PassOnBatch resumes it once the batch has been passed on
+		batchResumePending = true;
+	} else {
+		ResumeSweep();
+	}
+}
+
+static void ResumeSweep() {
 	if(usb_available_buffer() >= reservedUSBbuffer) {
 		// enough space available, can resume immediately
 		FPGA::ResumeHaltedSweep();
@@ -496,6 +632,7 @@ void VNA::SweepHalted() {
 
 void VNA::Stop() {
 	active = false;
+	batchResumePending = false;
 	FPGA::AbortSweep();
 }
 